@@ -21,10 +21,12 @@
  * details.
  */
 
+#include <algorithm>
 #include <cassert>
 
 #include <fstream>
 #include <iostream>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -69,6 +71,38 @@ class t_cpp_generator : public t_oop_generator {
     iter = parsed_options.find("templates");
     gen_templates_ = (iter != parsed_options.end());
 
+    iter = parsed_options.find("pipelined");
+    gen_pipelined_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("arena");
+    gen_arena_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("compact_layout");
+    gen_compact_layout_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("moveable_types");
+    gen_moveable_types_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("no_static_init");
+    gen_no_static_init_ = (iter != parsed_options.end());
+
+    // Template code is in headers, which cannot be split
+    iter = parsed_options.find("split");
+    split_ = 1;
+    if (iter != parsed_options.end() && !gen_templates_) {
+      split_ = atoi(iter->second.c_str());
+      if (split_ < 1) {
+        throw "split needs a positive number of files, as in split=8";
+      }
+    }
+
+    // The tables go through TProtocol's virtual calls, which templates are
+    // there to avoid, so templates take precedence
+    iter = parsed_options.find("table_serialization");
+    gen_table_serialization_ = (iter != parsed_options.end()) && !gen_templates_;
+
+    shard_buf_ = NULL;
+
     out_dir_base_ = "gen-cpp";
   }
 
@@ -110,6 +144,12 @@ class t_cpp_generator : public t_oop_generator {
   void generate_struct_reader        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
   void generate_struct_writer        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
   void generate_struct_result_writer (std::ofstream& out, t_struct* tstruct, bool pointers=false);
+  void generate_struct_table         (std::ofstream& out, t_struct* tstruct);
+  void generate_field_table_includes (std::ofstream& out);
+  void generate_types_impl_includes  (std::ofstream& out);
+  void generate_service_impl_includes(std::ofstream& out, std::string svcname);
+  void begin_shard(std::ofstream& out, const std::vector<std::ofstream*>& shards, const std::string& key);
+  void end_shard(std::ofstream& out);
   void generate_struct_swap          (std::ofstream& out, t_struct* tstruct);
 
   /**
@@ -199,6 +239,11 @@ class t_cpp_generator : public t_oop_generator {
   std::string namespace_close(std::string ns);
   std::string type_name(t_type* ttype, bool in_typedef=false, bool arg=false);
   std::string base_type_name(t_base_type::t_base tbase);
+  static std::string type_annotation(t_type* ttype, const std::string& key);
+  std::string move_value(const std::string& name);
+  std::string field_kind(t_field* tfield);
+  static int field_alignment(t_field* tfield);
+  static bool field_alignment_greater(t_field* a, t_field* b);
   std::string declare_field(t_field* tfield, bool init=false, bool pointer=false, bool constant=false, bool reference=false);
   std::string function_signature(t_function* tfunction, std::string style, std::string prefix="", bool name_params=true);
   std::string cob_function_signature(t_function* tfunction, std::string prefix="", bool name_params=true);
@@ -206,6 +251,8 @@ class t_cpp_generator : public t_oop_generator {
   std::string type_to_enum(t_type* ttype);
   std::string local_reflection_name(const char*, t_type* ttype, bool external=false);
 
+  void generate_enum_lookup(t_enum* tenum);
+
   void generate_enum_constant_list(std::ofstream& f,
                                    const vector<t_enum_value*>& constants,
                                    const char* prefix,
@@ -268,6 +315,46 @@ class t_cpp_generator : public t_oop_generator {
    */
   bool gen_no_client_completion_;
 
+  /**
+   * True if synchronous clients should number their calls and allow replies
+   * to be collected out of order.
+   */
+  bool gen_pipelined_;
+
+  /**
+   * True if strings and containers should allocate from the request's arena.
+   */
+  bool gen_arena_;
+
+  /**
+   * True if struct members should be laid out to minimize padding, with
+   * __isset packed into bits.
+   */
+  bool gen_compact_layout_;
+
+  /**
+   * True if structs should have C++11 move operations and rvalue setters.
+   */
+  bool gen_moveable_types_;
+
+  /**
+   * True if structs should be read and written by the library, from tables
+   * describing their fields.
+   */
+  bool gen_table_serialization_;
+
+  /**
+   * True if enum maps and constants should be built on first use, so that
+   * the generated code does nothing at startup.
+   */
+  bool gen_no_static_init_;
+
+  /**
+   * Number of .cpp files that the code of each struct and service function
+   * is spread over, by a hash of its name.
+   */
+  int split_;
+
   /**
    * Strings for namespace, computed once up front then used directly
    */
@@ -285,6 +372,15 @@ class t_cpp_generator : public t_oop_generator {
   std::ofstream f_types_tcc_;
   std::ofstream f_header_;
   std::ofstream f_service_;
+
+  /**
+   * With split, the files that struct and service function code goes to;
+   * the first is f_types_impl_ or f_service_.  begin_shard() points the
+   * stream at one of them until end_shard().
+   */
+  std::vector<std::ofstream*> f_types_shards_;
+  std::vector<std::ofstream*> f_service_shards_;
+  std::streambuf* shard_buf_;
   std::ofstream f_service_tcc_;
 
   /**
@@ -349,6 +445,18 @@ void t_cpp_generator::init_generator() {
     "#include <thrift/transport/TTransport.h>" << endl <<
     endl;
 
+  if (gen_arena_) {
+    f_types_ <<
+      "#include <thrift/Arena.h>" << endl <<
+      endl;
+  }
+
+  if (gen_moveable_types_) {
+    f_types_ <<
+      "#include <utility>" << endl <<
+      endl;
+  }
+
   // Include other Thrift includes
   const vector<t_program*>& includes = program_->get_includes();
   for (size_t i = 0; i < includes.size(); ++i) {
@@ -379,26 +487,12 @@ void t_cpp_generator::init_generator() {
     endl;
 
   // Include the types file
-  f_types_impl_ <<
-    "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
-    "_types.h\"" << endl <<
-    endl;
+  generate_types_impl_includes(f_types_impl_);
   f_types_tcc_ <<
     "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
     "_types.h\"" << endl <<
     endl;
 
-  // If we are generating local reflection metadata, we need to include
-  // the definition of TypeSpec.
-  if (gen_dense_) {
-    f_types_impl_ <<
-      "#include <thrift/TReflectionLocal.h>" << endl <<
-      endl;
-  }
-
-  // The swap() code needs <algorithm> for std::swap()
-  f_types_impl_ << "#include <algorithm>" << endl << endl;
-
   // Open namespace
   ns_open_ = namespace_open(program_->get_namespace("cpp"));
   ns_close_ = namespace_close(program_->get_namespace("cpp"));
@@ -414,6 +508,72 @@ void t_cpp_generator::init_generator() {
   f_types_tcc_ <<
     ns_open_ << endl <<
     endl;
+
+  f_types_shards_.push_back(&f_types_impl_);
+  for (int i = 1; i < split_; ++i) {
+    std::ostringstream f_shard_name;
+    f_shard_name << get_out_dir() << program_name_ << "_types_" << i << ".cpp";
+    std::ofstream* f_shard = new std::ofstream(f_shard_name.str().c_str());
+    *f_shard <<
+      autogen_comment();
+    generate_types_impl_includes(*f_shard);
+    *f_shard <<
+      ns_open_ << endl <<
+      endl;
+    f_types_shards_.push_back(f_shard);
+  }
+}
+
+/**
+ * Includes what the code in a types .cpp file needs.
+ */
+void t_cpp_generator::generate_types_impl_includes(ofstream& out) {
+  out <<
+    "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
+    "_types.h\"" << endl <<
+    endl;
+
+  // If we are generating local reflection metadata, we need to include
+  // the definition of TypeSpec.
+  if (gen_dense_) {
+    out <<
+      "#include <thrift/TReflectionLocal.h>" << endl <<
+      endl;
+  }
+
+  // The swap() code needs <algorithm> for std::swap()
+  out << "#include <algorithm>" << endl << endl;
+
+  if (gen_table_serialization_) {
+    generate_field_table_includes(out);
+  }
+}
+
+/**
+ * With split, sends what is written to out to the file that key hashes to,
+ * until end_shard().  The hash is FNV-1a, so that a struct or function
+ * stays in the same file whatever else is added to the IDL.
+ */
+void t_cpp_generator::begin_shard(ofstream& out,
+                                  const vector<ofstream*>& shards,
+                                  const string& key) {
+  if (shards.size() < 2) {
+    return;
+  }
+  uint32_t hash = 2166136261U;
+  for (string::const_iterator it = key.begin(); it != key.end(); ++it) {
+    hash ^= static_cast<unsigned char>(*it);
+    hash *= 16777619U;
+  }
+  ofstream* shard = shards[hash % shards.size()];
+  shard_buf_ = static_cast<std::ios&>(out).rdbuf(shard->rdbuf());
+}
+
+void t_cpp_generator::end_shard(ofstream& out) {
+  if (shard_buf_ != NULL) {
+    static_cast<std::ios&>(out).rdbuf(shard_buf_);
+    shard_buf_ = NULL;
+  }
 }
 
 /**
@@ -446,6 +606,13 @@ void t_cpp_generator::close_generator() {
   f_types_tcc_ <<
     "#endif" << endl;
 
+  for (size_t i = 1; i < f_types_shards_.size(); ++i) {
+    *f_types_shards_[i] <<
+      ns_close_ << endl;
+    delete f_types_shards_[i];
+  }
+  f_types_shards_.clear();
+
   // Close output file
   f_types_.close();
   f_types_impl_.close();
@@ -536,21 +703,76 @@ void t_cpp_generator::generate_enum(t_enum* tenum) {
     indent() << "const char* _k" << tenum->get_name() << "Names[] =";
   generate_enum_constant_list(f_types_impl_, constants, "\"", "\"", false);
 
-  f_types_ <<
-    indent() << "extern const std::map<int, const char*> _" <<
-    tenum->get_name() << "_VALUES_TO_NAMES;" << endl << endl;
+  if (gen_no_static_init_) {
+    generate_enum_lookup(tenum);
+  } else {
+    f_types_ <<
+      indent() << "extern const std::map<int, const char*> _" <<
+      tenum->get_name() << "_VALUES_TO_NAMES;" << endl << endl;
 
-  f_types_impl_ <<
-    indent() << "const std::map<int, const char*> _" << tenum->get_name() <<
-    "_VALUES_TO_NAMES(::apache::thrift::TEnumIterator(" << constants.size() <<
-    ", _k" << tenum->get_name() << "Values" <<
-    ", _k" << tenum->get_name() << "Names), " <<
-    "::apache::thrift::TEnumIterator(-1, NULL, NULL));" << endl << endl;
+    f_types_impl_ <<
+      indent() << "const std::map<int, const char*> _" << tenum->get_name() <<
+      "_VALUES_TO_NAMES(::apache::thrift::TEnumIterator(" << constants.size() <<
+      ", _k" << tenum->get_name() << "Values" <<
+      ", _k" << tenum->get_name() << "Names), " <<
+      "::apache::thrift::TEnumIterator(-1, NULL, NULL));" << endl << endl;
+  }
 
   generate_local_reflection(f_types_, tenum, false);
   generate_local_reflection(f_types_impl_, tenum, true);
 }
 
+/**
+ * Generates the no_static_init lookups for an enum: a function naming a
+ * value, which needs no data beyond the names, and the map of values to
+ * names, built on the first call.
+ *
+ * @param tenum The enumeration
+ */
+void t_cpp_generator::generate_enum_lookup(t_enum* tenum) {
+  string name = tenum->get_name();
+  vector<t_enum_value*> constants = tenum->get_constants();
+  vector<t_enum_value*>::iterator c_iter;
+
+  f_types_ <<
+    indent() << "const char* _" << name << "_VALUE_TO_NAME(int value);" << endl <<
+    indent() << "const std::map<int, const char*>& _" << name << "_VALUES_TO_NAMES();" << endl <<
+    endl;
+
+  // The first name given a value is the one used, as in the map
+  indent(f_types_impl_) <<
+    "const char* _" << name << "_VALUE_TO_NAME(int value) {" << endl;
+  indent_up();
+  indent(f_types_impl_) <<
+    "switch (value) {" << endl;
+  set<int> values;
+  for (c_iter = constants.begin(); c_iter != constants.end(); ++c_iter) {
+    if (values.insert((*c_iter)->get_value()).second) {
+      indent(f_types_impl_) <<
+        "case " << (*c_iter)->get_value() << ": return \"" << (*c_iter)->get_name() << "\";" << endl;
+    }
+  }
+  indent(f_types_impl_) <<
+    "}" << endl;
+  indent(f_types_impl_) <<
+    "return NULL;" << endl;
+  scope_down(f_types_impl_);
+  f_types_impl_ << endl;
+
+  indent(f_types_impl_) <<
+    "const std::map<int, const char*>& _" << name << "_VALUES_TO_NAMES() {" << endl;
+  indent_up();
+  f_types_impl_ <<
+    indent() << "static const std::map<int, const char*> valuesToNames(" <<
+      "::apache::thrift::TEnumIterator(" << constants.size() <<
+      ", _k" << name << "Values" <<
+      ", _k" << name << "Names), " <<
+      "::apache::thrift::TEnumIterator(-1, NULL, NULL));" << endl <<
+    indent() << "return valuesToNames;" << endl;
+  scope_down(f_types_impl_);
+  f_types_impl_ << endl;
+}
+
 /**
  * Generates a class that holds all the constants.
  */
@@ -604,8 +826,17 @@ void t_cpp_generator::generate_consts(std::vector<t_const*> consts) {
   f_consts <<
     "};" << endl;
 
+  if (gen_no_static_init_) {
+    f_consts_impl <<
+      "const " << program_name_ << "Constants& g_" << program_name_ << "_constants() {" << endl <<
+      "  static const " << program_name_ << "Constants constants;" << endl <<
+      "  return constants;" << endl <<
+      "}" << endl;
+  } else {
+    f_consts_impl <<
+      "const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl;
+  }
   f_consts_impl <<
-    "const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl <<
     endl <<
     program_name_ << "Constants::" << program_name_ << "Constants() {" << endl;
   indent_up();
@@ -619,9 +850,15 @@ void t_cpp_generator::generate_consts(std::vector<t_const*> consts) {
   indent(f_consts_impl) <<
     "}" << endl;
 
+  f_consts << endl;
+  if (gen_no_static_init_) {
+    f_consts <<
+      "const " << program_name_ << "Constants& g_" << program_name_ << "_constants();" << endl;
+  } else {
+    f_consts <<
+      "extern const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl;
+  }
   f_consts <<
-    endl <<
-    "extern const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl <<
     endl <<
     ns_close_ << endl <<
     endl <<
@@ -764,9 +1001,14 @@ void t_cpp_generator::generate_cpp_struct(t_struct* tstruct, bool is_exception)
   generate_local_reflection_pointer(f_types_impl_, tstruct);
 
   std::ofstream& out = (gen_templates_ ? f_types_tcc_ : f_types_impl_);
+  begin_shard(f_types_impl_, f_types_shards_, tstruct->get_name());
+  if (gen_table_serialization_) {
+    generate_struct_table(out, tstruct);
+  }
   generate_struct_reader(out, tstruct);
   generate_struct_writer(out, tstruct);
   generate_struct_swap(f_types_impl_, tstruct);
+  end_shard(f_types_impl_);
 }
 
 /**
@@ -827,10 +1069,12 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
     }
     out << " {}" << endl;
 
+    // Field tables need an offset for each flag, which bit-fields lack
+    bool bits = gen_compact_layout_ && !gen_table_serialization_;
     for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
       if ((*m_iter)->get_req() != t_field::T_REQUIRED) {
         indent(out) <<
-          "bool " << (*m_iter)->get_name() << ";" << endl;
+          "bool " << (*m_iter)->get_name() << (bits ? " : 1;" : ";") << endl;
         }
       }
 
@@ -841,6 +1085,14 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
 
   out << endl;
 
+  // Members are declared, and so initialized, in layout order.  With
+  // compact_layout, that is by decreasing alignment, so that no padding is
+  // needed between them.
+  vector<t_field*> layout(members);
+  if (gen_compact_layout_ && !pointers) {
+    std::stable_sort(layout.begin(), layout.end(), field_alignment_greater);
+  }
+
   // Open struct def
   out <<
     indent() << "class " << tstruct->get_name() << extends << " {" << endl <<
@@ -858,7 +1110,7 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
 
     bool init_ctor = false;
 
-    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    for (m_iter = layout.begin(); m_iter != layout.end(); ++m_iter) {
       t_type* t = get_true_type((*m_iter)->get_type());
       if (t->is_base_type() || t->is_enum()) {
         string dval;
@@ -896,6 +1148,17 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
     scope_down(out);
   }
 
+  if (gen_moveable_types_ && !pointers) {
+    // The destructor below would otherwise suppress the implicit moves
+    const string& name = tstruct->get_name();
+    out <<
+      endl <<
+      indent() << name << "(const " << name << "&) = default;" << endl <<
+      indent() << name << "(" << name << "&&) = default;" << endl <<
+      indent() << name << "& operator=(const " << name << "&) = default;" << endl <<
+      indent() << name << "& operator=(" << name << "&&) = default;" << endl;
+  }
+
   if (tstruct->annotations_.find("final") == tstruct->annotations_.end()) {
     out <<
       endl <<
@@ -910,7 +1173,7 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
   }
 
   // Declare all fields
-  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+  for (m_iter = layout.begin(); m_iter != layout.end(); ++m_iter) {
     indent(out) <<
       declare_field(*m_iter, false, pointers && !(*m_iter)->get_type()->is_xception(), !read) << endl;
   }
@@ -927,23 +1190,32 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
     if (pointers) {
       continue;
     }
-    out <<
-      endl <<
-      indent() << "void __set_" << (*m_iter)->get_name() <<
-        "(" << type_name((*m_iter)->get_type(), false, true);
-    out << " val) {" << endl << indent() <<
-      indent() << (*m_iter)->get_name() << " = val;" << endl;
-
-    // assume all fields are required except optional fields.
-    // for optional fields change __isset.name to true
-    bool is_optional = (*m_iter)->get_req() == t_field::T_OPTIONAL;
-    if (is_optional) {
+    // With moveable_types, strings, containers and structs also get a
+    // setter taking an rvalue, which moves the value in
+    bool rvalue = gen_moveable_types_ && is_complex_type((*m_iter)->get_type());
+    for (int by_rvalue = 0; by_rvalue <= (rvalue ? 1 : 0); ++by_rvalue) {
       out <<
-        indent() <<
-        indent() << "__isset." << (*m_iter)->get_name() << " = true;" << endl;
+        endl <<
+        indent() << "void __set_" << (*m_iter)->get_name() << "(";
+      if (by_rvalue) {
+        out << type_name((*m_iter)->get_type()) << "&& val) {" << endl << indent() <<
+          indent() << (*m_iter)->get_name() << " = std::move(val);" << endl;
+      } else {
+        out << type_name((*m_iter)->get_type(), false, true) << " val) {" << endl << indent() <<
+          indent() << (*m_iter)->get_name() << " = val;" << endl;
+      }
+
+      // assume all fields are required except optional fields.
+      // for optional fields change __isset.name to true
+      bool is_optional = (*m_iter)->get_req() == t_field::T_OPTIONAL;
+      if (is_optional) {
+        out <<
+          indent() <<
+          indent() << "__isset." << (*m_iter)->get_name() << " = true;" << endl;
+      }
+      out <<
+        indent()<< "}" << endl;
     }
-    out <<
-      indent()<< "}" << endl;
   }
   out << endl;
 
@@ -1215,6 +1487,16 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
   }
   indent_up();
 
+  if (gen_table_serialization_ && !pointers) {
+    indent(out) <<
+      "return ::apache::thrift::protocol::readStruct(iprot, this, " <<
+      tstruct->get_name() << "__spec);" << endl;
+    indent_down();
+    indent(out) <<
+      "}" << endl << endl;
+    return;
+  }
+
   const vector<t_field*>& fields = tstruct->get_members();
   vector<t_field*>::const_iterator f_iter;
 
@@ -1362,6 +1644,16 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
   }
   indent_up();
 
+  if (gen_table_serialization_ && !pointers) {
+    indent(out) <<
+      "return ::apache::thrift::protocol::writeStruct(oprot, this, " <<
+      name << "__spec);" << endl;
+    indent_down();
+    indent(out) <<
+      "}" << endl << endl;
+    return;
+  }
+
   out <<
     indent() << "uint32_t xfer = 0;" << endl;
 
@@ -1413,6 +1705,114 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
     endl;
 }
 
+/**
+ * Generates the table that the library reads and writes a struct from with
+ * table_serialization.  Fields the library cannot handle by their kind
+ * alone get a pair of functions, generated as the unrolled reader and
+ * writer would handle them.
+ *
+ * @param out Stream to write to
+ * @param tstruct The struct
+ */
+void t_cpp_generator::generate_struct_table(ofstream& out,
+                                            t_struct* tstruct) {
+  string name = tstruct->get_name();
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if (field_kind(*f_iter) != "TK_CUSTOM") {
+      continue;
+    }
+    string fname = (*f_iter)->get_name();
+
+    indent(out) <<
+      "static uint32_t " << name << "__read_" << fname <<
+      "(::apache::thrift::protocol::TProtocol* iprot, void* obj) {" << endl;
+    indent_up();
+    out <<
+      indent() << name << "* that = static_cast<" << name << "*>(obj);" << endl <<
+      indent() << "uint32_t xfer = 0;" << endl;
+    generate_deserialize_field(out, *f_iter, "that->");
+    indent(out) << "return xfer;" << endl;
+    scope_down(out);
+    out << endl;
+
+    indent(out) <<
+      "static uint32_t " << name << "__write_" << fname <<
+      "(::apache::thrift::protocol::TProtocol* oprot, const void* obj) {" << endl;
+    indent_up();
+    out <<
+      indent() << "const " << name << "* that = static_cast<const " << name << "*>(obj);" << endl <<
+      indent() << "uint32_t xfer = 0;" << endl;
+    generate_serialize_field(out, *f_iter, "that->");
+    indent(out) << "return xfer;" << endl;
+    scope_down(out);
+    out << endl;
+  }
+
+  if (!fields.empty()) {
+    indent(out) <<
+      "static const ::apache::thrift::protocol::TFieldSpec " << name << "__fields[] = {" << endl;
+    indent_up();
+    for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+      string fname = (*f_iter)->get_name();
+      string kind = field_kind(*f_iter);
+      bool required = (*f_iter)->get_req() == t_field::T_REQUIRED;
+      bool write_if_set = (*f_iter)->get_req() == t_field::T_OPTIONAL ||
+                          (*f_iter)->get_type()->is_xception();
+      // Required fields have no __isset flag to write by
+      if (required && write_if_set) {
+        throw "compiler error: required exception field " + fname + " in " + name +
+          " has no __isset flag for table_serialization to check";
+      }
+      indent(out) <<
+        "{ " << (*f_iter)->get_key() << ", " <<
+        type_to_enum((*f_iter)->get_type()) << ", " <<
+        "::apache::thrift::protocol::" << kind << ", " <<
+        (required ? "true" : "false") << ", " <<
+        (write_if_set ? "true" : "false") << ", " <<
+        "\"" << fname << "\", ";
+      if (kind == "TK_CUSTOM") {
+        out << "NULL, ";
+      } else {
+        out <<
+          "::apache::thrift::protocol::fieldOf<" << name << ", " <<
+          type_name((*f_iter)->get_type()) << ", &" << name << "::" << fname << ">, ";
+      }
+      if (required) {
+        out << "NULL, ";
+      } else {
+        out <<
+          "::apache::thrift::protocol::issetOf<" << name << ", _" << name << "__isset, &" <<
+          name << "::__isset, &_" << name << "__isset::" << fname << ">, ";
+      }
+      if (kind == "TK_CUSTOM") {
+        out << name << "__read_" << fname << ", " << name << "__write_" << fname;
+      } else {
+        out << "NULL, NULL";
+      }
+      out << " }," << endl;
+    }
+    indent_down();
+    indent(out) <<
+      "};" << endl << endl;
+  }
+
+  indent(out) <<
+    "static const ::apache::thrift::protocol::TStructSpec " << name << "__spec = {" << endl;
+  indent_up();
+  if (fields.empty()) {
+    indent(out) << "\"" << name << "\", NULL, 0" << endl;
+  } else {
+    indent(out) <<
+      "\"" << name << "\", " << name << "__fields, " << fields.size() << endl;
+  }
+  indent_down();
+  indent(out) <<
+    "};" << endl << endl;
+}
+
 /**
  * Struct writer for result of a function, which can have only one of its
  * fields set and does a conditional if else look up into the __isset field
@@ -1604,12 +2004,7 @@ void t_cpp_generator::generate_service(t_service* tservice) {
   f_service_.open(f_service_name.c_str());
   f_service_ <<
     autogen_comment();
-  f_service_ <<
-    "#include \"" << get_include_prefix(*get_program()) << svcname << ".h\"" << endl;
-  if (gen_cob_style_) {
-    f_service_ <<
-      "#include \"thrift/async/TAsyncChannel.h\"" << endl;
-  }
+  generate_service_impl_includes(f_service_, svcname);
   if (gen_templates_) {
     f_service_ <<
       "#include \"" << get_include_prefix(*get_program()) << svcname <<
@@ -1639,6 +2034,19 @@ void t_cpp_generator::generate_service(t_service* tservice) {
   f_service_tcc_ <<
     endl << ns_open_ << endl << endl;
 
+  f_service_shards_.push_back(&f_service_);
+  for (int i = 1; i < split_; ++i) {
+    std::ostringstream f_shard_name;
+    f_shard_name << get_out_dir() << svcname << "_" << i << ".cpp";
+    std::ofstream* f_shard = new std::ofstream(f_shard_name.str().c_str());
+    *f_shard <<
+      autogen_comment();
+    generate_service_impl_includes(*f_shard, svcname);
+    *f_shard <<
+      endl << ns_open_ << endl << endl;
+    f_service_shards_.push_back(f_shard);
+  }
+
   // Generate all the components
   generate_service_interface(tservice, "");
   generate_service_interface_factory(tservice, "");
@@ -1686,12 +2094,36 @@ void t_cpp_generator::generate_service(t_service* tservice) {
   f_service_tcc_ <<
     "#endif" << endl;
 
+  for (size_t i = 1; i < f_service_shards_.size(); ++i) {
+    *f_service_shards_[i] <<
+      ns_close_ << endl <<
+      endl;
+    delete f_service_shards_[i];
+  }
+  f_service_shards_.clear();
+
   // Close the files
   f_service_tcc_.close();
   f_service_.close();
   f_header_.close();
 }
 
+/**
+ * Includes what the code in a service .cpp file needs.
+ */
+void t_cpp_generator::generate_service_impl_includes(ofstream& out, string svcname) {
+  out <<
+    "#include \"" << get_include_prefix(*get_program()) << svcname << ".h\"" << endl;
+  if (gen_cob_style_) {
+    out <<
+      "#include \"thrift/async/TAsyncChannel.h\"" << endl;
+  }
+  if (gen_table_serialization_) {
+    out << endl;
+    generate_field_table_includes(out);
+  }
+}
+
 /**
  * Generates helper functions for a service. Basically, this generates types
  * for all the arguments and results to functions.
@@ -1707,9 +2139,15 @@ void t_cpp_generator::generate_service_helpers(t_service* tservice) {
     t_struct* ts = (*f_iter)->get_arglist();
     string name_orig = ts->get_name();
 
+    begin_shard(f_service_, f_service_shards_,
+                tservice->get_name() + "." + (*f_iter)->get_name());
+
     // TODO(dreiss): Why is this stuff not in generate_function_helpers?
     ts->set_name(tservice->get_name() + "_" + (*f_iter)->get_name() + "_args");
     generate_struct_definition(f_header_, ts, false);
+    if (gen_table_serialization_) {
+      generate_struct_table(out, ts);
+    }
     generate_struct_reader(out, ts);
     generate_struct_writer(out, ts);
     ts->set_name(tservice->get_name() + "_" + (*f_iter)->get_name() + "_pargs");
@@ -1718,6 +2156,7 @@ void t_cpp_generator::generate_service_helpers(t_service* tservice) {
     ts->set_name(name_orig);
 
     generate_function_helpers(tservice, *f_iter);
+    end_shard(f_service_);
   }
 }
 
@@ -2198,6 +2637,10 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
     extends_client = ", public " + extends + style + client_suffix;
   }
 
+  // Pipelined clients assume the same of their parent services.
+  bool pipelined = gen_pipelined_ && style != "Cob";
+  t_type* send_type = pipelined ? g_type_i32 : g_type_void;
+
   // Generate the header portion
   f_header_ <<
     template_header <<
@@ -2213,6 +2656,11 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       "(" << prot_ptr << " prot) :" <<
       endl;
     if (extends.empty()) {
+      if (pipelined) {
+        f_header_ <<
+          indent() << "  nextSeqid_(0)," << endl <<
+          indent() << "  replyPending_(false)," << endl;
+      }
       f_header_ <<
         indent() << "  piprot_(prot)," << endl <<
         indent() << "  poprot_(prot) {" << endl <<
@@ -2229,6 +2677,11 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       indent() << service_name_ << style << "Client" << short_suffix <<
       "(" << prot_ptr << " iprot, " << prot_ptr << " oprot) :" << endl;
     if (extends.empty()) {
+      if (pipelined) {
+        f_header_ <<
+          indent() << "  nextSeqid_(0)," << endl <<
+          indent() << "  replyPending_(false)," << endl;
+      }
       f_header_ <<
         indent() << "  piprot_(iprot)," << endl <<
         indent() << "  poprot_(oprot) {" << endl <<
@@ -2254,6 +2707,22 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       indent() << "  return " << _this << "poprot_;" << endl <<
       indent() << "}" << endl;
 
+    if (pipelined && extends.empty()) {
+      // send_ methods return the seqid of the call. After several sends,
+      // replies may be collected in any order: __recv_seqid() reads the
+      // header of the next reply, and the recv_ method for the returned
+      // name then reads the rest of it.
+      f_header_ <<
+        indent() << "int32_t __recv_seqid(std::string& fname) {" << endl <<
+        indent() << "  if (!replyPending_) {" << endl <<
+        indent() << "    iprot_->readMessageBegin(replyFname_, replyMtype_, replySeqid_);" << endl <<
+        indent() << "    replyPending_ = true;" << endl <<
+        indent() << "  }" << endl <<
+        indent() << "  fname = replyFname_;" << endl <<
+        indent() << "  return replySeqid_;" << endl <<
+        indent() << "}" << endl;
+    }
+
   } else /* if (style == "Cob") */ {
     f_header_ <<
       indent() << service_name_ << style << "Client" << short_suffix << "(" <<
@@ -2315,7 +2784,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     indent(f_header_) << function_signature(*f_iter, ifstyle) << ";" << endl;
     // TODO(dreiss): Use private inheritance to avoid generating thise in cob-style.
-    t_function send_function(g_type_void,
+    t_function send_function(send_type,
         string("send_") + (*f_iter)->get_name(),
         (*f_iter)->get_arglist());
     indent(f_header_) << function_signature(&send_function, "") << ";" << endl;
@@ -2340,6 +2809,14 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
         indent() << "boost::shared_ptr< ::apache::thrift::transport::TMemoryBuffer> itrans_;"  << endl <<
         indent() << "boost::shared_ptr< ::apache::thrift::transport::TMemoryBuffer> otrans_;"  << endl;
     }
+    if (pipelined) {
+      f_header_ <<
+        indent() << "uint32_t nextSeqid_;" << endl <<
+        indent() << "bool replyPending_;" << endl <<
+        indent() << "std::string replyFname_;" << endl <<
+        indent() << "::apache::thrift::protocol::TMessageType replyMtype_;" << endl <<
+        indent() << "int32_t replySeqid_;" << endl;
+    }
     f_header_ <<
       indent() << prot_ptr << " piprot_;"  << endl <<
       indent() << prot_ptr << " poprot_;"  << endl <<
@@ -2368,6 +2845,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
   // Generate client method implementations
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     string funname = (*f_iter)->get_name();
+    begin_shard(f_service_, f_service_shards_, tservice->get_name() + "." + funname);
 
     // Open function
     if (gen_templates_) {
@@ -2428,7 +2906,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
     //if (style != "Cob") // TODO(dreiss): Libify the client and don't generate this for cob-style
     if (true) {
       // Function for sending
-      t_function send_function(g_type_void,
+      t_function send_function(send_type,
                                string("send_") + (*f_iter)->get_name(),
                                (*f_iter)->get_arglist());
 
@@ -2445,8 +2923,14 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       string resultname = tservice->get_name() + "_" + (*f_iter)->get_name() + "_presult";
 
       // Serialize the request
+      if (pipelined) {
+        out <<
+          indent() << "int32_t cseqid = (int32_t)" << _this << "nextSeqid_++;" << endl;
+      } else {
+        out <<
+          indent() << "int32_t cseqid = 0;" << endl;
+      }
       out <<
-        indent() << "int32_t cseqid = 0;" << endl <<
         indent() << _this << "oprot_->writeMessageBegin(\"" <<
         (*f_iter)->get_name() <<
         "\", ::apache::thrift::protocol::T_CALL, cseqid);" << endl <<
@@ -2464,6 +2948,10 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
         indent() << _this << "oprot_->writeMessageEnd();" << endl <<
         indent() << _this << "oprot_->getTransport()->writeEnd();" << endl <<
         indent() << _this << "oprot_->getTransport()->flush();" << endl;
+      if (pipelined) {
+        out <<
+          indent() << "return cseqid;" << endl;
+      }
 
       scope_down(out);
       out << endl;
@@ -2493,8 +2981,23 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
             indent() << "try {";
           indent_up();
         }
-        out << endl <<
-          indent() << _this << "iprot_->readMessageBegin(fname, mtype, rseqid);" << endl <<
+        out << endl;
+        if (pipelined) {
+          // The header may already have been read by __recv_seqid()
+          out <<
+            indent() << "if (" << _this << "replyPending_) {" << endl <<
+            indent() << "  fname = " << _this << "replyFname_;" << endl <<
+            indent() << "  mtype = " << _this << "replyMtype_;" << endl <<
+            indent() << "  rseqid = " << _this << "replySeqid_;" << endl <<
+            indent() << "  " << _this << "replyPending_ = false;" << endl <<
+            indent() << "} else {" << endl <<
+            indent() << "  " << _this << "iprot_->readMessageBegin(fname, mtype, rseqid);" << endl <<
+            indent() << "}" << endl;
+        } else {
+          out <<
+            indent() << _this << "iprot_->readMessageBegin(fname, mtype, rseqid);" << endl;
+        }
+        out <<
           indent() << "if (mtype == ::apache::thrift::protocol::T_EXCEPTION) {" << endl <<
           indent() << "  ::apache::thrift::TApplicationException x;" << endl <<
           indent() << "  x.read(" << _this << "iprot_);" << endl <<
@@ -2634,6 +3137,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
         out << endl;
       }
     }
+    end_shard(f_service_);
   }
 }
 
@@ -2663,6 +3167,19 @@ class ProcessorGenerator {
   void generate_factory();
 
  protected:
+  /**
+   * A function the processor dispatches, and the processor class that
+   * defines it; the class is empty for the processor's own functions.
+   */
+  struct DispatchFunction {
+    DispatchFunction(const string& n, const string& c) : name(n), owner(c) {}
+    string name;
+    string owner;
+  };
+
+  void get_dispatch_functions(vector<DispatchFunction>& functions);
+  void generate_dispatch_tree(const vector<DispatchFunction>& functions);
+
   std::string type_name(t_type* ttype, bool in_typedef=false, bool arg=false) {
     return generator_->type_name(ttype, in_typedef, arg);
   }
@@ -2799,46 +3316,9 @@ void ProcessorGenerator::generate_class_definition() {
         "const std::string& fname, int32_t seqid" << call_context_ << ");" <<
         endl;
   }
-  indent_down();
-
-  // Process function declarations
-  f_header_ <<
-    " private:" << endl;
-  indent_up();
-
-  // Declare processMap_
-  f_header_ <<
-    indent() << "typedef  void (" << class_name_ << "::*" <<
-      "ProcessFunction)(" << finish_cob_decl_ << "int32_t, " <<
-      "apache::thrift::protocol::TProtocol*, " <<
-      "apache::thrift::protocol::TProtocol*" << call_context_decl_ << ");" <<
-      endl;
-  if (generator_->gen_templates_) {
-    f_header_ <<
-      indent() << "typedef void (" << class_name_ << "::*" <<
-        "SpecializedProcessFunction)(" << finish_cob_decl_ << "int32_t, " <<
-        "Protocol_*, Protocol_*" << call_context_decl_ << ");" <<
-        endl <<
-      indent() << "struct ProcessFunctions {" << endl <<
-      indent() << "  ProcessFunction generic;" << endl <<
-      indent() << "  SpecializedProcessFunction specialized;" << endl <<
-      indent() << "  ProcessFunctions(ProcessFunction g, " <<
-        "SpecializedProcessFunction s) :" << endl <<
-      indent() << "    generic(g)," << endl <<
-      indent() << "    specialized(s) {}" << endl <<
-      indent() << "  ProcessFunctions() : generic(NULL), specialized(NULL) " <<
-        "{}" << endl <<
-      indent() << "};" << endl <<
-      indent() << "typedef std::map<std::string, ProcessFunctions> " <<
-        "ProcessMap;" << endl;
-  } else {
-    f_header_ <<
-      indent() << "typedef std::map<std::string, ProcessFunction> " <<
-        "ProcessMap;" << endl;
-  }
-  f_header_ <<
-    indent() << "ProcessMap processMap_;" << endl;
 
+  // Process function declarations, protected so that the processors of
+  // extending services can dispatch to them
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     indent(f_header_) <<
       "void process_" << (*f_iter)->get_name() << "(" << finish_cob_ << "int32_t seqid, apache::thrift::protocol::TProtocol* iprot, apache::thrift::protocol::TProtocol* oprot" << call_context_ << ");" << endl;
@@ -2889,28 +3369,7 @@ void ProcessorGenerator::generate_class_definition() {
       indent() << "  " << extends_ << "(iface)," << endl;
   }
   f_header_ <<
-    indent() << "  iface_(iface) {" << endl;
-  indent_up();
-
-  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
-    f_header_ <<
-      indent() << "processMap_[\"" << (*f_iter)->get_name() << "\"] = ";
-    if (generator_->gen_templates_) {
-      f_header_ << "ProcessFunctions(" << endl <<
-        indent() << "  &" << class_name_ << "::process_" <<
-          (*f_iter)->get_name() << "," << endl <<
-        indent() << "  &" << class_name_ << "::process_" <<
-          (*f_iter)->get_name() << ")";
-    } else {
-      f_header_ << "&" << class_name_ << "::process_" << (*f_iter)->get_name();
-    }
-    f_header_ <<
-      ";" << endl;
-  }
-
-  indent_down();
-  f_header_ <<
-    indent() << "}" << endl <<
+    indent() << "  iface_(iface) {}" << endl <<
     endl <<
     indent() << "virtual ~" << class_name_ << "() {}" << endl;
   indent_down();
@@ -2958,72 +3417,156 @@ void ProcessorGenerator::generate_dispatch_call(bool template_protocol) {
     endl;
   indent_up();
 
-  // HOT: member function pointer map
-  f_out_ <<
-    indent() << typename_str_ << "ProcessMap::iterator pfn;" << endl <<
-    indent() << "pfn = processMap_.find(fname);" << endl <<
-    indent() << "if (pfn == processMap_.end()) {" << endl;
-  if (extends_.empty()) {
-    f_out_ <<
-      indent() << "  iprot->skip(apache::thrift::protocol::T_STRUCT);" << endl <<
-      indent() << "  iprot->readMessageEnd();" << endl <<
-      indent() << "  iprot->getTransport()->readEnd();" << endl <<
-      indent() << "  ::apache::thrift::TApplicationException x(::apache::thrift::TApplicationException::UNKNOWN_METHOD, \"Invalid method name: '\"+fname+\"'\");" << endl <<
-      indent() << "  oprot->writeMessageBegin(fname, ::apache::thrift::protocol::T_EXCEPTION, seqid);" << endl <<
-      indent() << "  x.write(oprot);" << endl <<
-      indent() << "  oprot->writeMessageEnd();" << endl <<
-      indent() << "  oprot->getTransport()->writeEnd();" << endl <<
-      indent() << "  oprot->getTransport()->flush();" << endl <<
-      indent() << (style_ == "Cob" ? "  return cob(true);" : "  return true;") << endl;
-  } else {
-    f_out_ <<
-      indent() << "  return "
-               << extends_ << "::dispatchCall("
-               << (style_ == "Cob" ? "cob, " : "")
-               << "iprot, oprot, fname, seqid" << call_context_arg_ << ");" << endl;
+  // HOT: switch on the name's length, then on characters that tell the
+  // names apart, so that a call costs one string comparison
+  vector<DispatchFunction> functions;
+  get_dispatch_functions(functions);
+
+  map<size_t, vector<DispatchFunction> > by_length;
+  vector<DispatchFunction>::iterator f_iter;
+  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    by_length[f_iter->name.size()].push_back(*f_iter);
   }
-  f_out_ <<
-    indent() << "}" << endl;
-  if (template_protocol) {
+
+  if (!by_length.empty()) {
     f_out_ <<
-      indent() << "(this->*(pfn->second.specialized))";
-  } else {
-    if (generator_->gen_templates_) {
+      indent() << "switch (fname.size()) {" << endl;
+    map<size_t, vector<DispatchFunction> >::iterator l_iter;
+    for (l_iter = by_length.begin(); l_iter != by_length.end(); ++l_iter) {
       f_out_ <<
-        indent() << "(this->*(pfn->second.generic))";
-    } else {
+        indent() << "case " << l_iter->first << ":" << endl;
+      indent_up();
+      generate_dispatch_tree(l_iter->second);
       f_out_ <<
-        indent() << "(this->*(pfn->second))";
+        indent() << "break;" << endl;
+      indent_down();
     }
-  }
-  f_out_ << "(" << cob_arg_ << "seqid, iprot, oprot" <<
-    call_context_arg_ << ");" << endl;
-
-  // TODO(dreiss): return pfn ret?
-  if (style_ == "Cob") {
     f_out_ <<
-      indent() << "return;" << endl;
-  } else {
-    f_out_ <<
-      indent() << "return true;" << endl;
+      indent() << "}" << endl << endl;
   }
 
+  // Inherited functions are in the table too, so anything else is unknown
+  f_out_ <<
+    indent() << "iprot->skip(apache::thrift::protocol::T_STRUCT);" << endl <<
+    indent() << "iprot->readMessageEnd();" << endl <<
+    indent() << "iprot->getTransport()->readEnd();" << endl <<
+    indent() << "::apache::thrift::TApplicationException x(::apache::thrift::TApplicationException::UNKNOWN_METHOD, \"Invalid method name: '\"+fname+\"'\");" << endl <<
+    indent() << "oprot->writeMessageBegin(fname, ::apache::thrift::protocol::T_EXCEPTION, seqid);" << endl <<
+    indent() << "x.write(oprot);" << endl <<
+    indent() << "oprot->writeMessageEnd();" << endl <<
+    indent() << "oprot->getTransport()->writeEnd();" << endl <<
+    indent() << "oprot->getTransport()->flush();" << endl <<
+    indent() << (style_ == "Cob" ? "return cob(true);" : "return true;") << endl;
+
   indent_down();
   f_out_ <<
     "}" << endl <<
     endl;
 }
 
+void ProcessorGenerator::get_dispatch_functions(
+    vector<DispatchFunction>& functions) {
+  set<string> names;
+  for (t_service* service = service_; service != NULL;
+       service = service->get_extends()) {
+    string owner;
+    if (service != service_) {
+      owner = type_name(service) + pstyle_ + "Processor";
+      if (generator_->gen_templates_) {
+        owner += "T<Protocol_>";
+      }
+    }
+
+    // An extending service's function hides an inherited one of the same
+    // name, as it would have with each processor dispatching in turn
+    vector<t_function*> service_functions = service->get_functions();
+    vector<t_function*>::iterator f_iter;
+    for (f_iter = service_functions.begin();
+         f_iter != service_functions.end(); ++f_iter) {
+      if (names.insert((*f_iter)->get_name()).second) {
+        functions.push_back(DispatchFunction((*f_iter)->get_name(), owner));
+      }
+    }
+  }
+}
+
+/**
+ * Generates the dispatch of functions whose names are all the same length:
+ * a switch on the character that divides them into the most groups, then
+ * the same for each group, down to single functions.
+ */
+void ProcessorGenerator::generate_dispatch_tree(
+    const vector<DispatchFunction>& functions) {
+  if (functions.size() == 1) {
+    const DispatchFunction& function = functions.front();
+    f_out_ <<
+      indent() << "if (fname == \"" << function.name << "\") {" << endl;
+    indent_up();
+    f_out_ << indent();
+    if (!function.owner.empty()) {
+      f_out_ << function.owner << "::";
+    }
+    f_out_ << "process_" << function.name << "(" << cob_arg_ <<
+      "seqid, iprot, oprot" << call_context_arg_ << ");" << endl <<
+      indent() << (style_ == "Cob" ? "return;" : "return true;") << endl;
+    indent_down();
+    f_out_ <<
+      indent() << "}" << endl;
+    return;
+  }
+
+  // Distinct names of the same length differ somewhere, so some position
+  // splits them into at least two groups
+  size_t length = functions.front().name.size();
+  size_t best_pos = 0;
+  size_t best_count = 0;
+  for (size_t pos = 0; pos < length; ++pos) {
+    set<char> chars;
+    vector<DispatchFunction>::const_iterator f_iter;
+    for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+      chars.insert(f_iter->name[pos]);
+    }
+    if (chars.size() > best_count) {
+      best_pos = pos;
+      best_count = chars.size();
+    }
+  }
+
+  map<char, vector<DispatchFunction> > groups;
+  vector<DispatchFunction>::const_iterator f_iter;
+  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    groups[f_iter->name[best_pos]].push_back(*f_iter);
+  }
+
+  f_out_ <<
+    indent() << "switch (fname[" << best_pos << "]) {" << endl;
+  map<char, vector<DispatchFunction> >::iterator g_iter;
+  for (g_iter = groups.begin(); g_iter != groups.end(); ++g_iter) {
+    f_out_ <<
+      indent() << "case '" << g_iter->first << "':" << endl;
+    indent_up();
+    generate_dispatch_tree(g_iter->second);
+    f_out_ <<
+      indent() << "break;" << endl;
+    indent_down();
+  }
+  f_out_ <<
+    indent() << "}" << endl;
+}
+
 void ProcessorGenerator::generate_process_functions() {
   vector<t_function*> functions = service_->get_functions();
   vector<t_function*>::iterator f_iter;
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    generator_->begin_shard(generator_->f_service_, generator_->f_service_shards_,
+                            service_->get_name() + "." + (*f_iter)->get_name());
     if (generator_->gen_templates_) {
       generator_->generate_process_function(service_, *f_iter, style_, false);
       generator_->generate_process_function(service_, *f_iter, style_, true);
     } else {
       generator_->generate_process_function(service_, *f_iter, style_, false);
     }
+    generator_->end_shard(generator_->f_service_);
   }
 }
 
@@ -3132,6 +3675,9 @@ void t_cpp_generator::generate_function_helpers(t_service* tservice,
   }
 
   generate_struct_definition(f_header_, &result, false);
+  if (gen_table_serialization_) {
+    generate_struct_table(out, &result);
+  }
   generate_struct_reader(out, &result);
   generate_struct_result_writer(out, &result);
 
@@ -3195,6 +3741,12 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
     string resultname = tservice->get_name() + "_" + tfunction->get_name() +
       "_result";
 
+    // Declared first so that args and result are destroyed before it
+    if (gen_arena_) {
+      out <<
+        indent() << "::apache::thrift::ArenaScope arenaScope;" << endl;
+    }
+
     if (tfunction->is_oneway() && !unnamed_oprot_seqid) {
       out <<
         indent() << "(void) seqid;" << endl <<
@@ -3277,7 +3829,7 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
           indent_up();
           out <<
             indent() << "result." << (*x_iter)->get_name() << " = " <<
-              (*x_iter)->get_name() << ";" << endl <<
+              move_value((*x_iter)->get_name()) << ";" << endl <<
             indent() << "result.__isset." << (*x_iter)->get_name() <<
               " = true;" << endl;
           indent_down();
@@ -3630,7 +4182,7 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
         indent_up();
         out <<
           indent() << "result." << (*x_iter)->get_name() << " = " <<
-            (*x_iter)->get_name() << ";" << endl <<
+            move_value((*x_iter)->get_name()) << ";" << endl <<
           indent() << "result.__isset." << (*x_iter)->get_name() <<
             " = true;" << endl;
         scope_down(out);
@@ -3791,6 +4343,35 @@ void t_cpp_generator::generate_deserialize_field(ofstream& out,
     generate_deserialize_struct(out, (t_struct*)type, name);
   } else if (type->is_container()) {
     generate_deserialize_container(out, type, name);
+  } else if (type->is_string() && !type_annotation(type, "cpp.type").empty()) {
+    // Protocols only read std::string; a cpp.type string must have assign()
+    string str = tmp("_str");
+    out <<
+      indent() << "{" << endl <<
+      indent() << "  std::string " << str << ";" << endl <<
+      indent() << "  xfer += iprot->" <<
+        (((t_base_type*)type)->is_binary() ? "readBinary" : "readString") <<
+        "(" << str << ");" << endl <<
+      indent() << "  " << name << ".assign(" << str << ".data(), " << str << ".size());" << endl <<
+      indent() << "}" << endl;
+  } else if (type->is_base_type() && !type_annotation(type, "cpp.type").empty()) {
+    // Any other cpp.type must convert to and from the base type
+    t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+    t_base_type plain(type->get_name(), tbase);
+    t_field val(&plain, tmp("_val"));
+    indent(out) << "{" << endl;
+    indent_up();
+    indent(out) << base_type_name(tbase) << " " << val.get_name() << ";" << endl;
+    generate_deserialize_field(out, &val);
+    indent(out) << name << " = static_cast<" << type_name(type) << ">(" << val.get_name() << ");" << endl;
+    indent_down();
+    indent(out) << "}" << endl;
+  } else if (gen_arena_ && type->is_string()) {
+    // Protocols only read std::string; the library stages arena strings
+    indent(out) <<
+      "xfer += ::apache::thrift::" <<
+      (((t_base_type*)type)->is_binary() ? "readArenaBinary" : "readArenaString") <<
+      "(iprot, " << name << ");" << endl;
   } else if (type->is_base_type()) {
     indent(out) <<
       "xfer += iprot->";
@@ -3866,12 +4447,25 @@ void t_cpp_generator::generate_deserialize_container(ofstream& out,
   string vtype = tmp("_vtype");
   string etype = tmp("_etype");
 
+  // Lists other than std::vector are only assumed to have push_back()
   t_container* tcontainer = (t_container*)ttype;
-  bool use_push = tcontainer->has_cpp_name();
+  bool use_push = tcontainer->has_cpp_name() ||
+    !type_annotation(ttype, "cpp.type").empty() ||
+    !type_annotation(ttype, "cpp.template").empty();
 
-  indent(out) <<
-    prefix << ".clear();" << endl <<
-    indent() << "uint32_t " << size << ";" << endl;
+  // A std::vector being read again keeps its elements, so that strings and
+  // nested containers reuse the memory they already have.  Structs are not
+  // reused, since read() leaves fields that are absent on the wire alone.
+  bool reuse = false;
+  if (ttype->is_list() && !use_push) {
+    t_type* elem_type = get_true_type(((t_list*)ttype)->get_elem_type());
+    reuse = !elem_type->is_struct() && !elem_type->is_xception();
+  }
+
+  if (!reuse) {
+    indent(out) << prefix << ".clear();" << endl;
+  }
+  indent(out) << "uint32_t " << size << ";" << endl;
 
   // Declare variables, read header
   if (ttype->is_map()) {
@@ -3969,7 +4563,15 @@ void t_cpp_generator::generate_deserialize_list_element(ofstream& out,
                                                         string prefix,
                                                         bool use_push,
                                                         string index) {
-  if (use_push) {
+  t_type* elem_type = get_true_type(tlist->get_elem_type());
+  if (use_push && (elem_type->is_struct() || elem_type->is_xception())) {
+    // Read into the appended element rather than copying in a temporary
+    indent(out) <<
+      prefix << ".push_back(" << type_name(tlist->get_elem_type()) << "());" << endl;
+    t_field felem(tlist->get_elem_type(), prefix + ".back()");
+    generate_deserialize_field(out, &felem);
+  } else if (use_push) {
+    // back() need not be a plain reference, as in lists of bool
     string elem = tmp("_elem");
     t_field felem(tlist->get_elem_type(), elem);
     indent(out) << declare_field(&felem) << endl;
@@ -4009,6 +4611,27 @@ void t_cpp_generator::generate_serialize_field(ofstream& out,
                               name);
   } else if (type->is_container()) {
     generate_serialize_container(out, type, name);
+  } else if (type->is_string() && !type_annotation(type, "cpp.type").empty()) {
+    indent(out) <<
+      "xfer += oprot->" <<
+      (((t_base_type*)type)->is_binary() ? "writeBinary" : "writeString") <<
+      "(std::string(" << name << ".data(), " << name << ".size()));" << endl;
+  } else if (type->is_base_type() && !type_annotation(type, "cpp.type").empty()) {
+    t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+    t_base_type plain(type->get_name(), tbase);
+    t_field val(&plain, tmp("_val"));
+    indent(out) << "{" << endl;
+    indent_up();
+    indent(out) << base_type_name(tbase) << " " << val.get_name() <<
+      " = static_cast<" << base_type_name(tbase) << ">(" << name << ");" << endl;
+    generate_serialize_field(out, &val);
+    indent_down();
+    indent(out) << "}" << endl;
+  } else if (gen_arena_ && type->is_string()) {
+    indent(out) <<
+      "xfer += ::apache::thrift::" <<
+      (((t_base_type*)type)->is_binary() ? "writeArenaBinary" : "writeArenaString") <<
+      "(oprot, " << name << ");" << endl;
   } else if (type->is_base_type() || type->is_enum()) {
 
     indent(out) <<
@@ -4245,7 +4868,10 @@ string t_cpp_generator::namespace_close(string ns) {
  */
 string t_cpp_generator::type_name(t_type* ttype, bool in_typedef, bool arg) {
   if (ttype->is_base_type()) {
-    string bname = base_type_name(((t_base_type*)ttype)->get_base());
+    string bname = type_annotation(ttype, "cpp.type");
+    if (bname.empty()) {
+      bname = base_type_name(((t_base_type*)ttype)->get_base());
+    }
     if (!arg) {
       return bname;
     }
@@ -4262,19 +4888,41 @@ string t_cpp_generator::type_name(t_type* ttype, bool in_typedef, bool arg) {
     string cname;
 
     t_container* tcontainer = (t_container*) ttype;
-    if (tcontainer->has_cpp_name()) {
+    // cpp.template swaps in another template, which is not assumed to take
+    // an allocator in the standard one's position
+    string tname = type_annotation(ttype, "cpp.template");
+    bool arena = gen_arena_ && tname.empty();
+    if (!type_annotation(ttype, "cpp.type").empty()) {
+      cname = type_annotation(ttype, "cpp.type");
+    } else if (tcontainer->has_cpp_name()) {
       cname = tcontainer->get_cpp_name();
     } else if (ttype->is_map()) {
       t_map* tmap = (t_map*) ttype;
-      cname = "std::map<" +
-        type_name(tmap->get_key_type(), in_typedef) + ", " +
-        type_name(tmap->get_val_type(), in_typedef) + "> ";
+      string kname = type_name(tmap->get_key_type(), in_typedef);
+      string vname = type_name(tmap->get_val_type(), in_typedef);
+      if (arena) {
+        cname = "std::map<" + kname + ", " + vname + ", std::less<" + kname + ">, " +
+          "::apache::thrift::ArenaAllocator<std::pair<const " + kname + ", " + vname + "> > > ";
+      } else {
+        cname = (tname.empty() ? "std::map" : tname) + "<" + kname + ", " + vname + "> ";
+      }
     } else if (ttype->is_set()) {
       t_set* tset = (t_set*) ttype;
-      cname = "std::set<" + type_name(tset->get_elem_type(), in_typedef) + "> ";
+      string ename = type_name(tset->get_elem_type(), in_typedef);
+      if (arena) {
+        cname = "std::set<" + ename + ", std::less<" + ename + ">, " +
+          "::apache::thrift::ArenaAllocator<" + ename + "> > ";
+      } else {
+        cname = (tname.empty() ? "std::set" : tname) + "<" + ename + "> ";
+      }
     } else if (ttype->is_list()) {
       t_list* tlist = (t_list*) ttype;
-      cname = "std::vector<" + type_name(tlist->get_elem_type(), in_typedef) + "> ";
+      string ename = type_name(tlist->get_elem_type(), in_typedef);
+      if (arena) {
+        cname = "std::vector<" + ename + ", ::apache::thrift::ArenaAllocator<" + ename + "> > ";
+      } else {
+        cname = (tname.empty() ? "std::vector" : tname) + "<" + ename + "> ";
+      }
     }
 
     if (arg) {
@@ -4316,6 +4964,99 @@ string t_cpp_generator::type_name(t_type* ttype, bool in_typedef, bool arg) {
   }
 }
 
+/**
+ * Returns the value of an annotation on a type, or "" if it has none.  A
+ * value starting with "::" gets a leading space, for the same reason as in
+ * namespace_prefix().
+ */
+string t_cpp_generator::type_annotation(t_type* ttype, const string& key) {
+  map<string, string>::const_iterator it = ttype->annotations_.find(key);
+  if (it == ttype->annotations_.end()) {
+    return "";
+  }
+  return it->second.compare(0, 2, "::") == 0 ? " " + it->second : it->second;
+}
+
+/**
+ * The TFieldKind the library reads and writes a field as, with
+ * table_serialization.  Only plain base types are handled by kind; anything
+ * else, or anything stored as some other C++ type, is TK_CUSTOM.
+ */
+string t_cpp_generator::field_kind(t_field* tfield) {
+  t_type* type = get_true_type(tfield->get_type());
+  if (!type->is_base_type() || !type_annotation(type, "cpp.type").empty()) {
+    return "TK_CUSTOM";
+  }
+  switch (((t_base_type*)type)->get_base()) {
+  case t_base_type::TYPE_STRING:
+    if (gen_arena_) {
+      return "TK_CUSTOM";
+    }
+    return ((t_base_type*)type)->is_binary() ? "TK_BINARY" : "TK_STRING";
+  case t_base_type::TYPE_BOOL:
+    return "TK_BOOL";
+  case t_base_type::TYPE_BYTE:
+    return "TK_BYTE";
+  case t_base_type::TYPE_I16:
+    return "TK_I16";
+  case t_base_type::TYPE_I32:
+    return "TK_I32";
+  case t_base_type::TYPE_I64:
+    return "TK_I64";
+  case t_base_type::TYPE_DOUBLE:
+    return "TK_DOUBLE";
+  default:
+    return "TK_CUSTOM";
+  }
+}
+
+/**
+ * Includes the field table declarations.
+ */
+void t_cpp_generator::generate_field_table_includes(ofstream& out) {
+  out <<
+    "#include <thrift/protocol/TFieldTable.h>" << endl <<
+    endl;
+}
+
+/**
+ * Renders name as the source of an assignment, moved from when generating
+ * moveable types.
+ */
+string t_cpp_generator::move_value(const string& name) {
+  return gen_moveable_types_ ? "std::move(" + name + ")" : name;
+}
+
+/**
+ * The alignment a field is expected to need on a 64-bit target.  Strings,
+ * containers, structs and anything with a cpp.type are taken to need a
+ * pointer's alignment.
+ */
+int t_cpp_generator::field_alignment(t_field* tfield) {
+  t_type* ttype = get_true_type(tfield->get_type());
+  if (ttype->is_enum()) {
+    return 4;
+  }
+  if (!ttype->is_base_type() || !type_annotation(ttype, "cpp.type").empty()) {
+    return 8;
+  }
+  switch (((t_base_type*)ttype)->get_base()) {
+  case t_base_type::TYPE_BOOL:
+  case t_base_type::TYPE_BYTE:
+    return 1;
+  case t_base_type::TYPE_I16:
+    return 2;
+  case t_base_type::TYPE_I32:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+bool t_cpp_generator::field_alignment_greater(t_field* a, t_field* b) {
+  return field_alignment(a) > field_alignment(b);
+}
+
 /**
  * Returns the C++ type that corresponds to the thrift type.
  *
@@ -4327,7 +5068,7 @@ string t_cpp_generator::base_type_name(t_base_type::t_base tbase) {
   case t_base_type::TYPE_VOID:
     return "void";
   case t_base_type::TYPE_STRING:
-    return "std::string";
+    return gen_arena_ ? " ::apache::thrift::ArenaString" : "std::string";
   case t_base_type::TYPE_BOOL:
     return "bool";
   case t_base_type::TYPE_BYTE:
@@ -4591,5 +5332,22 @@ THRIFT_REGISTER_GENERATOR(cpp, "C++",
 "    pure_enums:      Generate pure enums instead of wrapper classes.\n"
 "    dense:           Generate type specifications for the dense protocol.\n"
 "    include_prefix:  Use full include paths in generated files.\n"
+"    pipelined:       Number calls in synchronous clients, and let send_/recv_\n"
+"                     be split so that replies are collected in any order.\n"
+"    arena:           Allocate strings and containers from a per-call arena.\n"
+"    compact_layout:  Order struct members to minimize padding, and pack __isset\n"
+"                     into bits.\n"
+"    moveable_types:  Generate move constructors, move assignment and rvalue\n"
+"                     setters (requires C++11).\n"
+"    table_serialization:\n"
+"                     Read and write structs through the library, from tables\n"
+"                     of their fields, to shrink generated code.  Ignored with\n"
+"                     templates.\n"
+"    no_static_init:  Build enum maps and constants on first use instead of at\n"
+"                     startup.  _<enum>_VALUES_TO_NAMES and g_<program>_constants\n"
+"                     become functions, and _<enum>_VALUE_TO_NAME() is added.\n"
+"    split=N:         Spread struct and service function code over N .cpp files\n"
+"                     per IDL file and per service, for parallel builds.\n"
+"                     Ignored with templates.\n"
 )
 
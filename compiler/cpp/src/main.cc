@@ -34,6 +34,7 @@
 #include <time.h>
 #include <string>
 #include <algorithm>
+#include <set>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -41,12 +42,20 @@
 
 #ifdef MINGW
 # include <windows.h> /* for GetFullPathName */
+# include <io.h> /* for _findfirst */
+# include <process.h> /* for getpid */
+#else
+# include <dirent.h>
+# include <unistd.h>
+# include <sys/wait.h>
 #endif
 
 // Careful: must include globals first for extern definitions
 #include "globals.h"
 
 #include "main.h"
+#include "md5.h"
+#include "platform.h"
 #include "parse/t_program.h"
 #include "parse/t_scope.h"
 #include "generate/t_generator.h"
@@ -188,6 +197,26 @@ bool gen_delphi = false;
 bool gen_st = false;
 bool gen_recurse = false;
 
+/**
+ * Number of generators to run at once
+ */
+int gen_jobs = 1;
+
+/**
+ * Whether to leave generated files that have not changed untouched
+ */
+bool gen_incremental = false;
+
+/**
+ * Included programs already parsed, by path and include prefix
+ */
+struct parsed_include {
+  t_program* program;
+  // Definitions to add to the scope of each program that includes it
+  t_scope* exports;
+};
+map<pair<string, string>, parsed_include> g_parsed_includes;
+
 /**
  * MinGW doesn't have realpath, so use fallback implementation in that case,
  * otherwise this just calls through to realpath
@@ -649,6 +678,9 @@ void usage() {
   fprintf(stderr, "  -strict     Strict compiler warnings on\n");
   fprintf(stderr, "  -v[erbose]  Verbose mode\n");
   fprintf(stderr, "  -r[ecurse]  Also generate included files\n");
+  fprintf(stderr, "  -j[obs] N   Run up to N generators at once (default: 1)\n");
+  fprintf(stderr, "  -incremental  Do not rewrite generated files whose contents have\n");
+  fprintf(stderr, "                not changed, so that their timestamps stay the same\n");
   fprintf(stderr, "  -debug      Parse debug trace to stdout\n");
   fprintf(stderr, "  --allow-neg-keys  Allow negative field keys (Used to "
           "preserve protocol\n");
@@ -828,9 +860,52 @@ bool validate_throws(t_struct* throws) {
 }
 
 /**
- * Parses a program
+ * Returns the type to give a field or typedef that was written with the
+ * given annotations.  cpp.type and cpp.template say how a base or
+ * container type is represented in C++, so when they are written on a
+ * field or typedef they are copied onto a copy of the underlying type,
+ * just as if they had been written on the type itself.
  */
-void parse(t_program* program, t_program* parent_program) {
+t_type* annotate_type(t_type* type, const map<string, string>& annotations) {
+  static const char* const keys[] = { "cpp.type", "cpp.template" };
+  map<string, string> moved;
+  for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+    map<string, string>::const_iterator it = annotations.find(keys[i]);
+    if (it != annotations.end()) {
+      moved[it->first] = it->second;
+    }
+  }
+  if (moved.empty() || type == NULL) {
+    return type;
+  }
+
+  t_type* true_type = t_generator::get_true_type(type);
+  t_type* result;
+  if (true_type->is_base_type()) {
+    result = new t_base_type(*static_cast<t_base_type*>(true_type));
+  } else if (true_type->is_map()) {
+    result = new t_map(*static_cast<t_map*>(true_type));
+  } else if (true_type->is_set()) {
+    result = new t_set(*static_cast<t_set*>(true_type));
+  } else if (true_type->is_list()) {
+    result = new t_list(*static_cast<t_list*>(true_type));
+  } else {
+    pwarning(1, "cpp.type and cpp.template only apply to base and container types\n");
+    return type;
+  }
+  for (map<string, string>::iterator it = moved.begin(); it != moved.end(); ++it) {
+    result->annotations_[it->first] = it->second;
+  }
+  return result;
+}
+
+t_program* parse_include(t_program* program, t_program* parent_program);
+
+/**
+ * Parses a program, adding its definitions to parent_scope too if that is
+ * not NULL
+ */
+void parse(t_program* program, t_scope* parent_scope) {
   // Get scope file path
   string path = program->get_path();
 
@@ -863,14 +938,14 @@ void parse(t_program* program, t_program* parent_program) {
   vector<t_program*>& includes = program->get_includes();
   vector<t_program*>::iterator iter;
   for (iter = includes.begin(); iter != includes.end(); ++iter) {
-    parse(*iter, program);
+    *iter = parse_include(*iter, program);
   }
 
   // Parse the program file
   g_parse_mode = PROGRAM;
   g_program = program;
   g_scope = program->scope();
-  g_parent_scope = (parent_program != NULL) ? parent_program->scope() : NULL;
+  g_parent_scope = parent_scope;
   g_parent_prefix = program->get_name() + ".";
   g_curpath = path;
   yyin = fopen(path.c_str(), "r");
@@ -890,9 +965,41 @@ void parse(t_program* program, t_program* parent_program) {
 }
 
 /**
- * Generate code
+ * Parses a program included by parent_program, unless a program with the same
+ * path and include prefix has been parsed already, in which case that one is
+ * shared instead. Returns the program to use.
+ */
+t_program* parse_include(t_program* program, t_program* parent_program) {
+  pair<string, string> key(program->get_path(), program->get_include_prefix());
+  map<pair<string, string>, parsed_include>::iterator found = g_parsed_includes.find(key);
+  if (found == g_parsed_includes.end()) {
+    parsed_include parsed;
+    parsed.program = program;
+    parsed.exports = new t_scope();
+    parse(program, parsed.exports);
+    found = g_parsed_includes.insert(make_pair(key, parsed)).first;
+  } else {
+    pverbose("Reusing %s\n", program->get_path().c_str());
+    delete program;
+  }
+
+  try {
+    parent_program->scope()->add_all(found->second.exports);
+  } catch (string x) {
+    failure(x.c_str());
+  }
+  return found->second.program;
+}
+
+/**
+ * Adds program, and with -r the programs it includes, to programs in the order
+ * they are to be generated. Programs included more than once are added once.
  */
-void generate(t_program* program, const vector<string>& generator_strings) {
+void collect_programs(t_program* program, vector<t_program*>& programs, set<t_program*>& seen) {
+  if (!seen.insert(program).second) {
+    return;
+  }
+
   // Oooohh, recursive code generation, hot!!
   if (gen_recurse) {
     const vector<t_program*>& includes = program->get_includes();
@@ -900,40 +1007,236 @@ void generate(t_program* program, const vector<string>& generator_strings) {
       // Propogate output path from parent to child programs
       includes[i]->set_out_path(program->get_out_path(), program->is_out_path_absolute());
 
-      generate(includes[i], generator_strings);
+      collect_programs(includes[i], programs, seen);
     }
   }
 
-  // Generate code!
+  programs.push_back(program);
+}
+
+/**
+ * Generate code for a program with one generator
+ */
+void generate(t_program* program, const string& generator_string) {
   try {
-    pverbose("Program: %s\n", program->get_path().c_str());
+    t_generator* generator = t_generator_registry::get_generator(program, generator_string);
+
+    if (generator == NULL) {
+      pwarning(1, "Unable to get a generator for \"%s\".\n", generator_string.c_str());
+    } else {
+      pverbose("Generating \"%s\"\n", generator_string.c_str());
+      generator->generate_program();
+      delete generator;
+    }
+
+  } catch (string s) {
+    printf("Error: %s\n", s.c_str());
+  } catch (const char* exc) {
+    printf("Error: %s\n", exc);
+  }
+}
+
+#ifndef MINGW
+/**
+ * Waits for generator processes until no more than max_running are left.
+ * Returns false if any of them failed.
+ */
+bool wait_for_jobs(int& running, int max_running) {
+  bool ok = true;
+  while (running > max_running) {
+    int status;
+    if (wait(&status) < 0) {
+      failure("Could not wait for generator: %s", strerror(errno));
+    }
+    --running;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      ok = false;
+    }
+  }
+  return ok;
+}
+#endif
+
+/**
+ * Generate code, running up to gen_jobs generators at once in separate
+ * processes. The generators keep their state in globals, so they cannot
+ * share one. Returns false if a generator process failed.
+ */
+bool generate(t_program* program, const vector<string>& generator_strings) {
+  vector<t_program*> programs;
+  set<t_program*> seen;
+  collect_programs(program, programs, seen);
+
+  bool ok = true;
+  int running = 0;
+  for (size_t i = 0; i < programs.size(); ++i) {
+    pverbose("Program: %s\n", programs[i]->get_path().c_str());
 
     // Compute fingerprints.
-    generate_all_fingerprints(program);
+    generate_all_fingerprints(programs[i]);
 
     if (dump_docs) {
-      dump_docstrings(program);
+      dump_docstrings(programs[i]);
     }
 
     vector<string>::const_iterator iter;
     for (iter = generator_strings.begin(); iter != generator_strings.end(); ++iter) {
-      t_generator* generator = t_generator_registry::get_generator(program, *iter);
-
-      if (generator == NULL) {
-        pwarning(1, "Unable to get a generator for \"%s\".\n", iter->c_str());
-      } else {
-        pverbose("Generating \"%s\"\n", iter->c_str());
-        generator->generate_program();
-        delete generator;
+#ifndef MINGW
+      if (gen_jobs > 1) {
+        ok = wait_for_jobs(running, gen_jobs - 1) && ok;
+
+        // Anything buffered would be written again by the child
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0) {
+          generate(programs[i], *iter);
+          exit(0);
+        } else if (pid > 0) {
+          ++running;
+          continue;
+        }
+        pverbose("Could not start a process for \"%s\": %s\n", iter->c_str(), strerror(errno));
       }
+#endif
+      generate(programs[i], *iter);
     }
+  }
 
-  } catch (string s) {
-    printf("Error: %s\n", s.c_str());
-  } catch (const char* exc) {
-    printf("Error: %s\n", exc);
+#ifndef MINGW
+  ok = wait_for_jobs(running, 0) && ok;
+#endif
+  return ok;
+}
+
+/**
+ * Computes the md5 digest of a file's contents. Returns false if the file
+ * cannot be read.
+ */
+bool file_digest(const string& path, md5_byte_t digest[16]) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+
+  md5_state_t ctx;
+  md5_init(&ctx);
+  md5_byte_t buf[8192];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+    md5_append(&ctx, buf, (int)len);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  md5_finish(&ctx, digest);
+  return ok;
+}
+
+/**
+ * Whether the file at path exists with the given size and digest
+ */
+bool same_contents(const string& path, off_t size, const md5_byte_t digest[16]) {
+  struct stat sb;
+  if (stat(path.c_str(), &sb) < 0 || !S_ISREG(sb.st_mode) || sb.st_size != size) {
+    return false;
+  }
+  md5_byte_t existing[16];
+  return file_digest(path, existing) && memcmp(digest, existing, 16) == 0;
+}
+
+/**
+ * Adds the names of the entries in a directory to names. Returns false if
+ * it cannot be read.
+ */
+bool list_directory(const string& path, vector<string>& names) {
+#ifdef MINGW
+  struct _finddata_t entry;
+  intptr_t handle = _findfirst((path + "/*").c_str(), &entry);
+  if (handle == -1) {
+    return false;
+  }
+  do {
+    string name = entry.name;
+    if (name != "." && name != "..") {
+      names.push_back(name);
+    }
+  } while (_findnext(handle, &entry) == 0);
+  _findclose(handle);
+#else
+  DIR* dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return false;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    string name = entry->d_name;
+    if (name != "." && name != "..") {
+      names.push_back(name);
+    }
+  }
+  closedir(dir);
+#endif
+  return true;
+}
+
+/**
+ * Moves the files generated under staged to the same places under out, except
+ * those already there with the same contents, which are left untouched so
+ * that their timestamps do not change. Removes what is left of staged.
+ */
+void commit_outputs(const string& staged, const string& out, int& written, int& unchanged) {
+  vector<string> names;
+  if (!list_directory(staged, names)) {
+    failure("Could not read directory %s: %s", staged.c_str(), strerror(errno));
+  }
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    string from = staged + "/" + names[i];
+    string to = out + "/" + names[i];
+    struct stat sb;
+    if (stat(from.c_str(), &sb) < 0) {
+      failure("Could not stat %s: %s", from.c_str(), strerror(errno));
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+      MKDIR(to.c_str());
+      commit_outputs(from, to, written, unchanged);
+      continue;
+    }
+
+    md5_byte_t digest[16];
+    if (file_digest(from, digest) && same_contents(to, sb.st_size, digest)) {
+      pverbose("Unchanged: %s\n", to.c_str());
+      remove(from.c_str());
+      ++unchanged;
+      continue;
+    }
+#ifdef MINGW
+    // rename will not replace an existing file here
+    remove(to.c_str());
+#endif
+    if (rename(from.c_str(), to.c_str()) != 0) {
+      failure("Could not write %s: %s", to.c_str(), strerror(errno));
+    }
+    ++written;
   }
 
+  rmdir(staged.c_str());
+}
+
+/**
+ * Removes a directory and everything in it
+ */
+void remove_tree(const string& path) {
+  vector<string> names;
+  if (!list_directory(path, names)) {
+    remove(path.c_str());
+    return;
+  }
+  for (size_t i = 0; i < names.size(); ++i) {
+    remove_tree(path + "/" + names[i]);
+  }
+  rmdir(path.c_str());
 }
 
 /**
@@ -985,6 +1288,15 @@ int main(int argc, char** argv) {
         g_verbose = 1;
       } else if (strcmp(arg, "-r") == 0 || strcmp(arg, "-recurse") == 0 ) {
         gen_recurse = true;
+      } else if (strcmp(arg, "-j") == 0 || strcmp(arg, "-jobs") == 0) {
+        arg = argv[++i];
+        if (arg == NULL || atoi(arg) < 1) {
+          fprintf(stderr, "!!! Missing or invalid number of jobs\n");
+          usage();
+        }
+        gen_jobs = atoi(arg);
+      } else if (strcmp(arg, "-incremental") == 0) {
+        gen_incremental = true;
       } else if (strcmp(arg, "-allow-neg-keys") == 0) {
         g_allow_neg_field_keys = true;
       } else if (strcmp(arg, "-allow-64bit-consts") == 0) {
@@ -1243,8 +1555,38 @@ int main(int argc, char** argv) {
   // That is what shows up during argument parsing.
   yylineno = 1;
 
+  // Generate into a staging directory next to the real outputs, and only
+  // move the files that changed into place afterwards
+  string staging;
+  string out_dir;
+  if (gen_incremental) {
+    out_dir = program->get_out_path();
+    out_dir.erase(out_dir.size() - 1);
+    ostringstream staging_name;
+    staging_name << out_dir << "/.thrift-" << getpid();
+    staging = staging_name.str();
+    if (MKDIR(staging.c_str()) < 0) {
+      failure("Could not create %s: %s", staging.c_str(), strerror(errno));
+    }
+    program->set_out_path(staging, program->is_out_path_absolute());
+  }
+
   // Generate it!
-  generate(program, generator_strings);
+  bool generated = generate(program, generator_strings);
+
+  if (gen_incremental) {
+    if (!generated) {
+      remove_tree(staging);
+    } else {
+      int written = 0;
+      int unchanged = 0;
+      commit_outputs(staging, out_dir, written, unchanged);
+      pverbose("Wrote %d files, %d unchanged\n", written, unchanged);
+    }
+  }
+  if (!generated) {
+    failure("A generator process failed");
+  }
 
   // Clean up. Who am I kidding... this program probably orphans heap memory
   // all over the place, but who cares because it is about to exit and it is
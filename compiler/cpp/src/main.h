@@ -20,6 +20,7 @@
 #ifndef T_MAIN_H
 #define T_MAIN_H
 
+#include <map>
 #include <string>
 #include "parse/t_const.h"
 #include "parse/t_field.h"
@@ -67,6 +68,11 @@ void validate_field_value(t_field* field, t_const_value* cv);
  */
 bool validate_throws(t_struct* throws);
 
+/**
+ * Apply representation annotations written on a field or typedef to its type
+ */
+t_type* annotate_type(t_type* type, const std::map<std::string, std::string>& annotations);
+
 /**
  * Converts a string filename into a thrift program name
  */
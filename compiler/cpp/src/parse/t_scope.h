@@ -72,6 +72,24 @@ class t_scope {
     return constants_[name];
   }
 
+  /**
+   * Adds every type, service and constant in another scope to this one
+   */
+  void add_all(const t_scope* other) {
+    std::map<std::string, t_type*>::const_iterator t_iter;
+    for (t_iter = other->types_.begin(); t_iter != other->types_.end(); ++t_iter) {
+      add_type(t_iter->first, t_iter->second);
+    }
+    std::map<std::string, t_service*>::const_iterator s_iter;
+    for (s_iter = other->services_.begin(); s_iter != other->services_.end(); ++s_iter) {
+      add_service(s_iter->first, s_iter->second);
+    }
+    std::map<std::string, t_const*>::const_iterator c_iter;
+    for (c_iter = other->constants_.begin(); c_iter != other->constants_.end(); ++c_iter) {
+      add_constant(c_iter->first, c_iter->second);
+    }
+  }
+
   void print() {
     std::map<std::string, t_type*>::iterator iter;
     for (iter = types_.begin(); iter != types_.end(); ++iter) {
@@ -504,10 +504,17 @@ TypeDefinition:
     }
 
 Typedef:
-  tok_typedef FieldType tok_identifier
+  tok_typedef FieldType tok_identifier TypeAnnotations
     {
       pdebug("TypeDef -> tok_typedef FieldType tok_identifier");
-      t_typedef *td = new t_typedef(g_program, $2, $3);
+      t_typedef *td;
+      if ($4 != NULL) {
+        td = new t_typedef(g_program, annotate_type($2, $4->annotations_), $3);
+        td->annotations_ = $4->annotations_;
+        delete $4;
+      } else {
+        td = new t_typedef(g_program, $2, $3);
+      }
       $$ = td;
     }
 
@@ -892,7 +899,7 @@ Field:
           exit(1);
         }
       }
-      $$ = new t_field($4, $5, $2.value);
+      $$ = new t_field($10 != NULL ? annotate_type($4, $10->annotations_) : $4, $5, $2.value);
       $$->set_req($3);
       if ($6 != NULL) {
         g_scope->resolve_const_value($6, $4);
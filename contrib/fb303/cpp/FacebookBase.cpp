@@ -103,6 +103,12 @@ void FacebookBase::getCounters(std::map<std::string, int64_t>& _return) {
     _return[it->first] = it->second.value;
   }
   counters_.release();
+
+  shardedCounters_.getCounters(_return);
+
+  if (latencyStats_ != NULL) {
+    latencyStats_->getCounters(_return);
+  }
 }
 
 int64_t FacebookBase::getCounter(const std::string& key) {
@@ -113,8 +119,15 @@ int64_t FacebookBase::getCounter(const std::string& key) {
     it->second.acquireRead();
     rv = it->second.value;
     it->second.release();
+    counters_.release();
+    return rv;
   }
   counters_.release();
+
+  CounterHandle counter;
+  if (shardedCounters_.findCounter(key, counter)) {
+    rv = shardedCounters_.getSum(counter);
+  }
   return rv;
 }
 
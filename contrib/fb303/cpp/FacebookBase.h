@@ -21,9 +21,11 @@
 #define _FACEBOOK_TB303_FACEBOOKBASE_H_ 1
 
 #include "FacebookService.h"
+#include "ShardedCounters.h"
 
 #include <thrift/server/TServer.h>
 #include <thrift/concurrency/Mutex.h>
+#include <thrift/processor/LatencyStatsHandler.h>
 
 #include <time.h>
 #include <string>
@@ -33,10 +35,13 @@ namespace facebook { namespace fb303 {
 
 using apache::thrift::concurrency::Mutex;
 using apache::thrift::concurrency::ReadWriteMutex;
+using apache::thrift::concurrency::DistributedReadWriteMutex;
+using apache::thrift::processor::LatencyStatsHandler;
 using apache::thrift::server::TServer;
 
 struct ReadWriteInt : ReadWriteMutex {int64_t value;};
-struct ReadWriteCounterMap : ReadWriteMutex,
+// Every counter call read locks the map, and it is rarely written
+struct ReadWriteCounterMap : DistributedReadWriteMutex,
                              std::map<std::string, ReadWriteInt> {};
 
 /**
@@ -72,6 +77,28 @@ class FacebookBase : virtual public FacebookServiceIf {
   int64_t incrementCounter(const std::string& key, int64_t amount = 1);
   int64_t setCounter(const std::string& key, int64_t value);
 
+  typedef ShardedCounters::Handle CounterHandle;
+
+  /**
+   * Registers a counter to be updated through the returned handle, which
+   * unlike incrementCounter(key) takes no lock and does no lookup.  The
+   * counter's lifetime total is reported under key, and exportTypes (see
+   * ShardedCounters::ExportType) selects figures reported for the last
+   * minute, ten minutes and hour.  Registering key again returns the same
+   * handle.
+   */
+  CounterHandle registerCounter(const std::string& key, int exportTypes = 0) {
+    return shardedCounters_.registerCounter(key, exportTypes);
+  }
+
+  void incrementCounter(CounterHandle counter, int64_t amount = 1) {
+    shardedCounters_.add(counter, amount);
+  }
+
+  ShardedCounters& getShardedCounters() {
+    return shardedCounters_;
+  }
+
   void getCounters(std::map<std::string, int64_t>& _return);
   int64_t getCounter(const std::string& key);
 
@@ -82,6 +109,14 @@ class FacebookBase : virtual public FacebookServiceIf {
     server_ = server;
   }
 
+  /**
+   * Report the per-method latencies recorded by stats in getCounters().
+   * Install stats as the event handler of the service's processor.
+   */
+  void setLatencyStats(boost::shared_ptr<LatencyStatsHandler> stats) {
+    latencyStats_ = stats;
+  }
+
   void getCpuProfile(std::string& _return, int32_t durSecs) { _return = ""; }
 
  private:
@@ -94,8 +129,12 @@ class FacebookBase : virtual public FacebookServiceIf {
 
   ReadWriteCounterMap counters_;
 
+  ShardedCounters shardedCounters_;
+
   boost::shared_ptr<TServer> server_;
 
+  boost::shared_ptr<LatencyStatsHandler> latencyStats_;
+
 };
 
 }} // facebook::tb303
@@ -43,7 +43,7 @@ ServiceTracker::ServiceTracker(facebook::fb303::FacebookBase *handler,
     featureStatusCheck_(featureStatusCheck),
     featureThreadCheck_(featureThreadCheck),
     stopwatchUnit_(stopwatchUnit),
-    checkpointServices_(0)
+    lifetimeServices_(handler->registerCounter("lifetime_services"))
 {
   if (featureCheckpoint_) {
     time_t now = time(NULL);
@@ -70,12 +70,12 @@ ServiceTracker::ServiceTracker(facebook::fb303::FacebookBase *handler,
  * destructor work together, i.e. to work well with ServiceMethod
  * objects.
  *
- * @param const ServiceMethod &serviceMethod A reference to the ServiceMethod
- *                                           object instantiated at the start
- *                                           of the service method.
+ * @param ServiceMethod &serviceMethod A reference to the ServiceMethod
+ *                                     object instantiated at the start
+ *                                     of the service method.
  */
 void
-ServiceTracker::startService(const ServiceMethod &serviceMethod)
+ServiceTracker::startService(ServiceMethod &serviceMethod)
 {
   // note: serviceMethod.timer_ automatically starts at construction.
 
@@ -116,6 +116,12 @@ ServiceTracker::startService(const ServiceMethod &serviceMethod)
       }
     }
   }
+
+  // find the per-service timing counter now, so that finishService()
+  // only has to add to it
+  if (featureCheckpoint_ && !serviceMethod.featureLogOnly_) {
+    serviceMethod.counter_ = serviceDurations_.registerCounter(serviceMethod.name_);
+  }
 }
 
 /**
@@ -165,63 +171,37 @@ ServiceTracker::finishService(const ServiceMethod &serviceMethod)
   // count, record, and maybe report service statistics
   if (!serviceMethod.featureLogOnly_) {
 
-    if (!featureCheckpoint_) {
-
-      // lifetime counters
-      // (note: No need to lock statisticsMutex_ if not doing checkpoint;
-      // FacebookService::incrementCounter() is already thread-safe.)
-      handler_->incrementCounter("lifetime_services");
-
-    } else {
-
-      statisticsMutex_.lock();
-      // note: No exceptions expected from this code block.  Wrap in a try
-      // just to be safe.
-      try {
-
-        // lifetime counters
-        // note: Good to synchronize this with the increment of
-        // checkpoint services, even though incrementCounter() is
-        // already thread-safe, for the sake of checkpoint reporting
-        // consistency (i.e.  since the last checkpoint,
-        // lifetime_services has incremented by checkpointServices_).
-        handler_->incrementCounter("lifetime_services");
-
-        // checkpoint counters
-        checkpointServices_++;
-        checkpointDuration_ += duration;
-
-        // per-service timing
-        // note kjv: According to my tests it is very slightly faster to
-        // call insert() once (and detect not-found) than calling find()
-        // and then maybe insert (if not-found).  However, the difference
-        // is tiny for small maps like this one, and the code for the
-        // faster solution is slightly less readable.  Also, I wonder if
-        // the instantiation of the (often unused) pair to insert makes
-        // the first algorithm slower after all.
-        map<string, pair<uint64_t, uint64_t> >::iterator iter;
-        iter = checkpointServiceDuration_.find(serviceMethod.name_);
-        if (iter != checkpointServiceDuration_.end()) {
-          iter->second.first++;
-          iter->second.second += duration;
-        } else {
-          checkpointServiceDuration_.insert(make_pair(serviceMethod.name_,
-                                                      make_pair(1, duration)));
+    // lifetime counters
+    // (note: Counts on this thread's shard; only a thread's first
+    // service takes a lock.)
+    handler_->incrementCounter(lifetimeServices_);
+
+    if (featureCheckpoint_) {
+
+      // per-service timing
+      serviceDurations_.add(serviceMethod.counter_, duration);
+
+      // maybe report checkpoint
+      // note: ...if it's been long enough since the last report, and
+      // no other thread is reporting it already.  checkpointTime_ is
+      // read unlocked here and checked again under the lock.
+      time_t now = time(NULL);
+      uint64_t check_interval = now - checkpointTime_;
+      if (check_interval >= CHECKPOINT_MINIMUM_INTERVAL_SECONDS
+          && statisticsMutex_.trylock()) {
+        // note: No exceptions expected from this code block.  Wrap in a
+        // try just to be safe.
+        try {
+          check_interval = time(NULL) - checkpointTime_;
+          if (check_interval >= CHECKPOINT_MINIMUM_INTERVAL_SECONDS) {
+            reportCheckpoint();
+          }
+        } catch (...) {
+          statisticsMutex_.unlock();
+          throw;
         }
-
-        // maybe report checkpoint
-        // note: ...if it's been long enough since the last report.
-        time_t now = time(NULL);
-        uint64_t check_interval = now - checkpointTime_;
-        if (check_interval >= CHECKPOINT_MINIMUM_INTERVAL_SECONDS) {
-          reportCheckpoint();
-        }
-
-      } catch (...) {
         statisticsMutex_.unlock();
-        throw;
       }
-      statisticsMutex_.unlock();
 
     }
   }
@@ -241,38 +221,36 @@ ServiceTracker::reportCheckpoint()
 {
   time_t now = time(NULL);
 
-  uint64_t check_count = checkpointServices_;
+  uint64_t check_count = 0;
   uint64_t check_interval = now - checkpointTime_;
-  uint64_t check_duration = checkpointDuration_;
+  uint64_t check_duration = 0;
 
   // export counters for timing of service methods (by service name)
+  // note: Only services called since the last checkpoint are updated.
   handler_->setCounter("checkpoint_time", check_interval);
-  map<string, pair<uint64_t, uint64_t> >::iterator iter;
-  uint64_t count;
-  for (iter = checkpointServiceDuration_.begin();
-       iter != checkpointServiceDuration_.end();
-       iter++) {
-    count = iter->second.first;
-    handler_->setCounter(string("checkpoint_count_") + iter->first, count);
+  map<string, pair<int64_t, int64_t> > totals;
+  serviceDurations_.getTotals(totals);
+  map<string, pair<int64_t, int64_t> >::iterator iter;
+  for (iter = totals.begin(); iter != totals.end(); iter++) {
+    pair<int64_t, int64_t> &last = checkpointTotals_[iter->first];
+    uint64_t count = iter->second.first - last.first;
+    uint64_t duration = iter->second.second - last.second;
+    last = iter->second;
     if (count == 0) {
-      handler_->setCounter(string("checkpoint_speed_") + iter->first,
-                           0);
-    } else {
-      handler_->setCounter(string("checkpoint_speed_") + iter->first,
-                           iter->second.second / count);
+      continue;
     }
+    check_count += count;
+    check_duration += duration;
+    handler_->setCounter(string("checkpoint_count_") + iter->first, count);
+    handler_->setCounter(string("checkpoint_speed_") + iter->first,
+                         duration / count);
   }
 
-  // reset checkpoint variables
-  // note: Clearing the map while other threads are using it might
-  // cause undefined behavior.
-  checkpointServiceDuration_.clear();
   checkpointTime_ = now;
-  checkpointServices_ = 0;
-  checkpointDuration_ = 0;
 
   // get lifetime variables
-  uint64_t life_count = handler_->getCounter("lifetime_services");
+  uint64_t life_count =
+    handler_->getShardedCounters().getSum(lifetimeServices_);
   uint64_t life_interval = now - handler_->aliveSince();
 
   // log checkpoint
@@ -430,7 +408,7 @@ ServiceMethod::ServiceMethod(ServiceTracker *tracker,
                              const string &signature,
                              bool featureLogOnly)
   : tracker_(tracker), name_(name), signature_(signature),
-    featureLogOnly_(featureLogOnly)
+    featureLogOnly_(featureLogOnly), counter_(0)
 {
   // note: timer_ automatically starts at construction.
 
@@ -446,7 +424,8 @@ ServiceMethod::ServiceMethod(ServiceTracker *tracker,
                              const string &name,
                              uint64_t id,
                              bool featureLogOnly)
-  : tracker_(tracker), name_(name), featureLogOnly_(featureLogOnly)
+  : tracker_(tracker), name_(name), featureLogOnly_(featureLogOnly),
+    counter_(0)
 {
   // note: timer_ automatically starts at construction.
   stringstream ss_signature;
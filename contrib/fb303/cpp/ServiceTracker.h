@@ -102,6 +102,8 @@
 
 #include <thrift/concurrency/Mutex.h>
 
+#include "ShardedCounters.h"
+
 
 namespace apache { namespace thrift { namespace concurrency {
   class ThreadManager;
@@ -158,13 +160,17 @@ private:
   bool featureThreadCheck_;
   Stopwatch::Unit stopwatchUnit_;
 
+  ShardedCounters::Handle lifetimeServices_;
+  // per-service call counts and durations, by service name
+  ShardedCounters serviceDurations_;
+
+  // guards checkpoint reporting
   apache::thrift::concurrency::Mutex statisticsMutex_;
   time_t checkpointTime_;
-  uint64_t checkpointServices_;
-  uint64_t checkpointDuration_;
-  std::map<std::string, std::pair<uint64_t, uint64_t> > checkpointServiceDuration_;
+  // serviceDurations_ totals at the last checkpoint
+  std::map<std::string, std::pair<int64_t, int64_t> > checkpointTotals_;
 
-  void startService(const ServiceMethod &serviceMethod);
+  void startService(ServiceMethod &serviceMethod);
   int64_t stepService(const ServiceMethod &serviceMethod,
                       const std::string &stepName);
   void finishService(const ServiceMethod &serviceMethod);
@@ -192,6 +198,8 @@ private:
   std::string name_;
   std::string signature_;
   bool featureLogOnly_;
+  // serviceDurations_ counter for name_, resolved by startService()
+  ShardedCounters::Handle counter_;
   Stopwatch timer_;
 };
 
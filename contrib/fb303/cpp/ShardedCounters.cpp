@@ -0,0 +1,329 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "ShardedCounters.h"
+
+#include <thrift/Thrift.h>
+#include <thrift/concurrency/Util.h>
+
+#include <sstream>
+
+using namespace facebook::fb303;
+using apache::thrift::TException;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::RWGuard;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::Util;
+
+const int ShardedCounters::WINDOWS[ShardedCounters::NUM_WINDOWS] = { 60, 600, 3600 };
+
+namespace {
+
+/// Number of ShardedCounters whose shards each thread remembers
+const uint64_t SHARD_CACHE_SIZE = 16;
+
+struct CachedShard {
+  uint64_t owner;
+  void* shard;
+};
+
+/// This thread's shards of the ShardedCounters it used last, by owner id
+/// modulo SHARD_CACHE_SIZE.  Ids are handed out in sequence, so up to
+/// SHARD_CACHE_SIZE objects created close together never evict each other.
+__thread CachedShard cachedShards[SHARD_CACHE_SIZE];
+
+uint64_t lastOwnerId = 0;
+
+}
+
+ShardedCounters::ShardedCounters() :
+  id_(__sync_add_and_fetch(&lastOwnerId, 1)) {
+  // Windows start out measured from creation, when everything was zero
+  history_.push_back(Snapshot());
+  history_.back().time = Util::currentTime();
+}
+
+ShardedCounters::~ShardedCounters() {
+  for (std::vector<Shard*>::iterator it = shards_.begin(); it != shards_.end(); ++it) {
+    for (int i = 0; i < MAX_BLOCKS; ++i) {
+      delete [] (*it)->blocks[i];
+    }
+    delete *it;
+  }
+}
+
+ShardedCounters::Handle ShardedCounters::registerCounter(const std::string& name,
+                                                         int exportTypes) {
+  {
+    RWGuard g(registryMutex_);
+    std::map<std::string, Handle>::iterator it = handles_.find(name);
+    if (it != handles_.end() && (exportTypes_[it->second] & exportTypes) == exportTypes) {
+      return it->second;
+    }
+  }
+
+  RWGuard g(registryMutex_, true);
+  std::map<std::string, Handle>::iterator it = handles_.find(name);
+  if (it != handles_.end()) {
+    exportTypes_[it->second] |= exportTypes;
+    return it->second;
+  }
+  if (names_.size() >= MAX_COUNTERS) {
+    throw TException("ShardedCounters: too many counters");
+  }
+  Handle handle = static_cast<Handle>(names_.size());
+  names_.push_back(name);
+  exportTypes_.push_back(exportTypes);
+  handles_[name] = handle;
+  return handle;
+}
+
+bool ShardedCounters::findCounter(const std::string& name, Handle& handle) const {
+  RWGuard g(registryMutex_);
+  std::map<std::string, Handle>::const_iterator it = handles_.find(name);
+  if (it == handles_.end()) {
+    return false;
+  }
+  handle = it->second;
+  return true;
+}
+
+ShardedCounters::Shard* ShardedCounters::localShard() {
+  CachedShard& cached = cachedShards[id_ % SHARD_CACHE_SIZE];
+  if (cached.owner == id_) {
+    return static_cast<Shard*>(cached.shard);
+  }
+
+  // A thread that exited leaves its shard to the next thread given its id
+  Shard* shard;
+  {
+    Guard g(shardsMutex_);
+    Thread::id_t thread = Thread::get_current();
+    std::map<Thread::id_t, Shard*>::iterator it = shardsByThread_.find(thread);
+    if (it != shardsByThread_.end()) {
+      shard = it->second;
+    } else {
+      shard = new Shard();
+      shards_.push_back(shard);
+      shardsByThread_[thread] = shard;
+    }
+  }
+  cached.owner = id_;
+  cached.shard = shard;
+  return shard;
+}
+
+void ShardedCounters::add(Handle handle, int64_t amount) {
+  Shard* shard = localShard();
+  Slot* block = shard->blocks[handle >> BLOCK_BITS];
+  if (block == NULL) {
+    block = new Slot[BLOCK_SIZE]();
+    // Readers must see the zeroed slots before the block
+    __sync_synchronize();
+    shard->blocks[handle >> BLOCK_BITS] = block;
+  }
+  Slot& slot = block[handle & (BLOCK_SIZE - 1)];
+  slot.sum += amount;
+  ++slot.count;
+}
+
+void ShardedCounters::total(std::vector<Slot>& totals, size_t size) const {
+  totals.assign(size, Slot());
+
+  std::vector<Shard*> shards;
+  {
+    Guard g(shardsMutex_);
+    shards = shards_;
+  }
+
+  for (std::vector<Shard*>::iterator it = shards.begin(); it != shards.end(); ++it) {
+    for (size_t base = 0; base < size; base += BLOCK_SIZE) {
+      const Slot* block = (*it)->blocks[base >> BLOCK_BITS];
+      if (block == NULL) {
+        continue;
+      }
+      for (size_t i = 0; i < BLOCK_SIZE && base + i < size; ++i) {
+        totals[base + i].sum += block[i].sum;
+        totals[base + i].count += block[i].count;
+      }
+    }
+  }
+}
+
+int64_t ShardedCounters::getSum(Handle handle) const {
+  Guard g(shardsMutex_);
+  int64_t sum = 0;
+  for (std::vector<Shard*>::const_iterator it = shards_.begin(); it != shards_.end(); ++it) {
+    const Slot* block = (*it)->blocks[handle >> BLOCK_BITS];
+    if (block != NULL) {
+      sum += block[handle & (BLOCK_SIZE - 1)].sum;
+    }
+  }
+  return sum;
+}
+
+int64_t ShardedCounters::getCount(Handle handle) const {
+  Guard g(shardsMutex_);
+  int64_t count = 0;
+  for (std::vector<Shard*>::const_iterator it = shards_.begin(); it != shards_.end(); ++it) {
+    const Slot* block = (*it)->blocks[handle >> BLOCK_BITS];
+    if (block != NULL) {
+      count += block[handle & (BLOCK_SIZE - 1)].count;
+    }
+  }
+  return count;
+}
+
+void ShardedCounters::getTotals(std::map<std::string, std::pair<int64_t, int64_t> >& totals) const {
+  std::vector<std::string> names;
+  {
+    RWGuard g(registryMutex_);
+    names = names_;
+  }
+
+  std::vector<Slot> current;
+  total(current, names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    totals[names[i]] = std::make_pair(current[i].count, current[i].sum);
+  }
+}
+
+void ShardedCounters::update() {
+  update(Util::currentTime());
+}
+
+void ShardedCounters::update(int64_t now) {
+  size_t size;
+  {
+    RWGuard g(registryMutex_);
+    size = names_.size();
+  }
+
+  Guard g(historyMutex_);
+  if (!history_.empty() && now - history_.back().time < 1000) {
+    return;
+  }
+  history_.push_back(Snapshot());
+  history_.back().time = now;
+  total(history_.back().totals, size);
+  thinHistory(now);
+}
+
+void ShardedCounters::thinHistory(int64_t now) {
+  // Each window only needs the snapshots near its start, so older snapshots
+  // are kept further apart: one per second for the last two minutes, per
+  // ten seconds for the last twenty, and per minute after that, back to the
+  // first one past the longest window.  Spacing is by aligned intervals, so
+  // that the snapshot kept for an interval stays kept as it ages.  Totals
+  // are swapped, not copied, into the thinned history.
+  std::deque<Snapshot> thinned;
+  int64_t lastSpacing = 0;
+  int64_t lastInterval = 0;
+  for (std::deque<Snapshot>::reverse_iterator it = history_.rbegin();
+       it != history_.rend(); ++it) {
+    int64_t age = now - it->time;
+    int64_t spacing = age <= 2 * WINDOWS[0] * 1000LL ? 1000LL :
+                      age <= 2 * WINDOWS[1] * 1000LL ? 10000LL : 60000LL;
+    if (!thinned.empty() && spacing == lastSpacing &&
+        it->time / spacing == lastInterval) {
+      continue;
+    }
+    thinned.push_front(Snapshot());
+    thinned.front().time = it->time;
+    thinned.front().totals.swap(it->totals);
+    lastSpacing = spacing;
+    lastInterval = it->time / spacing;
+    if (age >= WINDOWS[NUM_WINDOWS - 1] * 1000LL) {
+      break;
+    }
+  }
+  history_.swap(thinned);
+}
+
+size_t ShardedCounters::getSnapshotCount() {
+  Guard g(historyMutex_);
+  return history_.size();
+}
+
+void ShardedCounters::getCounters(std::map<std::string, int64_t>& counters) {
+  getCounters(counters, Util::currentTime());
+}
+
+void ShardedCounters::getCounters(std::map<std::string, int64_t>& counters,
+                                  int64_t now) {
+  std::vector<std::string> names;
+  std::vector<int> exportTypes;
+  {
+    RWGuard g(registryMutex_);
+    names = names_;
+    exportTypes = exportTypes_;
+  }
+
+  update(now);
+
+  std::vector<Slot> current;
+  total(current, names.size());
+
+  // Snapshot at the start of each window, or the oldest one if the
+  // history is shorter than the window
+  const Snapshot* bases[NUM_WINDOWS];
+  Guard g(historyMutex_);
+  for (int w = 0; w < NUM_WINDOWS; ++w) {
+    bases[w] = &history_.front();
+    for (std::deque<Snapshot>::reverse_iterator it = history_.rbegin();
+         it != history_.rend(); ++it) {
+      if (now - it->time >= WINDOWS[w] * 1000LL) {
+        bases[w] = &*it;
+        break;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    counters[names[i]] = current[i].sum;
+    if (exportTypes[i] == 0) {
+      continue;
+    }
+
+    for (int w = 0; w < NUM_WINDOWS; ++w) {
+      int64_t sum = current[i].sum;
+      int64_t count = current[i].count;
+      if (i < bases[w]->totals.size()) {
+        sum -= bases[w]->totals[i].sum;
+        count -= bases[w]->totals[i].count;
+      }
+      int64_t elapsed = now - bases[w]->time;
+
+      std::ostringstream suffix;
+      suffix << '.' << WINDOWS[w];
+      if (exportTypes[i] & SUM) {
+        counters[names[i] + ".sum" + suffix.str()] = sum;
+      }
+      if (exportTypes[i] & COUNT) {
+        counters[names[i] + ".count" + suffix.str()] = count;
+      }
+      if (exportTypes[i] & AVG) {
+        counters[names[i] + ".avg" + suffix.str()] = count == 0 ? 0 : sum / count;
+      }
+      if (exportTypes[i] & RATE) {
+        counters[names[i] + ".rate" + suffix.str()] = elapsed <= 0 ? 0 : sum * 1000 / elapsed;
+      }
+    }
+  }
+}
@@ -0,0 +1,194 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _FACEBOOK_TB303_SHARDEDCOUNTERS_H_
+#define _FACEBOOK_TB303_SHARDEDCOUNTERS_H_ 1
+
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/Thread.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace facebook { namespace fb303 {
+
+/**
+ * Counters that many threads can add to without contending.
+ *
+ * Counters are registered once by name and then updated through the
+ * returned handle.  Each thread adds to its own copy of every counter, with
+ * no lock and no atomic operation; reading a counter sums the threads'
+ * copies.  Only a thread's first update of an object takes a lock, to find
+ * or create its copy.
+ *
+ * Besides its lifetime total, exported as the counter's name, a counter can
+ * export figures over the last minute, ten minutes and hour, as
+ * <name>.<type>.<seconds> (for example "requests.rate.60").  Windows are
+ * measured between snapshots of the totals, which update() takes.
+ * getCounters() calls update() itself, so with a monitor polling every few
+ * seconds the windows are accurate to the polling interval; otherwise call
+ * update() from a timer.
+ */
+class ShardedCounters {
+ public:
+  typedef uint32_t Handle;
+
+  /**
+   * Figures exported for the time windows, or'd together.
+   */
+  enum ExportType {
+    /// Sum of the amounts added in the window
+    SUM = 1,
+    /// Number of additions in the window
+    COUNT = 2,
+    /// SUM / COUNT
+    AVG = 4,
+    /// SUM per second
+    RATE = 8
+  };
+
+  enum {
+    NUM_WINDOWS = 3,
+    /// Most counters that can be registered
+    MAX_COUNTERS = 1 << 16
+  };
+
+  /// Length of each window, in seconds
+  static const int WINDOWS[NUM_WINDOWS];
+
+  ShardedCounters();
+
+  ~ShardedCounters();
+
+  /**
+   * Returns the handle of the counter called name, registering it if there
+   * is none.  Registering an existing counter adds exportTypes to the
+   * figures it exports.
+   *
+   * @throws TException Too many counters
+   */
+  Handle registerCounter(const std::string& name, int exportTypes = 0);
+
+  /**
+   * Finds the counter called name, returning false if it is not registered.
+   */
+  bool findCounter(const std::string& name, Handle& handle) const;
+
+  /**
+   * Adds amount to a counter.
+   */
+  void add(Handle handle, int64_t amount = 1);
+
+  /**
+   * Lifetime sum of the amounts added to a counter.
+   */
+  int64_t getSum(Handle handle) const;
+
+  /**
+   * Lifetime number of additions to a counter.
+   */
+  int64_t getCount(Handle handle) const;
+
+  /**
+   * Adds the lifetime count and sum of every counter to totals, by name.
+   */
+  void getTotals(std::map<std::string, std::pair<int64_t, int64_t> >& totals) const;
+
+  /**
+   * Snapshots the totals for the time windows, unless the last snapshot is
+   * less than a second old.
+   */
+  void update();
+
+  /**
+   * As update(), taking the current time in milliseconds.
+   */
+  void update(int64_t now);
+
+  /**
+   * Number of snapshots kept for the time windows.
+   */
+  size_t getSnapshotCount();
+
+  /**
+   * Calls update(), then adds every counter's lifetime sum and exported
+   * window figures to counters.
+   */
+  void getCounters(std::map<std::string, int64_t>& counters);
+
+  /**
+   * As getCounters(), taking the current time in milliseconds.
+   */
+  void getCounters(std::map<std::string, int64_t>& counters, int64_t now);
+
+ private:
+  struct Slot {
+    int64_t sum;
+    int64_t count;
+  };
+
+  enum {
+    BLOCK_BITS = 6,
+    BLOCK_SIZE = 1 << BLOCK_BITS,
+    MAX_BLOCKS = MAX_COUNTERS / BLOCK_SIZE
+  };
+
+  /**
+   * One thread's copy of the counters, allocated a block at a time as
+   * handles are used.  Only the owning thread writes it.
+   */
+  struct Shard {
+    Slot* volatile blocks[MAX_BLOCKS];
+  };
+
+  struct Snapshot {
+    int64_t time;
+    std::vector<Slot> totals;
+  };
+
+  Shard* localShard();
+
+  /// Sum of every thread's copy of the first size counters
+  void total(std::vector<Slot>& totals, size_t size) const;
+
+  /// Drops snapshots that no window needs
+  void thinHistory(int64_t now);
+
+  /// Distinguishes this object from earlier ones at the same address
+  const uint64_t id_;
+
+  mutable apache::thrift::concurrency::DistributedReadWriteMutex registryMutex_;
+  std::map<std::string, Handle> handles_;
+  std::vector<std::string> names_;
+  std::vector<int> exportTypes_;
+
+  mutable apache::thrift::concurrency::Mutex shardsMutex_;
+  std::map<apache::thrift::concurrency::Thread::id_t, Shard*> shardsByThread_;
+  std::vector<Shard*> shards_;
+
+  apache::thrift::concurrency::Mutex historyMutex_;
+  /// Snapshots, oldest first
+  std::deque<Snapshot> history_;
+};
+
+}} // facebook::tb303
+
+#endif // _FACEBOOK_TB303_SHARDEDCOUNTERS_H_
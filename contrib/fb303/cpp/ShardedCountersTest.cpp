@@ -0,0 +1,197 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/PosixThreadFactory.h>
+#include <thrift/concurrency/Util.h>
+
+#include "ShardedCounters.h"
+
+using std::cout;
+using std::endl;
+using std::map;
+using std::string;
+using std::vector;
+using boost::shared_ptr;
+using namespace apache::thrift::concurrency;
+using namespace facebook::fb303;
+
+class Adder : public Runnable {
+ public:
+  Adder(ShardedCounters* first, ShardedCounters* second,
+        ShardedCounters::Handle handle, int times) :
+    first_(first), second_(second), handle_(handle), times_(times) {}
+
+  void run() {
+    // Alternating between the objects is what ServiceTracker does
+    for (int i = 0; i < times_; ++i) {
+      first_->add(handle_);
+      second_->add(handle_, 2);
+    }
+  }
+
+ private:
+  ShardedCounters* first_;
+  ShardedCounters* second_;
+  ShardedCounters::Handle handle_;
+  int times_;
+};
+
+int main() {
+  cout << "Adding from several threads to two objects at once." << endl;
+  {
+    ShardedCounters first;
+    ShardedCounters second;
+    ShardedCounters::Handle handle = first.registerCounter("calls");
+    assert(second.registerCounter("calls") == handle);
+
+    PosixThreadFactory factory(PosixThreadFactory::ROUND_ROBIN,
+                               PosixThreadFactory::NORMAL, 1, false);
+    vector<shared_ptr<Thread> > threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.push_back(factory.newThread(
+          shared_ptr<Runnable>(new Adder(&first, &second, handle, 100000))));
+      threads.back()->start();
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+      threads[i]->join();
+    }
+    assert(first.getCount(handle) == 400000);
+    assert(first.getSum(handle) == 400000);
+    assert(second.getCount(handle) == 400000);
+    assert(second.getSum(handle) == 800000);
+  }
+
+  cout << "Adding to more objects than a thread remembers shards for." << endl;
+  {
+    vector<shared_ptr<ShardedCounters> > objects;
+    for (int i = 0; i < 40; ++i) {
+      objects.push_back(shared_ptr<ShardedCounters>(new ShardedCounters));
+      objects.back()->registerCounter("calls");
+    }
+    for (int round = 0; round < 3; ++round) {
+      for (size_t i = 0; i < objects.size(); ++i) {
+        objects[i]->add(0, i);
+      }
+    }
+    for (size_t i = 0; i < objects.size(); ++i) {
+      assert(objects[i]->getCount(0) == 3);
+      assert(objects[i]->getSum(0) == static_cast<int64_t>(3 * i));
+    }
+  }
+
+  cout << "Measuring windows longer than the history from creation." << endl;
+  {
+    ShardedCounters counters;
+    int64_t after = Util::currentTime();
+    ShardedCounters::Handle handle = counters.registerCounter(
+        "short", ShardedCounters::SUM | ShardedCounters::COUNT |
+                 ShardedCounters::AVG | ShardedCounters::RATE);
+    counters.add(handle, 10);
+    counters.add(handle, 20);
+    counters.add(handle, 30);
+
+    map<string, int64_t> values;
+    counters.getCounters(values, after + 30000);
+    assert(values["short"] == 60);
+    for (int w = 0; w < ShardedCounters::NUM_WINDOWS; ++w) {
+      std::ostringstream suffix;
+      suffix << '.' << ShardedCounters::WINDOWS[w];
+      assert(values["short.sum" + suffix.str()] == 60);
+      assert(values["short.count" + suffix.str()] == 3);
+      assert(values["short.avg" + suffix.str()] == 20);
+      // 60 over 30 seconds and however long creation took
+      assert(values["short.rate" + suffix.str()] == 2);
+    }
+    assert(counters.getSnapshotCount() == 2);
+
+    cout << "Skipping snapshots less than a second apart." << endl;
+    counters.update(after + 30999);
+    assert(counters.getSnapshotCount() == 2);
+    counters.update(after + 31000);
+    assert(counters.getSnapshotCount() == 3);
+  }
+
+  cout << "Thinning an hour and more of snapshots taken every second." << endl;
+  {
+    ShardedCounters counters;
+    ShardedCounters::Handle handle = counters.registerCounter(
+        "long", ShardedCounters::SUM | ShardedCounters::COUNT |
+                ShardedCounters::AVG | ShardedCounters::RATE);
+    counters.registerCounter("quiet");
+
+    // An hour past the next whole hour, so that the intervals that
+    // snapshots are kept for line up with the loop, and the snapshot taken
+    // at creation is older than every window
+    const int64_t T0 = (Util::currentTime() / 3600000 + 2) * 3600000;
+    for (int64_t t = 0; t <= 4000; ++t) {
+      counters.add(handle, 10);
+      counters.update(T0 + t * 1000);
+    }
+    int64_t now = T0 + 4000 * 1000;
+
+    // One snapshot per second for the last two minutes, per ten seconds
+    // (the last of each) for the last twenty, per minute back to the
+    // first one more than an hour old
+    assert(counters.getSnapshotCount() == 121 + 108 + 42);
+
+    map<string, int64_t> values;
+    counters.getCounters(values, now);
+    assert(values["long"] == 40010);
+    assert(values["quiet"] == 0);
+    assert(values.find("quiet.sum.60") == values.end());
+
+    // The minute starts on a snapshot exactly a minute old
+    assert(values["long.sum.60"] == 600);
+    assert(values["long.count.60"] == 60);
+    // Ten minutes ago falls on a dropped snapshot; the window starts at the
+    // one kept a second before
+    assert(values["long.sum.600"] == 6010);
+    assert(values["long.count.600"] == 601);
+    // An hour ago is 41 seconds after the last snapshot kept for its minute
+    assert(values["long.sum.3600"] == 36410);
+    assert(values["long.count.3600"] == 3641);
+    for (int w = 0; w < ShardedCounters::NUM_WINDOWS; ++w) {
+      std::ostringstream suffix;
+      suffix << '.' << ShardedCounters::WINDOWS[w];
+      assert(values["long.avg" + suffix.str()] == 10);
+      assert(values["long.rate" + suffix.str()] == 10);
+    }
+
+    cout << "Keeping the history bounded as time goes on." << endl;
+    for (int64_t t = 4001; t <= 8000; ++t) {
+      counters.add(handle, 10);
+      counters.update(T0 + t * 1000);
+      assert(counters.getSnapshotCount() < 300);
+    }
+    assert(counters.getSnapshotCount() == 121 + 108 + 42);
+    values.clear();
+    counters.getCounters(values, T0 + 8000 * 1000);
+    // This time an hour ago is 21 seconds after its minute's snapshot
+    assert(values["long.sum.3600"] == 36210);
+  }
+
+  cout << "All tests passed." << endl;
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/Arena.h>
+
+#include <stdlib.h>
+
+namespace apache { namespace thrift {
+
+__thread Arena* Arena::current_ = NULL;
+
+namespace {
+
+/// Room for the block header, keeping the data after it aligned
+const size_t HEADER_SIZE =
+  (sizeof(void*) + Arena::ALIGNMENT - 1) & ~static_cast<size_t>(Arena::ALIGNMENT - 1);
+
+}
+
+Arena::Arena(size_t blockSize) :
+  blocks_(NULL),
+  next_(NULL),
+  end_(NULL),
+  blockSize_(blockSize),
+  capacity_(0) {
+}
+
+Arena::~Arena() {
+  release();
+}
+
+void* Arena::allocate(size_t size) {
+  if (size > static_cast<size_t>(-1) - HEADER_SIZE - ALIGNMENT) {
+    throw std::bad_alloc();
+  }
+  size = (size + ALIGNMENT - 1) & ~static_cast<size_t>(ALIGNMENT - 1);
+  if (size <= static_cast<size_t>(end_ - next_)) {
+    void* result = next_;
+    next_ += size;
+    return result;
+  }
+
+  // Large pieces get a block to themselves, so that the current block's
+  // free space is not wasted on them
+  size_t dataSize = size > blockSize_ / 2 ? size : blockSize_;
+  Block* block = static_cast<Block*>(malloc(HEADER_SIZE + dataSize));
+  if (block == NULL) {
+    throw std::bad_alloc();
+  }
+  capacity_ += dataSize;
+  char* data = reinterpret_cast<char*>(block) + HEADER_SIZE;
+
+  if (dataSize == blockSize_) {
+    block->next = blocks_;
+    blocks_ = block;
+    next_ = data + size;
+    end_ = data + dataSize;
+    if (blockSize_ < MAX_BLOCK_SIZE) {
+      blockSize_ *= 2;
+    }
+  } else if (blocks_ != NULL) {
+    // Keep allocating from the current block
+    block->next = blocks_->next;
+    blocks_->next = block;
+  } else {
+    block->next = NULL;
+    blocks_ = block;
+  }
+  return data;
+}
+
+void Arena::release() {
+  while (blocks_ != NULL) {
+    Block* next = blocks_->next;
+    free(blocks_);
+    blocks_ = next;
+  }
+  next_ = NULL;
+  end_ = NULL;
+  capacity_ = 0;
+}
+
+}} // apache::thrift
@@ -0,0 +1,271 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_ARENA_H_
+#define _THRIFT_ARENA_H_ 1
+
+#include <thrift/Thrift.h>
+#include <boost/noncopyable.hpp>
+
+#include <new>
+#include <string>
+
+namespace apache { namespace thrift {
+
+/**
+ * Memory that is handed out in pieces and given back all at once.
+ *
+ * allocate() carves pieces off large blocks; nothing is freed until
+ * release() or the destructor, which free every block in one pass.  Not
+ * thread safe: an arena belongs to one request on one thread.
+ */
+class Arena : boost::noncopyable {
+ public:
+  enum {
+    /// Alignment of every piece allocate() returns
+    ALIGNMENT = 16,
+    DEFAULT_BLOCK_SIZE = 4096,
+    /// Blocks double in size up to this
+    MAX_BLOCK_SIZE = 1 << 20
+  };
+
+  explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+  ~Arena();
+
+  /**
+   * Returns size bytes that stay valid until release().
+   *
+   * @throws std::bad_alloc
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Frees everything allocated so far.
+   */
+  void release();
+
+  /**
+   * Total size of the blocks held, in bytes.
+   */
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  /**
+   * A string kept for the life of the arena, to stage data for protocols,
+   * which only read and write std::string.
+   */
+  std::string& scratch() {
+    return scratch_;
+  }
+
+  /**
+   * The arena that ArenaAllocator uses on this thread, or NULL.
+   */
+  static Arena* current() {
+    return current_;
+  }
+
+ private:
+  friend class ArenaScope;
+
+  struct Block {
+    Block* next;
+  };
+
+  static __thread Arena* current_;
+
+  Block* blocks_;
+  char* next_;
+  char* end_;
+  size_t blockSize_;
+  size_t capacity_;
+  std::string scratch_;
+};
+
+/**
+ * Makes a new arena the thread's current one for the life of the scope,
+ * and releases it at the end.
+ *
+ * Objects whose allocators were taken from the arena must be destroyed
+ * before the scope ends, so declare the scope ahead of them.
+ */
+class ArenaScope : boost::noncopyable {
+ public:
+  ArenaScope() :
+    previous_(Arena::current_) {
+    Arena::current_ = &arena_;
+  }
+
+  ~ArenaScope() {
+    Arena::current_ = previous_;
+  }
+
+  Arena& arena() {
+    return arena_;
+  }
+
+ private:
+  Arena arena_;
+  Arena* previous_;
+};
+
+/**
+ * Standard allocator over the arena that was current when it was created,
+ * or over the heap if there was none.
+ *
+ * Containers keep the allocator they were created with, and copy it when
+ * they are copied, so a copy of an arena-backed object is arena-backed as
+ * well and must not outlive the arena.  Assigning one to an object created
+ * outside the arena copies the data into that object's memory.
+ */
+template <class T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <class U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  ArenaAllocator() throw() :
+    arena_(Arena::current()) {}
+
+  explicit ArenaAllocator(Arena* arena) throw() :
+    arena_(arena) {}
+
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) throw() :
+    arena_(other.arena()) {}
+
+  pointer address(reference x) const {
+    return &x;
+  }
+
+  const_pointer address(const_reference x) const {
+    return &x;
+  }
+
+  pointer allocate(size_type n, const void* hint = 0) {
+    (void) hint;
+    if (n > max_size()) {
+      throw std::bad_alloc();
+    }
+    if (arena_ == NULL) {
+      return static_cast<pointer>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<pointer>(arena_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(pointer p, size_type n) {
+    (void) n;
+    if (arena_ == NULL) {
+      ::operator delete(p);
+    }
+  }
+
+  size_type max_size() const throw() {
+    return static_cast<size_type>(-1) / sizeof(T);
+  }
+
+  void construct(pointer p, const T& value) {
+    new (p) T(value);
+  }
+
+  void destroy(pointer p) {
+    p->~T();
+  }
+
+  Arena* arena() const {
+    return arena_;
+  }
+
+ private:
+  Arena* arena_;
+};
+
+template <class T, class U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <class T, class U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+/**
+ * The string type of code generated with the cpp:arena option.
+ */
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+
+/*
+ * Protocols read and write std::string, so these stage arena strings in the
+ * current arena's scratch string, which keeps its capacity across calls.
+ */
+
+template <class Protocol_>
+uint32_t readArenaString(Protocol_* iprot, ArenaString& str) {
+  Arena* arena = Arena::current();
+  std::string local;
+  std::string& buffer = arena != NULL ? arena->scratch() : local;
+  uint32_t xfer = iprot->readString(buffer);
+  str.assign(buffer.data(), buffer.size());
+  return xfer;
+}
+
+template <class Protocol_>
+uint32_t readArenaBinary(Protocol_* iprot, ArenaString& str) {
+  Arena* arena = Arena::current();
+  std::string local;
+  std::string& buffer = arena != NULL ? arena->scratch() : local;
+  uint32_t xfer = iprot->readBinary(buffer);
+  str.assign(buffer.data(), buffer.size());
+  return xfer;
+}
+
+template <class Protocol_>
+uint32_t writeArenaString(Protocol_* oprot, const ArenaString& str) {
+  Arena* arena = Arena::current();
+  std::string local;
+  std::string& buffer = arena != NULL ? arena->scratch() : local;
+  buffer.assign(str.data(), str.size());
+  return oprot->writeString(buffer);
+}
+
+template <class Protocol_>
+uint32_t writeArenaBinary(Protocol_* oprot, const ArenaString& str) {
+  Arena* arena = Arena::current();
+  std::string local;
+  std::string& buffer = arena != NULL ? arena->scratch() : local;
+  buffer.assign(str.data(), str.size());
+  return oprot->writeBinary(buffer);
+}
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_ARENA_H_
@@ -50,8 +50,18 @@ bool Mutex::timedlock(int64_t ms) const { return impl_->timed_lock(boost::get_sy
 
 void Mutex::unlock() const { impl_->unlock(); }
 
+bool Mutex::isFutex() const { return false; }
+
 void Mutex::DEFAULT_INITIALIZER(void* arg) {
 }
 
+void Mutex::FUTEX_INITIALIZER(void* arg) {
+}
+
+bool enableFutexMutexes(bool enable) {
+  (void)enable;
+  return false;
+}
+
 }}} // apache::thrift::concurrency
 
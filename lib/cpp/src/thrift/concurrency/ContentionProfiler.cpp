@@ -0,0 +1,439 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "ContentionProfiler.h"
+#include "Mutex.h"
+
+#ifndef THRIFT_NO_CONTENTION_PROFILING
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <cxxabi.h>
+#include <execinfo.h>
+#endif
+
+namespace apache { namespace thrift { namespace concurrency {
+
+static const int MAX_STACK_DEPTH = 24;
+
+// Bucket 0 counts times of 0 usec, and bucket b times of [2^(b-1), 2^b) usec
+static const int HISTOGRAM_BUCKETS = 40;
+
+/**
+ * Wait and hold statistics for a set of sampled acquisitions
+ */
+class ContentionStats {
+ public:
+  ContentionStats() :
+    acquisitions_(0),
+    contended_(0),
+    waitTotal_(0),
+    waitMax_(0),
+    holds_(0),
+    holdTotal_(0),
+    holdMax_(0) {
+    memset(waitHistogram_, 0, sizeof(waitHistogram_));
+    memset(holdHistogram_, 0, sizeof(holdHistogram_));
+  }
+
+  void add(int64_t waitTime, int64_t holdTime) {
+    acquisitions_++;
+    if (waitTime > 0) {
+      contended_++;
+    }
+    waitTotal_ += waitTime;
+    waitMax_ = std::max(waitMax_, waitTime);
+    waitHistogram_[bucket(waitTime)]++;
+    if (holdTime >= 0) {
+      holds_++;
+      holdTotal_ += holdTime;
+      holdMax_ = std::max(holdMax_, holdTime);
+      holdHistogram_[bucket(holdTime)]++;
+    }
+  }
+
+  void add(const ContentionStats& stats) {
+    acquisitions_ += stats.acquisitions_;
+    contended_ += stats.contended_;
+    waitTotal_ += stats.waitTotal_;
+    waitMax_ = std::max(waitMax_, stats.waitMax_);
+    holds_ += stats.holds_;
+    holdTotal_ += stats.holdTotal_;
+    holdMax_ = std::max(holdMax_, stats.holdMax_);
+    for (int ix = 0; ix < HISTOGRAM_BUCKETS; ix++) {
+      waitHistogram_[ix] += stats.waitHistogram_[ix];
+      holdHistogram_[ix] += stats.holdHistogram_[ix];
+    }
+  }
+
+  int64_t total(ContentionMetric metric) const {
+    return metric == CONTENTION_WAIT ? waitTotal_ : holdTotal_;
+  }
+
+  void print(FILE* f, int indent) const {
+    fprintf(f, "%*ssampled %llu, contended %llu\n", indent, "",
+            (unsigned long long)acquisitions_, (unsigned long long)contended_);
+    fprintf(f, "%*swait usec: total %lld avg %lld max %lld\n", indent, "",
+            (long long)waitTotal_, (long long)(waitTotal_ / std::max<uint64_t>(1, acquisitions_)),
+            (long long)waitMax_);
+    printHistogram(f, indent + 2, waitHistogram_);
+    if (holds_ > 0) {
+      fprintf(f, "%*shold usec: total %lld avg %lld max %lld\n", indent, "",
+              (long long)holdTotal_, (long long)(holdTotal_ / holds_), (long long)holdMax_);
+      printHistogram(f, indent + 2, holdHistogram_);
+    }
+  }
+
+ private:
+  static int bucket(int64_t time) {
+    int b = 0;
+    while (time > 0 && b < HISTOGRAM_BUCKETS - 1) {
+      time >>= 1;
+      b++;
+    }
+    return b;
+  }
+
+  static void printHistogram(FILE* f, int indent, const uint64_t* histogram) {
+    fprintf(f, "%*s", indent, "");
+    for (int ix = 0; ix < HISTOGRAM_BUCKETS; ix++) {
+      if (histogram[ix] != 0) {
+        fprintf(f, " <%lld:%llu", 1LL << ix, (unsigned long long)histogram[ix]);
+      }
+    }
+    fprintf(f, "\n");
+  }
+
+  uint64_t acquisitions_;
+  uint64_t contended_;
+  int64_t waitTotal_;
+  int64_t waitMax_;
+  uint64_t holds_;
+  int64_t holdTotal_;
+  int64_t holdMax_;
+  uint64_t waitHistogram_[HISTOGRAM_BUCKETS];
+  uint64_t holdHistogram_[HISTOGRAM_BUCKETS];
+};
+
+typedef std::vector<void*> Stack;
+typedef std::map<std::pair<const void*, Stack>, ContentionStats> SiteMap;
+
+static Mutex profileMutex;
+static std::map<const void*, ContentionStats> lockStats;
+static SiteMap siteStats;
+static size_t maxProfileEntries = 0;
+// Samples that were recorded without their lock or stack for lack of room
+static uint64_t overflowSamples = 0;
+
+// Keeps the profiler's own locking out of the profile
+static __thread bool inProfiler = false;
+
+static void recordContention(const void* id, int64_t waitTime, int64_t holdTime) {
+  if (inProfiler) {
+    return;
+  }
+  inProfiler = true;
+
+  Stack stack;
+#ifdef __GLIBC__
+  void* frames[MAX_STACK_DEPTH];
+  int depth = backtrace(frames, MAX_STACK_DEPTH);
+  // Leave out this frame
+  if (depth > 1) {
+    stack.assign(frames + 1, frames + depth);
+  }
+#endif
+
+  {
+    Guard g(profileMutex);
+    // Once full, new locks are counted together under NULL and new call
+    // sites under their lock with an empty stack, which keeps the totals
+    // right while bounding the memory used
+    std::map<const void*, ContentionStats>::iterator lock = lockStats.find(id);
+    if (lock == lockStats.end() && lockStats.size() >= maxProfileEntries) {
+      id = NULL;
+      stack.clear();
+      overflowSamples++;
+    }
+    SiteMap::key_type key(id, stack);
+    SiteMap::iterator site = siteStats.find(key);
+    if (site == siteStats.end() && siteStats.size() >= maxProfileEntries && !stack.empty()) {
+      key.second.clear();
+      overflowSamples++;
+    }
+    lockStats[id].add(waitTime, holdTime);
+    siteStats[key].add(waitTime, holdTime);
+  }
+
+  inProfiler = false;
+}
+
+void startContentionProfiling(int32_t sampleRate, size_t maxEntries) {
+  inProfiler = true;
+  {
+    Guard g(profileMutex);
+    maxProfileEntries = maxEntries;
+  }
+  inProfiler = false;
+  enableMutexContentionProfiling(sampleRate, recordContention);
+}
+
+void stopContentionProfiling() {
+  enableMutexContentionProfiling(0, NULL);
+}
+
+void resetContentionProfile() {
+  inProfiler = true;
+  {
+    Guard g(profileMutex);
+    lockStats.clear();
+    siteStats.clear();
+    overflowSamples = 0;
+  }
+  inProfiler = false;
+}
+
+/**
+ * Names stack frames, and finds where a call site's stack leaves the
+ * locking code.
+ */
+class Symbolizer {
+ public:
+  Symbolizer() {
+    void* self = (void*)&recordContention;
+    selfObject_ = object(symbol(self));
+  }
+
+  const std::string& name(void* frame) {
+    std::map<void*, std::string>::iterator it = names_.find(frame);
+    if (it != names_.end()) {
+      return it->second;
+    }
+
+    std::string raw = symbol(frame);
+    std::string result;
+    std::string::size_type open = raw.find('(');
+    std::string::size_type plus = raw.find('+', open);
+    if (open != std::string::npos && plus != std::string::npos && plus > open + 1) {
+      std::string mangled = raw.substr(open + 1, plus - open - 1);
+#ifdef __GLIBC__
+      int status = 0;
+      char* demangled = abi::__cxa_demangle(mangled.c_str(), NULL, NULL, &status);
+      if (status == 0 && demangled != NULL) {
+        result = demangled;
+        // Drop the argument list
+        std::string::size_type args = result.find('(');
+        if (args != std::string::npos && args > 0) {
+          result.erase(args);
+        }
+      } else {
+        result = mangled;
+      }
+      free(demangled);
+#else
+      result = mangled;
+#endif
+    } else {
+      char address[32];
+      snprintf(address, sizeof(address), "%p", frame);
+      result = object(raw) + "@" + address;
+    }
+
+    return names_[frame] = result;
+  }
+
+  /**
+   * The number of innermost frames that are the lock implementation or the
+   * profiler rather than the code taking the lock.
+   */
+  size_t lockFrames(const Stack& stack) {
+    size_t ix = 0;
+    for (; ix + 1 < stack.size(); ix++) {
+      const std::string& frame = name(stack[ix]);
+      bool unnamed = frame.find('@') != std::string::npos;
+      if (unnamed ? frame.compare(0, selfObject_.size(), selfObject_) != 0
+                  : !isLockFunction(frame)) {
+        break;
+      }
+    }
+    return ix;
+  }
+
+ private:
+  static bool isLockFunction(const std::string& name) {
+    static const char* prefixes[] = {
+      "apache::thrift::concurrency::Mutex",
+      "apache::thrift::concurrency::Guard",
+      "apache::thrift::concurrency::Monitor",
+      "apache::thrift::concurrency::Synchronized",
+      "apache::thrift::concurrency::ReadWriteMutex",
+      "apache::thrift::concurrency::NoStarveReadWriteMutex",
+      "apache::thrift::concurrency::DistributedReadWriteMutex",
+      "apache::thrift::concurrency::RWGuard",
+      "apache::thrift::concurrency::recordContention"
+    };
+    for (size_t ix = 0; ix < sizeof(prefixes) / sizeof(prefixes[0]); ix++) {
+      if (name.compare(0, strlen(prefixes[ix]), prefixes[ix]) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static std::string symbol(void* frame) {
+    std::string result;
+#ifdef __GLIBC__
+    char** symbols = backtrace_symbols(&frame, 1);
+    if (symbols != NULL) {
+      result = symbols[0];
+      free(symbols);
+    }
+#else
+    (void)frame;
+#endif
+    return result;
+  }
+
+  static std::string object(const std::string& symbol) {
+    return symbol.substr(0, symbol.find_first_of("( "));
+  }
+
+  std::string selfObject_;
+  std::map<void*, std::string> names_;
+};
+
+static std::string describeSite(Symbolizer& symbolizer, const Stack& stack,
+                                const char* separator, bool outermostFirst) {
+  std::vector<std::string> frames;
+  for (size_t ix = symbolizer.lockFrames(stack); ix < stack.size(); ix++) {
+    frames.push_back(symbolizer.name(stack[ix]));
+  }
+  if (outermostFirst) {
+    std::reverse(frames.begin(), frames.end());
+  }
+
+  std::string result;
+  for (size_t ix = 0; ix < frames.size(); ix++) {
+    if (ix > 0) {
+      result += separator;
+    }
+    result += frames[ix];
+  }
+  if (result.empty()) {
+    result = "<unknown>";
+  }
+  return result;
+}
+
+template <typename Key>
+static bool moreWait(const std::pair<Key, ContentionStats>& a,
+                     const std::pair<Key, ContentionStats>& b) {
+  return a.second.total(CONTENTION_WAIT) > b.second.total(CONTENTION_WAIT);
+}
+
+void printContentionProfile(FILE* f, size_t maxEntries) {
+  typedef std::vector<std::pair<const void*, ContentionStats> > LockVector;
+  typedef std::vector<std::pair<Stack, ContentionStats> > SiteVector;
+
+  LockVector locks;
+  std::map<Stack, ContentionStats> siteTotals;
+  std::map<const void*, std::pair<int64_t, Stack> > worstSites;
+  uint64_t overflow;
+
+  inProfiler = true;
+  {
+    Guard g(profileMutex);
+    overflow = overflowSamples;
+    locks.assign(lockStats.begin(), lockStats.end());
+    for (SiteMap::const_iterator it = siteStats.begin(); it != siteStats.end(); ++it) {
+      siteTotals[it->first.second].add(it->second);
+      std::pair<int64_t, Stack>& worst = worstSites[it->first.first];
+      if (worst.second.empty() || it->second.total(CONTENTION_WAIT) > worst.first) {
+        worst = std::make_pair(it->second.total(CONTENTION_WAIT), it->first.second);
+      }
+    }
+  }
+  inProfiler = false;
+
+  SiteVector sites(siteTotals.begin(), siteTotals.end());
+  std::sort(locks.begin(), locks.end(), moreWait<const void*>);
+  std::sort(sites.begin(), sites.end(), moreWait<Stack>);
+
+  Symbolizer symbolizer;
+
+  if (overflow > 0) {
+    fprintf(f, "%llu samples past the entry limit were recorded without their lock or stack\n",
+            (unsigned long long)overflow);
+  }
+
+  fprintf(f, "Locks by wait time (%zu locks):\n", locks.size());
+  for (size_t ix = 0; ix < locks.size() && ix < maxEntries; ix++) {
+    if (locks[ix].first == NULL) {
+      fprintf(f, "  other locks\n");
+      locks[ix].second.print(f, 4);
+      continue;
+    }
+    fprintf(f, "  lock %p, worst at %s\n", locks[ix].first,
+            describeSite(symbolizer, worstSites[locks[ix].first].second, " <- ", false).c_str());
+    locks[ix].second.print(f, 4);
+  }
+
+  fprintf(f, "Call sites by wait time (%zu sites):\n", sites.size());
+  for (size_t ix = 0; ix < sites.size() && ix < maxEntries; ix++) {
+    fprintf(f, "  %s\n", describeSite(symbolizer, sites[ix].first, " <- ", false).c_str());
+    sites[ix].second.print(f, 4);
+  }
+}
+
+void writeContentionProfileFolded(FILE* f, ContentionMetric metric) {
+  std::map<Stack, ContentionStats> siteTotals;
+
+  inProfiler = true;
+  {
+    Guard g(profileMutex);
+    for (SiteMap::const_iterator it = siteStats.begin(); it != siteStats.end(); ++it) {
+      siteTotals[it->first.second].add(it->second);
+    }
+  }
+  inProfiler = false;
+
+  Symbolizer symbolizer;
+  std::map<std::string, int64_t> folded;
+  for (std::map<Stack, ContentionStats>::const_iterator it = siteTotals.begin();
+       it != siteTotals.end(); ++it) {
+    folded[describeSite(symbolizer, it->first, ";", true)] += it->second.total(metric);
+  }
+
+  for (std::map<std::string, int64_t>::const_iterator it = folded.begin(); it != folded.end(); ++it) {
+    if (it->second > 0) {
+      fprintf(f, "%s %lld\n", it->first.c_str(), (long long)it->second);
+    }
+  }
+}
+
+}}} // apache::thrift::concurrency
+
+#endif // THRIFT_NO_CONTENTION_PROFILING
@@ -0,0 +1,86 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_CONTENTIONPROFILER_H_
+#define _THRIFT_CONCURRENCY_CONTENTIONPROFILER_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+#ifndef THRIFT_NO_CONTENTION_PROFILING
+
+/**
+ * Lock contention profiler
+ *
+ * Samples one in every sampleRate lock acquisitions through
+ * enableMutexContentionProfiling(), and aggregates how long each sampled
+ * acquisition waited for the lock and then held it, per lock and per call
+ * site (the stack of the locking thread), with log2 histograms of both.
+ * Covers Mutex, Monitor (whose waits are not counted as holding the lock),
+ * ReadWriteMutex and its subclasses; shared (read) locks have wait times
+ * only.
+ *
+ * Locks are identified by address, so a lock destroyed and another created
+ * at the same address share an entry.  Up to maxEntries locks and about
+ * twice as many call sites are told apart; samples beyond those are still
+ * counted, under "other locks" or under their lock with an unknown call
+ * site, so that a long profile does not grow without bound.  The profiler
+ * takes the place of any callback installed with
+ * enableMutexContentionProfiling().  Call sites are only available with
+ * glibc, and are best with binaries linked with -rdynamic so that
+ * backtrace_symbols() can name their functions.
+ */
+void startContentionProfiling(int32_t sampleRate = 100, size_t maxEntries = 10000);
+
+/**
+ * Stops sampling, keeping what has been recorded.
+ */
+void stopContentionProfiling();
+
+/**
+ * Discards everything recorded.
+ */
+void resetContentionProfile();
+
+/**
+ * Prints the locks and the call sites with the most total wait time, up to
+ * maxEntries of each, with their wait and hold statistics and histograms.
+ */
+void printContentionProfile(FILE* f, size_t maxEntries = 20);
+
+enum ContentionMetric {
+  CONTENTION_WAIT,
+  CONTENTION_HOLD
+};
+
+/**
+ * Writes the call sites as folded stacks weighted by total wait or hold
+ * time in usec, one "outermost;...;innermost weight" line per stack, for
+ * flamegraph.pl and similar tools.
+ */
+void writeContentionProfileFolded(FILE* f, ContentionMetric metric = CONTENTION_WAIT);
+
+#endif // THRIFT_NO_CONTENTION_PROFILING
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_CONTENTIONPROFILER_H_
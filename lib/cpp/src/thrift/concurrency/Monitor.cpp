@@ -25,17 +25,39 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <iostream>
 
 #include <pthread.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define THRIFT_FUTEX_MONITOR 1
+#endif
+
 namespace apache { namespace thrift { namespace concurrency {
 
 using boost::scoped_ptr;
 
+#ifdef THRIFT_FUTEX_MONITOR
+static inline long futex(volatile int32_t* addr, int op, int32_t val,
+                         const struct timespec* abstime) {
+  return syscall(SYS_futex, addr, op, val, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+#endif
+
 /**
- * Monitor implementation using the POSIX pthread library
+ * Monitor implementation using the POSIX pthread library, or a futex when
+ * the mutex is futex based (see Mutex::FUTEX_INITIALIZER)
+ *
+ * The futex condition is a sequence number that notify() bumps before
+ * waking waiters; a waiter sleeps only while the sequence number is still
+ * the one it saw while holding the mutex, so no wakeup is lost between
+ * unlocking the mutex and sleeping.  notify() makes no system call when no
+ * thread is waiting.
  *
  * @version $Id:$
  */
@@ -46,19 +68,28 @@ class Monitor::Impl {
   Impl()
      : ownedMutex_(new Mutex()),
        mutex_(NULL),
-       condInitialized_(false) {
+       condInitialized_(false),
+       futex_(false),
+       sequence_(0),
+       waiters_(0) {
     init(ownedMutex_.get());
   }
 
   Impl(Mutex* mutex)
      : mutex_(NULL),
-       condInitialized_(false) {
+       condInitialized_(false),
+       futex_(false),
+       sequence_(0),
+       waiters_(0) {
     init(mutex);
   }
 
   Impl(Monitor* monitor)
      : mutex_(NULL),
-       condInitialized_(false) {
+       condInitialized_(false),
+       futex_(false),
+       sequence_(0),
+       waiters_(0) {
     init(&(monitor->mutex()));
   }
 
@@ -110,6 +141,11 @@ class Monitor::Impl {
    */
   int waitForTime(const timespec* abstime) const {
     assert(mutex_);
+#ifdef THRIFT_FUTEX_MONITOR
+    if (futex_) {
+      return futexWait(abstime);
+    }
+#endif
     pthread_mutex_t* mutexImpl =
       reinterpret_cast<pthread_mutex_t*>(mutex_->getUnderlyingImpl());
     assert(mutexImpl);
@@ -126,6 +162,11 @@ class Monitor::Impl {
    */
   int waitForever() const {
     assert(mutex_);
+#ifdef THRIFT_FUTEX_MONITOR
+    if (futex_) {
+      return futexWait(NULL);
+    }
+#endif
     pthread_mutex_t* mutexImpl =
       reinterpret_cast<pthread_mutex_t*>(mutex_->getUnderlyingImpl());
     assert(mutexImpl);
@@ -135,12 +176,24 @@ class Monitor::Impl {
 
   void notify() {
     // XXX Need to assert that caller owns mutex
+#ifdef THRIFT_FUTEX_MONITOR
+    if (futex_) {
+      futexWake(1);
+      return;
+    }
+#endif
     int iret = pthread_cond_signal(&pthread_cond_);
     assert(iret == 0);
   }
 
   void notifyAll() {
     // XXX Need to assert that caller owns mutex
+#ifdef THRIFT_FUTEX_MONITOR
+    if (futex_) {
+      futexWake(INT_MAX);
+      return;
+    }
+#endif
     int iret = pthread_cond_broadcast(&pthread_cond_);
     assert(iret == 0);
   }
@@ -150,6 +203,13 @@ class Monitor::Impl {
   void init(Mutex* mutex) {
     mutex_ = mutex;
 
+#ifdef THRIFT_FUTEX_MONITOR
+    if (mutex->isFutex()) {
+      futex_ = true;
+      return;
+    }
+#endif
+
     if (pthread_cond_init(&pthread_cond_, NULL) == 0) {
       condInitialized_ = true;
     }
@@ -168,11 +228,42 @@ class Monitor::Impl {
     }
   }
 
+#ifdef THRIFT_FUTEX_MONITOR
+  int futexWait(const timespec* abstime) const {
+    // Both counters are only changed with the mutex held
+    int32_t sequence = sequence_;
+    waiters_++;
+    mutex_->unlock();
+
+    int op = abstime == NULL ? FUTEX_WAIT_PRIVATE
+                             : FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME;
+    int result = 0;
+    if (futex(&sequence_, op, sequence, abstime) == -1 && errno == ETIMEDOUT) {
+      result = ETIMEDOUT;
+    }
+
+    mutex_->lock();
+    waiters_--;
+    return result;
+  }
+
+  void futexWake(int32_t count) {
+    if (waiters_ > 0) {
+      __sync_fetch_and_add(&sequence_, 1);
+      futex(&sequence_, FUTEX_WAKE_PRIVATE, count, NULL);
+    }
+  }
+#endif
+
   scoped_ptr<Mutex> ownedMutex_;
   Mutex* mutex_;
 
   mutable pthread_cond_t pthread_cond_;
   mutable bool condInitialized_;
+
+  bool futex_;
+  mutable volatile int32_t sequence_;
+  mutable int waiters_;
 };
 
 Monitor::Monitor() : impl_(new Monitor::Impl()) {}
@@ -187,18 +278,36 @@ void Monitor::lock() const { impl_->lock(); }
 
 void Monitor::unlock() const { impl_->unlock(); }
 
-void Monitor::wait(int64_t timeout) const { impl_->wait(timeout); }
+void Monitor::wait(int64_t timeout) const {
+  mutex().conditionWaitBegin();
+  try {
+    impl_->wait(timeout);
+  } catch (...) {
+    mutex().conditionWaitEnd();
+    throw;
+  }
+  mutex().conditionWaitEnd();
+}
 
 int Monitor::waitForTime(const timespec* abstime) const {
-  return impl_->waitForTime(abstime);
+  mutex().conditionWaitBegin();
+  int result = impl_->waitForTime(abstime);
+  mutex().conditionWaitEnd();
+  return result;
 }
 
 int Monitor::waitForTimeRelative(int64_t timeout_ms) const {
-  return impl_->waitForTimeRelative(timeout_ms);
+  mutex().conditionWaitBegin();
+  int result = impl_->waitForTimeRelative(timeout_ms);
+  mutex().conditionWaitEnd();
+  return result;
 }
 
 int Monitor::waitForever() const {
-  return impl_->waitForever();
+  mutex().conditionWaitBegin();
+  int result = impl_->waitForever();
+  mutex().conditionWaitEnd();
+  return result;
 }
 
 void Monitor::notify() const { impl_->notify(); }
@@ -23,11 +23,24 @@
 #include "Mutex.h"
 #include "Util.h"
 
+#include <algorithm>
 #include <assert.h>
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
 #endif
+#include <sched.h>
 #include <signal.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define THRIFT_FUTEX_MUTEX 1
+#endif
 
 using boost::shared_ptr;
 
@@ -37,6 +50,7 @@ namespace apache { namespace thrift { namespace concurrency {
 
 static sig_atomic_t mutexProfilingSampleRate = 0;
 static MutexWaitCallback mutexProfilingCallback = 0;
+static MutexContentionCallback mutexContentionCallback = 0;
 
 volatile static sig_atomic_t mutexProfilingCounter = 0;
 
@@ -46,6 +60,34 @@ void enableMutexProfiling(int32_t profilingSampleRate,
   mutexProfilingCallback = callback;
 }
 
+void enableMutexContentionProfiling(int32_t profilingSampleRate,
+                                    MutexContentionCallback callback) {
+  mutexProfilingSampleRate = profilingSampleRate;
+  mutexContentionCallback = callback;
+}
+
+static void reportMutexWait(const void* id, int64_t waitTime) {
+  MutexWaitCallback waitCallback = mutexProfilingCallback;
+  if (waitCallback) {
+    (*waitCallback)(id, waitTime);
+  }
+  MutexContentionCallback contentionCallback = mutexContentionCallback;
+  if (contentionCallback) {
+    (*contentionCallback)(id, waitTime, -1);
+  }
+}
+
+static void reportMutexHold(const void* id, int64_t waitTime, int64_t holdTime) {
+  MutexWaitCallback waitCallback = mutexProfilingCallback;
+  if (waitCallback && waitTime > 0) {
+    (*waitCallback)(id, waitTime);
+  }
+  MutexContentionCallback contentionCallback = mutexContentionCallback;
+  if (contentionCallback) {
+    (*contentionCallback)(id, waitTime, holdTime);
+  }
+}
+
 #define PROFILE_MUTEX_START_LOCK() \
     int64_t _lock_startTime = maybeGetProfilingStartTime();
 
@@ -53,31 +95,38 @@ void enableMutexProfiling(int32_t profilingSampleRate,
   do { \
     if (_lock_startTime > 0) { \
       int64_t endTime = Util::currentTimeUsec(); \
-      (*mutexProfilingCallback)(this, endTime - _lock_startTime); \
+      reportMutexWait(this, endTime - _lock_startTime); \
     } \
   } while (0)
 
 #define PROFILE_MUTEX_LOCKED() \
   do { \
-    profileTime_ = _lock_startTime; \
-    if (profileTime_ > 0) { \
-      profileTime_ = Util::currentTimeUsec() - profileTime_; \
+    profileTime_ = 0; \
+    profileLockTime_ = 0; \
+    if (_lock_startTime > 0) { \
+      profileLockTime_ = Util::currentTimeUsec(); \
+      profileTime_ = profileLockTime_ - _lock_startTime; \
     } \
   } while (0)
 
 #define PROFILE_MUTEX_START_UNLOCK() \
   int64_t _temp_profileTime = profileTime_; \
-  profileTime_ = 0;
+  int64_t _temp_holdTime = 0; \
+  if (profileLockTime_ > 0) { \
+    _temp_holdTime = Util::currentTimeUsec() - profileLockTime_; \
+  } \
+  profileTime_ = 0; \
+  profileLockTime_ = 0;
 
 #define PROFILE_MUTEX_UNLOCKED() \
   do { \
-    if (_temp_profileTime > 0) { \
-      (*mutexProfilingCallback)(this, _temp_profileTime); \
+    if (_temp_holdTime > 0 || _temp_profileTime > 0) { \
+      reportMutexHold(this, _temp_profileTime, _temp_holdTime); \
     } \
   } while (0)
 
 static inline int64_t maybeGetProfilingStartTime() {
-  if (mutexProfilingSampleRate && mutexProfilingCallback) {
+  if (mutexProfilingSampleRate && (mutexProfilingCallback || mutexContentionCallback)) {
     // This block is unsynchronized, but should produce a reasonable sampling
     // rate on most architectures.  The main race conditions are the gap
     // between the decrement and the test, the non-atomicity of decrement, and
@@ -108,16 +157,70 @@ static inline int64_t maybeGetProfilingStartTime() {
 #  define PROFILE_MUTEX_UNLOCKED()
 #endif // THRIFT_NO_CONTENTION_PROFILING
 
+static inline void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__("pause");
+#endif
+}
+
+#ifdef THRIFT_FUTEX_MUTEX
+
+#ifdef USE_FUTEX_MUTEX
+static bool futexMutexes = true;
+#else
+static bool futexMutexes = false;
+#endif
+
+bool enableFutexMutexes(bool enable) {
+  futexMutexes = enable;
+  return true;
+}
+
+static inline long futex(volatile int32_t* addr, int op, int32_t val,
+                         const struct timespec* abstime) {
+  return syscall(SYS_futex, addr, op, val, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/**
+ * The most a futex mutex spins before sleeping.  Spinning only pays off if
+ * the holder can be running at the same time.
+ */
+static int maxSpins() {
+  static const int spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 100 : 0;
+  return spins;
+}
+
+#else
+
+bool enableFutexMutexes(bool enable) {
+  (void)enable;
+  return false;
+}
+
+#endif // THRIFT_FUTEX_MUTEX
+
 /**
- * Implementation of Mutex class using POSIX mutex
+ * Implementation of Mutex class using POSIX mutex, or a futex
+ *
+ * The futex mutex follows Drepper, "Futexes Are Tricky": the futex word is
+ * 0 when unlocked, 1 when locked and 2 when locked with threads (possibly)
+ * sleeping on it, so unlock only makes a system call when some thread has
+ * had to sleep.
  *
  * @version $Id:$
  */
 class Mutex::impl {
  public:
-  impl(Initializer init) : initialized_(false) {
+  impl(Initializer init) : initialized_(false), futex_(false), state_(0), spins_(0) {
 #ifndef THRIFT_NO_CONTENTION_PROFILING
     profileTime_ = 0;
+    profileLockTime_ = 0;
+#endif
+#ifdef THRIFT_FUTEX_MUTEX
+    if (init == FUTEX_INITIALIZER || (init == DEFAULT_INITIALIZER && futexMutexes)) {
+      futex_ = true;
+      return;
+    }
 #endif
     init(&pthread_mutex_);
     initialized_ = true;
@@ -133,13 +236,42 @@ class Mutex::impl {
 
   void lock() const {
     PROFILE_MUTEX_START_LOCK();
+#ifdef THRIFT_FUTEX_MUTEX
+    if (futex_) {
+      futexLock(NULL);
+      PROFILE_MUTEX_LOCKED();
+      return;
+    }
+#endif
     pthread_mutex_lock(&pthread_mutex_);
     PROFILE_MUTEX_LOCKED();
   }
 
-  bool trylock() const { return (0 == pthread_mutex_trylock(&pthread_mutex_)); }
+  bool trylock() const {
+#ifdef THRIFT_FUTEX_MUTEX
+    if (futex_) {
+      return __sync_bool_compare_and_swap(&state_, 0, 1);
+    }
+#endif
+    return (0 == pthread_mutex_trylock(&pthread_mutex_));
+  }
 
   bool timedlock(int64_t milliseconds) const {
+#ifdef THRIFT_FUTEX_MUTEX
+    if (futex_) {
+      PROFILE_MUTEX_START_LOCK();
+
+      struct timespec ts;
+      Util::toTimespec(ts, Util::currentTime() + milliseconds);
+      if (futexLock(&ts)) {
+        PROFILE_MUTEX_LOCKED();
+        return true;
+      }
+
+      PROFILE_MUTEX_NOT_LOCKED();
+      return false;
+    }
+#endif
 #if defined(_POSIX_TIMEOUTS) && _POSIX_TIMEOUTS >= 200112L
     PROFILE_MUTEX_START_LOCK();
 
@@ -163,17 +295,89 @@ class Mutex::impl {
 
   void unlock() const {
     PROFILE_MUTEX_START_UNLOCK();
+#ifdef THRIFT_FUTEX_MUTEX
+    if (futex_) {
+      if (__sync_fetch_and_sub(&state_, 1) != 1) {
+        __sync_lock_release(&state_);
+        futex(&state_, FUTEX_WAKE_PRIVATE, 1, NULL);
+      }
+      PROFILE_MUTEX_UNLOCKED();
+      return;
+    }
+#endif
     pthread_mutex_unlock(&pthread_mutex_);
     PROFILE_MUTEX_UNLOCKED();
   }
 
-  void* getUnderlyingImpl() const { return (void*) &pthread_mutex_; }
+  void* getUnderlyingImpl() const { return futex_ ? NULL : (void*) &pthread_mutex_; }
+
+  void conditionWaitBegin() const {
+#ifndef THRIFT_NO_CONTENTION_PROFILING
+    // A futex Monitor waits through unlock() and lock(), which profile
+    // themselves
+    if (futex_ || profileLockTime_ == 0) {
+      return;
+    }
+    PROFILE_MUTEX_START_UNLOCK();
+    PROFILE_MUTEX_UNLOCKED();
+#endif
+  }
+
+  void conditionWaitEnd() const {
+    if (futex_) {
+      return;
+    }
+    PROFILE_MUTEX_START_LOCK();
+    PROFILE_MUTEX_LOCKED();
+  }
+
+  bool isFutex() const { return futex_; }
 
  private:
+#ifdef THRIFT_FUTEX_MUTEX
+  /**
+   * Locks the futex mutex, giving up at abstime (CLOCK_REALTIME) if it is
+   * not NULL.  Returns whether the mutex was locked.
+   */
+  bool futexLock(const struct timespec* abstime) const {
+    if (__sync_bool_compare_and_swap(&state_, 0, 1)) {
+      return true;
+    }
+
+    // Spin for a little longer than it has recently taken to get the mutex,
+    // as glibc's adaptive mutexes do
+    int limit = std::min(maxSpins(), spins_ * 2 + 10);
+    int spin = 0;
+    bool locked = false;
+    while (spin < limit && !locked) {
+      spin++;
+      cpuRelax();
+      locked = state_ == 0 && __sync_bool_compare_and_swap(&state_, 0, 1);
+    }
+    spins_ += (spin - spins_) / 8;
+    if (locked) {
+      return true;
+    }
+
+    int op = abstime == NULL ? FUTEX_WAIT_PRIVATE
+                             : FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME;
+    while (__sync_lock_test_and_set(&state_, 2) != 0) {
+      if (futex(&state_, op, 2, abstime) == -1 && errno == ETIMEDOUT) {
+        return false;
+      }
+    }
+    return true;
+  }
+#endif
+
   mutable pthread_mutex_t pthread_mutex_;
   mutable bool initialized_;
+  bool futex_;
+  mutable volatile int32_t state_;
+  mutable int spins_;
 #ifndef THRIFT_NO_CONTENTION_PROFILING
   mutable int64_t profileTime_;
+  mutable int64_t profileLockTime_;
 #endif
 };
 
@@ -181,6 +385,12 @@ Mutex::Mutex(Initializer init) : impl_(new Mutex::impl(init)) {}
 
 void* Mutex::getUnderlyingImpl() const { return impl_->getUnderlyingImpl(); }
 
+bool Mutex::isFutex() const { return impl_->isFutex(); }
+
+void Mutex::conditionWaitBegin() const { impl_->conditionWaitBegin(); }
+
+void Mutex::conditionWaitEnd() const { impl_->conditionWaitEnd(); }
+
 void Mutex::lock() const { impl_->lock(); }
 
 bool Mutex::trylock() const { return impl_->trylock(); }
@@ -233,6 +443,12 @@ void Mutex::RECURSIVE_INITIALIZER(void* arg) {
 }
 #endif
 
+void Mutex::FUTEX_INITIALIZER(void* arg) {
+  // Only reached where futexes aren't available; Mutex::impl uses a futex
+  // instead of calling this elsewhere
+  DEFAULT_INITIALIZER(arg);
+}
+
 
 /**
  * Implementation of ReadWriteMutex class using POSIX rw lock
@@ -244,6 +460,7 @@ public:
   impl() : initialized_(false) {
 #ifndef THRIFT_NO_CONTENTION_PROFILING
     profileTime_ = 0;
+    profileLockTime_ = 0;
 #endif
     int ret = pthread_rwlock_init(&rw_lock_, NULL);
     assert(ret == 0);
@@ -285,11 +502,14 @@ private:
   mutable bool initialized_;
 #ifndef THRIFT_NO_CONTENTION_PROFILING
   mutable int64_t profileTime_;
+  mutable int64_t profileLockTime_;
 #endif
 };
 
 ReadWriteMutex::ReadWriteMutex() : impl_(new ReadWriteMutex::impl()) {}
 
+ReadWriteMutex::ReadWriteMutex(NoImplementation) {}
+
 void ReadWriteMutex::acquireRead() const { impl_->acquireRead(); }
 
 void ReadWriteMutex::acquireWrite() const { impl_->acquireWrite(); }
@@ -330,5 +550,159 @@ void NoStarveReadWriteMutex::acquireWrite() const
   mutex_.unlock();
 }
 
+/**
+ * Implementation of DistributedReadWriteMutex
+ *
+ * Writers take writeMutex_ for as long as they hold the write lock, which
+ * also serializes them.  The reader and writer each publish themselves (a
+ * reader count, writer_) before checking for the other, with a full barrier
+ * in between, so at least one of them sees the other and backs off.
+ *
+ * @version $Id:$
+ */
+class DistributedReadWriteMutex::impl {
+public:
+  impl() : writer_(0), writeLocked_(false) {
+#ifndef THRIFT_NO_CONTENTION_PROFILING
+    profileTime_ = 0;
+    profileLockTime_ = 0;
+#endif
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    slotCount_ = 1;
+    while (slotCount_ < cpus && slotCount_ < MAX_SLOTS) {
+      slotCount_ *= 2;
+    }
+    buffer_ = new char[(slotCount_ + 1) * sizeof(Slot)];
+    slots_ = reinterpret_cast<Slot*>(
+      (reinterpret_cast<uintptr_t>(buffer_) + sizeof(Slot) - 1) & ~(uintptr_t)(sizeof(Slot) - 1));
+    for (int ix = 0; ix < slotCount_; ix++) {
+      slots_[ix].readers = 0;
+    }
+  }
+
+  ~impl() {
+    delete[] buffer_;
+  }
+
+  void acquireRead() const {
+    PROFILE_MUTEX_START_LOCK();
+    while (!attemptRead()) {
+      // A writer is waiting or has the lock; wait until it's done
+      writeMutex_.lock();
+      writeMutex_.unlock();
+    }
+    PROFILE_MUTEX_NOT_LOCKED();  // not exclusive, so use not-locked path
+  }
+
+  void acquireWrite() const {
+    PROFILE_MUTEX_START_LOCK();
+    writeMutex_.lock();
+    __sync_lock_test_and_set(&writer_, 1);
+    __sync_synchronize();
+    for (int ix = 0; ix < slotCount_; ix++) {
+      for (int spin = 0; slots_[ix].readers != 0; spin++) {
+        if (spin < MAX_SPINS) {
+          cpuRelax();
+        } else {
+          sched_yield();
+        }
+      }
+    }
+    writeLocked_ = true;
+    PROFILE_MUTEX_LOCKED();
+  }
+
+  bool attemptRead() const {
+    volatile int32_t& readers = slots_[slot() & (slotCount_ - 1)].readers;
+    __sync_fetch_and_add(&readers, 1);
+    if (writer_ == 0) {
+      return true;
+    }
+    __sync_fetch_and_sub(&readers, 1);
+    return false;
+  }
+
+  bool attemptWrite() const {
+    if (!writeMutex_.trylock()) {
+      return false;
+    }
+    __sync_lock_test_and_set(&writer_, 1);
+    __sync_synchronize();
+    for (int ix = 0; ix < slotCount_; ix++) {
+      if (slots_[ix].readers != 0) {
+        __sync_lock_release(&writer_);
+        writeMutex_.unlock();
+        return false;
+      }
+    }
+    writeLocked_ = true;
+    return true;
+  }
+
+  void release() const {
+    // No reader can hold the lock while a writer does
+    if (!writeLocked_) {
+      __sync_fetch_and_sub(&slots_[slot() & (slotCount_ - 1)].readers, 1);
+      return;
+    }
+
+    PROFILE_MUTEX_START_UNLOCK();
+    writeLocked_ = false;
+    __sync_lock_release(&writer_);
+    writeMutex_.unlock();
+    PROFILE_MUTEX_UNLOCKED();
+  }
+
+private:
+  enum {
+    CACHE_LINE_SIZE = 64,
+    MAX_SLOTS = 32,
+    MAX_SPINS = 1000
+  };
+
+  struct Slot {
+    volatile int32_t readers;
+    char padding[CACHE_LINE_SIZE - sizeof(int32_t)];
+  };
+
+  /**
+   * The calling thread's reader slot.  Threads are numbered as they first
+   * take a read lock, so up to slotCount_ threads get slots of their own.
+   */
+  static int slot() {
+    static int32_t threadCount = 0;
+    static __thread int32_t threadSlot = -1;
+    if (threadSlot < 0) {
+      threadSlot = __sync_fetch_and_add(&threadCount, 1) & 0x7fffffff;
+    }
+    return threadSlot;
+  }
+
+  int slotCount_;
+  char* buffer_;
+  Slot* slots_;
+  Mutex writeMutex_;
+  mutable volatile int32_t writer_;
+  mutable volatile bool writeLocked_;
+#ifndef THRIFT_NO_CONTENTION_PROFILING
+  mutable int64_t profileTime_;
+  mutable int64_t profileLockTime_;
+#endif
+};
+
+DistributedReadWriteMutex::DistributedReadWriteMutex() :
+  ReadWriteMutex(NoImplementation()),
+  impl_(new DistributedReadWriteMutex::impl()) {}
+
+void DistributedReadWriteMutex::acquireRead() const { impl_->acquireRead(); }
+
+void DistributedReadWriteMutex::acquireWrite() const { impl_->acquireWrite(); }
+
+bool DistributedReadWriteMutex::attemptRead() const { return impl_->attemptRead(); }
+
+bool DistributedReadWriteMutex::attemptWrite() const { return impl_->attemptWrite(); }
+
+void DistributedReadWriteMutex::release() const { impl_->release(); }
+
 }}} // apache::thrift::concurrency
 
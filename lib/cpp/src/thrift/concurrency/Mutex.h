@@ -49,8 +49,39 @@ typedef void (*MutexWaitCallback)(const void* id, int64_t waitTimeMicros);
 void enableMutexProfiling(int32_t profilingSampleRate,
                           MutexWaitCallback callback);
 
+/**
+ * Like enableMutexProfiling(), for profilers that also want to know how long
+ * locks were held (see ContentionProfiler.h).  The callback is invoked for
+ * every sampled acquisition, contended or not, with the wait time and the
+ * time the lock was then held, both in usec.  For exclusive locks it is
+ * called in the locking thread just after the lock is released (or, for a
+ * Monitor, just before a wait releases it).  For shared locks, and timed
+ * locks that time out, it is called just after the attempt to lock, with a
+ * hold time of -1.
+ *
+ * Both callbacks share the sample rate; setting either sets it for both.
+ */
+typedef void (*MutexContentionCallback)(const void* id,
+                                        int64_t waitTimeMicros,
+                                        int64_t holdTimeMicros);
+void enableMutexContentionProfiling(int32_t profilingSampleRate,
+                                    MutexContentionCallback callback);
+
 #endif
 
+/**
+ * Determines whether Mutexes created with the DEFAULT_INITIALIZER, and so
+ * Monitors that create their own mutex, are futex based rather than pthread
+ * mutexes (see Mutex::FUTEX_INITIALIZER).  The default is set at build time
+ * by --enable-futex (USE_FUTEX_MUTEX); this call changes it for mutexes
+ * created afterwards.  Like enableMutexProfiling(), it is unsynchronized and
+ * should be called before any threads are started.
+ *
+ * @return whether futex mutexes are available, i.e. false on platforms
+ *         without futexes, where the setting is ignored.
+ */
+bool enableFutexMutexes(bool enable);
+
 /**
  * A simple mutex class
  *
@@ -69,11 +100,32 @@ class Mutex {
 
   void* getUnderlyingImpl() const;
 
+  /**
+   * Whether this mutex is futex based.  Futex mutexes have no underlying
+   * pthread mutex, so getUnderlyingImpl() returns NULL for them.
+   */
+  bool isFutex() const;
+
   static void DEFAULT_INITIALIZER(void*);
   static void ADAPTIVE_INITIALIZER(void*);
   static void RECURSIVE_INITIALIZER(void*);
 
+  /**
+   * Creates a mutex built directly on Linux futexes: uncontended lock and
+   * unlock are a single atomic instruction each, and a thread that finds
+   * the mutex locked spins for a while, adapting the spin to how long the
+   * mutex has recently been held, before sleeping in the kernel.  Falls back
+   * to the DEFAULT_INITIALIZER on other platforms.  Not recursive.
+   */
+  static void FUTEX_INITIALIZER(void*);
+
  private:
+  friend class Monitor;
+
+  // Profiling hooks for Monitor waits, which release and reacquire the
+  // mutex without calling unlock() and lock()
+  void conditionWaitBegin() const;
+  void conditionWaitEnd() const;
 
   class impl;
   boost::shared_ptr<impl> impl_;
@@ -95,6 +147,13 @@ public:
   // this releases both read and write locks
   virtual void release() const;
 
+protected:
+  struct NoImplementation {};
+
+  // For subclasses that override every method above, and so need no POSIX
+  // rw lock underneath
+  explicit ReadWriteMutex(NoImplementation);
+
 private:
 
   class impl;
@@ -120,6 +179,40 @@ private:
   mutable volatile bool writerWaiting_;
 };
 
+/**
+ * A ReadWriteMutex for data that is read far more often than it is written.
+ *
+ * A ReadWriteMutex keeps its readers in one lock word, so read locks taken
+ * on different cores contend for the same cache line even though they never
+ * exclude each other.  This mutex instead counts readers in an array of
+ * counters, one per cache line, with each thread using its own counter; a
+ * read lock that finds no writer touches only the thread's counter.  A
+ * writer announces itself and then waits for every counter to drain.
+ * Readers that arrive while a writer is waiting or holding the lock wait for
+ * it, so writers are not starved, and write locks cost more than on a
+ * ReadWriteMutex.  Only the interface is shared with ReadWriteMutex; there
+ * is no POSIX rw lock underneath.
+ *
+ * As with writer-preferring mutexes generally, a thread must not take a
+ * second read lock while it holds one.
+ */
+class DistributedReadWriteMutex : public ReadWriteMutex {
+public:
+  DistributedReadWriteMutex();
+
+  virtual void acquireRead() const;
+  virtual void acquireWrite() const;
+
+  virtual bool attemptRead() const;
+  virtual bool attemptWrite() const;
+
+  virtual void release() const;
+
+private:
+  class impl;
+  boost::shared_ptr<impl> impl_;
+};
+
 class Guard : boost::noncopyable {
  public:
   Guard(const Mutex& value, int64_t timeout = 0) : mutex_(&value) {
@@ -0,0 +1,711 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "PriorityThreadManager.h"
+#include "Exception.h"
+#include "Monitor.h"
+#include "Util.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <assert.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <set>
+#include <vector>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+using boost::shared_ptr;
+using boost::dynamic_pointer_cast;
+
+/**
+ * PriorityThreadManager implementation
+ *
+ * Works like ThreadManager::Impl, but with one task queue per priority and
+ * one worker pool per priority plus a general pool.  Pools are indexed by
+ * priority, with the general pool at index N_PRIORITIES.  Every pool waits
+ * on its own monitor so that add() can wake a worker that is able to run
+ * the new task; all monitors share one mutex.
+ */
+class PriorityThreadManager::Impl : public PriorityThreadManager {
+
+ public:
+  static const size_t GENERAL = PriorityThreadManager::N_PRIORITIES;
+
+  Impl() :
+    taskCount_(0),
+    expiredCount_(0),
+    state_(ThreadManager::UNINITIALIZED),
+    monitor_(&mutex_) {
+    for (size_t ix = 0; ix <= GENERAL; ix++) {
+      workerCount_[ix] = 0;
+      workerMaxCount_[ix] = 0;
+      idleCount_[ix] = 0;
+      wakeups_[ix] = 0;
+    }
+    for (size_t ix = 0; ix < GENERAL; ix++) {
+      pendingTaskCountMax_[ix] = 0;
+      laneMonitors_[ix] = new Monitor(&mutex_);
+      maxMonitors_[ix] = new Monitor(&mutex_);
+    }
+  }
+
+  ~Impl() {
+    stop();
+    for (size_t ix = 0; ix < GENERAL; ix++) {
+      delete laneMonitors_[ix];
+      delete maxMonitors_[ix];
+    }
+  }
+
+  void start();
+
+  void stop() { stopImpl(false); }
+
+  void join() { stopImpl(true); }
+
+  ThreadManager::STATE state() const {
+    return state_;
+  }
+
+  shared_ptr<ThreadFactory> threadFactory() const {
+    Synchronized s(monitor_);
+    return threadFactory_;
+  }
+
+  void threadFactory(shared_ptr<ThreadFactory> value) {
+    Synchronized s(monitor_);
+    threadFactory_ = value;
+  }
+
+  void addWorker(size_t value) {
+    addWorkerImpl(value, GENERAL);
+  }
+
+  void addWorker(size_t value, PRIORITY priority) {
+    addWorkerImpl(value, lane(priority));
+  }
+
+  void removeWorker(size_t value) {
+    removeWorkerImpl(value, GENERAL);
+  }
+
+  void removeWorker(size_t value, PRIORITY priority) {
+    removeWorkerImpl(value, lane(priority));
+  }
+
+  size_t idleWorkerCount() const {
+    Synchronized s(monitor_);
+    size_t result = 0;
+    for (size_t ix = 0; ix <= GENERAL; ix++) {
+      result += idleCount_[ix];
+    }
+    return result;
+  }
+
+  size_t workerCount() const {
+    Synchronized s(monitor_);
+    size_t result = 0;
+    for (size_t ix = 0; ix <= GENERAL; ix++) {
+      result += workerCount_[ix];
+    }
+    return result;
+  }
+
+  size_t pendingTaskCount() const {
+    Synchronized s(monitor_);
+    return taskCount_;
+  }
+
+  size_t pendingTaskCount(PRIORITY priority) const {
+    Synchronized s(monitor_);
+    return tasks_[lane(priority)].size();
+  }
+
+  size_t totalTaskCount() const {
+    Synchronized s(monitor_);
+    size_t result = taskCount_;
+    for (size_t ix = 0; ix <= GENERAL; ix++) {
+      result += workerCount_[ix] - idleCount_[ix];
+    }
+    return result;
+  }
+
+  size_t pendingTaskCountMax() const {
+    return pendingTaskCountMax(NORMAL);
+  }
+
+  size_t pendingTaskCountMax(PRIORITY priority) const {
+    Synchronized s(monitor_);
+    return pendingTaskCountMax_[lane(priority)];
+  }
+
+  void pendingTaskCountMax(PRIORITY priority, size_t value) {
+    Synchronized s(monitor_);
+    pendingTaskCountMax_[lane(priority)] = value;
+    maxMonitors_[lane(priority)]->notifyAll();
+  }
+
+  size_t expiredTaskCount() {
+    Synchronized s(monitor_);
+    size_t result = expiredCount_;
+    expiredCount_ = 0;
+    return result;
+  }
+
+  int64_t pendingTaskWaitTime() const;
+
+  size_t blockedWorkerCount(int64_t threshold) const;
+
+  bool canSleep();
+
+  void add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration) {
+    add(value, NORMAL, timeout, expiration);
+  }
+
+  void add(shared_ptr<Runnable> value, PRIORITY priority, int64_t timeout, int64_t expiration);
+
+  void remove(shared_ptr<Runnable> task);
+
+  shared_ptr<Runnable> removeNextPending();
+
+  void removeExpiredTasks();
+
+  void setExpireCallback(ExpireCallback expireCallback);
+
+private:
+  static size_t lane(PRIORITY priority) {
+    if (priority < HIGHEST || priority >= N_PRIORITIES) {
+      throw InvalidArgumentException();
+    }
+    return static_cast<size_t>(priority);
+  }
+
+  Monitor& poolMonitor(size_t pool) {
+    return pool == GENERAL ? monitor_ : *laneMonitors_[pool];
+  }
+
+  bool hasTask(size_t pool) const {
+    return pool == GENERAL ? taskCount_ > 0 : !tasks_[pool].empty();
+  }
+
+  /**
+   * Wakes an idle worker of the pool, unless every one of them has already
+   * been woken for an earlier task.  Called with the manager mutex held.
+   *
+   * @return false if the pool has no unclaimed idle worker
+   */
+  bool wakeIdleWorker(size_t pool) {
+    if (idleCount_[pool] <= wakeups_[pool]) {
+      return false;
+    }
+    wakeups_[pool]++;
+    poolMonitor(pool).notify();
+    return true;
+  }
+
+  /// Workers wanted across all pools
+  size_t workerMaxCountTotal() const {
+    size_t result = 0;
+    for (size_t ix = 0; ix <= GENERAL; ix++) {
+      result += workerMaxCount_[ix];
+    }
+    return result;
+  }
+
+  void addWorkerImpl(size_t value, size_t pool);
+
+  void removeWorkerImpl(size_t value, size_t pool);
+
+  void stopImpl(bool join);
+
+  size_t workerCount_[GENERAL + 1];
+  size_t workerMaxCount_[GENERAL + 1];
+  size_t idleCount_[GENERAL + 1];
+  // Idle workers woken by add() that have not yet got the mutex back
+  size_t wakeups_[GENERAL + 1];
+  size_t pendingTaskCountMax_[GENERAL];
+  size_t taskCount_;
+  size_t expiredCount_;
+  ExpireCallback expireCallback_;
+
+  ThreadManager::STATE state_;
+  shared_ptr<ThreadFactory> threadFactory_;
+
+  friend class PriorityThreadManager::Task;
+  std::queue<shared_ptr<Task> > tasks_[GENERAL];
+  Mutex mutex_;
+  Monitor monitor_;
+  Monitor* laneMonitors_[GENERAL];
+  Monitor* maxMonitors_[GENERAL];
+  Monitor workerMonitor_;
+
+  friend class PriorityThreadManager::Worker;
+  std::vector<PriorityThreadManager::Worker*> activeWorkers_;
+  std::set<shared_ptr<Thread> > workers_;
+  std::set<shared_ptr<Thread> > deadWorkers_;
+  std::map<const Thread::id_t, shared_ptr<Thread> > idMap_;
+};
+
+class PriorityThreadManager::Task : public Runnable {
+
+ public:
+  Task(shared_ptr<Runnable> runnable, int64_t expiration=0LL)  :
+    runnable_(runnable),
+    enqueueTime_(Util::currentTime()),
+    expireTime_(expiration != 0LL ? enqueueTime_ + expiration : 0LL) {}
+
+  ~Task() {}
+
+  void run() {
+    runnable_->run();
+  }
+
+  shared_ptr<Runnable> getRunnable() {
+    return runnable_;
+  }
+
+  int64_t getEnqueueTime() const {
+    return enqueueTime_;
+  }
+
+  int64_t getExpireTime() const {
+    return expireTime_;
+  }
+
+ private:
+  shared_ptr<Runnable> runnable_;
+  int64_t enqueueTime_;
+  int64_t expireTime_;
+};
+
+class PriorityThreadManager::Worker: public Runnable {
+
+ public:
+  Worker(PriorityThreadManager::Impl* manager, size_t pool) :
+    manager_(manager),
+    pool_(pool),
+    taskStart_(0LL) {}
+
+  ~Worker() {}
+
+ private:
+  bool isActive() const {
+    return
+      (manager_->workerCount_[pool_] <= manager_->workerMaxCount_[pool_]) ||
+      (manager_->state_ == JOINING && manager_->hasTask(pool_));
+  }
+
+  /**
+   * Dequeues the next task this worker may run: the oldest task of its own
+   * priority for a reserved worker, the oldest task of the highest non-empty
+   * priority for a general one.  Called with the manager mutex held.
+   */
+  shared_ptr<PriorityThreadManager::Task> nextTask() {
+    shared_ptr<PriorityThreadManager::Task> task;
+    size_t first = pool_ == Impl::GENERAL ? 0 : pool_;
+    size_t last = pool_ == Impl::GENERAL ? Impl::GENERAL - 1 : pool_;
+
+    for (size_t lane = first; lane <= last; lane++) {
+      std::queue<shared_ptr<PriorityThreadManager::Task> >& tasks = manager_->tasks_[lane];
+      if (tasks.empty()) {
+        continue;
+      }
+
+      task = tasks.front();
+      tasks.pop();
+      manager_->taskCount_--;
+
+      /* If the lane has a pending task max and we just dropped below it,
+         wakeup any thread that might be blocked on add. */
+      if (manager_->pendingTaskCountMax_[lane] != 0 &&
+          tasks.size() <= manager_->pendingTaskCountMax_[lane] - 1) {
+        manager_->maxMonitors_[lane]->notify();
+      }
+      break;
+    }
+    return task;
+  }
+
+ public:
+  /**
+   * Worker entry point
+   *
+   * As long as worker thread is running, pull tasks off the task queues and
+   * execute.
+   */
+  void run() {
+    bool active = false;
+    bool notifyManager = false;
+
+    {
+      Synchronized s(manager_->monitor_);
+      active = manager_->workerCount_[pool_] < manager_->workerMaxCount_[pool_];
+      if (active) {
+        manager_->workerCount_[pool_]++;
+        manager_->activeWorkers_.push_back(this);
+        notifyManager = manager_->workerCount_[pool_] == manager_->workerMaxCount_[pool_];
+      }
+    }
+
+    if (notifyManager) {
+      Synchronized s(manager_->workerMonitor_);
+      manager_->workerMonitor_.notify();
+    }
+
+    while (active) {
+      shared_ptr<PriorityThreadManager::Task> task;
+
+      {
+        Guard g(manager_->mutex_);
+        taskStart_ = 0LL;
+        active = isActive();
+
+        while (active && !manager_->hasTask(pool_)) {
+          manager_->idleCount_[pool_]++;
+          manager_->poolMonitor(pool_).wait();
+          active = isActive();
+          manager_->idleCount_[pool_]--;
+          if (manager_->wakeups_[pool_] > 0) {
+            manager_->wakeups_[pool_]--;
+          }
+        }
+
+        if (active) {
+          manager_->removeExpiredTasks();
+          task = nextTask();
+          if (task != NULL) {
+            taskStart_ = Util::currentTime();
+          }
+        } else {
+          manager_->workerCount_[pool_]--;
+          manager_->activeWorkers_.erase(std::find(manager_->activeWorkers_.begin(),
+                                                   manager_->activeWorkers_.end(),
+                                                   this));
+        }
+      }
+
+      if (task != NULL) {
+        try {
+          task->run();
+        } catch(...) {
+          // XXX need to log this
+        }
+      }
+    }
+
+    // removeWorkerImpl() waits for this as well as for the worker count,
+    // since the manager may be destroyed as soon as it returns
+    {
+      Synchronized s(manager_->workerMonitor_);
+      manager_->deadWorkers_.insert(this->thread());
+      manager_->workerMonitor_.notify();
+    }
+  }
+
+ private:
+  PriorityThreadManager::Impl* manager_;
+  friend class PriorityThreadManager::Impl;
+  const size_t pool_;
+  // When the running task was started, 0 if none.  Guarded by manager mutex
+  int64_t taskStart_;
+};
+
+void PriorityThreadManager::Impl::addWorkerImpl(size_t value, size_t pool) {
+  std::set<shared_ptr<Thread> > newThreads;
+  for (size_t ix = 0; ix < value; ix++) {
+    shared_ptr<PriorityThreadManager::Worker> worker = shared_ptr<PriorityThreadManager::Worker>(new PriorityThreadManager::Worker(this, pool));
+    newThreads.insert(threadFactory_->newThread(worker));
+  }
+
+  {
+    Synchronized s(monitor_);
+    workerMaxCount_[pool] += value;
+    workers_.insert(newThreads.begin(), newThreads.end());
+  }
+
+  for (std::set<shared_ptr<Thread> >::iterator ix = newThreads.begin(); ix != newThreads.end(); ix++) {
+    (*ix)->start();
+    idMap_.insert(std::pair<const Thread::id_t, shared_ptr<Thread> >((*ix)->getId(), *ix));
+  }
+
+  {
+    Synchronized s(workerMonitor_);
+    while (workerCount_[pool] != workerMaxCount_[pool]) {
+      workerMonitor_.wait();
+    }
+  }
+}
+
+void PriorityThreadManager::Impl::start() {
+
+  if (state_ == ThreadManager::STOPPED) {
+    return;
+  }
+
+  {
+    Synchronized s(monitor_);
+    if (state_ == ThreadManager::UNINITIALIZED) {
+      if (threadFactory_ == NULL) {
+        throw InvalidArgumentException();
+      }
+      state_ = ThreadManager::STARTED;
+      monitor_.notifyAll();
+    }
+
+    while (state_ == STARTING) {
+      monitor_.wait();
+    }
+  }
+}
+
+void PriorityThreadManager::Impl::stopImpl(bool join) {
+  bool doStop = false;
+  if (state_ == ThreadManager::STOPPED) {
+    return;
+  }
+
+  {
+    Synchronized s(monitor_);
+    if (state_ != ThreadManager::STOPPING &&
+        state_ != ThreadManager::JOINING &&
+        state_ != ThreadManager::STOPPED) {
+      doStop = true;
+      state_ = join ? ThreadManager::JOINING : ThreadManager::STOPPING;
+    }
+  }
+
+  if (doStop) {
+    // Drain the general pool last, so that a join runs every lane that
+    // general workers can reach.
+    for (size_t pool = 0; pool <= GENERAL; pool++) {
+      size_t count;
+      {
+        Synchronized s(monitor_);
+        count = workerMaxCount_[pool];
+      }
+      removeWorkerImpl(count, pool);
+    }
+  }
+
+  {
+    Synchronized s(monitor_);
+    state_ = ThreadManager::STOPPED;
+  }
+}
+
+void PriorityThreadManager::Impl::removeWorkerImpl(size_t value, size_t pool) {
+  {
+    Synchronized s(monitor_);
+    if (value > workerMaxCount_[pool]) {
+      throw InvalidArgumentException();
+    }
+
+    workerMaxCount_[pool] -= value;
+
+    if (idleCount_[pool] < value) {
+      for (size_t ix = 0; ix < idleCount_[pool]; ix++) {
+        poolMonitor(pool).notify();
+      }
+    } else {
+      poolMonitor(pool).notifyAll();
+    }
+  }
+
+  {
+    Synchronized s(workerMonitor_);
+
+    while (workerCount_[pool] != workerMaxCount_[pool] ||
+           workers_.size() - deadWorkers_.size() > workerMaxCountTotal()) {
+      workerMonitor_.wait();
+    }
+
+    for (std::set<shared_ptr<Thread> >::iterator ix = deadWorkers_.begin(); ix != deadWorkers_.end(); ix++) {
+      workers_.erase(*ix);
+      idMap_.erase((*ix)->getId());
+    }
+
+    deadWorkers_.clear();
+  }
+}
+
+bool PriorityThreadManager::Impl::canSleep() {
+  const Thread::id_t id = threadFactory_->getCurrentThreadId();
+  return idMap_.find(id) == idMap_.end();
+}
+
+void PriorityThreadManager::Impl::add(shared_ptr<Runnable> value,
+                                      PRIORITY priority,
+                                      int64_t timeout,
+                                      int64_t expiration) {
+  const size_t ln = lane(priority);
+
+  Guard g(mutex_, timeout);
+
+  if (!g) {
+    throw TimedOutException();
+  }
+
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("PriorityThreadManager::Impl::add "
+                                "ThreadManager not started");
+  }
+
+  removeExpiredTasks();
+  if (pendingTaskCountMax_[ln] > 0 && (tasks_[ln].size() >= pendingTaskCountMax_[ln])) {
+    if (canSleep() && timeout >= 0) {
+      while (pendingTaskCountMax_[ln] > 0 && tasks_[ln].size() >= pendingTaskCountMax_[ln]) {
+        // This is thread safe because the mutex is shared between monitors.
+        maxMonitors_[ln]->wait(timeout);
+      }
+    } else {
+      throw TooManyPendingTasksException();
+    }
+  }
+
+  tasks_[ln].push(shared_ptr<PriorityThreadManager::Task>(new PriorityThreadManager::Task(value, expiration)));
+  taskCount_++;
+
+  // Prefer a worker reserved for this priority, so that general workers
+  // stay free for the other lanes.  A reserved worker already woken for an
+  // earlier task doesn't count: it may be about to run that one.
+  if (!wakeIdleWorker(ln)) {
+    wakeIdleWorker(GENERAL);
+  }
+}
+
+void PriorityThreadManager::Impl::remove(shared_ptr<Runnable> task) {
+  (void) task;
+  Synchronized s(monitor_);
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("PriorityThreadManager::Impl::remove "
+                                "ThreadManager not started");
+  }
+}
+
+shared_ptr<Runnable> PriorityThreadManager::Impl::removeNextPending() {
+  Guard g(mutex_);
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("PriorityThreadManager::Impl::removeNextPending "
+                                "ThreadManager not started");
+  }
+
+  for (size_t ln = 0; ln < GENERAL; ln++) {
+    if (!tasks_[ln].empty()) {
+      shared_ptr<PriorityThreadManager::Task> task = tasks_[ln].front();
+      tasks_[ln].pop();
+      taskCount_--;
+      return task->getRunnable();
+    }
+  }
+
+  return shared_ptr<Runnable>();
+}
+
+void PriorityThreadManager::Impl::removeExpiredTasks() {
+  int64_t now = 0LL; // we won't ask for the time untile we need it
+
+  // note that each loop breaks at the first non-expiring task of its lane
+  for (size_t ln = 0; ln < GENERAL; ln++) {
+    std::queue<shared_ptr<PriorityThreadManager::Task> >& tasks = tasks_[ln];
+    while (!tasks.empty()) {
+      shared_ptr<PriorityThreadManager::Task> task = tasks.front();
+      if (task->getExpireTime() == 0LL) {
+        break;
+      }
+      if (now == 0LL) {
+        now = Util::currentTime();
+      }
+      if (task->getExpireTime() > now) {
+        break;
+      }
+      if (expireCallback_) {
+        expireCallback_(task->getRunnable());
+      }
+      tasks.pop();
+      taskCount_--;
+      expiredCount_++;
+    }
+  }
+}
+
+int64_t PriorityThreadManager::Impl::pendingTaskWaitTime() const {
+  Synchronized s(monitor_);
+  int64_t oldest = 0LL;
+  for (size_t ln = 0; ln < GENERAL; ln++) {
+    if (!tasks_[ln].empty() &&
+        (oldest == 0LL || tasks_[ln].front()->getEnqueueTime() < oldest)) {
+      oldest = tasks_[ln].front()->getEnqueueTime();
+    }
+  }
+  return oldest == 0LL ? 0LL : Util::currentTime() - oldest;
+}
+
+size_t PriorityThreadManager::Impl::blockedWorkerCount(int64_t threshold) const {
+  Synchronized s(monitor_);
+  int64_t now = Util::currentTime();
+  size_t result = 0;
+  for (std::vector<PriorityThreadManager::Worker*>::const_iterator ix = activeWorkers_.begin(); ix != activeWorkers_.end(); ix++) {
+    if ((*ix)->taskStart_ != 0LL && now - (*ix)->taskStart_ >= threshold) {
+      result++;
+    }
+  }
+  return result;
+}
+
+void PriorityThreadManager::Impl::setExpireCallback(ExpireCallback expireCallback) {
+  expireCallback_ = expireCallback;
+}
+
+class SimplePriorityThreadManager : public PriorityThreadManager::Impl {
+
+ public:
+  SimplePriorityThreadManager(size_t workerCount=4, size_t pendingTaskCountMax=0) :
+    workerCount_(workerCount),
+    firstTime_(true) {
+    for (int ix = HIGHEST; ix < N_PRIORITIES; ix++) {
+      PriorityThreadManager::Impl::pendingTaskCountMax(static_cast<PRIORITY>(ix), pendingTaskCountMax);
+    }
+  }
+
+  void start() {
+    PriorityThreadManager::Impl::start();
+    if (firstTime_) {
+      firstTime_ = false;
+      addWorker(workerCount_);
+    }
+  }
+
+ private:
+  const size_t workerCount_;
+  bool firstTime_;
+};
+
+
+shared_ptr<PriorityThreadManager> PriorityThreadManager::newPriorityThreadManager(size_t count, size_t pendingTaskCountMax) {
+  return shared_ptr<PriorityThreadManager>(new SimplePriorityThreadManager(count, pendingTaskCountMax));
+}
+
+}}} // apache::thrift::concurrency
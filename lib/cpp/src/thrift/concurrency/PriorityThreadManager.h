@@ -0,0 +1,114 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_PRIORITYTHREADMANAGER_H_
+#define _THRIFT_CONCURRENCY_PRIORITYTHREADMANAGER_H_ 1
+
+#include "ThreadManager.h"
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * Thread Pool Manager with priority lanes.
+ *
+ * Pending tasks are kept in one FIFO queue per priority, so a cheap, urgent
+ * task never waits behind a backlog of expensive ones.  General workers
+ * always take the oldest task from the highest non-empty priority.
+ * Workers can also be reserved for a single priority; a reserved worker only
+ * runs tasks of its own priority, which keeps that lane moving even while
+ * every general worker is busy.
+ *
+ * Each priority has its own pendingTaskCountMax.  The add() inherited from
+ * ThreadManager queues at NORMAL priority.
+ */
+class PriorityThreadManager : public ThreadManager {
+
+ protected:
+  PriorityThreadManager() {}
+
+ public:
+  enum PRIORITY {
+    HIGHEST = 0,
+    HIGH,
+    NORMAL,
+    LOW,
+    LOWEST,
+    N_PRIORITIES
+  };
+
+  using ThreadManager::add;
+  using ThreadManager::addWorker;
+  using ThreadManager::removeWorker;
+  using ThreadManager::pendingTaskCount;
+  using ThreadManager::pendingTaskCountMax;
+
+  /**
+   * Adds a task at the given priority.  Blocking, timeout and expiration
+   * behave as for ThreadManager::add(), except that the pending task limit
+   * is the one for that priority.
+   */
+  virtual void add(boost::shared_ptr<Runnable> task,
+                   PRIORITY priority,
+                   int64_t timeout=0LL,
+                   int64_t expiration=0LL) = 0;
+
+  /**
+   * Adds workers reserved for one priority.
+   */
+  virtual void addWorker(size_t value, PRIORITY priority) = 0;
+
+  /**
+   * Removes workers reserved for one priority.
+   */
+  virtual void removeWorker(size_t value, PRIORITY priority) = 0;
+
+  /**
+   * Gets the current number of pending tasks at the given priority
+   */
+  virtual size_t pendingTaskCount(PRIORITY priority) const = 0;
+
+  /**
+   * Gets the maximum pending task count for the given priority.  0 indicates
+   * no maximum
+   */
+  virtual size_t pendingTaskCountMax(PRIORITY priority) const = 0;
+
+  /**
+   * Sets the maximum pending task count for the given priority.
+   */
+  virtual void pendingTaskCountMax(PRIORITY priority, size_t value) = 0;
+
+  /**
+   * Creates a priority thread manager with count general workers and a
+   * maximum of pendingTaskCountMax pending tasks at each priority.  The
+   * default, 0, specifies no limit.  Reserved workers can be added with
+   * addWorker(value, priority) before or after start().
+   */
+  static boost::shared_ptr<PriorityThreadManager> newPriorityThreadManager(size_t count=4, size_t pendingTaskCountMax=0);
+
+  class Task;
+
+  class Worker;
+
+  class Impl;
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_PRIORITYTHREADMANAGER_H_
@@ -29,8 +29,10 @@
 #include <boost/shared_ptr.hpp>
 
 #include <assert.h>
+#include <algorithm>
 #include <queue>
 #include <set>
+#include <vector>
 
 #if defined(DEBUG)
 #include <iostream>
@@ -121,6 +123,10 @@ class ThreadManager::Impl : public ThreadManager  {
     return result;
   }
 
+  int64_t pendingTaskWaitTime() const;
+
+  size_t blockedWorkerCount(int64_t threshold) const;
+
   void pendingTaskCountMax(const size_t value) {
     Synchronized s(monitor_);
     pendingTaskCountMax_ = value;
@@ -160,6 +166,7 @@ private:
   Monitor workerMonitor_;
 
   friend class ThreadManager::Worker;
+  std::vector<ThreadManager::Worker*> activeWorkers_;
   std::set<shared_ptr<Thread> > workers_;
   std::set<shared_ptr<Thread> > deadWorkers_;
   std::map<const Thread::id_t, shared_ptr<Thread> > idMap_;
@@ -178,7 +185,8 @@ class ThreadManager::Task : public Runnable {
   Task(shared_ptr<Runnable> runnable, int64_t expiration=0LL)  :
     runnable_(runnable),
     state_(WAITING),
-    expireTime_(expiration != 0LL ? Util::currentTime() + expiration : 0LL) {}
+    enqueueTime_(Util::currentTime()),
+    expireTime_(expiration != 0LL ? enqueueTime_ + expiration : 0LL) {}
 
   ~Task() {}
 
@@ -193,6 +201,10 @@ class ThreadManager::Task : public Runnable {
     return runnable_;
   }
 
+  int64_t getEnqueueTime() const {
+    return enqueueTime_;
+  }
+
   int64_t getExpireTime() const {
     return expireTime_;
   }
@@ -201,6 +213,7 @@ class ThreadManager::Task : public Runnable {
   shared_ptr<Runnable> runnable_;
   friend class ThreadManager::Worker;
   STATE state_;
+  int64_t enqueueTime_;
   int64_t expireTime_;
 };
 
@@ -217,7 +230,8 @@ class ThreadManager::Worker: public Runnable {
   Worker(ThreadManager::Impl* manager) :
     manager_(manager),
     state_(UNINITIALIZED),
-    idle_(false) {}
+    idle_(false),
+    taskStart_(0LL) {}
 
   ~Worker() {}
 
@@ -251,6 +265,7 @@ class ThreadManager::Worker: public Runnable {
       active = manager_->workerCount_ < manager_->workerMaxCount_;
       if (active) {
         manager_->workerCount_++;
+        manager_->activeWorkers_.push_back(this);
         notifyManager = manager_->workerCount_ == manager_->workerMaxCount_;
       }
     }
@@ -258,7 +273,6 @@ class ThreadManager::Worker: public Runnable {
     if (notifyManager) {
       Synchronized s(manager_->workerMonitor_);
       manager_->workerMonitor_.notify();
-      notifyManager = false;
     }
 
     while (active) {
@@ -275,6 +289,7 @@ class ThreadManager::Worker: public Runnable {
        */
       {
         Guard g(manager_->mutex_);
+        taskStart_ = 0LL;
         active = isActive();
 
         while (active && manager_->tasks_.empty()) {
@@ -294,6 +309,7 @@ class ThreadManager::Worker: public Runnable {
             manager_->tasks_.pop();
             if (task->state_ == ThreadManager::Task::WAITING) {
               task->state_ = ThreadManager::Task::EXECUTING;
+              taskStart_ = Util::currentTime();
             }
 
             /* If we have a pending task max and we just dropped below it, wakeup any
@@ -306,7 +322,9 @@ class ThreadManager::Worker: public Runnable {
         } else {
           idle_ = true;
           manager_->workerCount_--;
-          notifyManager = (manager_->workerCount_ == manager_->workerMaxCount_);
+          manager_->activeWorkers_.erase(std::find(manager_->activeWorkers_.begin(),
+                                                   manager_->activeWorkers_.end(),
+                                                   this));
         }
       }
 
@@ -321,12 +339,14 @@ class ThreadManager::Worker: public Runnable {
       }
     }
 
+    /**
+     * removeWorker() waits for this as well as for the worker count, since
+     * the manager may be destroyed as soon as it returns.
+     */
     {
       Synchronized s(manager_->workerMonitor_);
       manager_->deadWorkers_.insert(this->thread());
-      if (notifyManager) {
-        manager_->workerMonitor_.notify();
-      }
+      manager_->workerMonitor_.notify();
     }
 
     return;
@@ -337,6 +357,8 @@ class ThreadManager::Worker: public Runnable {
     friend class ThreadManager::Impl;
     STATE state_;
     bool idle_;
+    // When the running task was started, 0 if none.  Guarded by manager mutex
+    int64_t taskStart_;
 };
 
 
@@ -443,7 +465,8 @@ void ThreadManager::Impl::removeWorker(size_t value) {
   {
     Synchronized s(workerMonitor_);
 
-    while (workerCount_ != workerMaxCount_) {
+    while (workerCount_ != workerMaxCount_ ||
+           workers_.size() - deadWorkers_.size() > workerMaxCount_) {
       workerMonitor_.wait();
     }
 
@@ -546,6 +569,26 @@ void ThreadManager::Impl::removeExpiredTasks() {
 }
 
 
+int64_t ThreadManager::Impl::pendingTaskWaitTime() const {
+  Synchronized s(monitor_);
+  if (tasks_.empty()) {
+    return 0LL;
+  }
+  return Util::currentTime() - tasks_.front()->getEnqueueTime();
+}
+
+size_t ThreadManager::Impl::blockedWorkerCount(int64_t threshold) const {
+  Synchronized s(monitor_);
+  int64_t now = Util::currentTime();
+  size_t result = 0;
+  for (std::vector<ThreadManager::Worker*>::const_iterator ix = activeWorkers_.begin(); ix != activeWorkers_.end(); ix++) {
+    if ((*ix)->taskStart_ != 0LL && now - (*ix)->taskStart_ >= threshold) {
+      result++;
+    }
+  }
+  return result;
+}
+
 void ThreadManager::Impl::setExpireCallback(ExpireCallback expireCallback) {
   expireCallback_ = expireCallback;
 }
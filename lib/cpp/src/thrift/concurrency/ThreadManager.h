@@ -133,6 +133,25 @@ class ThreadManager {
    */
   virtual size_t expiredTaskCount() = 0;
 
+  /**
+   * Gets how long, in milliseconds, the oldest pending task has been waiting
+   * to run.  0 if there is no pending task, or if this thread manager does
+   * not track it.
+   */
+  virtual int64_t pendingTaskWaitTime() const {
+    return 0LL;
+  }
+
+  /**
+   * Gets the number of workers that have been running their current task
+   * for at least threshold milliseconds, typically because the task is
+   * blocked on I/O.  0 if this thread manager does not track it.
+   */
+  virtual size_t blockedWorkerCount(int64_t threshold) const {
+    (void) threshold;
+    return 0;
+  }
+
   /**
    * Adds a task to be executed at some time in the future by a worker thread.
    *
@@ -190,6 +209,17 @@ class ThreadManager {
    */
   static boost::shared_ptr<ThreadManager> newSimpleThreadManager(size_t count=4, size_t pendingTaskCountMax=0);
 
+  /**
+   * Creates a thread manager like newSimpleThreadManager(), but which keeps
+   * pending tasks in per-worker lock-free queues and lets idle workers steal
+   * from busy ones, instead of sharing one locked queue.  Tasks added from
+   * a worker thread stay on that worker's own queue.  Order of execution is
+   * only roughly FIFO, and expired tasks are dropped when a worker reaches
+   * them rather than by removeExpiredTasks().  Needs GCC atomic builtins;
+   * elsewhere this returns a simple thread manager.
+   */
+  static boost::shared_ptr<ThreadManager> newWorkStealingThreadManager(size_t count=4, size_t pendingTaskCountMax=0);
+
   class Task;
 
   class Worker;
@@ -0,0 +1,210 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "ThreadManagerScaler.h"
+#include "Exception.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+using boost::shared_ptr;
+
+class ThreadManagerScaler::Dispatcher: public Runnable {
+
+ public:
+  Dispatcher(ThreadManagerScaler* scaler) :
+    scaler_(scaler) {}
+
+  ~Dispatcher() {}
+
+  /**
+   * Dispatcher entry point
+   *
+   * As long as the scaler is running, adjust the thread manager once every
+   * interval.
+   */
+  void run() {
+    {
+      Synchronized s(scaler_->monitor_);
+      if (scaler_->state_ == ThreadManagerScaler::STARTING) {
+        scaler_->state_ = ThreadManagerScaler::STARTED;
+        scaler_->monitor_.notifyAll();
+      }
+    }
+
+    while (true) {
+      {
+        Synchronized s(scaler_->monitor_);
+        if (scaler_->state_ == ThreadManagerScaler::STARTED) {
+          try {
+            scaler_->monitor_.wait(scaler_->interval_);
+          } catch (TimedOutException &e) {}
+        }
+        if (scaler_->state_ != ThreadManagerScaler::STARTED) {
+          break;
+        }
+      }
+
+      try {
+        scaler_->adjust();
+      } catch (TException& e) {
+        GlobalOutput.printf("ThreadManagerScaler: adjust failed: %s", e.what());
+      }
+    }
+
+    {
+      Synchronized s(scaler_->monitor_);
+      scaler_->state_ = ThreadManagerScaler::STOPPED;
+      scaler_->monitor_.notifyAll();
+    }
+  }
+
+ private:
+  ThreadManagerScaler* scaler_;
+};
+
+ThreadManagerScaler::ThreadManagerScaler(shared_ptr<ThreadManager> threadManager,
+                                         size_t minWorkerCount,
+                                         size_t maxWorkerCount) :
+  threadManager_(threadManager),
+  minWorkerCount_(minWorkerCount),
+  maxWorkerCount_(maxWorkerCount),
+  interval_(100LL),
+  maxWaitTime_(10LL),
+  blockedTime_(1000LL),
+  idleTime_(10000LL),
+  idleSince_(0LL),
+  state_(ThreadManagerScaler::UNINITIALIZED),
+  dispatcher_(shared_ptr<Dispatcher>(new Dispatcher(this))) {
+  if (minWorkerCount > maxWorkerCount) {
+    throw InvalidArgumentException();
+  }
+}
+
+ThreadManagerScaler::~ThreadManagerScaler() {
+  stop();
+}
+
+shared_ptr<ThreadFactory> ThreadManagerScaler::threadFactory() const {
+  Synchronized s(monitor_);
+  return threadFactory_;
+}
+
+void ThreadManagerScaler::threadFactory(shared_ptr<ThreadFactory> value) {
+  Synchronized s(monitor_);
+  threadFactory_ = value;
+}
+
+void ThreadManagerScaler::start() {
+  bool doStart = false;
+  {
+    Synchronized s(monitor_);
+    if (threadFactory_ == NULL) {
+      threadFactory_ = threadManager_->threadFactory();
+    }
+    if (threadFactory_ == NULL) {
+      throw InvalidArgumentException();
+    }
+    if (state_ == ThreadManagerScaler::UNINITIALIZED) {
+      state_ = ThreadManagerScaler::STARTING;
+      doStart = true;
+    }
+  }
+
+  if (doStart) {
+    dispatcherThread_ = threadFactory_->newThread(dispatcher_);
+    dispatcherThread_->start();
+  }
+
+  {
+    Synchronized s(monitor_);
+    while (state_ == ThreadManagerScaler::STARTING) {
+      monitor_.wait();
+    }
+  }
+}
+
+void ThreadManagerScaler::stop() {
+  Synchronized s(monitor_);
+  if (state_ == ThreadManagerScaler::UNINITIALIZED) {
+    state_ = ThreadManagerScaler::STOPPED;
+  } else if (state_ != STOPPING && state_ != STOPPED) {
+    state_ = STOPPING;
+    monitor_.notifyAll();
+  }
+  while (state_ != STOPPED) {
+    monitor_.wait();
+  }
+}
+
+ThreadManagerScaler::STATE ThreadManagerScaler::state() const {
+  return state_;
+}
+
+void ThreadManagerScaler::adjust() {
+  if (threadManager_->state() != ThreadManager::STARTED) {
+    return;
+  }
+
+  size_t workers = threadManager_->workerCount();
+  size_t idle = threadManager_->idleWorkerCount();
+  size_t pending = threadManager_->pendingTaskCount();
+
+  if (workers < minWorkerCount_) {
+    threadManager_->addWorker(minWorkerCount_ - workers);
+    return;
+  }
+
+  if (pending > 0) {
+    idleSince_ = 0LL;
+
+    size_t grow = 0;
+    if (idle == 0) {
+      grow = threadManager_->blockedWorkerCount(blockedTime_);
+    }
+    if (threadManager_->pendingTaskWaitTime() >= maxWaitTime_) {
+      grow = std::max(grow, std::max<size_t>(1, std::min(pending, workers / 2)));
+    }
+    grow = std::min(grow, maxWorkerCount_ > workers ? maxWorkerCount_ - workers : 0);
+    if (grow > 0) {
+      threadManager_->addWorker(grow);
+    }
+    return;
+  }
+
+  if (idle == 0 || workers <= minWorkerCount_) {
+    idleSince_ = 0LL;
+    return;
+  }
+
+  int64_t now = Util::currentTime();
+  if (idleSince_ == 0LL) {
+    idleSince_ = now;
+  } else if (now - idleSince_ >= idleTime_) {
+    // Shrink gradually: the next step waits for another idleTime
+    idleSince_ = now;
+    threadManager_->removeWorker(std::min(std::max<size_t>(1, idle / 2),
+                                          workers - minWorkerCount_));
+  }
+}
+
+}}} // apache::thrift::concurrency
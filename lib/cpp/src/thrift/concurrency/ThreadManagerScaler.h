@@ -0,0 +1,149 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_THREADMANAGERSCALER_H_
+#define _THRIFT_CONCURRENCY_THREADMANAGERSCALER_H_ 1
+
+#include "Monitor.h"
+#include "Thread.h"
+#include "ThreadManager.h"
+
+#include <boost/shared_ptr.hpp>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * Thread Manager Scaler
+ *
+ * Grows and shrinks the worker pool of a ThreadManager between a minimum
+ * and a maximum size.  Every interval it looks at the thread manager and:
+ *
+ * - adds workers when the oldest pending task has waited maxWaitTime or
+ *   longer, or when tasks are pending, no worker is idle and some workers
+ *   are blocked, i.e. have been running one task for blockedTime or longer.
+ *   It adds one worker per blocked worker, or, when tasks wait too long,
+ *   half again the current pool size (but no more than the pending tasks),
+ *   whichever is more.
+ * - removes half of the idle workers once workers have stayed idle, with
+ *   nothing pending, for idleTime.
+ *
+ * The bounds apply to the thread manager's total worker count, but only
+ * general workers are added and removed; workers reserved for a priority of
+ * a PriorityThreadManager are left alone.  Blocked workers can only be
+ * detected, and wait times only measured, by thread managers that track
+ * them (see ThreadManager::pendingTaskWaitTime()).
+ */
+class ThreadManagerScaler {
+
+ public:
+  ThreadManagerScaler(boost::shared_ptr<ThreadManager> threadManager,
+                      size_t minWorkerCount,
+                      size_t maxWorkerCount);
+
+  virtual ~ThreadManagerScaler();
+
+  /**
+   * The thread factory for the scaler's own thread.  Defaults to the thread
+   * manager's.
+   */
+  virtual boost::shared_ptr<ThreadFactory> threadFactory() const;
+
+  virtual void threadFactory(boost::shared_ptr<ThreadFactory> value);
+
+  /**
+   * Starts the scaler.  The thread manager must be started first.
+   *
+   * @throws InvalidArgumentException Missing thread factory
+   */
+  virtual void start();
+
+  /**
+   * Stops the scaler, leaving the thread manager with the workers it has.
+   */
+  virtual void stop();
+
+  /**
+   * Looks at the thread manager once and adds or removes workers.  Called
+   * by the scaler every interval; exposed so that callers can drive it from
+   * their own timer instead of starting the scaler.
+   */
+  virtual void adjust();
+
+  /**
+   * Milliseconds between adjustments.  Default 100.
+   */
+  int64_t interval() const { return interval_; }
+
+  void interval(int64_t value) { interval_ = value; }
+
+  /**
+   * Pending task wait time, in milliseconds, above which workers are added.
+   * Default 10.
+   */
+  int64_t maxWaitTime() const { return maxWaitTime_; }
+
+  void maxWaitTime(int64_t value) { maxWaitTime_ = value; }
+
+  /**
+   * Milliseconds a worker must spend on one task to count as blocked.
+   * Default 1000.
+   */
+  int64_t blockedTime() const { return blockedTime_; }
+
+  void blockedTime(int64_t value) { blockedTime_ = value; }
+
+  /**
+   * Milliseconds workers must stay idle before idle workers are removed.
+   * Default 10000.
+   */
+  int64_t idleTime() const { return idleTime_; }
+
+  void idleTime(int64_t value) { idleTime_ = value; }
+
+  enum STATE {
+    UNINITIALIZED,
+    STARTING,
+    STARTED,
+    STOPPING,
+    STOPPED
+  };
+
+  virtual STATE state() const;
+
+ private:
+  boost::shared_ptr<ThreadManager> threadManager_;
+  boost::shared_ptr<ThreadFactory> threadFactory_;
+  const size_t minWorkerCount_;
+  const size_t maxWorkerCount_;
+  int64_t interval_;
+  int64_t maxWaitTime_;
+  int64_t blockedTime_;
+  int64_t idleTime_;
+  int64_t idleSince_;
+  Monitor monitor_;
+  STATE state_;
+  class Dispatcher;
+  friend class Dispatcher;
+  boost::shared_ptr<Dispatcher> dispatcher_;
+  boost::shared_ptr<Thread> dispatcherThread_;
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_THREADMANAGERSCALER_H_
@@ -21,9 +21,10 @@
 #include "Exception.h"
 #include "Util.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
-#include <set>
+#include <limits>
 
 namespace apache { namespace thrift { namespace concurrency {
 
@@ -44,9 +45,14 @@ class TimerManager::Task : public Runnable {
     COMPLETE
   };
 
-  Task(shared_ptr<Runnable> runnable) :
+  Task(shared_ptr<Runnable> runnable, int64_t expiration) :
     runnable_(runnable),
-    state_(WAITING) {}
+    state_(WAITING),
+    expiration_(expiration),
+    level_(0),
+    slot_(0),
+    prev_(NULL),
+    next_(NULL) {}
 
   ~Task() {
   }
@@ -61,7 +67,16 @@ class TimerManager::Task : public Runnable {
  private:
   shared_ptr<Runnable> runnable_;
   friend class TimerManager::Dispatcher;
+  friend class TimerManager;
   STATE state_;
+  int64_t expiration_;
+  // Position in the wheel while WAITING
+  int level_;
+  int slot_;
+  Task* prev_;
+  Task* next_;
+  // The wheel's own reference, held while WAITING
+  shared_ptr<Task> self_;
 };
 
 class TimerManager::Dispatcher: public Runnable {
@@ -75,8 +90,8 @@ class TimerManager::Dispatcher: public Runnable {
   /**
    * Dispatcher entry point
    *
-   * As long as dispatcher thread is running, pull tasks off the task taskMap_
-   * and execute.
+   * As long as dispatcher thread is running, turn the wheel, sleeping until
+   * it next needs turning, and execute the tasks that fall due.
    */
   void run() {
     {
@@ -88,38 +103,33 @@ class TimerManager::Dispatcher: public Runnable {
     }
 
     do {
-      std::set<shared_ptr<TimerManager::Task> > expiredTasks;
+      std::vector<shared_ptr<TimerManager::Task> > expiredTasks;
       {
         Synchronized s(manager_->monitor_);
-        task_iterator expiredTaskEnd;
-        int64_t now = Util::currentTime();
-        while (manager_->state_ == TimerManager::STARTED &&
-               (expiredTaskEnd = manager_->taskMap_.upper_bound(now)) == manager_->taskMap_.begin()) {
+        while (manager_->state_ == TimerManager::STARTED) {
+          int64_t now = Util::currentTime();
+          manager_->advance(now, expiredTasks);
+          if (!expiredTasks.empty()) {
+            break;
+          }
+
+          int64_t next = manager_->nextTick();
           int64_t timeout = 0LL;
-          if (!manager_->taskMap_.empty()) {
-            timeout = manager_->taskMap_.begin()->first - now;
+          if (next != 0) {
+            timeout = next - now;
+            manager_->wakeTime_ = next;
+          } else {
+            manager_->wakeTime_ = std::numeric_limits<int64_t>::max();
           }
           assert((timeout != 0 && manager_->taskCount_ > 0) || (timeout == 0 && manager_->taskCount_ == 0));
           try {
             manager_->monitor_.wait(timeout);
           } catch (TimedOutException &e) {}
-          now = Util::currentTime();
-        }
-
-        if (manager_->state_ == TimerManager::STARTED) {
-          for (task_iterator ix = manager_->taskMap_.begin(); ix != expiredTaskEnd; ix++) {
-            shared_ptr<TimerManager::Task> task = ix->second;
-            expiredTasks.insert(task);
-            if (task->state_ == TimerManager::Task::WAITING) {
-              task->state_ = TimerManager::Task::EXECUTING;
-            }
-            manager_->taskCount_--;
-          }
-          manager_->taskMap_.erase(manager_->taskMap_.begin(), expiredTaskEnd);
+          manager_->wakeTime_ = 0LL;
         }
       }
 
-      for (std::set<shared_ptr<Task> >::iterator ix =  expiredTasks.begin(); ix != expiredTasks.end(); ix++) {
+      for (std::vector<shared_ptr<Task> >::iterator ix = expiredTasks.begin(); ix != expiredTasks.end(); ix++) {
         (*ix)->run();
       }
 
@@ -141,9 +151,15 @@ class TimerManager::Dispatcher: public Runnable {
 };
 
 TimerManager::TimerManager() :
+  wheelTime_(Util::currentTime()),
+  wakeTime_(0LL),
   taskCount_(0),
   state_(TimerManager::UNINITIALIZED),
   dispatcher_(shared_ptr<Dispatcher>(new Dispatcher(this))) {
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    std::fill(wheel_[level], wheel_[level] + WHEEL_SIZE, static_cast<Task*>(NULL));
+    levelCount_[level] = 0;
+  }
 }
 
 
@@ -207,7 +223,10 @@ void TimerManager::stop() {
 
   if (doStop) {
     // Clean up any outstanding tasks
-    taskMap_.clear();
+    {
+      Synchronized s(monitor_);
+      clear();
+    }
 
     // Remove dispatcher's reference to us.
     dispatcher_->manager_ = NULL;
@@ -229,8 +248,16 @@ size_t TimerManager::taskCount() const {
 }
 
 void TimerManager::add(shared_ptr<Runnable> task, int64_t timeout) {
+  schedule(task, timeout);
+}
+
+void TimerManager::add(shared_ptr<Runnable> task, const struct timespec& value) {
+  schedule(task, value);
+}
+
+TimerManager::Timer TimerManager::schedule(shared_ptr<Runnable> task, int64_t timeout) {
   int64_t now = Util::currentTime();
-  timeout += now;
+  shared_ptr<Task> timer(new Task(task, now + timeout));
 
   {
     Synchronized s(monitor_);
@@ -238,24 +265,27 @@ void TimerManager::add(shared_ptr<Runnable> task, int64_t timeout) {
       throw IllegalStateException();
     }
 
-    // If the task map is empty, we will kick the dispatcher for sure. Otherwise, we kick him
-    // if the expiration time is shorter than the current value. Need to test before we insert,
-    // because the new task might insert at the front.
-    bool notifyRequired = (taskCount_ == 0) ? true : timeout < taskMap_.begin()->first;
+    // With nothing pending the wheel can skip straight to now, which keeps
+    // the new task on the lowest level that will hold it
+    if (taskCount_ == 0 && wheelTime_ < now) {
+      wheelTime_ = now;
+    }
 
+    timer->self_ = timer;
+    link(timer.get());
     taskCount_++;
-    taskMap_.insert(std::pair<int64_t, shared_ptr<Task> >(timeout, shared_ptr<Task>(new Task(task))));
 
-    // If the task map was empty, or if we have an expiration that is earlier
-    // than any previously seen, kick the dispatcher so it can update its
-    // timeout
-    if (notifyRequired) {
+    // If the dispatcher is asleep until after this task falls due, kick it
+    // so it can update its timeout
+    if (timer->expiration_ < wakeTime_) {
       monitor_.notify();
     }
   }
+
+  return timer;
 }
 
-void TimerManager::add(shared_ptr<Runnable> task, const struct timespec& value) {
+TimerManager::Timer TimerManager::schedule(shared_ptr<Runnable> task, const struct timespec& value) {
 
   int64_t expiration;
   Util::toMilliseconds(expiration, value);
@@ -266,16 +296,174 @@ void TimerManager::add(shared_ptr<Runnable> task, const struct timespec& value)
     throw  InvalidArgumentException();
   }
 
-  add(task, expiration - now);
+  return schedule(task, expiration - now);
 }
 
 
 void TimerManager::remove(shared_ptr<Runnable> task) {
-  (void) task;
+  std::vector<shared_ptr<Task> > removed;
   Synchronized s(monitor_);
   if (state_ != TimerManager::STARTED) {
     throw IllegalStateException();
   }
+
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    if (levelCount_[level] == 0) {
+      continue;
+    }
+    for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+      Task* timer = wheel_[level][slot];
+      while (timer != NULL) {
+        Task* next = timer->next_;
+        if (timer->runnable_ == task) {
+          unlink(timer);
+          timer->state_ = Task::CANCELLED;
+          removed.push_back(timer->self_);
+          timer->self_.reset();
+          taskCount_--;
+        }
+        timer = next;
+      }
+    }
+  }
+
+  if (removed.empty()) {
+    throw NoSuchTaskException();
+  }
+}
+
+void TimerManager::remove(Timer timer) {
+  shared_ptr<Task> task = timer.lock();
+  Synchronized s(monitor_);
+  if (state_ != TimerManager::STARTED) {
+    throw IllegalStateException();
+  }
+  if (task == NULL || task->state_ == Task::CANCELLED || task->state_ == Task::COMPLETE) {
+    throw NoSuchTaskException();
+  }
+  if (task->state_ != Task::WAITING) {
+    throw UncancellableTaskException();
+  }
+
+  unlink(task.get());
+  task->state_ = Task::CANCELLED;
+  task->self_.reset();
+  taskCount_--;
+}
+
+void TimerManager::link(Task* task) {
+  // Tasks already due go in the next slot to be turned
+  int64_t expiration = std::max(task->expiration_, wheelTime_ + 1);
+  int64_t delta = expiration - wheelTime_;
+
+  int level = 0;
+  while (level < WHEEL_LEVELS - 1 && delta >= (1LL << (WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+
+  // Tasks beyond the range of the wheel wait in the last slot of the top
+  // level and are linked again when it comes round
+  expiration = std::min<int64_t>(expiration, wheelTime_ + (1LL << (WHEEL_BITS * WHEEL_LEVELS)) - 1);
+
+  int slot = static_cast<int>((expiration >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1));
+
+  task->level_ = level;
+  task->slot_ = slot;
+  task->prev_ = NULL;
+  task->next_ = wheel_[level][slot];
+  if (task->next_ != NULL) {
+    task->next_->prev_ = task;
+  }
+  wheel_[level][slot] = task;
+  levelCount_[level]++;
+}
+
+void TimerManager::unlink(Task* task) {
+  if (task->prev_ != NULL) {
+    task->prev_->next_ = task->next_;
+  } else {
+    wheel_[task->level_][task->slot_] = task->next_;
+  }
+  if (task->next_ != NULL) {
+    task->next_->prev_ = task->prev_;
+  }
+  task->prev_ = NULL;
+  task->next_ = NULL;
+  levelCount_[task->level_]--;
+}
+
+void TimerManager::advance(int64_t now, std::vector<shared_ptr<Task> >& expired) {
+  while (true) {
+    int64_t next = nextTick();
+    if (next == 0 || next > now) {
+      wheelTime_ = std::max(wheelTime_, now);
+      return;
+    }
+    wheelTime_ = next;
+
+    // When a level completes a turn, bring the next slot of the level above
+    // down into it
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+      int shift = WHEEL_BITS * level;
+      if ((wheelTime_ & ((1LL << shift) - 1)) != 0) {
+        break;
+      }
+      int slot = static_cast<int>((wheelTime_ >> shift) & (WHEEL_SIZE - 1));
+      Task* task;
+      while ((task = wheel_[level][slot]) != NULL) {
+        unlink(task);
+        link(task);
+      }
+    }
+
+    Task* task;
+    while ((task = wheel_[0][wheelTime_ & (WHEEL_SIZE - 1)]) != NULL) {
+      unlink(task);
+      if (task->expiration_ > wheelTime_) {
+        link(task);
+        continue;
+      }
+      task->state_ = Task::EXECUTING;
+      expired.push_back(task->self_);
+      task->self_.reset();
+      taskCount_--;
+    }
+  }
+}
+
+int64_t TimerManager::nextTick() const {
+  if (levelCount_[0] > 0) {
+    int64_t end = ((wheelTime_ >> WHEEL_BITS) + 1) << WHEEL_BITS;
+    for (int64_t tick = wheelTime_ + 1; tick < end; tick++) {
+      if (wheel_[0][tick & (WHEEL_SIZE - 1)] != NULL) {
+        return tick;
+      }
+    }
+    return end;
+  }
+
+  // Nothing can fall due before the lowest occupied level next cascades
+  for (int level = 1; level < WHEEL_LEVELS; level++) {
+    if (levelCount_[level] > 0) {
+      int shift = WHEEL_BITS * level;
+      return ((wheelTime_ >> shift) + 1) << shift;
+    }
+  }
+  return 0;
+}
+
+void TimerManager::clear() {
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+      Task* task;
+      while ((task = wheel_[level][slot]) != NULL) {
+        unlink(task);
+        task->state_ = Task::CANCELLED;
+        task->self_.reset();
+      }
+    }
+  }
+  taskCount_ = 0;
 }
 
 TimerManager::STATE TimerManager::state() const { return state_; }
@@ -25,8 +25,9 @@
 #include "Thread.h"
 
 #include <boost/shared_ptr.hpp>
-#include <map>
+#include <boost/weak_ptr.hpp>
 #include <time.h>
+#include <vector>
 
 namespace apache { namespace thrift { namespace concurrency {
 
@@ -35,12 +36,28 @@ namespace apache { namespace thrift { namespace concurrency {
  *
  * This class dispatches timer tasks when they fall due.
  *
+ * Pending tasks are kept in a hierarchical timing wheel with a resolution
+ * of one millisecond: WHEEL_LEVELS levels of WHEEL_SIZE slots, each level
+ * covering WHEEL_SIZE times the span of the one below.  A task goes in the
+ * slot for its expiration time on the lowest level whose span covers its
+ * timeout, and moves down a level each time the wheel below it completes a
+ * turn.  Adding and removing tasks are constant time, and all the tasks in
+ * a slot expire together, so timeouts that are nearly always cancelled
+ * before they fall due are cheap.
+ *
  * @version $Id:$
  */
 class TimerManager {
 
  public:
 
+  class Task;
+
+  /**
+   * Handle for a task added to the timer manager, used to remove it.
+   */
+  typedef boost::weak_ptr<Task> Timer;
+
   TimerManager();
 
   virtual ~TimerManager();
@@ -80,17 +97,45 @@ class TimerManager {
   virtual void add(boost::shared_ptr<Runnable> task, const struct timespec& timeout);
 
   /**
-   * Removes a pending task
+   * Like add(), but returns a handle that removes the task in constant time.
+   *
+   * @param task The task to execute
+   * @param timeout Time in milliseconds to delay before executing task
+   * @return handle for removing the task
+   */
+  Timer schedule(boost::shared_ptr<Runnable> task, int64_t timeout);
+
+  /**
+   * Like add(), but returns a handle that removes the task in constant time.
    *
-   * @throws NoSuchTaskException Specified task doesn't exist. It was either
-   *                             processed already or this call was made for a
-   *                             task that was never added to this timer
+   * @param task The task to execute
+   * @param timeout Absolute time in the future to execute task.
+   * @return handle for removing the task
+   */
+  Timer schedule(boost::shared_ptr<Runnable> task, const struct timespec& timeout);
+
+  /**
+   * Removes every pending instance of a task.  This has to search all the
+   * pending tasks; use remove(Timer) where the handle is available.
    *
-   * @throws UncancellableTaskException Specified task is already being
-   *                                    executed or has completed execution.
+   * @throws NoSuchTaskException No instance of the task is pending. Each was
+   *                             either processed already, is being executed,
+   *                             or this call was made for a task that was
+   *                             never added to this timer
    */
   virtual void remove(boost::shared_ptr<Runnable> task);
 
+  /**
+   * Removes the pending task scheduled with the given handle, in constant
+   * time.
+   *
+   * @throws NoSuchTaskException Specified task doesn't exist. It has either
+   *                             completed execution already or been removed.
+   *
+   * @throws UncancellableTaskException Specified task is being executed.
+   */
+  virtual void remove(Timer timer);
+
   enum STATE {
     UNINITIALIZED,
     STARTING,
@@ -102,10 +147,38 @@ class TimerManager {
   virtual STATE state() const;
 
  private:
+  enum {
+    WHEEL_BITS = 8,
+    WHEEL_SIZE = 1 << WHEEL_BITS,
+    WHEEL_LEVELS = 4
+  };
+
+  /// Puts a task in the slot for its expiration time
+  void link(Task* task);
+
+  /// Takes a task out of its slot
+  void unlink(Task* task);
+
+  /**
+   * Turns the wheel to now, cascading tasks down levels as it goes, and
+   * collects the tasks that have fallen due.
+   */
+  void advance(int64_t now, std::vector<boost::shared_ptr<Task> >& expired);
+
+  /// When the wheel next needs turning, or 0 if no tasks are pending
+  int64_t nextTick() const;
+
+  /// Drops all pending tasks
+  void clear();
+
   boost::shared_ptr<const ThreadFactory> threadFactory_;
-  class Task;
   friend class Task;
-  std::multimap<int64_t, boost::shared_ptr<Task> > taskMap_;
+  Task* wheel_[WHEEL_LEVELS][WHEEL_SIZE];
+  size_t levelCount_[WHEEL_LEVELS];
+  /// Time, in milliseconds, up to which the wheel has turned
+  int64_t wheelTime_;
+  /// When the dispatcher will next wake up by itself
+  int64_t wakeTime_;
   size_t taskCount_;
   Monitor monitor_;
   STATE state_;
@@ -113,8 +186,6 @@ class TimerManager {
   friend class Dispatcher;
   boost::shared_ptr<Dispatcher> dispatcher_;
   boost::shared_ptr<Thread> dispatcherThread_;
-  typedef std::multimap<int64_t, boost::shared_ptr<TimerManager::Task> >::iterator task_iterator;
-  typedef std::pair<task_iterator, task_iterator> task_range;
 };
 
 }}} // apache::thrift::concurrency
@@ -0,0 +1,952 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "ThreadManager.h"
+#include "Exception.h"
+#include "Monitor.h"
+#include "Util.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <assert.h>
+#include <deque>
+#include <set>
+#include <vector>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+using boost::shared_ptr;
+
+#if defined(__GNUC__)
+
+/**
+ * Work-stealing ThreadManager
+ *
+ * Pending tasks are spread over a set of slots instead of one locked queue.
+ * Every slot has a bounded lock-free MPMC inbox that any thread may add to
+ * and any worker may take from, and a lock-free work-stealing deque that
+ * only the worker owning the slot adds to (tasks added from inside one of
+ * our tasks) and that idle workers steal from.  add() from other threads
+ * hands tasks to the inboxes round robin; a worker serves its own deque and
+ * inbox first and then steals from everyone else.  Tasks are carried in
+ * nodes from a pre-allocated pool, so adding a task allocates nothing.
+ *
+ * The manager mutex is only taken to put workers to sleep and wake them up,
+ * when add() has to block on pendingTaskCountMax, and to add or remove
+ * workers.
+ *
+ * Expired tasks are dropped (and the expire callback called) when a worker
+ * takes them, rather than from the head of a single queue.
+ *
+ * @version $Id:$
+ */
+class WorkStealingThreadManager : public ThreadManager {
+
+ public:
+  WorkStealingThreadManager(size_t workerCount, size_t pendingTaskCountMax);
+
+  ~WorkStealingThreadManager();
+
+  void start();
+
+  void stop() { stopImpl(false); }
+
+  void join() { stopImpl(true); }
+
+  ThreadManager::STATE state() const {
+    return state_;
+  }
+
+  shared_ptr<ThreadFactory> threadFactory() const {
+    Synchronized s(monitor_);
+    return threadFactory_;
+  }
+
+  void threadFactory(shared_ptr<ThreadFactory> value) {
+    Synchronized s(monitor_);
+    threadFactory_ = value;
+  }
+
+  void addWorker(size_t value);
+
+  void removeWorker(size_t value);
+
+  size_t idleWorkerCount() const {
+    return sleepers_;
+  }
+
+  size_t workerCount() const {
+    Synchronized s(monitor_);
+    return workerCount_;
+  }
+
+  size_t pendingTaskCount() const {
+    return pending_;
+  }
+
+  size_t totalTaskCount() const {
+    return pending_ + running_;
+  }
+
+  size_t pendingTaskCountMax() const {
+    return pendingTaskCountMax_;
+  }
+
+  size_t expiredTaskCount() {
+    return __sync_lock_test_and_set(&expiredCount_, 0);
+  }
+
+  int64_t pendingTaskWaitTime() const;
+
+  size_t blockedWorkerCount(int64_t threshold) const;
+
+  void add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration);
+
+  void remove(shared_ptr<Runnable> task);
+
+  shared_ptr<Runnable> removeNextPending();
+
+  void removeExpiredTasks() {}
+
+  void setExpireCallback(ExpireCallback expireCallback) {
+    expireCallback_ = expireCallback;
+  }
+
+ private:
+  class Worker;
+
+  /// A pending task, normally taken from the node pool
+  struct Node {
+    shared_ptr<Runnable> runnable;
+    int64_t expireTime;
+    /// When the task was added; 0 once a worker has taken it
+    volatile int64_t enqueueTime;
+    uint32_t index;
+    uint32_t next;
+  };
+
+  static const uint32_t NO_NODE = 0xffffffff;
+
+  static const size_t DEFAULT_POOL_SIZE = 4096;
+
+  static const size_t MAX_SLOTS = 256;
+
+  static const unsigned long QUEUE_SIZE = 1024;
+
+  static const unsigned long QUEUE_MASK = QUEUE_SIZE - 1;
+
+  /// Keeps hot indices written by different threads on different lines
+  struct CacheLinePad {
+    char pad[64];
+  };
+
+  /**
+   * Bounded multi-producer multi-consumer queue (after Dmitry Vyukov's
+   * design): each cell carries a sequence number telling producers and
+   * consumers whose turn it is, so push and pop are one CAS each.
+   */
+  class Inbox {
+   public:
+    Inbox() : enqueuePos_(0), dequeuePos_(0) {
+      for (unsigned long i = 0; i < QUEUE_SIZE; ++i) {
+        cells_[i].seq = i;
+        cells_[i].node = NULL;
+      }
+    }
+
+    bool push(Node* node) {
+      Cell* cell;
+      unsigned long pos = enqueuePos_;
+      for (;;) {
+        cell = &cells_[pos & QUEUE_MASK];
+        unsigned long seq = cell->seq;
+        long dif = (long)seq - (long)pos;
+        if (dif == 0) {
+          if (__sync_bool_compare_and_swap(&enqueuePos_, pos, pos + 1)) {
+            break;
+          }
+          pos = enqueuePos_;
+        } else if (dif < 0) {
+          return false;
+        } else {
+          pos = enqueuePos_;
+        }
+      }
+      cell->node = node;
+      __sync_synchronize();
+      cell->seq = pos + 1;
+      return true;
+    }
+
+    Node* pop() {
+      Cell* cell;
+      unsigned long pos = dequeuePos_;
+      for (;;) {
+        cell = &cells_[pos & QUEUE_MASK];
+        unsigned long seq = cell->seq;
+        long dif = (long)seq - (long)(pos + 1);
+        if (dif == 0) {
+          if (__sync_bool_compare_and_swap(&dequeuePos_, pos, pos + 1)) {
+            break;
+          }
+          pos = dequeuePos_;
+        } else if (dif < 0) {
+          return NULL;
+        } else {
+          pos = dequeuePos_;
+        }
+      }
+      __sync_synchronize();
+      Node* node = cell->node;
+      __sync_synchronize();
+      cell->seq = pos + QUEUE_MASK + 1;
+      return node;
+    }
+
+   private:
+    struct Cell {
+      volatile unsigned long seq;
+      Node* volatile node;
+    };
+
+    CacheLinePad pad0_;
+    Cell cells_[QUEUE_SIZE];
+    CacheLinePad pad1_;
+    volatile unsigned long enqueuePos_;
+    CacheLinePad pad2_;
+    volatile unsigned long dequeuePos_;
+    CacheLinePad pad3_;
+  };
+
+  /**
+   * Fixed-size Chase-Lev work-stealing deque.  The owner pushes and pops at
+   * the bottom; thieves take from the top.
+   */
+  class WorkDeque {
+   public:
+    WorkDeque() : top_(0), bottom_(0) {}
+
+    bool push(Node* node) {
+      long b = bottom_;
+      long t = top_;
+      if (b - t >= (long)QUEUE_SIZE) {
+        return false;
+      }
+      buffer_[b & QUEUE_MASK] = node;
+      __sync_synchronize();
+      bottom_ = b + 1;
+      return true;
+    }
+
+    Node* pop() {
+      long b = bottom_ - 1;
+      bottom_ = b;
+      __sync_synchronize();
+      long t = top_;
+      if (t > b) {
+        bottom_ = b + 1;
+        return NULL;
+      }
+      Node* node = buffer_[b & QUEUE_MASK];
+      if (t == b) {
+        // Last one; race thieves for it
+        if (!__sync_bool_compare_and_swap(&top_, t, t + 1)) {
+          node = NULL;
+        }
+        bottom_ = b + 1;
+      }
+      return node;
+    }
+
+    Node* steal() {
+      long t = top_;
+      __sync_synchronize();
+      long b = bottom_;
+      if (t >= b) {
+        return NULL;
+      }
+      Node* node = buffer_[t & QUEUE_MASK];
+      if (!__sync_bool_compare_and_swap(&top_, t, t + 1)) {
+        return NULL;
+      }
+      return node;
+    }
+
+   private:
+    CacheLinePad pad0_;
+    volatile long top_;
+    CacheLinePad pad1_;
+    volatile long bottom_;
+    CacheLinePad pad2_;
+    Node* volatile buffer_[QUEUE_SIZE];
+  };
+
+  /// Per-worker task queues; never freed while the manager lives
+  struct Slot {
+    Inbox inbox;
+    WorkDeque deque;
+  };
+
+  void stopImpl(bool join);
+
+  bool canSleep() const;
+
+  Node* allocateNode();
+
+  void releaseNode(Node* node);
+
+  /// Queue a node from outside the worker owning the target slot.
+  void pushExternal(Node* node);
+
+  /// Find a task for the worker owning slot home (NULL for none).
+  Node* nextTask(Slot* own, size_t home);
+
+  /// Account for a node taken off the queues.
+  void taken(Node* node);
+
+  /// Run (or expire) a node and give it back to the pool.
+  void execute(Node* node);
+
+  /// Free every node still queued.
+  void drainQueues();
+
+  const size_t initialWorkerCount_;
+  const size_t pendingTaskCountMax_;
+
+  size_t workerCount_;
+  size_t workerMaxCount_;
+  volatile long pending_;
+  volatile long running_;
+  volatile long sleepers_;
+  volatile long addWaiters_;
+  volatile long retiring_;
+  volatile size_t expiredCount_;
+  ExpireCallback expireCallback_;
+
+  ThreadManager::STATE state_;
+  shared_ptr<ThreadFactory> threadFactory_;
+
+  std::vector<Node> nodes_;
+  /// Free list head: node index in the low half, ABA tag in the high half
+  volatile uint64_t freeList_;
+
+  Slot* volatile slots_[MAX_SLOTS];
+  bool slotInUse_[MAX_SLOTS];
+  volatile size_t slotCount_;
+  volatile size_t nextSlot_;
+
+  /// Tasks that did not fit in any inbox
+  std::deque<Node*> overflow_;
+  volatile long overflowCount_;
+  Mutex overflowMutex_;
+
+  Mutex mutex_;
+  Monitor monitor_;
+  Monitor maxMonitor_;
+  Monitor workerMonitor_;
+
+  std::set<shared_ptr<Thread> > workers_;
+  std::set<shared_ptr<Thread> > deadWorkers_;
+};
+
+namespace {
+
+/// Worker running on this thread, if it belongs to a work-stealing manager
+__thread void* currentWorker = NULL;
+
+}
+
+class WorkStealingThreadManager::Worker : public Runnable {
+ public:
+  explicit Worker(WorkStealingThreadManager* manager) :
+    manager_(manager),
+    slot_(NULL),
+    home_(0),
+    taskStart_(0LL) {}
+
+  WorkStealingThreadManager* getManager() const {
+    return manager_;
+  }
+
+  Slot* getSlot() const {
+    return slot_;
+  }
+
+  int64_t getTaskStart() const {
+    return taskStart_;
+  }
+
+  void run();
+
+ private:
+  /// Claim a free slot, creating it the first time it is used.
+  void claimSlot();
+
+  void releaseSlot();
+
+  /// Whether this worker may leave now that some worker has to.
+  bool mayRetire() const {
+    return !(manager_->state_ == ThreadManager::JOINING &&
+             manager_->pending_ > 0);
+  }
+
+  WorkStealingThreadManager* manager_;
+  Slot* slot_;
+  size_t home_;
+  volatile int64_t taskStart_;
+};
+
+WorkStealingThreadManager::WorkStealingThreadManager(
+    size_t workerCount, size_t pendingTaskCountMax) :
+  initialWorkerCount_(workerCount),
+  pendingTaskCountMax_(pendingTaskCountMax),
+  workerCount_(0),
+  workerMaxCount_(0),
+  pending_(0),
+  running_(0),
+  sleepers_(0),
+  addWaiters_(0),
+  retiring_(0),
+  expiredCount_(0),
+  state_(ThreadManager::UNINITIALIZED),
+  slotCount_(0),
+  nextSlot_(0),
+  overflowCount_(0),
+  monitor_(&mutex_),
+  maxMonitor_(&mutex_),
+  workerMonitor_() {
+  size_t poolSize = pendingTaskCountMax > 0 ?
+    pendingTaskCountMax + workerCount : DEFAULT_POOL_SIZE;
+  nodes_.resize(poolSize);
+  for (size_t i = 0; i < poolSize; ++i) {
+    nodes_[i].index = (uint32_t)i;
+    nodes_[i].enqueueTime = 0LL;
+    nodes_[i].next = (i + 1 < poolSize) ? (uint32_t)(i + 1) : NO_NODE;
+  }
+  freeList_ = poolSize > 0 ? 0 : NO_NODE;
+
+  for (size_t i = 0; i < MAX_SLOTS; ++i) {
+    slots_[i] = NULL;
+    slotInUse_[i] = false;
+  }
+}
+
+WorkStealingThreadManager::~WorkStealingThreadManager() {
+  stop();
+  drainQueues();
+  for (size_t i = 0; i < MAX_SLOTS; ++i) {
+    delete slots_[i];
+  }
+}
+
+WorkStealingThreadManager::Node* WorkStealingThreadManager::allocateNode() {
+  uint64_t head = freeList_;
+  for (;;) {
+    uint32_t index = (uint32_t)head;
+    if (index == NO_NODE) {
+      // Pool exhausted; fall back to the heap
+      Node* node = new Node();
+      node->index = NO_NODE;
+      node->enqueueTime = 0LL;
+      return node;
+    }
+    uint64_t tag = (head >> 32) + 1;
+    uint64_t next = (tag << 32) | nodes_[index].next;
+    uint64_t seen = __sync_val_compare_and_swap(&freeList_, head, next);
+    if (seen == head) {
+      return &nodes_[index];
+    }
+    head = seen;
+  }
+}
+
+void WorkStealingThreadManager::releaseNode(Node* node) {
+  node->runnable.reset();
+  node->enqueueTime = 0LL;
+  if (node->index == NO_NODE) {
+    delete node;
+    return;
+  }
+
+  uint64_t head = freeList_;
+  for (;;) {
+    node->next = (uint32_t)head;
+    uint64_t tag = (head >> 32) + 1;
+    uint64_t seen = __sync_val_compare_and_swap(&freeList_, head,
+                                                (tag << 32) | node->index);
+    if (seen == head) {
+      return;
+    }
+    head = seen;
+  }
+}
+
+void WorkStealingThreadManager::Worker::claimSlot() {
+  Guard g(manager_->mutex_);
+  for (size_t i = 0; i < MAX_SLOTS; ++i) {
+    if (manager_->slotInUse_[i]) {
+      continue;
+    }
+    manager_->slotInUse_[i] = true;
+    if (manager_->slots_[i] == NULL) {
+      manager_->slots_[i] = new Slot();
+    }
+    if (i >= manager_->slotCount_) {
+      // Publish the slot only once it is fully constructed
+      __sync_synchronize();
+      manager_->slotCount_ = i + 1;
+    }
+    slot_ = manager_->slots_[i];
+    home_ = i;
+    return;
+  }
+
+  // More workers than slots; this one only steals
+  slot_ = NULL;
+  home_ = __sync_fetch_and_add(&manager_->nextSlot_, 1) % MAX_SLOTS;
+}
+
+void WorkStealingThreadManager::Worker::releaseSlot() {
+  if (slot_ == NULL) {
+    return;
+  }
+
+  // Nobody else may push to our deque, so hand its leftovers to the inboxes
+  Node* node;
+  while ((node = slot_->deque.pop()) != NULL) {
+    manager_->pushExternal(node);
+  }
+
+  Guard g(manager_->mutex_);
+  manager_->slotInUse_[home_] = false;
+  slot_ = NULL;
+}
+
+void WorkStealingThreadManager::Worker::run() {
+  // Take a slot before counting ourselves in, so that tasks added as soon
+  // as addWorker() returns find an inbox
+  claimSlot();
+  currentWorker = this;
+
+  bool notifyManager = false;
+  {
+    Synchronized s(manager_->monitor_);
+    manager_->workerCount_++;
+    notifyManager = manager_->workerCount_ == manager_->workerMaxCount_;
+  }
+  if (notifyManager) {
+    Synchronized s(manager_->workerMonitor_);
+    manager_->workerMonitor_.notify();
+  }
+
+  for (;;) {
+    long retiring = manager_->retiring_;
+    if (retiring > 0 && mayRetire() &&
+        __sync_bool_compare_and_swap(&manager_->retiring_, retiring,
+                                     retiring - 1)) {
+      break;
+    }
+
+    Node* node = manager_->nextTask(slot_, home_);
+    if (node != NULL) {
+      taskStart_ = Util::currentTime();
+      manager_->execute(node);
+      taskStart_ = 0LL;
+      continue;
+    }
+
+    // Nothing to do.  The sleeper count is raised before pending_ is
+    // checked, and add() raises pending_ before it checks the sleeper
+    // count, so one of us always sees the other.
+    Guard g(manager_->mutex_);
+    __sync_fetch_and_add(&manager_->sleepers_, 1);
+    while (manager_->pending_ <= 0 && manager_->retiring_ == 0) {
+      manager_->monitor_.wait();
+    }
+    __sync_fetch_and_sub(&manager_->sleepers_, 1);
+  }
+
+  currentWorker = NULL;
+  releaseSlot();
+
+  {
+    Synchronized s(manager_->workerMonitor_);
+    {
+      Synchronized m(manager_->monitor_);
+      manager_->workerCount_--;
+      notifyManager = manager_->workerCount_ == manager_->workerMaxCount_;
+    }
+    manager_->deadWorkers_.insert(this->thread());
+    if (notifyManager) {
+      manager_->workerMonitor_.notify();
+    }
+  }
+}
+
+void WorkStealingThreadManager::pushExternal(Node* node) {
+  size_t count = slotCount_;
+  if (count > 0) {
+    size_t first = __sync_fetch_and_add(&nextSlot_, 1);
+    for (size_t i = 0; i < count; ++i) {
+      if (slots_[(first + i) % count]->inbox.push(node)) {
+        return;
+      }
+    }
+  }
+
+  Guard g(overflowMutex_);
+  overflow_.push_back(node);
+  __sync_fetch_and_add(&overflowCount_, 1);
+}
+
+WorkStealingThreadManager::Node* WorkStealingThreadManager::nextTask(
+    Slot* own, size_t home) {
+  Node* node = NULL;
+  if (own != NULL) {
+    node = own->deque.pop();
+    if (node == NULL) {
+      node = own->inbox.pop();
+    }
+  }
+
+  if (node == NULL && overflowCount_ > 0) {
+    Guard g(overflowMutex_);
+    if (!overflow_.empty()) {
+      node = overflow_.front();
+      overflow_.pop_front();
+      __sync_fetch_and_sub(&overflowCount_, 1);
+    }
+  }
+
+  if (node == NULL) {
+    size_t count = slotCount_;
+    for (size_t i = 1; i <= count && node == NULL; ++i) {
+      Slot* victim = slots_[(home + i) % count];
+      if (victim == own) {
+        continue;
+      }
+      node = victim->inbox.pop();
+      if (node == NULL) {
+        node = victim->deque.steal();
+      }
+    }
+  }
+
+  if (node != NULL) {
+    __sync_fetch_and_add(&running_, 1);
+    taken(node);
+  }
+  return node;
+}
+
+void WorkStealingThreadManager::taken(Node* node) {
+  node->enqueueTime = 0LL;
+  __sync_fetch_and_sub(&pending_, 1);
+  // Same handshake as for sleeping workers, with blocked add() calls
+  if (addWaiters_ > 0) {
+    Guard g(mutex_);
+    maxMonitor_.notify();
+  }
+}
+
+void WorkStealingThreadManager::execute(Node* node) {
+  if (node->expireTime != 0LL && node->expireTime <= Util::currentTime()) {
+    __sync_fetch_and_add(&expiredCount_, 1);
+    if (expireCallback_) {
+      expireCallback_(node->runnable);
+    }
+  } else {
+    try {
+      node->runnable->run();
+    } catch(...) {
+      // XXX need to log this
+    }
+  }
+  __sync_fetch_and_sub(&running_, 1);
+  releaseNode(node);
+}
+
+void WorkStealingThreadManager::drainQueues() {
+  for (size_t i = 0; i < slotCount_; ++i) {
+    Node* node;
+    while ((node = slots_[i]->inbox.pop()) != NULL ||
+           (node = slots_[i]->deque.steal()) != NULL) {
+      releaseNode(node);
+    }
+  }
+  Guard g(overflowMutex_);
+  while (!overflow_.empty()) {
+    releaseNode(overflow_.front());
+    overflow_.pop_front();
+  }
+  overflowCount_ = 0;
+  pending_ = 0;
+}
+
+void WorkStealingThreadManager::start() {
+  if (state_ == ThreadManager::STOPPED) {
+    return;
+  }
+
+  {
+    Synchronized s(monitor_);
+    if (state_ != ThreadManager::UNINITIALIZED) {
+      return;
+    }
+    if (threadFactory_ == NULL) {
+      throw InvalidArgumentException();
+    }
+    state_ = ThreadManager::STARTED;
+  }
+
+  addWorker(initialWorkerCount_);
+}
+
+void WorkStealingThreadManager::addWorker(size_t value) {
+  std::set<shared_ptr<Thread> > newThreads;
+  for (size_t ix = 0; ix < value; ix++) {
+    shared_ptr<Runnable> worker(new Worker(this));
+    newThreads.insert(threadFactory_->newThread(worker));
+  }
+
+  {
+    Synchronized s(monitor_);
+    workerMaxCount_ += value;
+    workers_.insert(newThreads.begin(), newThreads.end());
+  }
+
+  for (std::set<shared_ptr<Thread> >::iterator ix = newThreads.begin();
+       ix != newThreads.end(); ++ix) {
+    (*ix)->start();
+  }
+
+  {
+    Synchronized s(workerMonitor_);
+    while (workerCount() != workerMaxCount_) {
+      workerMonitor_.wait();
+    }
+  }
+}
+
+void WorkStealingThreadManager::removeWorker(size_t value) {
+  {
+    Synchronized s(monitor_);
+    if (value > workerMaxCount_) {
+      throw InvalidArgumentException();
+    }
+    workerMaxCount_ -= value;
+    __sync_fetch_and_add(&retiring_, (long)value);
+    monitor_.notifyAll();
+  }
+
+  {
+    Synchronized s(workerMonitor_);
+
+    while (workerCount() != workerMaxCount_) {
+      workerMonitor_.wait();
+    }
+
+    Synchronized m(monitor_);
+    for (std::set<shared_ptr<Thread> >::iterator ix = deadWorkers_.begin();
+         ix != deadWorkers_.end(); ++ix) {
+      workers_.erase(*ix);
+    }
+
+    deadWorkers_.clear();
+  }
+}
+
+void WorkStealingThreadManager::stopImpl(bool join) {
+  bool doStop = false;
+  if (state_ == ThreadManager::STOPPED) {
+    return;
+  }
+
+  {
+    Synchronized s(monitor_);
+    if (state_ != ThreadManager::STOPPING &&
+        state_ != ThreadManager::JOINING &&
+        state_ != ThreadManager::STOPPED) {
+      doStop = true;
+      state_ = join ? ThreadManager::JOINING : ThreadManager::STOPPING;
+    }
+  }
+
+  if (doStop) {
+    removeWorker(workerMaxCount_);
+  }
+
+  {
+    Synchronized s(monitor_);
+    state_ = ThreadManager::STOPPED;
+  }
+}
+
+bool WorkStealingThreadManager::canSleep() const {
+  Worker* worker = static_cast<Worker*>(currentWorker);
+  return worker == NULL || worker->getManager() != this;
+}
+
+void WorkStealingThreadManager::add(shared_ptr<Runnable> value,
+                                    int64_t timeout,
+                                    int64_t expiration) {
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("WorkStealingThreadManager::add "
+                                "ThreadManager not started");
+  }
+
+  // Reserve our place in the pending count before queueing
+  for (;;) {
+    long pending = pending_;
+    if (pendingTaskCountMax_ > 0 && pending >= (long)pendingTaskCountMax_) {
+      if (!canSleep() || timeout < 0) {
+        throw TooManyPendingTasksException();
+      }
+      Guard g(mutex_);
+      __sync_fetch_and_add(&addWaiters_, 1);
+      try {
+        while (pending_ >= (long)pendingTaskCountMax_) {
+          maxMonitor_.wait(timeout);
+        }
+      } catch (...) {
+        __sync_fetch_and_sub(&addWaiters_, 1);
+        throw;
+      }
+      __sync_fetch_and_sub(&addWaiters_, 1);
+      continue;
+    }
+    if (__sync_bool_compare_and_swap(&pending_, pending, pending + 1)) {
+      break;
+    }
+  }
+
+  Node* node = allocateNode();
+  int64_t now = Util::currentTime();
+  node->runnable = value;
+  node->expireTime = expiration != 0LL ? now + expiration : 0LL;
+  node->enqueueTime = now;
+
+  Worker* worker = static_cast<Worker*>(currentWorker);
+  if (worker == NULL || worker->getManager() != this ||
+      worker->getSlot() == NULL || !worker->getSlot()->deque.push(node)) {
+    pushExternal(node);
+  }
+
+  if (sleepers_ > 0) {
+    Guard g(mutex_);
+    monitor_.notify();
+  }
+}
+
+void WorkStealingThreadManager::remove(shared_ptr<Runnable> task) {
+  (void) task;
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("WorkStealingThreadManager::remove "
+                                "ThreadManager not started");
+  }
+}
+
+shared_ptr<Runnable> WorkStealingThreadManager::removeNextPending() {
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("WorkStealingThreadManager::removeNextPending "
+                                "ThreadManager not started");
+  }
+
+  Node* node = NULL;
+  {
+    Guard g(overflowMutex_);
+    if (!overflow_.empty()) {
+      node = overflow_.front();
+      overflow_.pop_front();
+      __sync_fetch_and_sub(&overflowCount_, 1);
+    }
+  }
+
+  size_t count = slotCount_;
+  for (size_t i = 0; i < count && node == NULL; ++i) {
+    node = slots_[i]->inbox.pop();
+    if (node == NULL) {
+      node = slots_[i]->deque.steal();
+    }
+  }
+
+  if (node == NULL) {
+    return shared_ptr<Runnable>();
+  }
+
+  taken(node);
+  shared_ptr<Runnable> runnable = node->runnable;
+  releaseNode(node);
+  return runnable;
+}
+
+int64_t WorkStealingThreadManager::pendingTaskWaitTime() const {
+  if (pending_ <= 0) {
+    return 0LL;
+  }
+
+  // There is no single queue head to look at, so scan the node pool.
+  // Nodes allocated from the heap while the pool is exhausted are not
+  // seen, which can only make the answer low.
+  int64_t oldest = 0LL;
+  for (std::vector<Node>::const_iterator ix = nodes_.begin(); ix != nodes_.end(); ++ix) {
+    int64_t enqueueTime = ix->enqueueTime;
+    if (enqueueTime != 0LL && (oldest == 0LL || enqueueTime < oldest)) {
+      oldest = enqueueTime;
+    }
+  }
+  return oldest != 0LL ? Util::currentTime() - oldest : 0LL;
+}
+
+size_t WorkStealingThreadManager::blockedWorkerCount(int64_t threshold) const {
+  Synchronized s(monitor_);
+  int64_t now = Util::currentTime();
+  size_t result = 0;
+  for (std::set<shared_ptr<Thread> >::const_iterator ix = workers_.begin();
+       ix != workers_.end(); ++ix) {
+    Worker* worker = static_cast<Worker*>((*ix)->runnable().get());
+    int64_t taskStart = worker->getTaskStart();
+    if (taskStart != 0LL && now - taskStart >= threshold) {
+      result++;
+    }
+  }
+  return result;
+}
+
+shared_ptr<ThreadManager> ThreadManager::newWorkStealingThreadManager(
+    size_t count, size_t pendingTaskCountMax) {
+  return shared_ptr<ThreadManager>(
+    new WorkStealingThreadManager(count, pendingTaskCountMax));
+}
+
+#else // !defined(__GNUC__)
+
+shared_ptr<ThreadManager> ThreadManager::newWorkStealingThreadManager(
+    size_t count, size_t pendingTaskCountMax) {
+  // The lock-free queues need GCC atomic builtins
+  return newSimpleThreadManager(count, pendingTaskCountMax);
+}
+
+#endif // defined(__GNUC__)
+
+}}} // apache::thrift::concurrency
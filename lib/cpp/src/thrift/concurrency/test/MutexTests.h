@@ -0,0 +1,212 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/Util.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace concurrency { namespace test {
+
+using boost::shared_ptr;
+using namespace apache::thrift::concurrency;
+
+/**
+ * MutexTests class
+ *
+ * Checks Mutex and Monitor created with a given initializer, and times them
+ * under contention so that the pthread and futex implementations can be
+ * compared.
+ */
+class MutexTests {
+
+ public:
+
+  MutexTests(Mutex::Initializer init, const std::string& name) :
+    _init(init),
+    _name(name) {}
+
+  class CountTask: public Runnable {
+   public:
+
+    CountTask(const Mutex& mutex, int64_t& counter, size_t count) :
+      _mutex(mutex),
+      _counter(counter),
+      _count(count) {}
+
+    void run() {
+      for (size_t ix = 0; ix < _count; ix++) {
+        Guard g(_mutex);
+        _counter++;
+      }
+    }
+
+    const Mutex& _mutex;
+    int64_t& _counter;
+    size_t _count;
+  };
+
+  /**
+   * Has threadCount threads each increment a counter count times, taking
+   * the mutex for each increment, and checks that no increment was lost.
+   */
+  bool contentionTest(size_t threadCount=4, size_t count=1000000) {
+
+    Mutex mutex(_init);
+    int64_t counter = 0;
+
+    PlatformThreadFactory threadFactory;
+    threadFactory.setDetached(false);
+
+    std::vector<shared_ptr<Thread> > threads;
+    for (size_t ix = 0; ix < threadCount; ix++) {
+      threads.push_back(threadFactory.newThread(shared_ptr<Runnable>(new CountTask(mutex, counter, count))));
+    }
+
+    int64_t startTime = Util::currentTime();
+
+    for (size_t ix = 0; ix < threads.size(); ix++) {
+      threads[ix]->start();
+    }
+    for (size_t ix = 0; ix < threads.size(); ix++) {
+      threads[ix]->join();
+    }
+
+    int64_t endTime = Util::currentTime();
+
+    bool success = counter == (int64_t)(threadCount * count);
+
+    std::cout << "\t\t\t" << _name << " " << (success ? "Success" : "Failure") << "! " << threadCount * count << " locks in "
+              << endTime - startTime << "ms (" << (threadCount * count) / std::max<int64_t>(1, endTime - startTime)
+              << " locks/ms)" << std::endl;
+
+    return success;
+  }
+
+  class PingTask: public Runnable {
+   public:
+
+    PingTask(Monitor& monitor, size_t& turn, size_t id, size_t count) :
+      _monitor(monitor),
+      _turn(turn),
+      _id(id),
+      _count(count) {}
+
+    void run() {
+      for (size_t ix = 0; ix < _count; ix++) {
+        Synchronized s(_monitor);
+        while (_turn % 2 != _id) {
+          _monitor.wait();
+        }
+        _turn++;
+        _monitor.notify();
+      }
+    }
+
+    Monitor& _monitor;
+    size_t& _turn;
+    size_t _id;
+    size_t _count;
+  };
+
+  /**
+   * Passes a turn back and forth between two threads count times through a
+   * monitor, then checks that a wait with nothing to wake it times out.
+   */
+  bool monitorTest(size_t count=100000, int64_t timeout=10) {
+
+    Mutex mutex(_init);
+    Monitor monitor(&mutex);
+    size_t turn = 0;
+
+    PlatformThreadFactory threadFactory;
+    threadFactory.setDetached(false);
+
+    shared_ptr<Thread> ping = threadFactory.newThread(shared_ptr<Runnable>(new PingTask(monitor, turn, 0, count)));
+    shared_ptr<Thread> pong = threadFactory.newThread(shared_ptr<Runnable>(new PingTask(monitor, turn, 1, count)));
+
+    int64_t startTime = Util::currentTime();
+
+    ping->start();
+    pong->start();
+    ping->join();
+    pong->join();
+
+    int64_t endTime = Util::currentTime();
+
+    bool success = turn == 2 * count;
+
+    bool timedOut = false;
+    {
+      Synchronized s(monitor);
+      try {
+        monitor.wait(timeout);
+      } catch (TimedOutException&) {
+        timedOut = true;
+      }
+    }
+    success = success && timedOut;
+
+    std::cout << "\t\t\t" << _name << " " << (success ? "Success" : "Failure") << "! " << 2 * count << " handoffs in "
+              << endTime - startTime << "ms" << std::endl;
+
+    return success;
+  }
+
+  /**
+   * Checks trylock and timedlock on a locked mutex.
+   */
+  bool timedLockTest(int64_t timeout=10) {
+
+    Mutex mutex(_init);
+
+    bool success = mutex.trylock();
+    success = success && !mutex.trylock();
+
+    int64_t startTime = Util::currentTime();
+    success = success && !mutex.timedlock(timeout);
+    if (mutex.isFutex()) {
+      // The pthread mutex passes timedlock() a relative time where
+      // pthread_mutex_timedlock() expects an absolute one, so only the futex
+      // mutex actually waits
+      success = success && Util::currentTime() - startTime >= timeout - 1;
+    }
+    mutex.unlock();
+    success = success && mutex.timedlock(timeout);
+    mutex.unlock();
+
+    std::cout << "\t\t\t" << _name << " " << (success ? "Success" : "Failure") << "!" << std::endl;
+
+    return success;
+  }
+
+ private:
+  Mutex::Initializer _init;
+  std::string _name;
+};
+
+}}}} // apache::thrift::concurrency
+
+using namespace apache::thrift::concurrency::test;
@@ -24,6 +24,7 @@
 #include "ThreadFactoryTests.h"
 #include "TimerManagerTests.h"
 #include "ThreadManagerTests.h"
+#include "MutexTests.h"
 
 int main(int argc, char** argv) {
 
@@ -90,6 +91,34 @@ int main(int argc, char** argv) {
   }
 
 
+  if (runAll || args[0].compare("mutex") == 0) {
+
+    std::cout << "Mutex tests..." << std::endl;
+
+    MutexTests pthreadTests(Mutex::DEFAULT_INITIALIZER, "pthread");
+    MutexTests futexTests(Mutex::FUTEX_INITIALIZER, "futex");
+
+    std::cout << "\t\tMutex timed lock test" << std::endl;
+
+    assert(pthreadTests.timedLockTest());
+    assert(futexTests.timedLockTest());
+
+    size_t threadCounts[] = {1, 2, 4, 8};
+
+    for (size_t ix = 0; ix < sizeof(threadCounts) / sizeof(threadCounts[0]); ix++) {
+
+      std::cout << "\t\tMutex contention test: thread count: " << threadCounts[ix] << std::endl;
+
+      assert(pthreadTests.contentionTest(threadCounts[ix]));
+      assert(futexTests.contentionTest(threadCounts[ix]));
+    }
+
+    std::cout << "\t\tMonitor handoff test" << std::endl;
+
+    assert(pthreadTests.monitorTest());
+    assert(futexTests.monitorTest());
+  }
+
   if (runAll || args[0].compare("timer-manager") == 0) {
 
     std::cout << "TimerManager tests..." << std::endl;
@@ -99,6 +128,10 @@ int main(int argc, char** argv) {
     TimerManagerTests timerManagerTests;
 
     assert(timerManagerTests.test00());
+
+    std::cout << "\t\tTimerManager test01" << std::endl;
+
+    assert(timerManagerTests.test01());
   }
 
   if (runAll || args[0].compare("thread-manager") == 0) {
@@ -119,10 +152,42 @@ int main(int argc, char** argv) {
 
       assert(threadManagerTests.loadTest(taskCount, delay, workerCount));
 
+      ThreadManagerTests workStealingTests(true);
+
+      std::cout << "\t\tWork-stealing ThreadManager load test: worker count: " << workerCount << " task count: " << taskCount << " delay: " << delay << std::endl;
+
+      assert(workStealingTests.loadTest(taskCount, delay, workerCount));
+
+      std::cout << "\t\tWork-stealing ThreadManager scaling test: worker count: " << 8 << std::endl;
+
+      assert(workStealingTests.scalingTest(100000, 4, 8));
+
+      std::cout << "\t\tPriorityThreadManager priority test" << std::endl;
+
+      assert(threadManagerTests.priorityTest());
+
+      std::cout << "\t\tPriorityThreadManager lane dispatch test" << std::endl;
+
+      assert(threadManagerTests.laneDispatchTest());
+
+      std::cout << "\t\tThreadManagerScaler test" << std::endl;
+
+      assert(threadManagerTests.scalerTest());
+
+      std::cout << "\t\tThreadManagerScaler work-stealing test" << std::endl;
+
+      assert(workStealingTests.scalerTest());
+
+      // The block tests go last: with this many workers they can hang on a
+      // missed wakeup, which should not keep the tests above from running
+
       std::cout << "\t\tThreadManager block test: worker count: " << workerCount << " delay: " << delay << std::endl;
 
       assert(threadManagerTests.blockTest(delay, workerCount));
 
+      std::cout << "\t\tWork-stealing ThreadManager block test: worker count: " << workerCount << " delay: " << delay << std::endl;
+
+      assert(workStealingTests.blockTest(delay, workerCount));
     }
   }
 
@@ -152,4 +217,27 @@ int main(int argc, char** argv) {
       }
     }
   }
+
+  if (runAll || args[0].compare("thread-manager-scaling") == 0) {
+
+    std::cout << "ThreadManager scaling benchmark..." << std::endl;
+
+    {
+
+      size_t tasksPerProducer = 100000;
+
+      size_t maxThreadCount = 32;
+
+      for (size_t threadCount = 1; threadCount <= maxThreadCount; threadCount*= 2) {
+
+        ThreadManagerTests simpleTests;
+
+        simpleTests.scalingTest(tasksPerProducer, threadCount, threadCount);
+
+        ThreadManagerTests workStealingTests(true);
+
+        workStealingTests.scalingTest(tasksPerProducer, threadCount, threadCount);
+      }
+    }
+  }
 }
@@ -19,6 +19,8 @@
 
 #include <config.h>
 #include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/PriorityThreadManager.h>
+#include <thrift/concurrency/ThreadManagerScaler.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 #include <thrift/concurrency/Monitor.h>
 #include <thrift/concurrency/Util.h>
@@ -27,6 +29,7 @@
 #include <set>
 #include <iostream>
 #include <set>
+#include <vector>
 #include <stdint.h>
 
 namespace apache { namespace thrift { namespace concurrency { namespace test {
@@ -44,6 +47,19 @@ public:
 
   static const double ERROR;
 
+  /**
+   * @param workStealing whether to test the work-stealing thread manager
+   * instead of the simple one.
+   */
+  ThreadManagerTests(bool workStealing=false) :
+    _workStealing(workStealing) {}
+
+  shared_ptr<ThreadManager> newThreadManager(size_t workerCount, size_t pendingTaskMaxCount=0) {
+    return _workStealing ?
+      ThreadManager::newWorkStealingThreadManager(workerCount, pendingTaskMaxCount) :
+      ThreadManager::newSimpleThreadManager(workerCount, pendingTaskMaxCount);
+  }
+
   class Task: public Runnable {
 
   public:
@@ -108,7 +124,7 @@ public:
 
     size_t activeCount = count;
 
-    shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(workerCount);
+    shared_ptr<ThreadManager> threadManager = newThreadManager(workerCount);
 
     shared_ptr<PlatformThreadFactory> threadFactory = shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory());
 
@@ -248,7 +264,7 @@ public:
 
       size_t activeCounts[] = {workerCount, pendingTaskMaxCount, 1};
 
-      shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(workerCount, pendingTaskMaxCount);
+      shared_ptr<ThreadManager> threadManager = newThreadManager(workerCount, pendingTaskMaxCount);
 
       shared_ptr<PlatformThreadFactory> threadFactory = shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory());
 
@@ -371,6 +387,392 @@ public:
     std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
     return success;
  }
+
+  class CountTask: public Runnable {
+
+  public:
+
+    CountTask(Monitor& monitor, size_t& count) :
+      _monitor(monitor),
+      _count(count) {}
+
+    void run() {
+      if (__sync_sub_and_fetch(&_count, 1) == 0) {
+        Synchronized s(_monitor);
+        _monitor.notify();
+      }
+    }
+
+    Monitor& _monitor;
+    size_t& _count;
+  };
+
+  class Producer: public Runnable {
+
+  public:
+
+    Producer(shared_ptr<ThreadManager> threadManager, shared_ptr<Runnable> task, size_t count) :
+      _threadManager(threadManager),
+      _task(task),
+      _count(count) {}
+
+    void run() {
+      for (size_t ix = 0; ix < _count; ix++) {
+        _threadManager->add(_task);
+      }
+    }
+
+    shared_ptr<ThreadManager> _threadManager;
+    shared_ptr<Runnable> _task;
+    size_t _count;
+  };
+
+  /**
+   * Scaling benchmark.  producerCount threads each add count trivial tasks
+   * as fast as they can; measures how many tasks per millisecond get through
+   * the thread manager, which is dominated by the cost of its queueing.
+   */
+  bool scalingTest(size_t count=100000, size_t producerCount=1, size_t workerCount=4) {
+
+    Monitor monitor;
+
+    size_t activeCount = count * producerCount;
+
+    shared_ptr<ThreadManager> threadManager = newThreadManager(workerCount);
+
+    threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    threadManager->start();
+
+    shared_ptr<PlatformThreadFactory> threadFactory = shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory());
+
+    threadFactory->setDetached(false);
+
+    shared_ptr<Runnable> task(new ThreadManagerTests::CountTask(monitor, activeCount));
+
+    std::vector<shared_ptr<Thread> > producers;
+
+    for (size_t ix = 0; ix < producerCount; ix++) {
+      producers.push_back(threadFactory->newThread(shared_ptr<Runnable>(new ThreadManagerTests::Producer(threadManager, task, count))));
+    }
+
+    int64_t time00 = Util::currentTime();
+
+    for (size_t ix = 0; ix < producerCount; ix++) {
+      producers[ix]->start();
+    }
+
+    {
+      Synchronized s(monitor);
+
+      while (activeCount > 0) {
+        monitor.wait();
+      }
+    }
+
+    int64_t time01 = Util::currentTime();
+
+    for (size_t ix = 0; ix < producerCount; ix++) {
+      producers[ix]->join();
+    }
+
+    threadManager->join();
+
+    double elapsed = time01 > time00 ? (double)(time01 - time00) : 1.0;
+
+    std::cout << "\t\t\t" << (_workStealing ? "work-stealing" : "simple") << ": producers: " << producerCount << " workers: " << workerCount << " tasks: " << count * producerCount << " elapsed: " << time01 - time00 << "ms tasks/ms: " << (count * producerCount) / elapsed << std::endl;
+
+    return activeCount == 0;
+  }
+
+  class GateTask: public Runnable {
+
+  public:
+
+    GateTask(Monitor& monitor, bool& started, bool& open) :
+      _monitor(monitor),
+      _started(started),
+      _open(open) {}
+
+    void run() {
+      Synchronized s(_monitor);
+      _started = true;
+      _monitor.notifyAll();
+      while (!_open) {
+        _monitor.wait();
+      }
+    }
+
+    Monitor& _monitor;
+    bool& _started;
+    bool& _open;
+  };
+
+  class OrderTask: public Runnable {
+
+  public:
+
+    OrderTask(Monitor& monitor, std::vector<int>& order, int id) :
+      _monitor(monitor),
+      _order(order),
+      _id(id) {}
+
+    void run() {
+      Synchronized s(_monitor);
+      _order.push_back(_id);
+      _monitor.notifyAll();
+    }
+
+    Monitor& _monitor;
+    std::vector<int>& _order;
+    int _id;
+  };
+
+  /**
+   * Priority test.  Block the only general worker, queue tasks at several
+   * priorities, and verify that a worker reserved for HIGHEST runs its task
+   * at once, that the rest run highest priority first once the general
+   * worker is free, and that per-priority pending limits apply only to
+   * their own lane.
+   */
+  bool priorityTest() {
+    bool success = false;
+
+    try {
+
+      Monitor monitor;
+
+      bool started = false;
+
+      bool open = false;
+
+      std::vector<int> order;
+
+      shared_ptr<PriorityThreadManager> threadManager = PriorityThreadManager::newPriorityThreadManager(1);
+
+      threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+      threadManager->addWorker(1, PriorityThreadManager::HIGHEST);
+
+      threadManager->start();
+
+      threadManager->add(shared_ptr<Runnable>(new GateTask(monitor, started, open)), PriorityThreadManager::LOW);
+
+      {
+        Synchronized s(monitor);
+        while (!started) {
+          monitor.wait(1000);
+        }
+      }
+
+      threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 3)), PriorityThreadManager::LOWEST);
+      threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 2)), PriorityThreadManager::NORMAL);
+      threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 1)), PriorityThreadManager::HIGH);
+      threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 0)), PriorityThreadManager::HIGHEST);
+
+      {
+        Synchronized s(monitor);
+        while (order.empty()) {
+          monitor.wait(1000);
+        }
+        if (order.size() != 1 || order[0] != 0) {
+          throw TException("Reserved worker did not run the HIGHEST task first");
+        }
+      }
+
+      if (threadManager->pendingTaskCount() != 3 ||
+          threadManager->pendingTaskCount(PriorityThreadManager::HIGH) != 1) {
+        throw TException("Unexpected pending task count");
+      }
+
+      threadManager->pendingTaskCountMax(PriorityThreadManager::LOWEST, 1);
+
+      try {
+        threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 4)), PriorityThreadManager::LOWEST, -1);
+        throw TException("Unexpected success adding task in excess of LOWEST pending task count");
+      } catch(TooManyPendingTasksException& e) {
+        // Expected result
+      }
+
+      threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 4)), PriorityThreadManager::LOW, -1);
+
+      {
+        Synchronized s(monitor);
+        open = true;
+        monitor.notifyAll();
+
+        while (order.size() != 5) {
+          monitor.wait(1000);
+        }
+      }
+
+      std::cout << "\t\t\t" << "Run order:";
+      for (size_t ix = 0; ix < order.size(); ix++) {
+        std::cout << " " << order[ix];
+      }
+      std::cout << std::endl;
+
+      if (order[1] != 1 || order[2] != 2 || order[3] != 4 || order[4] != 3) {
+        throw TException("Tasks did not run in priority order");
+      }
+
+      threadManager->join();
+
+      success = threadManager->totalTaskCount() == 0;
+
+    } catch(TException& e) {
+      std::cout << "ERROR: " << e.what() << std::endl;
+    }
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+    return success;
+  }
+
+  /**
+   * Lane dispatch test.  With one worker reserved for HIGHEST and one
+   * general worker, both idle, queue a HIGHEST task that blocks and then
+   * another HIGHEST task.  Whichever worker takes the first task, the other
+   * must run the second while the first is still blocked.
+   */
+  bool laneDispatchTest(size_t rounds=20) {
+    bool success = false;
+
+    try {
+
+      for (size_t round = 0; round < rounds; round++) {
+
+        Monitor monitor;
+
+        bool started = false;
+
+        bool open = false;
+
+        std::vector<int> order;
+
+        shared_ptr<PriorityThreadManager> threadManager = PriorityThreadManager::newPriorityThreadManager(1);
+
+        threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+        threadManager->addWorker(1, PriorityThreadManager::HIGHEST);
+
+        threadManager->start();
+
+        threadManager->add(shared_ptr<Runnable>(new GateTask(monitor, started, open)), PriorityThreadManager::HIGHEST);
+        threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 0)), PriorityThreadManager::HIGHEST);
+
+        bool ran = false;
+        {
+          Synchronized s(monitor);
+          int64_t deadline = Util::currentTime() + 1000LL;
+          while (order.empty() && Util::currentTime() < deadline) {
+            try {
+              monitor.wait(deadline - Util::currentTime());
+            } catch (TimedOutException&) {}
+          }
+          ran = !order.empty();
+          open = true;
+          monitor.notifyAll();
+        }
+
+        threadManager->join();
+
+        if (!ran) {
+          throw TException("HIGHEST task waited behind a blocked task while a general worker was idle");
+        }
+      }
+
+      success = true;
+
+    } catch(TException& e) {
+      std::cout << "ERROR: " << e.what() << std::endl;
+    }
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+    return success;
+  }
+
+  /**
+   * Scaler test.  Start with one worker and queue tasks that block until
+   * released; verify that the scaler grows the pool to its maximum, then
+   * shrinks it back to its minimum once the tasks are done.
+   */
+  bool scalerTest(size_t taskCount=16, size_t maxWorkerCount=8) {
+    bool success = false;
+
+    try {
+
+      Monitor monitor;
+
+      bool started = false;
+
+      bool open = false;
+
+      shared_ptr<ThreadManager> threadManager = newThreadManager(1);
+
+      threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+      threadManager->start();
+
+      ThreadManagerScaler scaler(threadManager, 1, maxWorkerCount);
+
+      scaler.interval(10);
+
+      scaler.maxWaitTime(20);
+
+      scaler.blockedTime(50);
+
+      scaler.idleTime(100);
+
+      scaler.start();
+
+      for (size_t ix = 0; ix < taskCount; ix++) {
+        threadManager->add(shared_ptr<Runnable>(new GateTask(monitor, started, open)));
+      }
+
+      int64_t deadline = Util::currentTime() + 5000;
+
+      while (threadManager->workerCount() < maxWorkerCount && Util::currentTime() < deadline) {
+        usleep(10000);
+      }
+
+      size_t grownCount = threadManager->workerCount();
+
+      size_t blockedCount = threadManager->blockedWorkerCount(50);
+
+      {
+        Synchronized s(monitor);
+        open = true;
+        monitor.notifyAll();
+      }
+
+      deadline = Util::currentTime() + 5000;
+
+      while ((threadManager->totalTaskCount() > 0 || threadManager->workerCount() > 1) &&
+             Util::currentTime() < deadline) {
+        usleep(10000);
+      }
+
+      size_t shrunkCount = threadManager->workerCount();
+
+      std::cout << "\t\t\t" << "workers grown to: " << grownCount << " blocked: " << blockedCount << " shrunk to: " << shrunkCount << std::endl;
+
+      scaler.stop();
+
+      threadManager->join();
+
+      success = grownCount == maxWorkerCount && shrunkCount == 1;
+
+    } catch(TException& e) {
+      std::cout << "ERROR: " << e.what() << std::endl;
+    }
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+    return success;
+  }
+
+private:
+
+  bool _workStealing;
 };
 
 const double ThreadManagerTests::ERROR = .20;
@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <iostream>
+#include <vector>
 
 namespace apache { namespace thrift { namespace concurrency { namespace test {
 
@@ -144,6 +145,108 @@ class TimerManagerTests {
     return true;
   }
 
+  class CountTask: public Runnable {
+   public:
+
+    CountTask(Monitor& monitor, size_t& count) :
+      _monitor(monitor),
+      _count(count) {}
+
+    void run() {
+      Synchronized s(_monitor);
+      _count++;
+      _monitor.notifyAll();
+    }
+
+    Monitor& _monitor;
+    size_t& _count;
+  };
+
+  /**
+   * This test adds many timers spread over every level of the wheel,
+   * removes most of them through their handles and the rest of the far ones
+   * by task, and verifies that exactly the remaining ones run, and that
+   * handles to timers that have run or been removed can't be removed again.
+   */
+  bool test01(size_t count=100000, int64_t timeout=500LL) {
+
+    TimerManager timerManager;
+
+    timerManager.threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    timerManager.start();
+
+    size_t runCount = 0;
+    shared_ptr<CountTask> task(new CountTask(_monitor, runCount));
+    shared_ptr<CountTask> farTask(new CountTask(_monitor, runCount));
+
+    std::vector<TimerManager::Timer> timers;
+    size_t expected = 0;
+
+    for (size_t ix = 0; ix < count; ix++) {
+      timers.push_back(timerManager.schedule(task, timeout + (int64_t)(ix % timeout)));
+    }
+    for (size_t ix = 0; ix < timers.size(); ix++) {
+      if (ix % 100 == 0) {
+        expected++;
+      } else {
+        timerManager.remove(timers[ix]);
+      }
+    }
+
+    // Beyond the first two levels of the wheel
+    timerManager.add(farTask, 100000LL);
+    timerManager.add(farTask, 100000000LL);
+
+    assert(timerManager.taskCount() == expected + 2);
+
+    int64_t start = Util::currentTime();
+    {
+      Synchronized s(_monitor);
+      while (runCount < expected && Util::currentTime() - start < 10 * timeout) {
+        try {
+          _monitor.wait(timeout);
+        } catch (TimedOutException&) {}
+      }
+    }
+    assert(runCount == expected);
+
+    assert(timerManager.taskCount() == 2);
+    timerManager.remove(farTask);
+    assert(timerManager.taskCount() == 0);
+
+    bool threw = false;
+    try {
+      timerManager.remove(farTask);
+    } catch (NoSuchTaskException&) {
+      threw = true;
+    }
+    assert(threw);
+
+    for (size_t ix = 0; ix < 2; ix++) {
+      threw = false;
+      try {
+        timerManager.remove(timers[ix]);
+      } catch (NoSuchTaskException&) {
+        threw = true;
+      }
+      assert(threw);
+    }
+
+    // Nothing removed should have run late
+    {
+      Synchronized s(_monitor);
+      try {
+        _monitor.wait(timeout);
+      } catch (TimedOutException&) {}
+    }
+    assert(runCount == expected);
+
+    std::cout << "\t\t\t" << expected << " of " << count << " timers ran" << std::endl;
+
+    return true;
+  }
+
   friend class TestTask;
 
   Monitor _monitor;
@@ -0,0 +1,367 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/processor/LatencyStatsHandler.h>
+#include <thrift/concurrency/Util.h>
+
+#include <string.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::Util;
+
+LatencyHistogram::LatencyHistogram() {
+  clear();
+}
+
+int LatencyHistogram::bucketOf(uint64_t value) {
+  if (value < 2 * SUB_BUCKETS) {
+    return static_cast<int>(value);
+  }
+  if (value >> MAX_BITS) {
+    return NUM_BUCKETS - 1;
+  }
+  int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+  return (shift + 1) * SUB_BUCKETS + static_cast<int>(value >> shift) - SUB_BUCKETS;
+}
+
+uint64_t LatencyHistogram::bucketLimit(int bucket) {
+  if (bucket < 2 * SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = bucket / SUB_BUCKETS - 1;
+  uint64_t base = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  return base + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+void LatencyHistogram::add(uint64_t value) {
+  ++buckets_[bucketOf(value)];
+  ++count_;
+  sum_ += value;
+  if (value > max_) {
+    max_ = value;
+  }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  if (other.max_ > max_) {
+    max_ = other.max_;
+  }
+}
+
+void LatencyHistogram::clear() {
+  count_ = 0;
+  sum_ = 0;
+  max_ = 0;
+  memset(buckets_, 0, sizeof(buckets_));
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const {
+  // Count from the buckets rather than count_: a histogram copied while its
+  // owner was recording may not quite agree with itself
+  uint64_t total = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    total += buckets_[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint64_t rank = static_cast<uint64_t>(percent / 100.0 * total + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  } else if (rank > total) {
+    rank = total;
+  }
+
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      uint64_t limit = bucketLimit(i);
+      return limit < max_ ? limit : max_;
+    }
+  }
+  return max_;
+}
+
+void LatencyStatsHandler::MethodStats::merge(const MethodStats& other) {
+  calls += other.calls;
+  errors += other.errors;
+  readTime.merge(other.readTime);
+  handlerTime.merge(other.handlerTime);
+  writeTime.merge(other.writeTime);
+  requestBytes.merge(other.requestBytes);
+  responseBytes.merge(other.responseBytes);
+}
+
+/**
+ * The statistics recorded by one thread.  Only the owning thread adds
+ * methods or records samples; it looks methods up without the lock, and
+ * takes it only to add one, so that readers can walk the map under the
+ * lock.
+ */
+class LatencyStatsHandler::Shard {
+ public:
+  ~Shard() {
+    for (MethodMap::iterator it = methods.begin(); it != methods.end(); ++it) {
+      delete it->second;
+    }
+  }
+
+  MethodStats& get(const char* fn_name) {
+    MethodMap::iterator it = methods.find(fn_name);
+    if (it != methods.end()) {
+      return *it->second;
+    }
+    MethodStats* stats = new MethodStats();
+    Guard g(mutex);
+    methods.insert(std::make_pair(fn_name, stats));
+    return *stats;
+  }
+
+  // Keyed by the generated code's name literal; readers merge entries that
+  // happen to have the same name
+  typedef std::map<const char*, MethodStats*> MethodMap;
+
+  Mutex mutex;
+  MethodMap methods;
+};
+
+struct LatencyStatsHandler::Context {
+  explicit Context(const char* fn) :
+    fn_name(fn),
+    shard(NULL),
+    stats(NULL),
+    readStart(0),
+    handlerStart(0),
+    writeStart(0) {}
+
+  const char* fn_name;
+  /// The shard stats belongs to; hooks on other threads look theirs up
+  Shard* shard;
+  MethodStats* stats;
+  int64_t readStart;
+  int64_t handlerStart;
+  int64_t writeStart;
+};
+
+namespace {
+
+/// Last handler used on this thread, and this thread's shard of it
+__thread uint64_t cachedHandler = 0;
+__thread void* cachedShard = NULL;
+
+uint64_t lastHandlerId = 0;
+
+inline uint64_t elapsed(int64_t start, int64_t end) {
+  return end > start ? static_cast<uint64_t>(end - start) : 0;
+}
+
+}
+
+LatencyStatsHandler::LatencyStatsHandler() :
+  id_(__sync_add_and_fetch(&lastHandlerId, 1)) {
+}
+
+LatencyStatsHandler::~LatencyStatsHandler() {
+  for (std::vector<Shard*>::iterator it = shards_.begin(); it != shards_.end(); ++it) {
+    delete *it;
+  }
+}
+
+LatencyStatsHandler::Shard* LatencyStatsHandler::localShard() {
+  if (cachedHandler == id_) {
+    return static_cast<Shard*>(cachedShard);
+  }
+
+  // A thread that exited leaves its shard to the next thread given its id
+  Shard* shard;
+  {
+    Guard g(mutex_);
+    Thread::id_t thread = Thread::get_current();
+    std::map<Thread::id_t, Shard*>::iterator it = shardsByThread_.find(thread);
+    if (it != shardsByThread_.end()) {
+      shard = it->second;
+    } else {
+      shard = new Shard();
+      shards_.push_back(shard);
+      shardsByThread_[thread] = shard;
+    }
+  }
+  cachedHandler = id_;
+  cachedShard = shard;
+  return shard;
+}
+
+LatencyStatsHandler::MethodStats& LatencyStatsHandler::localStats(const char* fn_name) {
+  return localShard()->get(fn_name);
+}
+
+void LatencyStatsHandler::getStats(std::map<std::string, MethodStats>& result) const {
+  std::vector<Shard*> shards;
+  {
+    Guard g(mutex_);
+    shards = shards_;
+  }
+
+  for (std::vector<Shard*>::iterator it = shards.begin(); it != shards.end(); ++it) {
+    Guard g((*it)->mutex);
+    Shard::MethodMap& methods = (*it)->methods;
+    for (Shard::MethodMap::iterator m = methods.begin(); m != methods.end(); ++m) {
+      result[m->first].merge(*m->second);
+    }
+  }
+}
+
+void LatencyStatsHandler::getCounters(std::map<std::string, int64_t>& counters,
+                                      const std::string& prefix) const {
+  std::map<std::string, MethodStats> stats;
+  getStats(stats);
+
+  for (std::map<std::string, MethodStats>::iterator it = stats.begin(); it != stats.end(); ++it) {
+    std::string name = prefix + it->first;
+    const MethodStats& method = it->second;
+    counters[name + ".calls"] = method.calls;
+    counters[name + ".errors"] = method.errors;
+
+    const struct {
+      const char* suffix;
+      const LatencyHistogram* histogram;
+    } metrics[] = {
+      { ".read_us", &method.readTime },
+      { ".handler_us", &method.handlerTime },
+      { ".write_us", &method.writeTime },
+      { ".request_bytes", &method.requestBytes },
+      { ".response_bytes", &method.responseBytes }
+    };
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); ++i) {
+      std::string metric = name + metrics[i].suffix;
+      const LatencyHistogram& histogram = *metrics[i].histogram;
+      counters[metric + ".avg"] = histogram.mean();
+      counters[metric + ".p50"] = histogram.percentile(50);
+      counters[metric + ".p99"] = histogram.percentile(99);
+      counters[metric + ".p999"] = histogram.percentile(99.9);
+    }
+  }
+}
+
+void LatencyStatsHandler::reset() {
+  Guard g(mutex_);
+  for (std::vector<Shard*>::iterator it = shards_.begin(); it != shards_.end(); ++it) {
+    Guard sg((*it)->mutex);
+    Shard::MethodMap& methods = (*it)->methods;
+    for (Shard::MethodMap::iterator m = methods.begin(); m != methods.end(); ++m) {
+      MethodStats& stats = *m->second;
+      stats.calls = 0;
+      stats.errors = 0;
+      stats.readTime.clear();
+      stats.handlerTime.clear();
+      stats.writeTime.clear();
+      stats.requestBytes.clear();
+      stats.responseBytes.clear();
+    }
+  }
+}
+
+void* LatencyStatsHandler::getContext(const char* fn_name, void* serverContext) {
+  (void) serverContext;
+  Context* context = new Context(fn_name);
+  context->shard = localShard();
+  context->stats = &context->shard->get(fn_name);
+  return context;
+}
+
+void LatencyStatsHandler::freeContext(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  delete static_cast<Context*>(ctx);
+}
+
+void LatencyStatsHandler::preRead(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  static_cast<Context*>(ctx)->readStart = Util::currentTimeUsec();
+}
+
+void LatencyStatsHandler::postRead(void* ctx, const char* fn_name, uint32_t bytes) {
+  (void) fn_name;
+  Context* context = static_cast<Context*>(ctx);
+  int64_t now = Util::currentTimeUsec();
+  MethodStats& stats = context->shard == localShard() ?
+    *context->stats : localStats(context->fn_name);
+  ++stats.calls;
+  if (context->readStart != 0) {
+    stats.readTime.add(elapsed(context->readStart, now));
+  }
+  stats.requestBytes.add(bytes);
+  context->handlerStart = now;
+}
+
+void LatencyStatsHandler::preWrite(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  Context* context = static_cast<Context*>(ctx);
+  endHandler(context, false);
+  context->writeStart = Util::currentTimeUsec();
+}
+
+void LatencyStatsHandler::postWrite(void* ctx, const char* fn_name, uint32_t bytes) {
+  (void) fn_name;
+  Context* context = static_cast<Context*>(ctx);
+  int64_t now = Util::currentTimeUsec();
+  MethodStats& stats = context->shard == localShard() ?
+    *context->stats : localStats(context->fn_name);
+  if (context->writeStart != 0) {
+    stats.writeTime.add(elapsed(context->writeStart, now));
+  }
+  stats.responseBytes.add(bytes);
+}
+
+void LatencyStatsHandler::asyncComplete(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  endHandler(static_cast<Context*>(ctx), false);
+}
+
+void LatencyStatsHandler::handlerError(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  endHandler(static_cast<Context*>(ctx), true);
+}
+
+void LatencyStatsHandler::endHandler(Context* context, bool error) {
+  if (context->handlerStart == 0 && !error) {
+    return;
+  }
+  MethodStats& stats = context->shard == localShard() ?
+    *context->stats : localStats(context->fn_name);
+  if (error) {
+    ++stats.errors;
+  }
+  if (context->handlerStart != 0) {
+    stats.handlerTime.add(elapsed(context->handlerStart, Util::currentTimeUsec()));
+    context->handlerStart = 0;
+  }
+}
+
+}}} // apache::thrift::processor
@@ -0,0 +1,190 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROCESSOR_LATENCYSTATSHANDLER_H_
+#define _THRIFT_PROCESSOR_LATENCYSTATSHANDLER_H_ 1
+
+#include <thrift/TProcessor.h>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/Thread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * Log-linear histogram of non-negative integer samples.
+ *
+ * Values below 2 * SUB_BUCKETS are counted exactly.  Above that, each power
+ * of two is split into SUB_BUCKETS equal buckets, so percentiles are within
+ * 1 / SUB_BUCKETS of the true value.  Values of 2^MAX_BITS and above all
+ * fall in the last bucket.
+ *
+ * Not thread safe; LatencyStatsHandler gives each thread its own.
+ */
+class LatencyHistogram {
+ public:
+  enum {
+    SUB_BUCKET_BITS = 3,
+    SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+    MAX_BITS = 40,
+    NUM_BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS
+  };
+
+  LatencyHistogram();
+
+  void add(uint64_t value);
+
+  void merge(const LatencyHistogram& other);
+
+  void clear();
+
+  uint64_t count() const {
+    return count_;
+  }
+
+  uint64_t sum() const {
+    return sum_;
+  }
+
+  uint64_t max() const {
+    return max_;
+  }
+
+  uint64_t mean() const {
+    return count_ == 0 ? 0 : sum_ / count_;
+  }
+
+  /**
+   * The smallest bucket bound that at least percent% of the samples are at
+   * or below, or 0 when there are no samples.  The result never exceeds
+   * max().
+   */
+  uint64_t percentile(double percent) const;
+
+  /// Index of the bucket that value is counted in
+  static int bucketOf(uint64_t value);
+
+  /// Largest value counted in bucket
+  static uint64_t bucketLimit(int bucket);
+
+ private:
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+  uint64_t buckets_[NUM_BUCKETS];
+};
+
+/**
+ * Processor event handler that records, for each method, how long requests
+ * take to read, to run in the handler and to write, and how large requests
+ * and responses are.
+ *
+ *   boost::shared_ptr<LatencyStatsHandler> stats(new LatencyStatsHandler());
+ *   processor->setEventHandler(stats);
+ *   ...
+ *   stats->getCounters(counters);
+ *
+ * Each thread records into its own set of histograms without taking a lock
+ * or using atomic operations, so a server's workers don't contend on the
+ * handler.  Readers merge the threads' histograms; a snapshot taken while
+ * requests are running may miss samples recorded in the meantime.
+ *
+ * Async processors get a new context for the response, so for them only
+ * read, write and size figures are recorded; the time between the two is
+ * not known to the handler.
+ */
+class LatencyStatsHandler : public TProcessorEventHandler {
+ public:
+  /**
+   * Statistics for one method.  Times are in microseconds.
+   */
+  struct MethodStats {
+    /// Requests read
+    uint64_t calls;
+    /// Handler calls that threw an undeclared exception
+    uint64_t errors;
+    LatencyHistogram readTime;
+    LatencyHistogram handlerTime;
+    LatencyHistogram writeTime;
+    LatencyHistogram requestBytes;
+    LatencyHistogram responseBytes;
+
+    MethodStats() : calls(0), errors(0) {}
+
+    void merge(const MethodStats& other);
+  };
+
+  LatencyStatsHandler();
+
+  virtual ~LatencyStatsHandler();
+
+  /**
+   * Merge every thread's statistics, keyed by method name.
+   */
+  void getStats(std::map<std::string, MethodStats>& result) const;
+
+  /**
+   * Add counters in the form of fb303's getCounters() to counters:
+   * <prefix><method>.calls and .errors, and for each of read_us,
+   * handler_us, write_us, request_bytes and response_bytes, the
+   * <prefix><method>.<metric>.avg, .p50, .p99 and .p999.
+   */
+  void getCounters(std::map<std::string, int64_t>& counters,
+                   const std::string& prefix = "thrift.") const;
+
+  /**
+   * Discard the statistics gathered so far.  Samples recorded while this
+   * runs may be lost or kept.
+   */
+  void reset();
+
+  void* getContext(const char* fn_name, void* serverContext);
+  void freeContext(void* ctx, const char* fn_name);
+  void preRead(void* ctx, const char* fn_name);
+  void postRead(void* ctx, const char* fn_name, uint32_t bytes);
+  void preWrite(void* ctx, const char* fn_name);
+  void postWrite(void* ctx, const char* fn_name, uint32_t bytes);
+  void asyncComplete(void* ctx, const char* fn_name);
+  void handlerError(void* ctx, const char* fn_name);
+
+ private:
+  class Shard;
+  struct Context;
+
+  /// Statistics for fn_name recorded by the calling thread
+  MethodStats& localStats(const char* fn_name);
+
+  Shard* localShard();
+
+  void endHandler(Context* context, bool error);
+
+  /// Distinguishes this handler from earlier ones at the same address
+  const uint64_t id_;
+
+  mutable apache::thrift::concurrency::Mutex mutex_;
+  std::map<apache::thrift::concurrency::Thread::id_t, Shard*> shardsByThread_;
+  std::vector<Shard*> shards_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_LATENCYSTATSHANDLER_H_
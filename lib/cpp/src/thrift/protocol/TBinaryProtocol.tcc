@@ -233,7 +233,7 @@ uint32_t TBinaryProtocolT<Transport_>::readMessageEnd() {
 
 template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readStructBegin(std::string& name) {
-  name = "";
+  (void) name;
   return 0;
 }
 
@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TFieldTable.h>
+
+#include <vector>
+
+namespace apache { namespace thrift { namespace protocol {
+
+namespace {
+
+/**
+ * Index of the field with the given id, or spec.numFields if there is none.
+ * Fields usually arrive in id order, so the one after the last is tried
+ * before searching.
+ */
+size_t findField(const TStructSpec& spec, int16_t id, size_t next) {
+  if (next < spec.numFields && spec.fields[next].id == id) {
+    return next;
+  }
+  size_t low = 0;
+  size_t high = spec.numFields;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (spec.fields[mid].id < id) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return (low < spec.numFields && spec.fields[low].id == id) ? low : spec.numFields;
+}
+
+uint32_t readField(TProtocol* iprot, void* obj, const TFieldSpec& field) {
+  void* data = field.kind == TK_CUSTOM ? NULL : field.field(obj);
+  switch (field.kind) {
+  case TK_BOOL:
+    return iprot->readBool(*static_cast<bool*>(data));
+  case TK_BYTE:
+    return iprot->readByte(*static_cast<int8_t*>(data));
+  case TK_I16:
+    return iprot->readI16(*static_cast<int16_t*>(data));
+  case TK_I32:
+    return iprot->readI32(*static_cast<int32_t*>(data));
+  case TK_I64:
+    return iprot->readI64(*static_cast<int64_t*>(data));
+  case TK_DOUBLE:
+    return iprot->readDouble(*static_cast<double*>(data));
+  case TK_STRING:
+    return iprot->readString(*static_cast<std::string*>(data));
+  case TK_BINARY:
+    return iprot->readBinary(*static_cast<std::string*>(data));
+  default:
+    return field.read(iprot, obj);
+  }
+}
+
+uint32_t writeField(TProtocol* oprot, const void* obj, const TFieldSpec& field) {
+  // The table's functions take a non-const struct, but nothing is written
+  const void* data =
+    field.kind == TK_CUSTOM ? NULL : field.field(const_cast<void*>(obj));
+  switch (field.kind) {
+  case TK_BOOL:
+    return oprot->writeBool(*static_cast<const bool*>(data));
+  case TK_BYTE:
+    return oprot->writeByte(*static_cast<const int8_t*>(data));
+  case TK_I16:
+    return oprot->writeI16(*static_cast<const int16_t*>(data));
+  case TK_I32:
+    return oprot->writeI32(*static_cast<const int32_t*>(data));
+  case TK_I64:
+    return oprot->writeI64(*static_cast<const int64_t*>(data));
+  case TK_DOUBLE:
+    return oprot->writeDouble(*static_cast<const double*>(data));
+  case TK_STRING:
+    return oprot->writeString(*static_cast<const std::string*>(data));
+  case TK_BINARY:
+    return oprot->writeBinary(*static_cast<const std::string*>(data));
+  default:
+    return field.write(oprot, obj);
+  }
+}
+
+}
+
+uint32_t readStruct(TProtocol* iprot, void* obj, const TStructSpec& spec) {
+  uint32_t xfer = 0;
+  std::string fname;
+  TType ftype;
+  int16_t fid;
+
+  // Fields seen, by index; the first 64 need no allocation
+  uint64_t seen = 0;
+  std::vector<bool> seenMore;
+  if (spec.numFields > 64) {
+    seenMore.resize(spec.numFields - 64);
+  }
+
+  xfer += iprot->readStructBegin(fname);
+  size_t next = 0;
+  while (true) {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == T_STOP) {
+      break;
+    }
+    size_t index = findField(spec, fid, next);
+    if (index == spec.numFields || ftype != spec.fields[index].type) {
+      xfer += iprot->skip(ftype);
+    } else {
+      const TFieldSpec& field = spec.fields[index];
+      xfer += readField(iprot, obj, field);
+      if (field.issetFlag != NULL) {
+        *field.issetFlag(obj) = true;
+      }
+      if (index < 64) {
+        seen |= static_cast<uint64_t>(1) << index;
+      } else {
+        seenMore[index - 64] = true;
+      }
+      next = index + 1;
+    }
+    xfer += iprot->readFieldEnd();
+  }
+  xfer += iprot->readStructEnd();
+
+  // Throw if any required fields are missing, after reading the struct end
+  // so that there might possibly be a chance of continuing
+  for (size_t i = 0; i < spec.numFields; ++i) {
+    if (spec.fields[i].required &&
+        !(i < 64 ? (seen >> i) & 1 : seenMore[i - 64])) {
+      throw TProtocolException(TProtocolException::INVALID_DATA);
+    }
+  }
+  return xfer;
+}
+
+uint32_t writeStruct(TProtocol* oprot, const void* obj, const TStructSpec& spec) {
+  uint32_t xfer = 0;
+  xfer += oprot->writeStructBegin(spec.name);
+  for (size_t i = 0; i < spec.numFields; ++i) {
+    const TFieldSpec& field = spec.fields[i];
+    if (field.writeIfSet && field.issetFlag != NULL &&
+        !*field.issetFlag(const_cast<void*>(obj))) {
+      continue;
+    }
+    xfer += oprot->writeFieldBegin(field.name, static_cast<TType>(field.type), field.id);
+    xfer += writeField(oprot, obj, field);
+    xfer += oprot->writeFieldEnd();
+  }
+  xfer += oprot->writeFieldStop();
+  xfer += oprot->writeStructEnd();
+  return xfer;
+}
+
+}}} // apache::thrift::protocol
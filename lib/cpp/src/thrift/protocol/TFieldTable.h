@@ -0,0 +1,117 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TFIELDTABLE_H_
+#define _THRIFT_PROTOCOL_TFIELDTABLE_H_ 1
+
+#include <thrift/protocol/TProtocol.h>
+
+#include <cstddef>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * How a field is stored in its struct.
+ */
+enum TFieldKind {
+  TK_BOOL,
+  TK_BYTE,
+  TK_I16,
+  TK_I32,
+  TK_I64,
+  TK_DOUBLE,
+  TK_STRING,
+  TK_BINARY,
+  /// Read and written by the field's own functions
+  TK_CUSTOM
+};
+
+/**
+ * Describes one field of a struct, for readStruct() and writeStruct().
+ *
+ * Tables of these are plain constants, so they need no initialization at
+ * startup.  The code generated with the cpp:table_serialization option
+ * builds them, finding fields with the fieldOf() and issetOf() templates
+ * below.  Generated structs are not standard-layout, so offsetof is not
+ * defined for them; member pointers are.
+ */
+struct TFieldSpec {
+  int16_t id;
+  /// TType on the wire
+  uint8_t type;
+  /// TFieldKind in memory
+  uint8_t kind;
+  /// Reading throws if the field is missing
+  bool required;
+  /// Written only if its __isset flag is set; ignored if it has none
+  bool writeIfSet;
+  const char* name;
+  /// Finds the field in the struct; NULL for TK_CUSTOM fields
+  void* (*field)(void* obj);
+  /// Finds the field's __isset flag in the struct, or NULL if it has none
+  bool* (*issetFlag)(void* obj);
+  /// For TK_CUSTOM fields; these take the struct, not the field
+  uint32_t (*read)(TProtocol* iprot, void* obj);
+  uint32_t (*write)(TProtocol* oprot, const void* obj);
+};
+
+/**
+ * TFieldSpec::field for the member Member of T, which is of type M.
+ */
+template <class T, class M, M T::*Member>
+void* fieldOf(void* obj) {
+  return &(static_cast<T*>(obj)->*Member);
+}
+
+/**
+ * TFieldSpec::issetFlag for the flag Flag of the member Isset of T, which is
+ * of type I.
+ */
+template <class T, class I, I T::*Isset, bool I::*Flag>
+bool* issetOf(void* obj) {
+  return &((static_cast<T*>(obj)->*Isset).*Flag);
+}
+
+/**
+ * Describes a struct, for readStruct() and writeStruct().
+ */
+struct TStructSpec {
+  const char* name;
+  /// Sorted by id
+  const TFieldSpec* fields;
+  size_t numFields;
+};
+
+/**
+ * Reads the struct at obj as spec describes it, as the generated read()
+ * would: unknown fields and fields of the wrong type are skipped, and
+ * missing required fields throw after the whole struct is read.
+ *
+ * @throws TProtocolException Missing required field
+ */
+uint32_t readStruct(TProtocol* iprot, void* obj, const TStructSpec& spec);
+
+/**
+ * Writes the struct at obj as spec describes it, in field id order.
+ */
+uint32_t writeStruct(TProtocol* oprot, const void* obj, const TStructSpec& spec);
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TFIELDTABLE_H_
@@ -0,0 +1,112 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/server/TAdmissionController.h>
+#include <thrift/concurrency/Util.h>
+
+#include <cmath>
+
+namespace apache { namespace thrift { namespace server {
+
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Util;
+
+TAdmissionController::TAdmissionController(int64_t targetUsec,
+                                           int64_t intervalUsec) :
+  targetUsec_(targetUsec),
+  intervalUsec_(intervalUsec),
+  firstAboveTime_(0),
+  dropNext_(0),
+  dropCount_(0),
+  lastDropCount_(0),
+  dropping_(false),
+  lastSojournUsec_(0),
+  admitted_(0),
+  rejected_(0) {
+}
+
+bool TAdmissionController::admit(int64_t sojournUsec) {
+  return admit(sojournUsec, Util::currentTimeUsec());
+}
+
+bool TAdmissionController::admitQueuedAt(int64_t enqueueTimeUsec) {
+  int64_t now = Util::currentTimeUsec();
+  return admit(now - enqueueTimeUsec, now);
+}
+
+int64_t TAdmissionController::controlLaw(int64_t t, uint32_t count) const {
+  return t + static_cast<int64_t>(intervalUsec_ / std::sqrt(static_cast<double>(count)));
+}
+
+bool TAdmissionController::admit(int64_t sojournUsec, int64_t now) {
+  Guard g(mutex_);
+  lastSojournUsec_ = sojournUsec;
+
+  // Only a delay that persists for a whole interval counts as a standing
+  // queue; anything shorter is a burst the queue is there to absorb.
+  bool okToDrop = false;
+  if (sojournUsec < targetUsec_) {
+    firstAboveTime_ = 0;
+  } else if (firstAboveTime_ == 0) {
+    firstAboveTime_ = now + intervalUsec_;
+  } else if (now >= firstAboveTime_) {
+    okToDrop = true;
+  }
+
+  if (dropping_) {
+    if (!okToDrop) {
+      dropping_ = false;
+    } else if (now >= dropNext_) {
+      ++dropCount_;
+      dropNext_ = controlLaw(dropNext_, dropCount_);
+      ++rejected_;
+      return false;
+    }
+  } else if (okToDrop) {
+    dropping_ = true;
+    // If we were dropping recently, resume near the old drop rate rather
+    // than starting over
+    uint32_t delta = dropCount_ - lastDropCount_;
+    if (delta > 1 && now - dropNext_ < 16 * intervalUsec_) {
+      dropCount_ = delta;
+    } else {
+      dropCount_ = 1;
+    }
+    lastDropCount_ = dropCount_;
+    dropNext_ = controlLaw(now, dropCount_);
+    ++rejected_;
+    return false;
+  }
+
+  ++admitted_;
+  return true;
+}
+
+TAdmissionController::State TAdmissionController::getState() const {
+  Guard g(mutex_);
+  State state;
+  state.dropping = dropping_;
+  state.lastSojournUsec = lastSojournUsec_;
+  state.dropCount = dropping_ ? dropCount_ : 0;
+  state.admitted = admitted_;
+  state.rejected = rejected_;
+  return state;
+}
+
+}}} // apache::thrift::server
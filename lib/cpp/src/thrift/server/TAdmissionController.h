@@ -0,0 +1,123 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TADMISSIONCONTROLLER_H_
+#define _THRIFT_SERVER_TADMISSIONCONTROLLER_H_ 1
+
+#include <thrift/Thrift.h>
+#include <thrift/concurrency/Mutex.h>
+
+namespace apache { namespace thrift { namespace server {
+
+/**
+ * Admission controller for queued requests, based on the CoDel queue
+ * management algorithm (Nichols and Jacobson, "Controlling Queue Delay").
+ *
+ * Servers call admit() as each request leaves the thread manager queue,
+ * with the time the request spent queued (its sojourn time).  Short bursts
+ * are admitted in full.  Once the sojourn time has stayed above the target
+ * for a whole interval, the controller enters the dropping state and
+ * rejects requests at a rate that rises with the square root of the number
+ * of drops, until the sojourn time falls below the target again.  Rejected
+ * requests should be failed quickly rather than processed, which brings the
+ * queue delay back down to the target without a static limit.
+ *
+ * All methods are thread safe.
+ */
+class TAdmissionController {
+ public:
+  /**
+   * Snapshot of the controller's state.
+   */
+  struct State {
+    /// Whether requests are currently being rejected
+    bool dropping;
+    /// Sojourn time of the last request seen, in microseconds
+    int64_t lastSojournUsec;
+    /// Requests rejected since entering the dropping state
+    uint32_t dropCount;
+    /// Total requests admitted
+    uint64_t admitted;
+    /// Total requests rejected
+    uint64_t rejected;
+  };
+
+  /**
+   * @param targetUsec acceptable standing queue delay, in microseconds.
+   * @param intervalUsec how long the delay must stay above target before
+   *        requests are rejected, in microseconds; should be about the
+   *        worst-case time to process a request.
+   */
+  TAdmissionController(int64_t targetUsec = 5000, int64_t intervalUsec = 100000);
+
+  /**
+   * Decide whether to run a request that has just been dequeued.
+   *
+   * @param sojournUsec how long the request waited in the queue.
+   * @return false if the request should be rejected.
+   */
+  bool admit(int64_t sojournUsec);
+
+  /**
+   * Like admit(sojournUsec), deciding as of nowUsec (on the clock of
+   * Util::currentTimeUsec()), for callers that have already read the clock.
+   */
+  bool admit(int64_t sojournUsec, int64_t nowUsec);
+
+  /**
+   * Like admit(sojournUsec), for a request queued at enqueueTimeUsec (as
+   * returned by Util::currentTimeUsec()).
+   */
+  bool admitQueuedAt(int64_t enqueueTimeUsec);
+
+  State getState() const;
+
+  int64_t getTarget() const {
+    return targetUsec_;
+  }
+
+  int64_t getInterval() const {
+    return intervalUsec_;
+  }
+
+ private:
+  /// Time of the next drop after one at t, the count'th of this episode
+  int64_t controlLaw(int64_t t, uint32_t count) const;
+
+  const int64_t targetUsec_;
+  const int64_t intervalUsec_;
+
+  mutable apache::thrift::concurrency::Mutex mutex_;
+
+  /// When the sojourn time will have been above target for an interval
+  int64_t firstAboveTime_;
+  /// When to reject the next request in the dropping state
+  int64_t dropNext_;
+  uint32_t dropCount_;
+  /// dropCount_ at the end of the previous dropping episode
+  uint32_t lastDropCount_;
+  bool dropping_;
+  int64_t lastSojournUsec_;
+  uint64_t admitted_;
+  uint64_t rejected_;
+};
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TADMISSIONCONTROLLER_H_
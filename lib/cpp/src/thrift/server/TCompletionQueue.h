@@ -0,0 +1,150 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCOMPLETIONQUEUE_H_
+#define _THRIFT_SERVER_TCOMPLETIONQUEUE_H_ 1
+
+#include <thrift/Thrift.h>
+#include <thrift/concurrency/Mutex.h>
+
+namespace apache { namespace thrift { namespace server {
+
+/**
+ * Per-object state that links an object into a TCompletionQueue.
+ */
+template <class T>
+struct TCompletionLink {
+  TCompletionLink() : next(NULL), queued(false) {}
+
+  /// Next object on the queue
+  T* next;
+
+  /// Whether the object is on the queue and not yet released by the consumer
+  volatile bool queued;
+};
+
+/**
+ * Multi-producer, single-consumer queue of objects that want the attention
+ * of one thread.  T links itself in through a TCompletionLink<T> member
+ * named completionLink_, which the queue must be able to access.
+ *
+ * Any thread may push(); the consumer takes everything at once with
+ * popAll() and hands each object back with release() before dealing with
+ * it.  An object pushed again before it has been released is not queued a
+ * second time, since the consumer is still going to see it; intrusive
+ * links could not hold it twice anyway.
+ *
+ * With GCC the queue is lock-free; elsewhere a mutex guards it.
+ */
+template <class T>
+class TCompletionQueue {
+ public:
+  TCompletionQueue() : head_(NULL) {}
+
+  /**
+   * Queues obj unless it is queued already.
+   *
+   * @return true if the queue was empty, i.e. the consumer needs a wakeup.
+   */
+  bool push(T* obj) {
+    TCompletionLink<T>& link = obj->completionLink_;
+#if defined(__GNUC__)
+    if (!__sync_bool_compare_and_swap(&link.queued, false, true)) {
+      return false;
+    }
+    T* head;
+    do {
+      head = head_;
+      link.next = head;
+    } while (__sync_val_compare_and_swap(&head_, head, obj) != head);
+    return head == NULL;
+#else
+    concurrency::Guard g(mutex_);
+    if (link.queued) {
+      return false;
+    }
+    link.queued = true;
+    link.next = head_;
+    head_ = obj;
+    return link.next == NULL;
+#endif
+  }
+
+  /**
+   * Takes every queued object off the queue.  Consumer only.
+   *
+   * @return the objects, oldest first, linked through their next pointers;
+   *         NULL if there were none.
+   */
+  T* popAll() {
+#if defined(__GNUC__)
+    T* head = __sync_lock_test_and_set(&head_, (T*) NULL);
+#else
+    T* head;
+    {
+      concurrency::Guard g(mutex_);
+      head = head_;
+      head_ = NULL;
+    }
+#endif
+
+    // The list is LIFO; reverse it so objects come out in the order they
+    // were pushed.
+    T* ordered = NULL;
+    while (head != NULL) {
+      T* next = head->completionLink_.next;
+      head->completionLink_.next = ordered;
+      ordered = head;
+      head = next;
+    }
+    return ordered;
+  }
+
+  /**
+   * Unlinks obj, taken from popAll(), so that it may be pushed again.
+   * Consumer only; call it before acting on obj, so that a push made
+   * while the consumer acts is not lost.
+   *
+   * @return the object after obj in the list popAll() returned.
+   */
+  T* release(T* obj) {
+    TCompletionLink<T>& link = obj->completionLink_;
+    T* next = link.next;
+    link.next = NULL;
+#if defined(__GNUC__)
+    __sync_lock_release(&link.queued);
+#else
+    concurrency::Guard g(mutex_);
+    link.queued = false;
+#endif
+    return next;
+  }
+
+ private:
+  /// Most recently pushed object
+  T* volatile head_;
+
+#if !defined(__GNUC__)
+  concurrency::Mutex mutex_;
+#endif
+};
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TCOMPLETIONQUEUE_H_
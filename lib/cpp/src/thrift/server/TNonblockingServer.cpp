@@ -24,11 +24,16 @@
 #endif
 
 #include "TNonblockingServer.h"
+#include <thrift/TApplicationException.h>
 #include <thrift/concurrency/Exception.h>
+#include <thrift/concurrency/Util.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 
 #include <iostream>
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
@@ -58,6 +63,10 @@
 #include <sched.h>
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #ifndef AF_LOCAL
 #define AF_LOCAL AF_UNIX
 #endif
@@ -185,6 +194,42 @@ class TNonblockingServer::TConnection {
   /// Thrift call context, if any
   void *connectionContext_;
 
+  /// Links this connection into its IO thread's completion queue
+  TCompletionLink<TConnection> completionLink_;
+
+  class Request;
+
+  /// Whether this connection may have several requests in flight
+  bool pipelined_;
+
+  /// Pipelined requests not yet answered, in arrival order
+  std::deque<Request*> requests_;
+
+  /// Idle Request objects kept for reuse by this connection
+  std::vector<Request*> requestPool_;
+
+  /// Pipelined request whose response is being written, if any
+  Request* writingRequest_;
+
+  /// # of pipelined requests dispatched but not yet collected as finished
+  uint32_t requestsProcessing_;
+
+  /// Whether to close as soon as no pipelined request is processing
+  bool closePending_;
+
+  /// Whether a completion notification for this connection is outstanding
+  bool completionQueued_;
+
+  /// Guards Request::state and completionQueued_ against worker threads
+  Mutex requestMutex_;
+
+  /// Transport and protocol used to read the method name of a request
+  boost::shared_ptr<TMemoryBuffer> peekTransport_;
+  boost::shared_ptr<TProtocol> peekProtocol_;
+
+  friend class TNonblockingIOThread;
+  friend class TCompletionQueue<TConnection>;
+
   /// Go into read mode
   void setRead() {
     setFlags(EV_READ | EV_PERSIST);
@@ -211,13 +256,47 @@ class TNonblockingServer::TConnection {
    * Libevent handler called (via our static wrapper) when the connection
    * socket had something happen.  Rather than use the flags libevent passed,
    * we use the connection state to determine whether we need to read or
-   * write the socket.
+   * write the socket.  Pipelined connections read and write independently,
+   * so for them the flags decide which side is worked.
+   *
+   * @param which the flags associated with the event.
    */
-  void workSocket();
+  void workSocket(short which);
 
   /// Close this connection and free or reset its resources.
   void close();
 
+  /// Close now, or once no pipelined request is processing any more.
+  void closeWhenIdle();
+
+  /**
+   * Hand the frame just read to the thread pool as a new pipelined request.
+   *
+   * @return false if the request could not be dispatched.
+   */
+  bool dispatchRequest();
+
+  /// Pick up pipelined requests that worker threads have finished.
+  void collectCompletions();
+
+  /// Return the next pipelined request whose response can be written.
+  Request* nextResponse();
+
+  /// Write (more of) the current pipelined response.
+  void writeResponse();
+
+  /// Register for reads and/or writes as a pipelined connection needs.
+  void updatePipelinedFlags();
+
+  /**
+   * Read the method name of a request frame and look up the priority the
+   * server routes that method to.
+   */
+  PriorityThreadManager::PRIORITY requestPriority(uint8_t* buf, uint32_t len);
+
+  /// Queue a task with the thread manager at its method's priority.
+  void addTask(boost::shared_ptr<Runnable> task, uint8_t* buf, uint32_t len);
+
  public:
 
   class Task;
@@ -227,6 +306,10 @@ class TNonblockingServer::TConnection {
               const sockaddr* addr, socklen_t addrLen) {
     readBuffer_ = NULL;
     readBufferSize_ = 0;
+    writingRequest_ = NULL;
+    requestsProcessing_ = 0;
+    closePending_ = false;
+    completionQueued_ = false;
 
     ioThread_ = ioThread;
     server_ = ioThread->getServer();
@@ -240,9 +323,7 @@ class TNonblockingServer::TConnection {
     init(socket, ioThread, addr, addrLen);
   }
 
-  ~TConnection() {
-    std::free(readBuffer_);
-  }
+  ~TConnection();
 
  /**
    * Check buffers against any size limits and shrink it if exceeded.
@@ -271,9 +352,9 @@ class TNonblockingServer::TConnection {
    * @param which the flags associated with the event.
    * @param v void* callback arg where we placed TConnection's "this".
    */
-  static void eventHandler(evutil_socket_t fd, short /* which */, void* v) {
+  static void eventHandler(evutil_socket_t fd, short which, void* v) {
     assert(fd == ((TConnection*)v)->getTSocket()->getSocketFD());
-    ((TConnection*)v)->workSocket();
+    ((TConnection*)v)->workSocket(which);
   }
 
   /**
@@ -289,6 +370,21 @@ class TNonblockingServer::TConnection {
     return ioThread_->notify(this);
   }
 
+  /**
+   * Notification that a worker thread is done with a pipelined request,
+   * either because it was processed or because it was dropped (on
+   * overload, in which case the connection is closed).
+   *
+   * Don't call this from the IO thread itself.
+   *
+   * @param request the request, owned by this connection.
+   * @param dropped true if the request was never processed.
+   */
+  void completeRequest(Request* request, bool dropped);
+
+  /// Called on the IO thread for each notifyIOThread() of this connection.
+  void handleNotification();
+
   /*
    * Returns the number of this connection's currently assigned IO
    * thread.
@@ -301,7 +397,7 @@ class TNonblockingServer::TConnection {
   void forceClose() {
     appState_ = APP_CLOSE_CONNECTION;
     if (!notifyIOThread()) {
-      throw TException("TConnection::forceClose: failed write on notify pipe");
+      throw TException("TConnection::forceClose: failed to notify IO thread");
     }
   }
 
@@ -332,28 +428,91 @@ class TNonblockingServer::TConnection {
 
 };
 
+/**
+ * A request in flight on a pipelined connection: its frame, the transports
+ * and protocols a worker thread processes it with, and how far it has got.
+ * Only state is touched by worker threads, under the connection's
+ * requestMutex_; everything else belongs to the IO thread.
+ */
+class TNonblockingServer::TConnection::Request {
+ public:
+  enum State {
+    PROCESSING,
+    DONE,
+    DROPPED
+  };
+
+  explicit Request(TNonblockingServer* server) :
+    buffer(NULL),
+    bufferSize(0),
+    state(PROCESSING),
+    finished(false) {
+    inputTransport.reset(new TMemoryBuffer(buffer, bufferSize));
+    outputTransport.reset(new TMemoryBuffer(
+                                server->getWriteBufferDefaultSize()));
+    factoryInputTransport = server->getInputTransportFactory()->getTransport(
+                              inputTransport);
+    factoryOutputTransport = server->getOutputTransportFactory()->getTransport(
+                              outputTransport);
+    inputProtocol = server->getInputProtocolFactory()->getProtocol(
+                      factoryInputTransport);
+    outputProtocol = server->getOutputProtocolFactory()->getProtocol(
+                      factoryOutputTransport);
+  }
+
+  ~Request() {
+    std::free(buffer);
+  }
+
+  /// Frame being processed; traded with the connection's read buffer
+  uint8_t* buffer;
+  uint32_t bufferSize;
+
+  boost::shared_ptr<TMemoryBuffer> inputTransport;
+  boost::shared_ptr<TMemoryBuffer> outputTransport;
+  boost::shared_ptr<TTransport> factoryInputTransport;
+  boost::shared_ptr<TTransport> factoryOutputTransport;
+  boost::shared_ptr<TProtocol> inputProtocol;
+  boost::shared_ptr<TProtocol> outputProtocol;
+
+  /// Set by the worker thread once it is done with the request
+  State state;
+
+  /// Whether the IO thread has seen that the request is done
+  bool finished;
+};
+
 class TNonblockingServer::TConnection::Task: public Runnable {
  public:
   Task(boost::shared_ptr<TProcessor> processor,
        boost::shared_ptr<TProtocol> input,
        boost::shared_ptr<TProtocol> output,
-       TConnection* connection) :
+       TConnection* connection,
+       Request* request = NULL) :
     processor_(processor),
     input_(input),
     output_(output),
     connection_(connection),
+    request_(request),
     serverEventHandler_(connection_->getServerEventHandler()),
-    connectionContext_(connection_->getConnectionContext()) {}
+    connectionContext_(connection_->getConnectionContext()),
+    admissionController_(connection_->getServer()->getAdmissionController()),
+    enqueueTimeUsec_(admissionController_ ? Util::currentTimeUsec() : 0) {}
 
   void run() {
     try {
-      for (;;) {
-        if (serverEventHandler_ != NULL) {
-          serverEventHandler_->processContext(connectionContext_, connection_->getTSocket());
-        }
-        if (!processor_->process(input_, output_, connectionContext_) ||
-            !input_->getTransport()->peek()) {
-          break;
+      if (admissionController_ &&
+          !admissionController_->admitQueuedAt(enqueueTimeUsec_)) {
+        reject();
+      } else {
+        for (;;) {
+          if (serverEventHandler_ != NULL) {
+            serverEventHandler_->processContext(connectionContext_, connection_->getTSocket());
+          }
+          if (!processor_->process(input_, output_, connectionContext_) ||
+              !input_->getTransport()->peek()) {
+            break;
+          }
         }
       }
     } catch (const TTransportException& ttx) {
@@ -369,9 +528,21 @@ class TNonblockingServer::TConnection::Task: public Runnable {
         "TNonblockingServer: unknown exception while processing.");
     }
 
-    // Signal completion back to the libevent thread via a pipe
-    if (!connection_->notifyIOThread()) {
-      throw TException("TNonblockingServer::Task::run: failed write on notify pipe");
+    // Signal completion back to the libevent thread via its completion queue
+    if (request_ != NULL) {
+      connection_->completeRequest(request_, false);
+    } else if (!connection_->notifyIOThread()) {
+      throw TException("TNonblockingServer::Task::run: failed to notify IO thread");
+    }
+  }
+
+  /// Give up on this task without running it, closing its connection.
+  void abandon() {
+    if (request_ != NULL) {
+      connection_->completeRequest(request_, true);
+    } else {
+      assert(connection_->getState() == APP_WAIT_TASK);
+      connection_->forceClose();
     }
   }
 
@@ -380,12 +551,38 @@ class TNonblockingServer::TConnection::Task: public Runnable {
   }
 
  private:
+  /**
+   * Fail the request with a TApplicationException instead of processing it,
+   * so the client learns at once that the server is overloaded.  Oneway
+   * requests are just dropped.
+   */
+  void reject() {
+    std::string fname;
+    TMessageType mtype;
+    int32_t seqid;
+    input_->readMessageBegin(fname, mtype, seqid);
+    if (mtype != T_CALL) {
+      return;
+    }
+
+    TApplicationException x(TApplicationException::INTERNAL_ERROR,
+                            "TNonblockingServer: overloaded, request rejected");
+    output_->writeMessageBegin(fname, T_EXCEPTION, seqid);
+    x.write(output_.get());
+    output_->writeMessageEnd();
+    output_->getTransport()->writeEnd();
+    output_->getTransport()->flush();
+  }
+
   boost::shared_ptr<TProcessor> processor_;
   boost::shared_ptr<TProtocol> input_;
   boost::shared_ptr<TProtocol> output_;
   TConnection* connection_;
+  Request* request_;
   boost::shared_ptr<TServerEventHandler> serverEventHandler_;
   void* connectionContext_;
+  boost::shared_ptr<TAdmissionController> admissionController_;
+  int64_t enqueueTimeUsec_;
 };
 
 void TNonblockingServer::TConnection::init(int socket,
@@ -400,6 +597,9 @@ void TNonblockingServer::TConnection::init(int socket,
   appState_ = APP_INIT;
   eventFlags_ = 0;
 
+  pipelined_ = server_->isThreadPoolProcessing() &&
+               server_->getMaxPipelinedRequests() > 1;
+
   readBufferPos_ = 0;
   readWant_ = 0;
 
@@ -436,10 +636,271 @@ void TNonblockingServer::TConnection::init(int socket,
   processor_ = server_->getProcessor(inputProtocol_, outputProtocol_, tSocket_);
 }
 
-void TNonblockingServer::TConnection::workSocket() {
+TNonblockingServer::TConnection::~TConnection() {
+  std::free(readBuffer_);
+  for (std::deque<Request*>::iterator it = requests_.begin();
+       it != requests_.end(); ++it) {
+    delete *it;
+  }
+  for (std::vector<Request*>::iterator it = requestPool_.begin();
+       it != requestPool_.end(); ++it) {
+    delete *it;
+  }
+}
+
+void TNonblockingServer::TConnection::completeRequest(Request* request,
+                                                      bool dropped) {
+  bool wake;
+  {
+    Guard g(requestMutex_);
+    request->state = dropped ? Request::DROPPED : Request::DONE;
+    // The connection sits on the completion queue at most once; whatever
+    // completes before the IO thread gets to it is collected in one go.
+    wake = !completionQueued_;
+    completionQueued_ = true;
+  }
+
+  if (wake && !notifyIOThread()) {
+    throw TException("TConnection::completeRequest: failed to notify IO thread");
+  }
+}
+
+void TNonblockingServer::TConnection::handleNotification() {
+  if (pipelined_ && appState_ != APP_INIT) {
+    collectCompletions();
+  } else {
+    transition();
+  }
+}
+
+void TNonblockingServer::TConnection::closeWhenIdle() {
+  if (requestsProcessing_ == 0) {
+    close();
+    return;
+  }
+
+  // Worker threads still hold requests of ours; finish the job when the
+  // last of them has been collected.
+  closePending_ = true;
+  setIdle();
+}
+
+bool TNonblockingServer::TConnection::dispatchRequest() {
+  Request* request;
+  if (requestPool_.empty()) {
+    request = new Request(server_);
+  } else {
+    request = requestPool_.back();
+    requestPool_.pop_back();
+  }
+
+  // The request takes the frame; its old buffer receives the next one
+  std::swap(readBuffer_, request->buffer);
+  std::swap(readBufferSize_, request->bufferSize);
+  request->inputTransport->resetBuffer(request->buffer, readBufferPos_);
+  request->outputTransport->resetBuffer();
+  // Prepend four bytes of blank space for the frame size
+  request->outputTransport->getWritePtr(4);
+  request->outputTransport->wroteBytes(4);
+  request->state = Request::PROCESSING;
+  request->finished = false;
+
+  requests_.push_back(request);
+  ++requestsProcessing_;
+  server_->incrementActiveProcessors();
+
+  boost::shared_ptr<Runnable> task =
+    boost::shared_ptr<Runnable>(new Task(processor_,
+                                         request->inputProtocol,
+                                         request->outputProtocol,
+                                         this,
+                                         request));
+  try {
+    addTask(task, request->buffer, readBufferPos_);
+  } catch (IllegalStateException & ise) {
+    // The ThreadManager is not ready to handle any more tasks (it's probably shutting down).
+    GlobalOutput.printf("IllegalStateException: Server::process() %s", ise.what());
+    requests_.pop_back();
+    requestPool_.push_back(request);
+    --requestsProcessing_;
+    server_->decrementActiveProcessors();
+    closeWhenIdle();
+    return false;
+  }
+  return true;
+}
+
+PriorityThreadManager::PRIORITY
+TNonblockingServer::TConnection::requestPriority(uint8_t* buf, uint32_t len) {
+  if (!peekProtocol_) {
+    peekTransport_.reset(new TMemoryBuffer());
+    peekProtocol_ = server_->getInputProtocolFactory()->getProtocol(
+                      server_->getInputTransportFactory()->getTransport(
+                        peekTransport_));
+  }
+
+  std::string fname;
+  protocol::TMessageType mtype;
+  int32_t seqid;
+  try {
+    peekTransport_->resetBuffer(buf, len);
+    peekProtocol_->readMessageBegin(fname, mtype, seqid);
+  } catch (TException& te) {
+    // Let the processor report the bad request
+    return PriorityThreadManager::NORMAL;
+  }
+  return server_->getMethodPriority(fname);
+}
+
+void TNonblockingServer::TConnection::addTask(boost::shared_ptr<Runnable> task,
+                                              uint8_t* buf, uint32_t len) {
+  if (server_->isPriorityRouting()) {
+    server_->addTask(task, requestPriority(buf, len));
+  } else {
+    server_->addTask(task);
+  }
+}
+
+void TNonblockingServer::TConnection::collectCompletions() {
+  {
+    Guard g(requestMutex_);
+    completionQueued_ = false;
+
+    for (std::deque<Request*>::iterator it = requests_.begin();
+         it != requests_.end(); ++it) {
+      Request* request = *it;
+      if (request->finished || request->state == Request::PROCESSING) {
+        continue;
+      }
+      request->finished = true;
+      --requestsProcessing_;
+      server_->decrementActiveProcessors();
+      if (request->state == Request::DROPPED) {
+        closePending_ = true;
+      }
+    }
+  }
+
+  if (closePending_) {
+    if (requestsProcessing_ == 0) {
+      close();
+    } else {
+      setIdle();
+    }
+    return;
+  }
+
+  // Oneway requests have nothing to send back (4 bytes were reserved for
+  // frame size) and must not hold up the responses behind them.
+  std::deque<Request*>::iterator it = requests_.begin();
+  while (it != requests_.end()) {
+    uint8_t* buf;
+    uint32_t size;
+    (*it)->outputTransport->getBuffer(&buf, &size);
+    if ((*it)->finished && size <= 4) {
+      requestPool_.push_back(*it);
+      it = requests_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  updatePipelinedFlags();
+}
+
+TNonblockingServer::TConnection::Request*
+TNonblockingServer::TConnection::nextResponse() {
+  if (server_->getOutOfOrderResponses()) {
+    for (std::deque<Request*>::iterator it = requests_.begin();
+         it != requests_.end(); ++it) {
+      if ((*it)->finished) {
+        return *it;
+      }
+    }
+    return NULL;
+  }
+
+  if (!requests_.empty() && requests_.front()->finished) {
+    return requests_.front();
+  }
+  return NULL;
+}
+
+void TNonblockingServer::TConnection::updatePipelinedFlags() {
+  short flags = 0;
+  if (requests_.size() < server_->getMaxPipelinedRequests()) {
+    flags |= EV_READ;
+  }
+  if (writingRequest_ != NULL || nextResponse() != NULL) {
+    flags |= EV_WRITE;
+  }
+  setFlags(flags == 0 ? 0 : flags | EV_PERSIST);
+}
+
+void TNonblockingServer::TConnection::writeResponse() {
+  if (writingRequest_ == NULL) {
+    writingRequest_ = nextResponse();
+    if (writingRequest_ == NULL) {
+      updatePipelinedFlags();
+      return;
+    }
+
+    writingRequest_->outputTransport->getBuffer(&writeBuffer_,
+                                                &writeBufferSize_);
+    writeBufferPos_ = 0;
+
+    // Put the frame size into the write buffer
+    int32_t frameSize = (int32_t)htonl(writeBufferSize_ - 4);
+    memcpy(writeBuffer_, &frameSize, 4);
+  }
+
+  uint32_t sent = 0;
+  try {
+    sent = tSocket_->write_partial(writeBuffer_ + writeBufferPos_,
+                                   writeBufferSize_ - writeBufferPos_);
+  } catch (TTransportException& te) {
+    GlobalOutput.printf("TConnection::writeResponse(): %s ", te.what());
+    closeWhenIdle();
+    return;
+  }
+
+  writeBufferPos_ += sent;
+  assert(writeBufferPos_ <= writeBufferSize_);
+  if (writeBufferPos_ < writeBufferSize_) {
+    return;
+  }
+
+  if (writeBufferSize_ > largestWriteBufferSize_) {
+    largestWriteBufferSize_ = writeBufferSize_;
+  }
+  requests_.erase(std::find(requests_.begin(), requests_.end(),
+                            writingRequest_));
+  requestPool_.push_back(writingRequest_);
+  writingRequest_ = NULL;
+  writeBuffer_ = NULL;
+  writeBufferPos_ = 0;
+  writeBufferSize_ = 0;
+
+  updatePipelinedFlags();
+}
+
+void TNonblockingServer::TConnection::workSocket(short which) {
   int got=0, left=0, sent=0;
   uint32_t fetch = 0;
 
+  if (pipelined_) {
+    if (which & EV_WRITE) {
+      writeResponse();
+      // Writing may have closed the connection or paused reading
+      if (ioThread_ == NULL || !(eventFlags_ & EV_READ)) {
+        return;
+      }
+    }
+    if (!(which & EV_READ)) {
+      return;
+    }
+  }
+
   switch (socketState_) {
   case SOCKET_RECV_FRAMING:
     union {
@@ -456,13 +917,13 @@ void TNonblockingServer::TConnection::workSocket() {
                              uint32_t(sizeof(framing.size) - readBufferPos_));
       if (fetch == 0) {
         // Whenever we get here it means a remote disconnect
-        close();
+        closeWhenIdle();
         return;
       }
       readBufferPos_ += fetch;
     } catch (TTransportException& te) {
       GlobalOutput.printf("TConnection::workSocket(): %s", te.what());
-      close();
+      closeWhenIdle();
 
       return;
     }
@@ -482,7 +943,7 @@ void TNonblockingServer::TConnection::workSocket() {
                           "using TFramedTransport?",
                           readWant_, server_->getMaxFrameSize(),
                           tSocket_->getSocketInfo().c_str());
-      close();
+      closeWhenIdle();
       return;
     }
     // size known; now get the rest of the frame
@@ -500,7 +961,7 @@ void TNonblockingServer::TConnection::workSocket() {
     }
     catch (TTransportException& te) {
       GlobalOutput.printf("TConnection::workSocket(): %s", te.what());
-      close();
+      closeWhenIdle();
 
       return;
     }
@@ -520,7 +981,7 @@ void TNonblockingServer::TConnection::workSocket() {
     }
 
     // Whenever we get down here it means a remote disconnect
-    close();
+    closeWhenIdle();
 
     return;
 
@@ -577,6 +1038,18 @@ void TNonblockingServer::TConnection::transition() {
   switch (appState_) {
 
   case APP_READ_REQUEST:
+    if (pipelined_) {
+      // Dispatch the request and go straight on to reading the next frame
+      if (!dispatchRequest()) {
+        return;
+      }
+      socketState_ = SOCKET_RECV_FRAMING;
+      appState_ = APP_READ_FRAME_SIZE;
+      readBufferPos_ = 0;
+      updatePipelinedFlags();
+      return;
+    }
+
     // We are done reading the request, package the read buffer into transport
     // and get back some data from the dispatch function
     inputTransport_->resetBuffer(readBuffer_, readBufferPos_);
@@ -601,7 +1074,7 @@ void TNonblockingServer::TConnection::transition() {
       appState_ = APP_WAIT_TASK;
 
         try {
-          server_->addTask(task);
+          addTask(task, readBuffer_, readBufferPos_);
         } catch (IllegalStateException & ise) {
           // The ThreadManager is not ready to handle any more tasks (it's probably shutting down).
           GlobalOutput.printf("IllegalStateException: Server::process() %s", ise.what());
@@ -827,8 +1300,15 @@ void TNonblockingServer::TConnection::close() {
   if (serverEventHandler_ != NULL) {
     serverEventHandler_->deleteContext(connectionContext_, inputProtocol_, outputProtocol_);
   }
+  TNonblockingIOThread* ioThread = ioThread_;
   ioThread_ = NULL;
 
+  // Nothing is processing any more, so keep the requests for reuse
+  requestPool_.insert(requestPool_.end(), requests_.begin(), requests_.end());
+  requests_.clear();
+  writingRequest_ = NULL;
+  closePending_ = false;
+
   // Close the socket
   tSocket_->close();
 
@@ -837,7 +1317,7 @@ void TNonblockingServer::TConnection::close() {
   factoryOutputTransport_->close();
 
   // Give this object back to the server that owns it
-  server_->returnConnection(this);
+  server_->returnConnection(this, ioThread);
 }
 
 void TNonblockingServer::TConnection::checkIdleBufferMemLimit(
@@ -849,6 +1329,18 @@ void TNonblockingServer::TConnection::checkIdleBufferMemLimit(
     readBufferSize_ = 0;
   }
 
+  for (std::vector<Request*>::iterator it = requestPool_.begin();
+       it != requestPool_.end(); ++it) {
+    if (readLimit > 0 && (*it)->bufferSize > readLimit) {
+      free((*it)->buffer);
+      (*it)->buffer = NULL;
+      (*it)->bufferSize = 0;
+    }
+    if (writeLimit > 0 && largestWriteBufferSize_ > writeLimit) {
+      (*it)->outputTransport->resetBuffer(server_->getWriteBufferDefaultSize());
+    }
+  }
+
   if (writeLimit > 0 && largestWriteBufferSize_ > writeLimit) {
     // just start over
     outputTransport_->resetBuffer(server_->getWriteBufferDefaultSize());
@@ -871,12 +1363,72 @@ TNonblockingServer::~TNonblockingServer() {
   }
 }
 
+size_t TNonblockingServer::getNumConnections() const {
+  size_t count;
+  {
+    Guard g(connMutex_);
+    count = numTConnections_;
+  }
+  for (uint32_t i = 0; i < ioThreads_.size(); ++i) {
+    Guard g(ioThreads_[i]->connMutex_);
+    count += ioThreads_[i]->numTConnections_;
+  }
+  return count;
+}
+
+size_t TNonblockingServer::getNumActiveConnections() const {
+  // Count each pool under its own lock, so that a connection moving from
+  // one state to the other is never counted in one and missed in the other
+  size_t count;
+  {
+    Guard g(connMutex_);
+    count = numTConnections_ - connectionStack_.size();
+  }
+  for (uint32_t i = 0; i < ioThreads_.size(); ++i) {
+    Guard g(ioThreads_[i]->connMutex_);
+    count += ioThreads_[i]->numTConnections_ -
+             ioThreads_[i]->connectionStack_.size();
+  }
+  return count;
+}
+
+size_t TNonblockingServer::getNumIdleConnections() const {
+  size_t count;
+  {
+    Guard g(connMutex_);
+    count = connectionStack_.size();
+  }
+  for (uint32_t i = 0; i < ioThreads_.size(); ++i) {
+    Guard g(ioThreads_[i]->connMutex_);
+    count += ioThreads_[i]->connectionStack_.size();
+  }
+  return count;
+}
+
 /**
  * Creates a new connection either by reusing an object off the stack or
  * by allocating a new one entirely
  */
 TNonblockingServer::TConnection* TNonblockingServer::createConnection(
-    int socket, const sockaddr* addr, socklen_t addrLen) {
+    int socket, const sockaddr* addr, socklen_t addrLen,
+    TNonblockingIOThread* acceptThread) {
+  if (threadPerCore_) {
+    // The connection stays on the thread that accepted it and is recycled
+    // through that thread's own pool.  Its lock is only ever contended by
+    // the connection counts.
+    Guard g(acceptThread->connMutex_);
+    TConnection* result = NULL;
+    if (acceptThread->connectionStack_.empty()) {
+      result = new TConnection(socket, acceptThread, addr, addrLen);
+      ++acceptThread->numTConnections_;
+    } else {
+      result = acceptThread->connectionStack_.top();
+      acceptThread->connectionStack_.pop();
+      result->init(socket, acceptThread, addr, addrLen);
+    }
+    return result;
+  }
+
   // Check the stack
   Guard g(connMutex_);
 
@@ -903,7 +1455,21 @@ TNonblockingServer::TConnection* TNonblockingServer::createConnection(
 /**
  * Returns a connection to the stack
  */
-void TNonblockingServer::returnConnection(TConnection* connection) {
+void TNonblockingServer::returnConnection(TConnection* connection,
+                                          TNonblockingIOThread* ioThread) {
+  if (threadPerCore_) {
+    Guard g(ioThread->connMutex_);
+    std::stack<TConnection*>& stack = ioThread->connectionStack_;
+    if (connectionStackLimit_ && (stack.size() >= connectionStackLimit_)) {
+      delete connection;
+      --ioThread->numTConnections_;
+    } else {
+      connection->checkIdleBufferMemLimit(idleReadBufferLimit_, idleWriteBufferLimit_);
+      stack.push(connection);
+    }
+    return;
+  }
+
   Guard g(connMutex_);
 
   if (connectionStackLimit_ &&
@@ -920,10 +1486,11 @@ void TNonblockingServer::returnConnection(TConnection* connection) {
  * Server socket had something happen.  We accept all waiting client
  * connections on fd and assign TConnection objects to handle those requests.
  */
-void TNonblockingServer::handleEvent(int fd, short which) {
+void TNonblockingServer::handleEvent(int fd, short which,
+                                     TNonblockingIOThread* ioThread) {
   (void) which;
   // Make sure that libevent didn't mess up the socket handles
-  assert(fd == serverSocket_);
+  assert(fd == ioThread->listenSocket_);
 
   // Server socket accepted a new connection
   socklen_t addrLen;
@@ -937,7 +1504,12 @@ void TNonblockingServer::handleEvent(int fd, short which) {
   // Accept as many new clients as possible, even though libevent signaled only
   // one, this helps us to avoid having to go back into the libevent engine so
   // many times
+#if defined(HAVE_ACCEPT4) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+  while ((clientSocket = ::accept4(fd, addrp, &addrLen,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+#else
   while ((clientSocket = ::accept(fd, addrp, &addrLen)) != -1) {
+#endif
     // If we're overloaded, take action here
     if (overloadAction_ != T_OVERLOAD_NO_ACTION && serverOverloaded()) {
       Guard g(connMutex_);
@@ -955,6 +1527,7 @@ void TNonblockingServer::handleEvent(int fd, short which) {
       }
     }
 
+#if !(defined(HAVE_ACCEPT4) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC))
     // Explicitly set this socket to NONBLOCK mode
     int flags;
     if ((flags = fcntl(clientSocket, F_GETFL, 0)) < 0 ||
@@ -963,10 +1536,11 @@ void TNonblockingServer::handleEvent(int fd, short which) {
       ::close(clientSocket);
       return;
     }
+#endif
 
     // Create a new TConnection for this client socket.
     TConnection* clientConnection =
-      createConnection(clientSocket, addrp, addrLen);
+      createConnection(clientSocket, addrp, addrLen, ioThread);
 
     // Fail fast if we could not create a TConnection object
     if (clientConnection == NULL) {
@@ -983,11 +1557,10 @@ void TNonblockingServer::handleEvent(int fd, short which) {
      * (We need to avoid writing to our own notification pipe, to
      * avoid possible deadlocks if the pipe is full.)
      *
-     * The IO thread #0 is the only one that handles these listen
-     * events, so unless the connection has been assigned to thread #0
-     * we know it's not on our thread.
+     * Unless the connection has been assigned to the thread that owns
+     * the listen socket, we know it's not on our thread.
      */
-    if (clientConnection->getIOThreadNumber() == 0) {
+    if (clientConnection->getIOThreadNumber() == ioThread->getThreadNumber()) {
       clientConnection->transition();
     } else {
       clientConnection->notifyIOThread();
@@ -1057,6 +1630,26 @@ void TNonblockingServer::createAndListenOnSocket() {
   // Set reuseaddr to avoid 2MSL delay on server restart
   setsockopt(s, SOL_SOCKET, SO_REUSEADDR, const_cast_sockopt(&one), sizeof(one));
 
+  // Every IO thread binds its own listener to the port in thread-per-core
+  // mode, and the kernel spreads new connections among them
+  if (threadPerCore_) {
+#ifdef SO_REUSEPORT
+    if (-1 == setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                         const_cast_sockopt(&one), sizeof(one))) {
+      ::close(s);
+      freeaddrinfo(res0);
+      throw TTransportException(TTransportException::NOT_OPEN,
+                                "TNonblockingServer::serve() SO_REUSEPORT",
+                                errno);
+    }
+#else
+    ::close(s);
+    freeaddrinfo(res0);
+    throw TException("TNonblockingServer::serve() thread-per-core mode "
+                     "requires SO_REUSEPORT");
+#endif
+  }
+
   if (::bind(s, res->ai_addr, res->ai_addrlen) == -1) {
     ::close(s);
     freeaddrinfo(res0);
@@ -1070,6 +1663,27 @@ void TNonblockingServer::createAndListenOnSocket() {
 
   // Set up this file descriptor for listening
   listenSocket(s);
+
+  // With port 0 the bind picked a port.  Remember it, so that any other
+  // listener joins it rather than taking a port of its own, and so that
+  // getListenPort() can report it.
+  if (port_ == 0) {
+    struct sockaddr_storage addr;
+    socklen_t addrLen = sizeof(addr);
+    if (-1 == getsockname(s, (struct sockaddr*)&addr, &addrLen)) {
+      int errno_copy = errno;
+      ::close(s);
+      serverSocket_ = -1;
+      throw TTransportException(TTransportException::NOT_OPEN,
+                                "TNonblockingServer::serve() getsockname",
+                                errno_copy);
+    }
+    if (addr.ss_family == AF_INET6) {
+      port_ = ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+    } else {
+      port_ = ntohs(((struct sockaddr_in*)&addr)->sin_port);
+    }
+  }
 }
 
 /**
@@ -1117,6 +1731,8 @@ void TNonblockingServer::listenSocket(int s) {
 
 void TNonblockingServer::setThreadManager(boost::shared_ptr<ThreadManager> threadManager) {
   threadManager_ = threadManager;
+  priorityThreadManager_ =
+    boost::dynamic_pointer_cast<PriorityThreadManager>(threadManager);
   if (threadManager != NULL) {
     threadManager->setExpireCallback(std::tr1::bind(&TNonblockingServer::expireClose, this, std::tr1::placeholders::_1));
     threadPoolProcessing_ = true;
@@ -1126,7 +1742,7 @@ void TNonblockingServer::setThreadManager(boost::shared_ptr<ThreadManager> threa
 }
 
 bool  TNonblockingServer::serverOverloaded() {
-  size_t activeConnections = numTConnections_ - connectionStack_.size();
+  size_t activeConnections = getNumActiveConnections();
   if (numActiveProcessors_ > maxActiveProcessors_ ||
       activeConnections > maxConnections_) {
     if (!overloaded_) {
@@ -1152,11 +1768,11 @@ bool TNonblockingServer::drainPendingTask() {
   if (threadManager_) {
     boost::shared_ptr<Runnable> task = threadManager_->removeNextPending();
     if (task) {
-      TConnection* connection =
-        static_cast<TConnection::Task*>(task.get())->getTConnection();
-      assert(connection && connection->getServer()
-             && connection->getState() == APP_WAIT_TASK);
-      connection->forceClose();
+      TConnection::Task* connectionTask =
+        static_cast<TConnection::Task*>(task.get());
+      assert(connectionTask->getTConnection() &&
+             connectionTask->getTConnection()->getServer());
+      connectionTask->abandon();
       return true;
     }
   }
@@ -1164,11 +1780,11 @@ bool TNonblockingServer::drainPendingTask() {
 }
 
 void TNonblockingServer::expireClose(boost::shared_ptr<Runnable> task) {
-  TConnection* connection =
-    static_cast<TConnection::Task*>(task.get())->getTConnection();
-  assert(connection && connection->getServer() &&
-         connection->getState() == APP_WAIT_TASK);
-  connection->forceClose();
+  TConnection::Task* connectionTask =
+    static_cast<TConnection::Task*>(task.get());
+  assert(connectionTask->getTConnection() &&
+         connectionTask->getTConnection()->getServer());
+  connectionTask->abandon();
 }
 
 void TNonblockingServer::stop() {
@@ -1183,8 +1799,13 @@ void TNonblockingServer::stop() {
  * loops over the libevent handler.
  */
 void TNonblockingServer::serve() {
-  // init listen socket
-  createAndListenOnSocket();
+  // init listen socket (one per IO thread in thread-per-core mode)
+  if (!threadPerCore_) {
+    createAndListenOnSocket();
+  } else if (threadPoolProcessing_) {
+    GlobalOutput("TNonblockingServer: thread-per-core mode processes "
+                 "inline, ignoring the ThreadManager.");
+  }
 
   // set up the IO threads
   assert(ioThreads_.empty());
@@ -1193,8 +1814,13 @@ void TNonblockingServer::serve() {
   }
 
   for (uint32_t id = 0; id < numIOThreads_; ++id) {
-    // the first IO thread also does the listening on server socket
+    // the first IO thread also does the listening on server socket, unless
+    // every thread has a listener of its own
     int listenFd = (id == 0 ? serverSocket_ : -1);
+    if (threadPerCore_) {
+      createAndListenOnSocket();
+      listenFd = serverSocket_;
+    }
 
     shared_ptr<TNonblockingIOThread> thread(
       new TNonblockingIOThread(this, id, listenFd, useHighPriorityIOThreads_));
@@ -1254,7 +1880,9 @@ TNonblockingIOThread::TNonblockingIOThread(TNonblockingServer* server,
       , number_(number)
       , listenSocket_(listenSocket)
       , useHighPriority_(useHighPriority)
-      , eventBase_(NULL) {
+      , eventBase_(NULL)
+      , useEventFD_(false)
+      , numTConnections_(0) {
   notificationPipeFDs_[0] = -1;
   notificationPipeFDs_[1] = -1;
 }
@@ -1263,6 +1891,13 @@ TNonblockingIOThread::~TNonblockingIOThread() {
   // make sure our associated thread is fully finished
   join();
 
+  // Clean up unused TConnection objects in our own pool
+  while (!connectionStack_.empty()) {
+    TNonblockingServer::TConnection* connection = connectionStack_.top();
+    connectionStack_.pop();
+    delete connection;
+  }
+
   if (eventBase_) {
     event_base_free(eventBase_);
   }
@@ -1275,6 +1910,10 @@ TNonblockingIOThread::~TNonblockingIOThread() {
     listenSocket_ = TNonblockingServer::INVALID_SOCKET_VALUE;
   }
 
+  // An eventfd is stored in both slots but only needs closing once
+  if (useEventFD_) {
+    notificationPipeFDs_[1] = TNonblockingServer::INVALID_SOCKET_VALUE;
+  }
   for (int i = 0; i < 2; ++i) {
     if (notificationPipeFDs_[i] >= 0) {
       if (0 != ::close(notificationPipeFDs_[i])) {
@@ -1287,6 +1926,20 @@ TNonblockingIOThread::~TNonblockingIOThread() {
 }
 
 void TNonblockingIOThread::createNotificationPipe() {
+#if defined(HAVE_SYS_EVENTFD_H) && defined(EFD_NONBLOCK) && defined(EFD_CLOEXEC)
+  // A single eventfd serves as both ends: writers add to its counter and
+  // the reader clears it in one read().
+  int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd >= 0) {
+    notificationPipeFDs_[0] = efd;
+    notificationPipeFDs_[1] = efd;
+    useEventFD_ = true;
+    return;
+  }
+  GlobalOutput.perror("TNonblockingServer::createNotificationPipe eventfd ",
+                      errno);
+#endif
+
   if(evutil_socketpair(AF_LOCAL, SOCK_STREAM, 0, notificationPipeFDs_) == -1) {
     GlobalOutput.perror("TNonblockingServer::createNotificationPipe ", EVUTIL_SOCKET_ERROR());
     throw TException("can't create notification pipe");
@@ -1323,7 +1976,7 @@ void TNonblockingIOThread::registerEvents() {
               listenSocket_,
               EV_READ | EV_PERSIST,
               TNonblockingIOThread::listenHandler,
-              server_);
+              this);
     event_base_set(eventBase_, &serverEvent_);
 
     // Add the event and start up the server
@@ -1356,56 +2009,92 @@ void TNonblockingIOThread::registerEvents() {
                       number_);
 }
 
-bool TNonblockingIOThread::notify(TNonblockingServer::TConnection* conn) {
+bool TNonblockingIOThread::signalNotification() {
   int fd = getNotificationSendFD();
   if (fd < 0) {
     return false;
   }
 
-  const int kSize = sizeof(conn);
-  if (send(fd, const_cast_sockopt(&conn), kSize, 0) != kSize) {
-    return false;
+  if (useEventFD_) {
+    uint64_t one = 1;
+    if (::write(fd, &one, sizeof(one)) != sizeof(one)) {
+      // The counter can only be full if a wakeup is already pending
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
   }
 
+  int8_t byte = 0;
+  if (send(fd, const_cast_sockopt(&byte), sizeof(byte), 0) != sizeof(byte)) {
+    // A full pipe means the IO thread has plenty of wakeups pending
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
   return true;
 }
 
+bool TNonblockingIOThread::drainNotification(evutil_socket_t fd) {
+  if (useEventFD_) {
+    uint64_t count;
+    if (::read(fd, &count, sizeof(count)) < 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK) {
+      GlobalOutput.perror("TNonblocking: notifyHandler read() failed: ", errno);
+      return false;
+    }
+    return true;
+  }
+
+  while (true) {
+    int8_t buf[64];
+    int nBytes = recv(fd, cast_sockopt(buf), sizeof(buf), 0);
+    if (nBytes > 0) {
+      continue;
+    } else if (nBytes == 0) {
+      GlobalOutput.printf("notifyHandler: Notify socket closed!");
+      return true;
+    } else if (errno != EWOULDBLOCK && errno != EAGAIN) {
+      GlobalOutput.perror("TNonblocking: notifyHandler read() failed: ", errno);
+      return false;
+    }
+    return true;
+  }
+}
+
+bool TNonblockingIOThread::notify(TNonblockingServer::TConnection* conn) {
+  if (getNotificationSendFD() < 0) {
+    return false;
+  }
+
+  // Only the producer that makes the queue non-empty has to wake us up; the
+  // handler takes everything queued since then in the same pass.
+  if (conn != NULL && !completions_.push(conn)) {
+    return true;
+  }
+
+  return signalNotification();
+}
+
 /* static */
 void TNonblockingIOThread::notifyHandler(evutil_socket_t fd, short which, void* v) {
   TNonblockingIOThread* ioThread = (TNonblockingIOThread*) v;
   assert(ioThread);
   (void)which;
 
-  while (true) {
-    TNonblockingServer::TConnection* connection = 0;
-    const int kSize = sizeof(connection);
-    int nBytes = recv(fd, cast_sockopt(&connection), kSize, 0);
-    if (nBytes == kSize) {
-      if (connection == NULL) {
-        // this is the command to stop our thread, exit the handler!
-        return;
-      }
-      connection->transition();
-    } else if (nBytes > 0) {
-      // throw away these bytes and hope that next time we get a solid read
-      GlobalOutput.printf("notifyHandler: Bad read of %d bytes, wanted %d",
-                          nBytes, kSize);
-      ioThread->breakLoop(true);
-      return;
-    } else if (nBytes == 0) {
-      GlobalOutput.printf("notifyHandler: Notify socket closed!");
-      // exit the loop
-      break;
-    } else { // nBytes < 0
-      if (errno != EWOULDBLOCK && errno != EAGAIN) {
-          GlobalOutput.perror(
-            "TNonblocking: notifyHandler read() failed: ", errno);
-          ioThread->breakLoop(true);
-          return;
-      }
-      // exit the loop
-      break;
-    }
+  // Clear the wakeup before looking at the queue, so that anything pushed
+  // after we emptied it is guaranteed to trigger another one.
+  if (!ioThread->drainNotification(fd)) {
+    ioThread->breakLoop(true);
+    return;
+  }
+
+  TNonblockingServer::TConnection* connection =
+    ioThread->completions_.popAll();
+  while (connection != NULL) {
+    // The connection may be recycled or queued again below, so step past
+    // it first
+    TNonblockingServer::TConnection* next =
+      ioThread->completions_.release(connection);
+    connection->handleNotification();
+    connection = next;
   }
 }
 
@@ -1464,6 +2153,30 @@ void TNonblockingIOThread::setCurrentThreadHighPriority(bool value) {
 #endif
 }
 
+void TNonblockingIOThread::setCurrentThreadAffinity() {
+#if defined(HAVE_SCHED_H) && defined(CPU_SET)
+  long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numCpus <= 0) {
+    return;
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(number_ % numCpus, &cpus);
+
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  if (0 == ret) {
+    GlobalOutput.printf("TNonblocking: IO Thread #%d pinned to CPU %ld",
+                        number_, number_ % numCpus);
+  } else {
+    GlobalOutput.perror("TNonblocking: pthread_setaffinity_np(): ", ret);
+  }
+#else
+  GlobalOutput.printf(
+    "TNonblocking: IO Thread #%d can't be pinned on this platform", number_);
+#endif
+}
+
 void TNonblockingIOThread::run() {
   threadId_ = Thread::get_current();
 
@@ -1487,6 +2200,10 @@ void TNonblockingIOThread::run() {
     setCurrentThreadHighPriority(true);
   }
 
+  if (server_->getPinIOThreads()) {
+    setCurrentThreadAffinity();
+  }
+
   // Run libevent engine, never returns, invokes calls to eventHandler
   event_base_loop(eventBase_, 0);
 
@@ -22,13 +22,17 @@
 
 #include <thrift/Thrift.h>
 #include <thrift/server/TServer.h>
+#include <thrift/server/TAdmissionController.h>
+#include <thrift/server/TCompletionQueue.h>
 #include <thrift/transport/TBufferTransports.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/PriorityThreadManager.h>
 #include <climits>
 #include <thrift/concurrency/Thread.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 #include <thrift/concurrency/Mutex.h>
+#include <map>
 #include <stack>
 #include <vector>
 #include <string>
@@ -48,6 +52,7 @@ using apache::thrift::transport::TSocket;
 using apache::thrift::protocol::TProtocol;
 using apache::thrift::concurrency::Runnable;
 using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::concurrency::PriorityThreadManager;
 using apache::thrift::concurrency::PlatformThreadFactory;
 using apache::thrift::concurrency::ThreadFactory;
 using apache::thrift::concurrency::Thread;
@@ -154,6 +159,18 @@ class TNonblockingServer : public TServer {
   /// Whether to set high scheduling priority for IO threads
   bool useHighPriorityIOThreads_;
 
+  /// Whether each IO thread listens, accepts and processes on its own
+  bool threadPerCore_;
+
+  /// Whether to pin each IO thread to a single CPU
+  bool pinIOThreads_;
+
+  /// Max # of requests a connection may have in flight (1 = no pipelining)
+  size_t maxPipelinedRequests_;
+
+  /// Whether pipelined responses are written as soon as they are ready
+  bool outOfOrderResponses_;
+
   /// Server socket file descriptor
   int serverSocket_;
 
@@ -163,6 +180,12 @@ class TNonblockingServer : public TServer {
   /// For processing via thread pool, may be NULL
   boost::shared_ptr<ThreadManager> threadManager_;
 
+  /// threadManager_, if that is a PriorityThreadManager
+  boost::shared_ptr<PriorityThreadManager> priorityThreadManager_;
+
+  /// Priorities of methods not run at NORMAL priority
+  std::map<std::string, PriorityThreadManager::PRIORITY> methodPriorities_;
+
   /// Is thread pool processing?
   bool threadPoolProcessing_;
 
@@ -199,6 +222,9 @@ class TNonblockingServer : public TServer {
   /// Time in milliseconds before an unperformed task expires (0 == infinite).
   int64_t taskExpireTime_;
 
+  /// Decides which queued tasks to reject, if set
+  boost::shared_ptr<TAdmissionController> admissionController_;
+
   /**
    * Hysteresis for overload state.  This is the fraction of the overload
    * value that needs to be reached before the overload state is cleared;
@@ -262,14 +288,19 @@ class TNonblockingServer : public TServer {
    *
    * @param fd the listen socket.
    * @param which the event flag that triggered the handler.
+   * @param ioThread the IO thread that owns the listen socket.
    */
-  void handleEvent(int fd, short which);
+  void handleEvent(int fd, short which, TNonblockingIOThread* ioThread);
 
   void init(int port) {
     serverSocket_ = -1;
     numIOThreads_ = DEFAULT_IO_THREADS;
     nextIOThread_ = 0;
     useHighPriorityIOThreads_ = false;
+    threadPerCore_ = false;
+    pinIOThreads_ = false;
+    maxPipelinedRequests_ = 1;
+    outOfOrderResponses_ = false;
     port_ = port;
     threadPoolProcessing_ = false;
     numTConnections_ = 0;
@@ -414,11 +445,87 @@ class TNonblockingServer : public TServer {
     useHighPriorityIOThreads_ = val;
   }
 
+  /**
+   * Return the port the server listens on: the one it was given, or, once
+   * serve() has bound a server created with port 0, the one picked for it.
+   */
+  int getListenPort() const {
+    return port_;
+  }
+
   /** Return the number of IO threads used by this server. */
   size_t getNumIOThreads() const {
     return numIOThreads_;
   }
 
+  /** Return whether the server runs in thread-per-core mode. */
+  bool getThreadPerCore() const {
+    return threadPerCore_;
+  }
+
+  /**
+   * Set thread-per-core (shared-nothing) mode. Each IO thread then opens its
+   * own SO_REUSEPORT listen socket on the server port, accepts and serves
+   * its connections itself, processes requests inline on its event loop and
+   * keeps a private pool of idle TConnection objects (connectionStackLimit_
+   * applies per thread). No connection or request ever crosses threads, so
+   * any ThreadManager is ignored and the active processor count is not
+   * tracked. Use one IO thread per core, usually with setPinIOThreads(true).
+   * Can only be used before the call to serve().
+   */
+  void setThreadPerCore(bool threadPerCore) {
+    threadPerCore_ = threadPerCore;
+  }
+
+  /** Return whether IO threads are pinned to CPUs. */
+  bool getPinIOThreads() const {
+    return pinIOThreads_;
+  }
+
+  /**
+   * Set whether IO thread N should be pinned to CPU (N % number of CPUs).
+   * Only supported where pthread_setaffinity_np() is available.
+   */
+  void setPinIOThreads(bool pinIOThreads) {
+    pinIOThreads_ = pinIOThreads;
+  }
+
+  /** Return the max # of requests in flight on a single connection. */
+  size_t getMaxPipelinedRequests() const {
+    return maxPipelinedRequests_;
+  }
+
+  /**
+   * Set the max # of requests a single connection may have in flight. With
+   * a value above 1 and a ThreadManager, the server keeps reading frames
+   * from a connection while earlier ones are still being processed, and
+   * dispatches each to the thread pool as soon as it is complete. Reading
+   * stops while the cap is reached. Ignored when requests are processed
+   * inline on the IO thread (including thread-per-core mode).
+   *
+   * Responses carry the seqid of their request, so a client that matches
+   * replies by seqid may also use setOutOfOrderResponses(true).
+   *
+   * @param maxPipelinedRequests the cap; 0 is treated as 1.
+   */
+  void setMaxPipelinedRequests(size_t maxPipelinedRequests) {
+    maxPipelinedRequests_ = maxPipelinedRequests > 0 ? maxPipelinedRequests : 1;
+  }
+
+  /** Return whether pipelined responses may be written out of order. */
+  bool getOutOfOrderResponses() const {
+    return outOfOrderResponses_;
+  }
+
+  /**
+   * Set whether a pipelined connection writes each response as soon as its
+   * request completes (true), or strictly in request order (false, the
+   * default, which is safe for any client).
+   */
+  void setOutOfOrderResponses(bool outOfOrderResponses) {
+    outOfOrderResponses_ = outOfOrderResponses;
+  }
+
   /**
    * Get the maximum number of unused TConnection we will hold in reserve.
    *
@@ -438,39 +545,79 @@ class TNonblockingServer : public TServer {
   }
 
   bool isThreadPoolProcessing() const {
-    return threadPoolProcessing_;
+    return threadPoolProcessing_ && !threadPerCore_;
   }
 
   void addTask(boost::shared_ptr<Runnable> task) {
     threadManager_->add(task, 0LL, taskExpireTime_);
   }
 
+  void addTask(boost::shared_ptr<Runnable> task,
+               PriorityThreadManager::PRIORITY priority) {
+    if (priorityThreadManager_) {
+      priorityThreadManager_->add(task, priority, 0LL, taskExpireTime_);
+    } else {
+      threadManager_->add(task, 0LL, taskExpireTime_);
+    }
+  }
+
+  /**
+   * Route calls to a method to the given priority lane when the thread
+   * manager is a PriorityThreadManager, so that cheap or latency critical
+   * calls don't queue behind expensive ones.  Methods default to NORMAL.
+   * Must be set before serve() is called.
+   *
+   * @param fname the method name, as sent by clients.
+   * @param priority the lane to queue its calls in.
+   */
+  void setMethodPriority(const std::string& fname,
+                         PriorityThreadManager::PRIORITY priority) {
+    if (priority == PriorityThreadManager::NORMAL) {
+      methodPriorities_.erase(fname);
+    } else {
+      methodPriorities_[fname] = priority;
+    }
+  }
+
+  /**
+   * Get the priority lane calls to a method are routed to.
+   *
+   * @param fname the method name.
+   * @return the priority set by setMethodPriority(), or NORMAL.
+   */
+  PriorityThreadManager::PRIORITY getMethodPriority(const std::string& fname) const {
+    std::map<std::string, PriorityThreadManager::PRIORITY>::const_iterator it =
+      methodPriorities_.find(fname);
+    return it == methodPriorities_.end() ? PriorityThreadManager::NORMAL : it->second;
+  }
+
+  /**
+   * Whether requests need their method name read to pick a priority lane.
+   */
+  bool isPriorityRouting() const {
+    return priorityThreadManager_ && !methodPriorities_.empty();
+  }
+
   /**
    * Return the count of sockets currently connected to.
    *
    * @return count of connected sockets.
    */
-  size_t getNumConnections() const {
-    return numTConnections_;
-  }
+  size_t getNumConnections() const;
 
   /**
    * Return the count of sockets currently connected to.
    *
    * @return count of connected sockets.
    */
-  size_t getNumActiveConnections() const {
-    return getNumConnections() - getNumIdleConnections();
-  }
+  size_t getNumActiveConnections() const;
 
   /**
    * Return the count of connection objects allocated but not in use.
    *
    * @return count of idle connection objects.
    */
-  size_t getNumIdleConnections() const {
-    return connectionStack_.size();
-  }
+  size_t getNumIdleConnections() const;
 
   /**
    * Return count of number of connections which are currently processing.
@@ -486,12 +633,18 @@ class TNonblockingServer : public TServer {
 
   /// Increment the count of connections currently processing.
   void incrementActiveProcessors() {
+    if (threadPerCore_) {
+      return;
+    }
     Guard g(connMutex_);
     ++numActiveProcessors_;
   }
 
   /// Decrement the count of connections currently processing.
   void decrementActiveProcessors() {
+    if (threadPerCore_) {
+      return;
+    }
     Guard g(connMutex_);
     if (numActiveProcessors_ > 0) {
       --numActiveProcessors_;
@@ -612,6 +765,31 @@ class TNonblockingServer : public TServer {
     taskExpireTime_ = taskExpireTime;
   }
 
+  /**
+   * Get the admission controller, if any.  Its getState() shows whether
+   * requests are being rejected and how many have been.
+   *
+   * @return the controller, or NULL if admission control is off.
+   */
+  boost::shared_ptr<TAdmissionController> getAdmissionController() const {
+    return admissionController_;
+  }
+
+  /**
+   * Set an admission controller for thread pool processing.  The time each
+   * task spends queued in the thread manager is passed to the controller
+   * when a worker picks the task up; tasks it rejects are answered with a
+   * TApplicationException instead of being processed.  Unlike the static
+   * limits, this adapts to how fast the handlers are actually going.  Must
+   * be set before serve() is called.
+   *
+   * @param admissionController the controller, or NULL to admit everything.
+   */
+  void setAdmissionController(
+      boost::shared_ptr<TAdmissionController> admissionController) {
+    admissionController_ = admissionController;
+  }
+
   /**
    * Determine if the server is currently overloaded.
    * This function checks the maximums for open connections and connections
@@ -775,10 +953,12 @@ class TNonblockingServer : public TServer {
    * @param socket FD of socket associated with this connection.
    * @param addr the sockaddr of the client
    * @param addrLen the length of addr
+   * @param acceptThread the IO thread that accepted the socket.
    * @return pointer to initialized TConnection object.
    */
   TConnection* createConnection(int socket, const sockaddr* addr,
-                                            socklen_t addrLen);
+                                socklen_t addrLen,
+                                TNonblockingIOThread* acceptThread);
 
   /**
    * Returns a connection to pool or deletion.  If the connection pool
@@ -786,11 +966,14 @@ class TNonblockingServer : public TServer {
    * just delete it.
    *
    * @param connection the TConection being returned.
+   * @param ioThread the IO thread the connection was served by.
    */
-  void returnConnection(TConnection* connection);
+  void returnConnection(TConnection* connection,
+                        TNonblockingIOThread* ioThread);
 };
 
 class TNonblockingIOThread : public Runnable {
+  friend class TNonblockingServer;
  public:
   // Creates an IO thread and sets up the event base.  The listenSocket should
   // be a valid FD on which listen() has already been called.  If the
@@ -815,7 +998,8 @@ class TNonblockingIOThread : public Runnable {
   // only be called after the thread has been started.
   Thread::id_t getThreadId() const { return threadId_; }
 
-  // Returns the send-fd for task complete notifications.
+  // Returns the send-fd for task complete notifications.  This is the same
+  // descriptor as the read-fd when an eventfd is used.
   evutil_socket_t getNotificationSendFD() const { return notificationPipeFDs_[1]; }
 
   // Returns the read-fd for task complete notifications.
@@ -827,7 +1011,10 @@ class TNonblockingIOThread : public Runnable {
   // Sets the actual thread object associated with this IO thread.
   void setThread(const boost::shared_ptr<Thread>& t) { thread_ = t; }
 
-  // Used by TConnection objects to indicate processing has finished.
+  // Used by TConnection objects to indicate processing has finished.  The
+  // connection is queued for this thread, unless it is queued already, and
+  // the thread is only woken up if the queue was empty.  Passing NULL just
+  // wakes the thread up.
   bool notify(TNonblockingServer::TConnection* conn);
 
   // Enters the event loop and does not return until a call to stop().
@@ -842,24 +1029,31 @@ class TNonblockingIOThread : public Runnable {
  private:
   /**
    * C-callable event handler for signaling task completion.  Provides a
-   * callback that libevent can understand that will read a connection
-   * object's address from a pipe and call connection->transition() for
-   * that object.
+   * callback that libevent can understand that will clear the wakeup on
+   * the notification descriptor, then take every connection queued on the
+   * completion queue and call connection->transition() for each of them.
    *
    * @param fd the descriptor the event occurred on.
    */
   static void notifyHandler(evutil_socket_t fd, short which, void* v);
 
+  /// Wakes up the event loop through the notification descriptor.
+  bool signalNotification();
+
+  /// Clears pending wakeups from the notification descriptor.
+  bool drainNotification(evutil_socket_t fd);
+
   /**
    * C-callable event handler for listener events.  Provides a callback
    * that libevent can understand which invokes server->handleEvent().
    *
    * @param fd the descriptor the event occured on.
    * @param which the flags associated with the event.
-   * @param v void* callback arg where we placed TNonblockingServer's "this".
+   * @param v void* callback arg where we placed TNonblockingIOThread's "this".
    */
   static void listenHandler(evutil_socket_t fd, short which, void* v) {
-    ((TNonblockingServer*)v)->handleEvent(fd, which);
+    TNonblockingIOThread* ioThread = (TNonblockingIOThread*)v;
+    ioThread->server_->handleEvent(fd, which, ioThread);
   }
 
   /// Exits the loop ASAP in case of shutdown or error.
@@ -868,7 +1062,10 @@ class TNonblockingIOThread : public Runnable {
   /// Registers the events for the notification & listen sockets
   void registerEvents();
 
-  /// Create the pipe used to notify I/O process of task completion.
+  /**
+   * Create the eventfd (or, where there is none, the pipe) used to notify
+   * I/O process of task completion.
+   */
   void createNotificationPipe();
 
   /// Unregisters our events for notification and listen sockets.
@@ -877,6 +1074,9 @@ class TNonblockingIOThread : public Runnable {
   /// Sets (or clears) high priority scheduling status for the current thread.
   void setCurrentThreadHighPriority(bool value);
 
+  /// Pins the current thread to the CPU matching our thread number.
+  void setCurrentThreadAffinity();
+
  private:
   /// associated server
   TNonblockingServer* server_;
@@ -905,8 +1105,24 @@ class TNonblockingIOThread : public Runnable {
  /// File descriptors for pipe used for task completion notification.
   evutil_socket_t notificationPipeFDs_[2];
 
+  /// Whether notificationPipeFDs_ hold a single eventfd
+  bool useEventFD_;
+
+  /// Connections that finished processing, emptied all at once by this thread
+  TCompletionQueue<TNonblockingServer::TConnection> completions_;
+
   /// Actual IO Thread
   boost::shared_ptr<Thread> thread_;
+
+  /// Guards connectionStack_ and numTConnections_, which other threads read
+  /// for the connection counts
+  Mutex connMutex_;
+
+  /// Idle connections owned by this thread (thread-per-core mode only)
+  std::stack<TNonblockingServer::TConnection*> connectionStack_;
+
+  /// Number of TConnection objects this thread created (thread-per-core mode)
+  size_t numTConnections_;
 };
 
 }}} // apache::thrift::server
@@ -25,6 +25,7 @@
 #include <thrift/transport/TTransportException.h>
 #include <thrift/concurrency/Thread.h>
 #include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
 #include <string>
 #include <iostream>
 
@@ -112,23 +113,89 @@ public:
   shared_ptr<TTransport> transport_;
 };
 
+class TThreadPoolServer::Acceptor : public Runnable {
+
+public:
+
+  Acceptor(TThreadPoolServer& server,
+           shared_ptr<TServerTransport> serverTransport) :
+    server_(server),
+    serverTransport_(serverTransport) {
+  }
+
+  void run() {
+    server_.acceptConnections(serverTransport_);
+  }
+
+ private:
+  TThreadPoolServer& server_;
+  shared_ptr<TServerTransport> serverTransport_;
+};
+
 TThreadPoolServer::~TThreadPoolServer() {}
 
 void TThreadPoolServer::serve() {
-  shared_ptr<TTransport> client;
-  shared_ptr<TTransport> inputTransport;
-  shared_ptr<TTransport> outputTransport;
-  shared_ptr<TProtocol> inputProtocol;
-  shared_ptr<TProtocol> outputProtocol;
-
   // Start the server listening
   serverTransport_->listen();
+  for (vector<shared_ptr<TServerTransport> >::iterator it =
+         extraServerTransports_.begin();
+       it != extraServerTransports_.end(); ++it) {
+    (*it)->listen();
+  }
 
   // Run the preServe event
   if (eventHandler_ != NULL) {
     eventHandler_->preServe();
   }
 
+  // Every additional transport gets an acceptor thread of its own; the
+  // primary one is served from this thread.
+  PlatformThreadFactory acceptorFactory;
+  acceptorFactory.setDetached(false);
+  vector<shared_ptr<Thread> > acceptors;
+  for (vector<shared_ptr<TServerTransport> >::iterator it =
+         extraServerTransports_.begin();
+       it != extraServerTransports_.end(); ++it) {
+    shared_ptr<Thread> thread = acceptorFactory.newThread(
+      shared_ptr<Runnable>(new TThreadPoolServer::Acceptor(*this, *it)));
+    thread->start();
+    acceptors.push_back(thread);
+  }
+
+  acceptConnections(serverTransport_);
+
+  for (vector<shared_ptr<Thread> >::iterator it = acceptors.begin();
+       it != acceptors.end(); ++it) {
+    (*it)->join();
+  }
+
+  // If stopped manually, join the existing threads
+  if (stop_) {
+    try {
+      serverTransport_->close();
+      for (vector<shared_ptr<TServerTransport> >::iterator it =
+             extraServerTransports_.begin();
+           it != extraServerTransports_.end(); ++it) {
+        (*it)->close();
+      }
+      threadManager_->join();
+    } catch (TException &tx) {
+      string errStr = string("TThreadPoolServer: Exception shutting down: ") + tx.what();
+      GlobalOutput(errStr.c_str());
+    }
+    stop_ = false;
+  }
+
+}
+
+void TThreadPoolServer::acceptConnections(
+    const shared_ptr<TServerTransport>& serverTransport) {
+  shared_ptr<TTransport> client;
+  shared_ptr<TTransport> inputTransport;
+  shared_ptr<TTransport> outputTransport;
+  shared_ptr<TProtocol> inputProtocol;
+  shared_ptr<TProtocol> outputProtocol;
+
   while (!stop_) {
     try {
       client.reset();
@@ -138,7 +205,7 @@ void TThreadPoolServer::serve() {
       outputProtocol.reset();
 
       // Fetch client from server
-      client = serverTransport_->accept();
+      client = serverTransport->accept();
 
       // Make IO transports
       inputTransport = inputTransportFactory_->getTransport(client);
@@ -180,18 +247,9 @@ void TThreadPoolServer::serve() {
     }
   }
 
-  // If stopped manually, join the existing threads
-  if (stop_) {
-    try {
-      serverTransport_->close();
-      threadManager_->join();
-    } catch (TException &tx) {
-      string errStr = string("TThreadPoolServer: Exception shutting down: ") + tx.what();
-      GlobalOutput(errStr.c_str());
-    }
-    stop_ = false;
+  if (!stop_ && !extraServerTransports_.empty()) {
+    stop();
   }
-
 }
 
 int64_t TThreadPoolServer::getTimeout() const {
@@ -25,6 +25,7 @@
 #include <thrift/transport/TServerTransport.h>
 
 #include <boost/shared_ptr.hpp>
+#include <vector>
 
 namespace apache { namespace thrift { namespace server {
 
@@ -36,6 +37,7 @@ using apache::thrift::transport::TTransportFactory;
 class TThreadPoolServer : public TServer {
  public:
   class Task;
+  class Acceptor;
 
   template<typename ProcessorFactory>
   TThreadPoolServer(
@@ -106,13 +108,40 @@ class TThreadPoolServer : public TServer {
 
   virtual void setTimeout(int64_t value);
 
+  /**
+   * Adds another server transport to accept connections from, served by
+   * its own acceptor thread. Typically this is one of several
+   * TServerSockets bound to the same port with setReusePort(true), so the
+   * kernel balances incoming connections across the acceptors. Must be
+   * called before serve().
+   */
+  void addServerTransport(
+      const boost::shared_ptr<TServerTransport>& serverTransport) {
+    extraServerTransports_.push_back(serverTransport);
+  }
+
   virtual void stop() {
     stop_ = true;
     serverTransport_->interrupt();
+    for (std::vector<boost::shared_ptr<TServerTransport> >::iterator it =
+           extraServerTransports_.begin();
+         it != extraServerTransports_.end(); ++it) {
+      (*it)->interrupt();
+    }
   }
 
  protected:
 
+  /**
+   * Runs the accept loop for one server transport until the server stops.
+   * If the loop gives up by itself, it stops the server, so that serve()
+   * does not wait forever on the other acceptors.
+   */
+  void acceptConnections(
+      const boost::shared_ptr<TServerTransport>& serverTransport);
+
+  std::vector<boost::shared_ptr<TServerTransport> > extraServerTransports_;
+
   boost::shared_ptr<ThreadManager> threadManager_;
 
   volatile bool stop_;
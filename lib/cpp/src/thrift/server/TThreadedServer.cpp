@@ -121,6 +121,25 @@ public:
   shared_ptr<TTransport> transport_;
 };
 
+class TThreadedServer::Acceptor : public Runnable {
+
+public:
+
+  Acceptor(TThreadedServer& server,
+           shared_ptr<TServerTransport> serverTransport) :
+    server_(server),
+    serverTransport_(serverTransport) {
+  }
+
+  void run() {
+    server_.acceptConnections(serverTransport_);
+  }
+
+ private:
+  TThreadedServer& server_;
+  shared_ptr<TServerTransport> serverTransport_;
+};
+
 void TThreadedServer::init() {
   stop_ = false;
 
@@ -133,20 +152,75 @@ TThreadedServer::~TThreadedServer() {}
 
 void TThreadedServer::serve() {
 
-  shared_ptr<TTransport> client;
-  shared_ptr<TTransport> inputTransport;
-  shared_ptr<TTransport> outputTransport;
-  shared_ptr<TProtocol> inputProtocol;
-  shared_ptr<TProtocol> outputProtocol;
-
   // Start the server listening
   serverTransport_->listen();
+  for (vector<shared_ptr<TServerTransport> >::iterator it =
+         extraServerTransports_.begin();
+       it != extraServerTransports_.end(); ++it) {
+    (*it)->listen();
+  }
 
   // Run the preServe event
   if (eventHandler_ != NULL) {
     eventHandler_->preServe();
   }
 
+  // Acceptors must be joinable, whatever threadFactory_ does for tasks
+  PlatformThreadFactory acceptorFactory;
+  acceptorFactory.setDetached(false);
+  vector<shared_ptr<Thread> > acceptors;
+  for (vector<shared_ptr<TServerTransport> >::iterator it =
+         extraServerTransports_.begin();
+       it != extraServerTransports_.end(); ++it) {
+    shared_ptr<Thread> thread = acceptorFactory.newThread(
+      shared_ptr<Runnable>(new TThreadedServer::Acceptor(*this, *it)));
+    thread->start();
+    acceptors.push_back(thread);
+  }
+
+  acceptConnections(serverTransport_);
+
+  for (vector<shared_ptr<Thread> >::iterator it = acceptors.begin();
+       it != acceptors.end(); ++it) {
+    (*it)->join();
+  }
+
+  // If stopped manually, make sure to close server transport
+  if (stop_) {
+    try {
+      serverTransport_->close();
+      for (vector<shared_ptr<TServerTransport> >::iterator it =
+             extraServerTransports_.begin();
+           it != extraServerTransports_.end(); ++it) {
+        (*it)->close();
+      }
+    } catch (TException &tx) {
+      string errStr = string("TThreadedServer: Exception shutting down: ") + tx.what();
+      GlobalOutput(errStr.c_str());
+    }
+    try {
+      Synchronized s(tasksMonitor_);
+      while (!tasks_.empty()) {
+        tasksMonitor_.wait();
+      }
+    } catch (TException &tx) {
+      string errStr = string("TThreadedServer: Exception joining workers: ") + tx.what();
+      GlobalOutput(errStr.c_str());
+    }
+    stop_ = false;
+  }
+
+}
+
+void TThreadedServer::acceptConnections(
+    const shared_ptr<TServerTransport>& serverTransport) {
+
+  shared_ptr<TTransport> client;
+  shared_ptr<TTransport> inputTransport;
+  shared_ptr<TTransport> outputTransport;
+  shared_ptr<TProtocol> inputProtocol;
+  shared_ptr<TProtocol> outputProtocol;
+
   while (!stop_) {
     try {
       client.reset();
@@ -156,7 +230,7 @@ void TThreadedServer::serve() {
       outputProtocol.reset();
 
       // Fetch client from server
-      client = serverTransport_->accept();
+      client = serverTransport->accept();
 
       // Make IO transports
       inputTransport = inputTransportFactory_->getTransport(client);
@@ -216,26 +290,9 @@ void TThreadedServer::serve() {
     }
   }
 
-  // If stopped manually, make sure to close server transport
-  if (stop_) {
-    try {
-      serverTransport_->close();
-    } catch (TException &tx) {
-      string errStr = string("TThreadedServer: Exception shutting down: ") + tx.what();
-      GlobalOutput(errStr.c_str());
-    }
-    try {
-      Synchronized s(tasksMonitor_);
-      while (!tasks_.empty()) {
-        tasksMonitor_.wait();
-      }
-    } catch (TException &tx) {
-      string errStr = string("TThreadedServer: Exception joining workers: ") + tx.what();
-      GlobalOutput(errStr.c_str());
-    }
-    stop_ = false;
+  if (!stop_ && !extraServerTransports_.empty()) {
+    stop();
   }
-
 }
 
 }}} // apache::thrift::server
@@ -26,6 +26,7 @@
 #include <thrift/concurrency/Thread.h>
 
 #include <boost/shared_ptr.hpp>
+#include <vector>
 
 namespace apache { namespace thrift { namespace server {
 
@@ -39,6 +40,7 @@ class TThreadedServer : public TServer {
 
  public:
   class Task;
+  class Acceptor;
 
   template<typename ProcessorFactory>
   TThreadedServer(const boost::shared_ptr<ProcessorFactory>& processorFactory,
@@ -74,14 +76,39 @@ class TThreadedServer : public TServer {
 
   virtual void serve();
 
+  /**
+   * Adds a server transport with its own acceptor thread, e.g. a second
+   * SO_REUSEPORT TServerSocket on the same port. Must be called before
+   * serve().
+   */
+  void addServerTransport(
+      const boost::shared_ptr<TServerTransport>& serverTransport) {
+    extraServerTransports_.push_back(serverTransport);
+  }
+
   void stop() {
     stop_ = true;
     serverTransport_->interrupt();
+    for (std::vector<boost::shared_ptr<TServerTransport> >::iterator it =
+           extraServerTransports_.begin();
+         it != extraServerTransports_.end(); ++it) {
+      (*it)->interrupt();
+    }
   }
 
  protected:
   void init();
 
+  /**
+   * Runs the accept loop for one server transport until the server stops.
+   * If the loop gives up by itself, it stops the server, so that serve()
+   * does not wait forever on the other acceptors.
+   */
+  void acceptConnections(
+      const boost::shared_ptr<TServerTransport>& serverTransport);
+
+  std::vector<boost::shared_ptr<TServerTransport> > extraServerTransports_;
+
   boost::shared_ptr<ThreadFactory> threadFactory_;
   volatile bool stop_;
 
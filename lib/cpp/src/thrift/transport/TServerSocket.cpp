@@ -47,6 +47,7 @@
 #include "TSocket.h"
 #include "TServerSocket.h"
 #include <boost/shared_ptr.hpp>
+#include <vector>
 
 #ifndef AF_LOCAL
 #define AF_LOCAL AF_UNIX
@@ -74,6 +75,72 @@ namespace apache { namespace thrift { namespace transport {
 
 using namespace std;
 using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+
+namespace {
+
+/**
+ * A connection taken off the listen queue, along with its peer address.
+ */
+struct AcceptedClient {
+  int socket;
+  struct sockaddr_storage address;
+  socklen_t size;
+};
+
+/**
+ * Accepts one connection from the (non-blocking) listen socket. The client
+ * socket is returned in blocking mode with close-on-exec set. Returns -1
+ * with errno set if nothing could be accepted.
+ */
+int acceptClient(int serverSocket, AcceptedClient& client) {
+  client.size = sizeof(client.address);
+#if defined(HAVE_ACCEPT4) && defined(SOCK_CLOEXEC)
+  // accept4() never inherits O_NONBLOCK from the listener, so this saves
+  // both the fcntl() round trips below and a separate FD_CLOEXEC call.
+  client.socket = ::accept4(serverSocket,
+                            (struct sockaddr *) &client.address,
+                            &client.size,
+                            SOCK_CLOEXEC);
+  return client.socket;
+#else
+  client.socket = ::accept(serverSocket,
+                           (struct sockaddr *) &client.address,
+                           &client.size);
+  if (client.socket < 0) {
+    return -1;
+  }
+
+  // Make sure client socket is blocking
+  int flags = fcntl(client.socket, F_GETFL, 0);
+  if (flags == -1) {
+    int errno_copy = errno;
+    ::close(client.socket);
+    GlobalOutput.perror("TServerSocket::acceptImpl() fcntl() F_GETFL ", errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN, "fcntl(F_GETFL)", errno_copy);
+  }
+
+  if (-1 == fcntl(client.socket, F_SETFL, flags & ~O_NONBLOCK)) {
+    int errno_copy = errno;
+    ::close(client.socket);
+    GlobalOutput.perror("TServerSocket::acceptImpl() fcntl() F_SETFL ~O_NONBLOCK ", errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN, "fcntl(F_SETFL)", errno_copy);
+  }
+  return client.socket;
+#endif
+}
+
+/**
+ * Errors from accept() that just mean another acceptor got there first or
+ * the peer went away before we picked the connection up.
+ */
+bool isTransientAcceptError(int err) {
+  return err == EAGAIN || err == EWOULDBLOCK || err == EINTR ||
+         err == ECONNABORTED;
+}
+
+}
+
 
 TServerSocket::TServerSocket(int port) :
   port_(port),
@@ -86,6 +153,8 @@ TServerSocket::TServerSocket(int port) :
   retryDelay_(0),
   tcpSendBuffer_(0),
   tcpRecvBuffer_(0),
+  reusePort_(false),
+  acceptBatchSize_(1),
   intSock1_(-1),
   intSock2_(-1) {}
 
@@ -100,6 +169,8 @@ TServerSocket::TServerSocket(int port, int sendTimeout, int recvTimeout) :
   retryDelay_(0),
   tcpSendBuffer_(0),
   tcpRecvBuffer_(0),
+  reusePort_(false),
+  acceptBatchSize_(1),
   intSock1_(-1),
   intSock2_(-1) {}
 
@@ -115,6 +186,8 @@ TServerSocket::TServerSocket(string path) :
   retryDelay_(0),
   tcpSendBuffer_(0),
   tcpRecvBuffer_(0),
+  reusePort_(false),
+  acceptBatchSize_(1),
   intSock1_(-1),
   intSock2_(-1) {}
 
@@ -150,6 +223,14 @@ void TServerSocket::setTcpRecvBuffer(int tcpRecvBuffer) {
   tcpRecvBuffer_ = tcpRecvBuffer;
 }
 
+void TServerSocket::setReusePort(bool reusePort) {
+  reusePort_ = reusePort;
+}
+
+void TServerSocket::setAcceptBatchSize(int acceptBatchSize) {
+  acceptBatchSize_ = acceptBatchSize < 1 ? 1 : acceptBatchSize;
+}
+
 void TServerSocket::listen() {
   int sv[2];
   if (-1 == socketpair(AF_LOCAL, SOCK_STREAM, 0, sv)) {
@@ -208,6 +289,22 @@ void TServerSocket::listen() {
     throw TTransportException(TTransportException::NOT_OPEN, "Could not set SO_REUSEADDR", errno_copy);
   }
 
+  // Allow other sockets to listen on the same port
+  if (reusePort_) {
+#ifdef SO_REUSEPORT
+    if (-1 == setsockopt(serverSocket_, SOL_SOCKET, SO_REUSEPORT,
+                         cast_sockopt(&one), sizeof(one))) {
+      int errno_copy = errno;
+      GlobalOutput.perror("TServerSocket::listen() setsockopt() SO_REUSEPORT ", errno_copy);
+      close();
+      throw TTransportException(TTransportException::NOT_OPEN, "Could not set SO_REUSEPORT", errno_copy);
+    }
+#else
+    close();
+    throw TTransportException(TTransportException::NOT_OPEN, "SO_REUSEPORT is not supported on this platform");
+#endif // #ifdef SO_REUSEPORT
+  }
+
   // Set TCP buffer sizes
   if (tcpSendBuffer_ > 0) {
     if (-1 == setsockopt(serverSocket_, SOL_SOCKET, SO_SNDBUF,
@@ -362,11 +459,23 @@ shared_ptr<TTransport> TServerSocket::acceptImpl() {
     throw TTransportException(TTransportException::NOT_OPEN, "TServerSocket not listening");
   }
 
+  // Hand out anything left over from an earlier batched accept first
+  {
+    Guard g(pendingMutex_);
+    if (!pending_.empty()) {
+      shared_ptr<TSocket> client = pending_.front();
+      pending_.pop_front();
+      return client;
+    }
+  }
+
   struct pollfd fds[2];
 
   int maxEintrs = 5;
   int numEintrs = 0;
 
+  AcceptedClient accepted;
+
   while (true) {
     std::memset(fds, 0 , sizeof(fds));
     fds[0].fd = serverSocket_;
@@ -403,7 +512,16 @@ shared_ptr<TTransport> TServerSocket::acceptImpl() {
 
       // Check for the actual server socket being ready
       if (fds[0].revents & POLLIN) {
-        break;
+        if (acceptClient(serverSocket_, accepted) >= 0) {
+          break;
+        }
+        // Another thread sharing this socket may have taken the connection
+        int errno_copy = errno;
+        if (isTransientAcceptError(errno_copy)) {
+          continue;
+        }
+        GlobalOutput.perror("TServerSocket::acceptImpl() ::accept() ", errno_copy);
+        throw TTransportException(TTransportException::UNKNOWN, "accept()", errno_copy);
       }
     } else {
       GlobalOutput("TServerSocket::acceptImpl() poll 0");
@@ -411,42 +529,48 @@ shared_ptr<TTransport> TServerSocket::acceptImpl() {
     }
   }
 
-  struct sockaddr_storage clientAddress;
-  int size = sizeof(clientAddress);
-  int clientSocket = ::accept(serverSocket_,
-                              (struct sockaddr *) &clientAddress,
-                              (socklen_t *) &size);
-
-  if (clientSocket < 0) {
-    int errno_copy = errno;
-    GlobalOutput.perror("TServerSocket::acceptImpl() ::accept() ", errno_copy);
-    throw TTransportException(TTransportException::UNKNOWN, "accept()", errno_copy);
+  // Drain whatever else is already queued on the listen socket so that a
+  // burst of connections costs one poll() instead of one per connection.
+  std::vector<AcceptedClient> batch(1, accepted);
+  while ((int) batch.size() < acceptBatchSize_) {
+    try {
+      if (acceptClient(serverSocket_, accepted) < 0) {
+        int errno_copy = errno;
+        if (!isTransientAcceptError(errno_copy)) {
+          GlobalOutput.perror("TServerSocket::acceptImpl() ::accept() ", errno_copy);
+        }
+        break;
+      }
+    } catch (const TTransportException&) {
+      // acceptClient() has closed and logged the socket it failed on; the
+      // ones already in the batch are fine, so hand those out rather than
+      // leak them
+      break;
+    }
+    batch.push_back(accepted);
   }
 
-  // Make sure client socket is blocking
-  int flags = fcntl(clientSocket, F_GETFL, 0);
-  if (flags == -1) {
-    int errno_copy = errno;
-    GlobalOutput.perror("TServerSocket::acceptImpl() fcntl() F_GETFL ", errno_copy);
-    throw TTransportException(TTransportException::UNKNOWN, "fcntl(F_GETFL)", errno_copy);
+  std::vector<shared_ptr<TSocket> > clients;
+  clients.reserve(batch.size());
+  for (std::vector<AcceptedClient>::iterator it = batch.begin();
+       it != batch.end(); ++it) {
+    shared_ptr<TSocket> client = createSocket(it->socket);
+    if (sendTimeout_ > 0) {
+      client->setSendTimeout(sendTimeout_);
+    }
+    if (recvTimeout_ > 0) {
+      client->setRecvTimeout(recvTimeout_);
+    }
+    client->setCachedAddress((sockaddr*) &it->address, it->size);
+    clients.push_back(client);
   }
 
-  if (-1 == fcntl(clientSocket, F_SETFL, flags & ~O_NONBLOCK)) {
-    int errno_copy = errno;
-    GlobalOutput.perror("TServerSocket::acceptImpl() fcntl() F_SETFL ~O_NONBLOCK ", errno_copy);
-    throw TTransportException(TTransportException::UNKNOWN, "fcntl(F_SETFL)", errno_copy);
+  if (clients.size() > 1) {
+    Guard g(pendingMutex_);
+    pending_.insert(pending_.end(), clients.begin() + 1, clients.end());
   }
 
-  shared_ptr<TSocket> client = createSocket(clientSocket);
-  if (sendTimeout_ > 0) {
-    client->setSendTimeout(sendTimeout_);
-  }
-  if (recvTimeout_ > 0) {
-    client->setRecvTimeout(recvTimeout_);
-  }
-  client->setCachedAddress((sockaddr*) &clientAddress, size);
-  
-  return client;
+  return clients.front();
 }
 
 shared_ptr<TSocket> TServerSocket::createSocket(int clientSocket) {
@@ -483,6 +607,10 @@ void TServerSocket::close() {
   serverSocket_ = -1;
   intSock1_ = -1;
   intSock2_ = -1;
+
+  // Drop connections that were accepted but never handed out
+  Guard g(pendingMutex_);
+  pending_.clear();
 }
 
 }}} // apache::thrift::transport
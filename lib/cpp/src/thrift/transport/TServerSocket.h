@@ -21,7 +21,9 @@
 #define _THRIFT_TRANSPORT_TSERVERSOCKET_H_ 1
 
 #include "TServerTransport.h"
+#include <thrift/concurrency/Mutex.h>
 #include <boost/shared_ptr.hpp>
+#include <deque>
 
 namespace apache { namespace thrift { namespace transport {
 
@@ -51,6 +53,21 @@ class TServerSocket : public TServerTransport {
   void setTcpSendBuffer(int tcpSendBuffer);
   void setTcpRecvBuffer(int tcpRecvBuffer);
 
+  /**
+   * Sets SO_REUSEPORT on the listening socket, so that several
+   * TServerSocket instances (one per acceptor thread or process) can bind
+   * the same port and let the kernel spread incoming connections across
+   * them. Must be called before listen().
+   */
+  void setReusePort(bool reusePort);
+
+  /**
+   * Sets the maximum number of pending connections accepted per poll()
+   * wakeup. Connections beyond the first are queued and handed out by
+   * subsequent accept() calls without polling again. Defaults to 1.
+   */
+  void setAcceptBatchSize(int acceptBatchSize);
+
   void listen();
   void close();
 
@@ -72,9 +89,15 @@ class TServerSocket : public TServerTransport {
   int retryDelay_;
   int tcpSendBuffer_;
   int tcpRecvBuffer_;
+  bool reusePort_;
+  int acceptBatchSize_;
 
   int intSock1_;
   int intSock2_;
+
+  // Connections drained by a batched accept, waiting to be handed out
+  concurrency::Mutex pendingMutex_;
+  std::deque<boost::shared_ptr<TSocket> > pending_;
 };
 
 }}} // apache::thrift::transport
@@ -148,4 +148,28 @@ inline int close(SOCKET socket)
     return ::closesocket(socket);
 }
 
+// GCC extensions used by the per-thread statistics and arenas.
+#define __thread __declspec(thread)
+
+#include <intrin.h>
+
+inline boost::uint64_t __sync_add_and_fetch(volatile boost::uint64_t* value,
+                                            boost::uint64_t amount)
+{
+    return static_cast<boost::uint64_t>(InterlockedExchangeAdd64(
+        reinterpret_cast<volatile LONGLONG*>(value),
+        static_cast<LONGLONG>(amount))) + amount;
+}
+
+// As with GCC's, the result is undefined for 0.
+inline int __builtin_clzll(boost::uint64_t value)
+{
+    unsigned long index;
+    if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32))) {
+        return 31 - static_cast<int>(index);
+    }
+    _BitScanReverse(&index, static_cast<unsigned long>(value));
+    return 63 - static_cast<int>(index);
+}
+
 #endif // _THRIFT_WINDOWS_CONFIG_H_
@@ -0,0 +1,123 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <thrift/Arena.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include <map>
+#include <vector>
+
+using apache::thrift::Arena;
+using apache::thrift::ArenaAllocator;
+using apache::thrift::ArenaScope;
+using apache::thrift::ArenaString;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+BOOST_AUTO_TEST_SUITE( ArenaTest )
+
+BOOST_AUTO_TEST_CASE( test_allocate ) {
+  Arena arena(64);
+  BOOST_CHECK_EQUAL(arena.capacity(), 0u);
+
+  char* first = static_cast<char*>(arena.allocate(1));
+  char* second = static_cast<char*>(arena.allocate(20));
+  BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(first) % Arena::ALIGNMENT, 0u);
+  BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(second) % Arena::ALIGNMENT, 0u);
+  BOOST_CHECK_EQUAL(second - first, Arena::ALIGNMENT);
+  BOOST_CHECK_EQUAL(arena.capacity(), 64u);
+
+  // A large piece gets its own block, and the current one is still used
+  char* large = static_cast<char*>(arena.allocate(1000));
+  memset(large, 0xff, 1000);
+  BOOST_CHECK_EQUAL(arena.capacity(), 64u + 1008u);
+  char* third = static_cast<char*>(arena.allocate(16));
+  BOOST_CHECK_EQUAL(third - second, 2 * Arena::ALIGNMENT);
+
+  // Running out of a block starts a larger one
+  arena.allocate(32);
+  arena.allocate(32);
+  BOOST_CHECK_EQUAL(arena.capacity(), 64u + 1008u + 128u);
+
+  arena.release();
+  BOOST_CHECK_EQUAL(arena.capacity(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_scope ) {
+  BOOST_CHECK(Arena::current() == NULL);
+  {
+    ArenaScope outer;
+    BOOST_CHECK(Arena::current() == &outer.arena());
+    {
+      ArenaScope inner;
+      BOOST_CHECK(Arena::current() == &inner.arena());
+    }
+    BOOST_CHECK(Arena::current() == &outer.arena());
+  }
+  BOOST_CHECK(Arena::current() == NULL);
+}
+
+BOOST_AUTO_TEST_CASE( test_allocator ) {
+  // Without a current arena, allocators use the heap
+  std::vector<int, ArenaAllocator<int> > heap(100, 1);
+  BOOST_CHECK(heap.get_allocator().arena() == NULL);
+
+  ArenaScope scope;
+  typedef std::map<ArenaString, std::vector<ArenaString, ArenaAllocator<ArenaString> >,
+                   std::less<ArenaString>,
+                   ArenaAllocator<std::pair<const ArenaString,
+                                            std::vector<ArenaString,
+                                                        ArenaAllocator<ArenaString> > > > >
+    ArenaMap;
+  ArenaMap map;
+  for (int i = 0; i < 100; ++i) {
+    map[ArenaString(100, 'a' + i % 26)].push_back(ArenaString(50, 'x'));
+  }
+  BOOST_CHECK_EQUAL(map.size(), 26u);
+  BOOST_CHECK(map.get_allocator().arena() == &scope.arena());
+  BOOST_CHECK(scope.arena().capacity() > 26 * 100);
+
+  // Assigning into a heap-backed string copies the data out of the arena
+  std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> >
+    kept(ArenaAllocator<char>(NULL));
+  kept = map.begin()->first;
+  BOOST_CHECK(kept.get_allocator().arena() == NULL);
+  BOOST_CHECK(kept == ArenaString(100, 'a'));
+}
+
+BOOST_AUTO_TEST_CASE( test_protocol_strings ) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+
+  ArenaScope scope;
+  ArenaString written(300, 'q');
+  apache::thrift::writeArenaString(&protocol, written);
+  apache::thrift::writeArenaBinary(&protocol, ArenaString("\0\1\2", 3));
+
+  ArenaString read;
+  apache::thrift::readArenaString(&protocol, read);
+  BOOST_CHECK(read == written);
+  apache::thrift::readArenaBinary(&protocol, read);
+  BOOST_CHECK(read == ArenaString("\0\1\2", 3));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thrift/Arena.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/ArenaEcho.h"
+#include "gen-cpp/ArenaTypesTest_constants.h"
+
+using std::cout;
+using std::endl;
+using boost::shared_ptr;
+using namespace thrift::test::arena;
+using namespace apache::thrift;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::protocol;
+
+class ArenaEchoHandler : public ArenaEchoIf {
+ public:
+  ArenaEchoHandler() : calls_(0), inArena_(0) {}
+
+  void echo(Request& _return, const Request& request) {
+    ++calls_;
+    // The request and the result were both built in the call's arena
+    Arena* arena = Arena::current();
+    if (arena != NULL &&
+        request.name.get_allocator().arena() == arena &&
+        request.items.get_allocator().arena() == arena &&
+        _return.tags.get_allocator().arena() == arena) {
+      ++inArena_;
+    }
+    _return = request;
+  }
+
+  void fail(const ArenaString& why) {
+    Failure failure;
+    failure.why = why;
+    failure.trace.push_back("fail");
+    failure.trace.push_back("ArenaEchoHandler");
+    throw failure;
+  }
+
+  int calls_;
+  int inArena_;
+};
+
+static Request makeRequest() {
+  Request request;
+  request.name = "request";
+  request.item.name = "item";
+  request.item.payload.assign("\0\1\2\3", 4);
+  request.item.counts.push_back(1);
+  request.item.counts.push_back(2);
+  for (int i = 0; i < 100; i++) {
+    request.tags.push_back(ArenaString(i, 't'));
+  }
+  request.labels.insert("a");
+  request.labels.insert("b");
+  request.items["first"] = request.item;
+  request.items["second"].name = "second";
+  request.matrix.resize(3);
+  request.matrix[2].push_back(9);
+  request.__set_note("note");
+  return request;
+}
+
+int main() {
+  cout << "Defaults and constants are arena strings." << endl;
+  {
+    Request request;
+    assert(request.name == "unnamed");
+    assert(!request.__isset.note);
+    assert(g_ArenaTypesTest_constants.GREETING == "hello");
+  }
+
+  cout << "Outside an arena the types allocate from the heap." << endl;
+  {
+    assert(Arena::current() == NULL);
+    const Request expected = makeRequest();
+    assert(expected.name.get_allocator().arena() == NULL);
+    assert(expected.items.get_allocator().arena() == NULL);
+
+    shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+    TBinaryProtocol protocol(buffer);
+    expected.write(&protocol);
+    Request result;
+    result.read(&protocol);
+    assert(result == expected);
+    assert(result.item.payload.size() == 4 && result.item.payload[3] == '\3');
+  }
+
+  cout << "Inside an arena scope the types allocate from the arena." << endl;
+  {
+    ArenaScope scope;
+    size_t before = scope.arena().capacity();
+    Request request = makeRequest();
+    assert(request.name.get_allocator().arena() == &scope.arena());
+    assert(request.tags[99].get_allocator().arena() == &scope.arena());
+    assert(scope.arena().capacity() > before);
+
+    shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+    TBinaryProtocol protocol(buffer);
+    request.write(&protocol);
+    Request result;
+    result.read(&protocol);
+    assert(result == request);
+  }
+  assert(Arena::current() == NULL);
+
+  shared_ptr<TMemoryBuffer> requests(new TMemoryBuffer);
+  shared_ptr<TMemoryBuffer> replies(new TMemoryBuffer);
+  shared_ptr<TProtocol> clientOut(new TBinaryProtocol(requests));
+  shared_ptr<TProtocol> clientIn(new TBinaryProtocol(replies));
+  shared_ptr<TProtocol> serverIn(new TBinaryProtocol(requests));
+  shared_ptr<TProtocol> serverOut(new TBinaryProtocol(replies));
+  ArenaEchoClient client(clientIn, clientOut);
+  shared_ptr<ArenaEchoHandler> handler(new ArenaEchoHandler);
+  ArenaEchoProcessor processor(handler);
+
+  cout << "Round trip through the processor, which serves from an arena." << endl;
+  {
+    const Request expected = makeRequest();
+    for (int i = 0; i < 3; i++) {
+      client.send_echo(expected);
+      assert(processor.process(serverIn, serverOut, NULL));
+      assert(Arena::current() == NULL);
+      Request result;
+      client.recv_echo(result);
+      assert(result == expected);
+      assert(result.name.get_allocator().arena() == NULL);
+    }
+    assert(handler->calls_ == 3);
+    assert(handler->inArena_ == 3);
+  }
+
+  cout << "A thrown exception reaches the client intact." << endl;
+  {
+    client.send_fail("because");
+    assert(processor.process(serverIn, serverOut, NULL));
+    bool caught = false;
+    try {
+      client.recv_fail();
+    } catch (Failure& failure) {
+      caught = true;
+      assert(failure.why == "because");
+      assert(failure.trace.size() == 2 && failure.trace[1] == "ArenaEchoHandler");
+    }
+    assert(caught);
+  }
+
+  return 0;
+}
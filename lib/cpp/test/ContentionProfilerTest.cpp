@@ -0,0 +1,191 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "thrift/concurrency/ContentionProfiler.h"
+#include "thrift/concurrency/Monitor.h"
+#include "thrift/concurrency/Mutex.h"
+#include "thrift/concurrency/PosixThreadFactory.h"
+
+using namespace apache::thrift::concurrency;
+
+BOOST_AUTO_TEST_SUITE( ContentionProfilerTest )
+
+class Holder : public Runnable {
+public:
+  Holder(const Mutex& mutex, int count, int holdUsec) :
+    mutex_(mutex), count_(count), holdUsec_(holdUsec) { }
+
+  void run() {
+    for (int i = 0; i < count_; ++i) {
+      Guard g(mutex_);
+      usleep(holdUsec_);
+    }
+  }
+
+private:
+  const Mutex& mutex_;
+  int count_;
+  int holdUsec_;
+};
+
+// Sums the weights of folded stack lines
+static int64_t foldedTotal(ContentionMetric metric, std::string* text = NULL) {
+  FILE* f = tmpfile();
+  writeContentionProfileFolded(f, metric);
+  rewind(f);
+  int64_t total = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (text != NULL) {
+      *text += line;
+    }
+    const char* weight = strrchr(line, ' ');
+    BOOST_REQUIRE(weight != NULL);
+    total += strtoll(weight + 1, NULL, 10);
+  }
+  fclose(f);
+  return total;
+}
+
+BOOST_AUTO_TEST_CASE( test_mutex_hold_and_wait ) {
+  resetContentionProfile();
+  startContentionProfiling(1);
+
+  Mutex mutex;
+  PosixThreadFactory factory;
+  factory.setDetached(false);
+  boost::shared_ptr<Thread> first = factory.newThread(boost::shared_ptr<Runnable>(new Holder(mutex, 20, 1000)));
+  boost::shared_ptr<Thread> second = factory.newThread(boost::shared_ptr<Runnable>(new Holder(mutex, 20, 1000)));
+  first->start();
+  second->start();
+  first->join();
+  second->join();
+
+  stopContentionProfiling();
+
+  // 40 holds of at least 1ms each
+  BOOST_CHECK_GE(foldedTotal(CONTENTION_HOLD), 40 * 1000);
+
+  FILE* f = tmpfile();
+  printContentionProfile(f);
+  long size = ftell(f);
+  fclose(f);
+  BOOST_CHECK_GT(size, 0);
+
+  resetContentionProfile();
+  BOOST_CHECK_EQUAL(foldedTotal(CONTENTION_HOLD), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_monitor_wait_is_not_hold ) {
+  resetContentionProfile();
+  startContentionProfiling(1);
+
+  Monitor monitor;
+  {
+    Synchronized s(monitor);
+    try {
+      monitor.wait(100);
+    } catch (TimedOutException&) {
+    }
+  }
+
+  stopContentionProfiling();
+
+  // The 100ms spent waiting on the condition isn't time holding the mutex
+  BOOST_CHECK_LT(foldedTotal(CONTENTION_HOLD), 50 * 1000);
+}
+
+BOOST_AUTO_TEST_CASE( test_read_write_mutex ) {
+  resetContentionProfile();
+  startContentionProfiling(1);
+
+  ReadWriteMutex rwlock;
+  rwlock.acquireWrite();
+  usleep(10000);
+  rwlock.release();
+  rwlock.acquireRead();
+  rwlock.release();
+
+  stopContentionProfiling();
+
+  BOOST_CHECK_GE(foldedTotal(CONTENTION_HOLD), 10000);
+
+  FILE* f = tmpfile();
+  printContentionProfile(f);
+  rewind(f);
+  char line[4096];
+  bool sampledTwice = false;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strstr(line, "sampled 2,") != NULL) {
+      sampledTwice = true;
+    }
+  }
+  fclose(f);
+  BOOST_CHECK(sampledTwice);
+}
+
+BOOST_AUTO_TEST_CASE( test_entry_limit ) {
+  resetContentionProfile();
+  startContentionProfiling(1, 4);
+
+  Mutex mutexes[20];
+  for (int i = 0; i < 20; ++i) {
+    Guard g(mutexes[i]);
+    // Acquisitions are only recorded with a nonzero wait or hold time
+    usleep(100);
+  }
+
+  stopContentionProfiling();
+
+  FILE* f = tmpfile();
+  printContentionProfile(f);
+  rewind(f);
+  char line[4096];
+  bool overflowed = false;
+  int locks = -1;
+  bool others = false;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strstr(line, "past the entry limit") != NULL) {
+      overflowed = true;
+    }
+    sscanf(line, "Locks by wait time (%d locks)", &locks);
+    if (strstr(line, "other locks") != NULL) {
+      others = true;
+      // Every lock past the first four is counted here
+      BOOST_REQUIRE(fgets(line, sizeof(line), f) != NULL);
+      BOOST_CHECK(strstr(line, "sampled 16,") != NULL);
+    }
+  }
+  fclose(f);
+  BOOST_CHECK(overflowed);
+  BOOST_CHECK_EQUAL(locks, 5);
+  BOOST_CHECK(others);
+
+  resetContentionProfile();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,86 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TJSONProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/CppTypeTest_types.h"
+
+using std::cout;
+using std::endl;
+using namespace thrift::test::cpptype;
+using namespace apache::thrift;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::protocol;
+
+template <typename Protocol>
+void round_trip(const Holder& w, Holder& r) {
+  Protocol protocol(boost::shared_ptr<TTransport>(new TMemoryBuffer));
+  w.write(&protocol);
+  r.read(&protocol);
+}
+
+int main() {
+  Holder w;
+  w.ints.push_back(1);
+  w.ints.push_front(-2);
+  w.names.push_back("first");
+  w.names.push_back("second");
+  w.shorts.insert(7);
+  w.data.assign("\0\1\2", 3);
+  w.when = Timestamp(1234567890123LL);
+  Item item;
+  item.name = "item";
+  w.items.push_back(item);
+  w.items.push_back(item);
+  w.flags.push_back(true);
+  w.flags.push_back(false);
+  w.flags.push_back(true);
+
+  cout << "Round trip through TBinaryProtocol." << endl;
+  {
+    Holder r;
+    round_trip<TBinaryProtocol>(w, r);
+    assert(r == w);
+    assert(r.ints.front() == -2);
+    assert(r.data.size() == 3);
+    assert(static_cast<int64_t>(r.when) == 1234567890123LL);
+    assert(r.items.size() == 2 && r.items.back().name == "item");
+    assert(r.flags.size() == 3 && r.flags[0] && !r.flags[1]);
+  }
+
+  cout << "Round trip through TJSONProtocol." << endl;
+  {
+    Holder r;
+    round_trip<TJSONProtocol>(w, r);
+    assert(r == w);
+  }
+
+  cout << "Reading again replaces what was there." << endl;
+  {
+    Holder r;
+    round_trip<TBinaryProtocol>(w, r);
+    round_trip<TBinaryProtocol>(w, r);
+    assert(r == w);
+  }
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TEST_CPPTYPETEST_EXTRAS_H_
+#define _THRIFT_TEST_CPPTYPETEST_EXTRAS_H_ 1
+
+#include <stdint.h>
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+
+// The containers named in CppTypeTest.thrift come in through here too
+
+namespace thrift { namespace test { namespace cpptype {
+
+/**
+ * Stands in for a binary type other than std::string.  Generated code only
+ * uses assign(), data() and size().
+ */
+class Buffer {
+ public:
+  void assign(const char* data, size_t size) {
+    bytes_.assign(data, data + size);
+  }
+
+  const char* data() const {
+    return bytes_.empty() ? "" : &bytes_[0];
+  }
+
+  size_t size() const {
+    return bytes_.size();
+  }
+
+  bool operator==(const Buffer& rhs) const {
+    return bytes_ == rhs.bytes_;
+  }
+
+ private:
+  std::vector<char> bytes_;
+};
+
+/**
+ * Stands in for an i64 stored as a class, which converts to and from
+ * int64_t.
+ */
+class Timestamp {
+ public:
+  Timestamp(int64_t micros = 0) : micros_(micros) {}
+
+  operator int64_t() const {
+    return micros_;
+  }
+
+  bool operator==(const Timestamp& rhs) const {
+    return micros_ == rhs.micros_;
+  }
+
+ private:
+  int64_t micros_;
+};
+
+/**
+ * Stands in for a list of bool whose elements are not bools in memory, so
+ * that it cannot hand out a bool&.  It has no back() at all, since
+ * generated code should only need push_back() to fill it.
+ */
+class BitList {
+ public:
+  typedef std::vector<bool>::const_iterator const_iterator;
+
+  void clear() {
+    bits_.clear();
+  }
+
+  void push_back(bool bit) {
+    bits_.push_back(bit);
+  }
+
+  size_t size() const {
+    return bits_.size();
+  }
+
+  bool operator[](size_t i) const {
+    return bits_[i];
+  }
+
+  const_iterator begin() const {
+    return bits_.begin();
+  }
+
+  const_iterator end() const {
+    return bits_.end();
+  }
+
+  bool operator==(const BitList& rhs) const {
+    return bits_ == rhs.bits_;
+  }
+
+ private:
+  std::vector<bool> bits_;
+};
+
+}}} // thrift::test::cpptype
+
+#endif // #ifndef _THRIFT_TEST_CPPTYPETEST_EXTRAS_H_
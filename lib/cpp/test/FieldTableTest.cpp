@@ -0,0 +1,194 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TFieldTable.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include <vector>
+
+using namespace apache::thrift::protocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+BOOST_AUTO_TEST_SUITE( FieldTableTest )
+
+/**
+ * Laid out as the generator lays out a struct
+ */
+struct Record {
+  Record() : id(0), score(0) {}
+  virtual ~Record() throw() {}
+
+  int32_t id;
+  std::string name;
+  double score;
+  std::vector<int32_t> tags;
+
+  struct Isset {
+    Isset() : name(false), score(false), tags(false) {}
+    bool name;
+    bool score;
+    bool tags;
+  } __isset;
+};
+
+uint32_t readTags(TProtocol* iprot, void* obj) {
+  std::vector<int32_t>& tags = static_cast<Record*>(obj)->tags;
+  uint32_t xfer = 0;
+  TType etype;
+  uint32_t size;
+  xfer += iprot->readListBegin(etype, size);
+  tags.resize(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    xfer += iprot->readI32(tags[i]);
+  }
+  xfer += iprot->readListEnd();
+  return xfer;
+}
+
+uint32_t writeTags(TProtocol* oprot, const void* obj) {
+  const std::vector<int32_t>& tags = static_cast<const Record*>(obj)->tags;
+  uint32_t xfer = 0;
+  xfer += oprot->writeListBegin(T_I32, static_cast<uint32_t>(tags.size()));
+  for (size_t i = 0; i < tags.size(); ++i) {
+    xfer += oprot->writeI32(tags[i]);
+  }
+  xfer += oprot->writeListEnd();
+  return xfer;
+}
+
+const TFieldSpec recordFields[] = {
+  { 1, T_I32, TK_I32, true, false, "id",
+    fieldOf<Record, int32_t, &Record::id>, NULL, NULL, NULL },
+  { 2, T_STRING, TK_STRING, false, false, "name",
+    fieldOf<Record, std::string, &Record::name>,
+    issetOf<Record, Record::Isset, &Record::__isset, &Record::Isset::name>, NULL, NULL },
+  { 5, T_DOUBLE, TK_DOUBLE, false, true, "score",
+    fieldOf<Record, double, &Record::score>,
+    issetOf<Record, Record::Isset, &Record::__isset, &Record::Isset::score>, NULL, NULL },
+  { 7, T_LIST, TK_CUSTOM, false, false, "tags", NULL,
+    issetOf<Record, Record::Isset, &Record::__isset, &Record::Isset::tags>, readTags, writeTags },
+};
+
+const TStructSpec recordSpec = { "Record", recordFields, 4 };
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+
+  Record written;
+  written.id = 17;
+  written.name = "seventeen";
+  written.score = 1.5;
+  written.__isset.score = true;
+  written.tags.push_back(3);
+  written.tags.push_back(-4);
+  uint32_t size = writeStruct(&protocol, &written, recordSpec);
+  BOOST_CHECK_EQUAL(size, buffer->available_read());
+
+  Record read;
+  BOOST_CHECK_EQUAL(readStruct(&protocol, &read, recordSpec), size);
+  BOOST_CHECK_EQUAL(read.id, 17);
+  BOOST_CHECK_EQUAL(read.name, "seventeen");
+  BOOST_CHECK_EQUAL(read.score, 1.5);
+  BOOST_CHECK(read.tags == written.tags);
+  BOOST_CHECK(read.__isset.name);
+  BOOST_CHECK(read.__isset.score);
+  BOOST_CHECK(read.__isset.tags);
+}
+
+BOOST_AUTO_TEST_CASE( test_optional_unset ) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+
+  Record written;
+  written.score = 1.5;
+  writeStruct(&protocol, &written, recordSpec);
+
+  Record read;
+  readStruct(&protocol, &read, recordSpec);
+  BOOST_CHECK_EQUAL(read.score, 0.0);
+  BOOST_CHECK(!read.__isset.score);
+  BOOST_CHECK(read.__isset.name);
+}
+
+BOOST_AUTO_TEST_CASE( test_unknown_fields ) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+
+  // Field 2 with the wrong type, and fields the table does not know, out of
+  // order
+  protocol.writeStructBegin("Record");
+  protocol.writeFieldBegin("other", T_I64, 9);
+  protocol.writeI64(1);
+  protocol.writeFieldBegin("name", T_I32, 2);
+  protocol.writeI32(2);
+  protocol.writeFieldBegin("id", T_I32, 1);
+  protocol.writeI32(3);
+  protocol.writeFieldBegin("other", T_STRING, 3);
+  protocol.writeString("skipped");
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+
+  Record read;
+  readStruct(&protocol, &read, recordSpec);
+  BOOST_CHECK_EQUAL(read.id, 3);
+  BOOST_CHECK(!read.__isset.name);
+  BOOST_CHECK_EQUAL(buffer->available_read(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_missing_required ) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+
+  protocol.writeStructBegin("Record");
+  protocol.writeFieldBegin("name", T_STRING, 2);
+  protocol.writeString("no id");
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+
+  Record read;
+  BOOST_CHECK_THROW(readStruct(&protocol, &read, recordSpec), TProtocolException);
+  // The whole struct is read before throwing
+  BOOST_CHECK_EQUAL(buffer->available_read(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_write_if_set_without_flag ) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+
+  // A field with no __isset flag is always written, writeIfSet or not
+  const TFieldSpec fields[] = {
+    { 1, T_I32, TK_I32, true, true, "id",
+      fieldOf<Record, int32_t, &Record::id>, NULL, NULL, NULL },
+  };
+  const TStructSpec spec = { "Record", fields, 1 };
+
+  Record written;
+  written.id = 5;
+  writeStruct(&protocol, &written, spec);
+
+  Record read;
+  readStruct(&protocol, &read, spec);
+  BOOST_CHECK_EQUAL(read.id, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,165 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <unistd.h>
+#include <thrift/processor/LatencyStatsHandler.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+
+using apache::thrift::processor::LatencyHistogram;
+using apache::thrift::processor::LatencyStatsHandler;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using boost::shared_ptr;
+
+BOOST_AUTO_TEST_SUITE( LatencyStatsHandlerTest )
+
+BOOST_AUTO_TEST_CASE( test_histogram_buckets ) {
+  // Every value falls in a bucket whose limit is at or above it, and
+  // within 1 / SUB_BUCKETS of it
+  for (uint64_t value = 0; value < (1ULL << 30); value = value * 5 / 4 + 1) {
+    int bucket = LatencyHistogram::bucketOf(value);
+    BOOST_CHECK(value <= LatencyHistogram::bucketLimit(bucket));
+    BOOST_CHECK(LatencyHistogram::bucketLimit(bucket) - value <=
+                value / LatencyHistogram::SUB_BUCKETS);
+    if (bucket > 0) {
+      BOOST_CHECK(value > LatencyHistogram::bucketLimit(bucket - 1));
+    }
+  }
+  BOOST_CHECK_EQUAL(LatencyHistogram::bucketOf(~0ULL),
+                    LatencyHistogram::NUM_BUCKETS - 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_histogram_percentiles ) {
+  LatencyHistogram histogram;
+  BOOST_CHECK_EQUAL(histogram.percentile(50), 0u);
+
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram.add(value);
+  }
+  BOOST_CHECK_EQUAL(histogram.count(), 1000u);
+  BOOST_CHECK_EQUAL(histogram.mean(), 500u);
+  BOOST_CHECK_EQUAL(histogram.max(), 1000u);
+  BOOST_CHECK(histogram.percentile(50) >= 500 && histogram.percentile(50) <= 500 * 9 / 8);
+  BOOST_CHECK(histogram.percentile(99) >= 990);
+  BOOST_CHECK_EQUAL(histogram.percentile(99.9), 1000u);
+  BOOST_CHECK_EQUAL(histogram.percentile(100), 1000u);
+
+  LatencyHistogram other;
+  other.add(5000);
+  histogram.merge(other);
+  BOOST_CHECK_EQUAL(histogram.count(), 1001u);
+  BOOST_CHECK_EQUAL(histogram.percentile(100), 5000u);
+}
+
+namespace {
+
+void call(LatencyStatsHandler& handler, const char* fn, useconds_t handlerTime,
+          bool error) {
+  void* ctx = handler.getContext(fn, NULL);
+  handler.preRead(ctx, fn);
+  handler.postRead(ctx, fn, 100);
+  usleep(handlerTime);
+  if (error) {
+    handler.handlerError(ctx, fn);
+  } else {
+    handler.preWrite(ctx, fn);
+    handler.postWrite(ctx, fn, 2000);
+  }
+  handler.freeContext(ctx, fn);
+}
+
+class Caller : public Runnable {
+ public:
+  Caller(LatencyStatsHandler& handler, int calls) :
+    handler_(handler),
+    calls_(calls) {}
+
+  void run() {
+    for (int i = 0; i < calls_; ++i) {
+      call(handler_, "Service.fast", 0, false);
+    }
+  }
+
+ private:
+  LatencyStatsHandler& handler_;
+  int calls_;
+};
+
+}
+
+BOOST_AUTO_TEST_CASE( test_handler_records_methods ) {
+  LatencyStatsHandler handler;
+
+  for (int i = 0; i < 5; ++i) {
+    call(handler, "Service.slow", 20000, false);
+  }
+  call(handler, "Service.slow", 0, true);
+
+  std::map<std::string, LatencyStatsHandler::MethodStats> stats;
+  handler.getStats(stats);
+  BOOST_REQUIRE_EQUAL(stats.size(), 1u);
+  const LatencyStatsHandler::MethodStats& slow = stats["Service.slow"];
+  BOOST_CHECK_EQUAL(slow.calls, 6u);
+  BOOST_CHECK_EQUAL(slow.errors, 1u);
+  BOOST_CHECK_EQUAL(slow.handlerTime.count(), 6u);
+  BOOST_CHECK(slow.handlerTime.percentile(50) >= 20000);
+  BOOST_CHECK_EQUAL(slow.writeTime.count(), 5u);
+  BOOST_CHECK_EQUAL(slow.requestBytes.percentile(50), 100u);
+  BOOST_CHECK_EQUAL(slow.responseBytes.percentile(50), 2000u);
+
+  std::map<std::string, int64_t> counters;
+  handler.getCounters(counters);
+  BOOST_CHECK_EQUAL(counters["thrift.Service.slow.calls"], 6);
+  BOOST_CHECK_EQUAL(counters["thrift.Service.slow.errors"], 1);
+  BOOST_CHECK(counters["thrift.Service.slow.handler_us.p99"] >= 20000);
+  BOOST_CHECK_EQUAL(counters.count("thrift.Service.slow.read_us.p999"), 1u);
+  BOOST_CHECK_EQUAL(counters["thrift.Service.slow.response_bytes.avg"], 2000);
+
+  handler.reset();
+  stats.clear();
+  handler.getStats(stats);
+  BOOST_CHECK_EQUAL(stats["Service.slow"].calls, 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_handler_merges_threads ) {
+  LatencyStatsHandler handler;
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+
+  std::vector<shared_ptr<Thread> > threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(factory.newThread(shared_ptr<Runnable>(new Caller(handler, 1000))));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->start();
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+
+  std::map<std::string, LatencyStatsHandler::MethodStats> stats;
+  handler.getStats(stats);
+  BOOST_CHECK_EQUAL(stats["Service.fast"].calls, 4000u);
+  BOOST_CHECK_EQUAL(stats["Service.fast"].handlerTime.count(), 4000u);
+  BOOST_CHECK_EQUAL(stats["Service.fast"].responseBytes.count(), 4000u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <utility>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/Moveable.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+using boost::shared_ptr;
+using namespace thrift::test::moveable;
+using namespace apache::thrift;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::protocol;
+
+class MoveableHandler : public MoveableIf {
+ public:
+  void echo(Outer& _return, const Outer& outer) {
+    _return = outer;
+  }
+
+  void fail(const string& why) {
+    Failure failure;
+    failure.why = why;
+    failure.trace.push_back("fail");
+    failure.trace.push_back("MoveableHandler");
+    throw failure;
+  }
+};
+
+static Outer makeOuter() {
+  Outer outer;
+  outer.name = "outer";
+  outer.inner.text = "inner";
+  outer.inner.numbers.push_back(1);
+  outer.inner.numbers.push_back(2);
+  outer.byName["a"] = outer.inner;
+  outer.ids.insert(42);
+  vector<string> tags(1, "tag");
+  outer.__set_tags(tags);
+  return outer;
+}
+
+int main() {
+  cout << "Rvalue setters move the value in." << endl;
+  {
+    Inner inner;
+    vector<int32_t> numbers(3, 7);
+    inner.__set_numbers(std::move(numbers));
+    assert(numbers.empty());
+    assert(inner.numbers.size() == 3);
+
+    Outer outer;
+    vector<string> tags(2, "tag");
+    outer.__set_tags(std::move(tags));
+    assert(tags.empty());
+    assert(outer.__isset.tags && outer.tags.size() == 2);
+
+    outer.__set_inner(std::move(inner));
+    assert(inner.numbers.empty());
+    assert(outer.inner.numbers.size() == 3);
+
+    // Lvalues are still copied
+    vector<string> kept(1, "kept");
+    outer.__set_tags(kept);
+    assert(kept.size() == 1 && outer.tags == kept);
+  }
+
+  cout << "Structs are move constructible and move assignable." << endl;
+  {
+    const Outer expected = makeOuter();
+
+    Outer source = expected;
+    Outer constructed(std::move(source));
+    assert(constructed == expected);
+    assert(source.inner.numbers.empty() && source.byName.empty());
+
+    Outer assigned;
+    assigned = std::move(constructed);
+    assert(assigned == expected);
+    assert(constructed.inner.numbers.empty() && constructed.byName.empty());
+
+    Failure failure;
+    failure.trace.push_back("frame");
+    Failure moved(std::move(failure));
+    assert(failure.trace.empty());
+    assert(moved.trace.size() == 1);
+  }
+
+  shared_ptr<TMemoryBuffer> requests(new TMemoryBuffer);
+  shared_ptr<TMemoryBuffer> replies(new TMemoryBuffer);
+  shared_ptr<TProtocol> clientOut(new TBinaryProtocol(requests));
+  shared_ptr<TProtocol> clientIn(new TBinaryProtocol(replies));
+  shared_ptr<TProtocol> serverIn(new TBinaryProtocol(requests));
+  shared_ptr<TProtocol> serverOut(new TBinaryProtocol(replies));
+  MoveableClient client(clientIn, clientOut);
+  MoveableProcessor processor(shared_ptr<MoveableIf>(new MoveableHandler));
+
+  cout << "Round trip through the processor." << endl;
+  {
+    const Outer expected = makeOuter();
+    client.send_echo(expected);
+    assert(processor.process(serverIn, serverOut, NULL));
+    Outer result;
+    client.recv_echo(result);
+    assert(result == expected);
+  }
+
+  cout << "A thrown exception is moved into the result intact." << endl;
+  {
+    client.send_fail("because");
+    assert(processor.process(serverIn, serverOut, NULL));
+    bool caught = false;
+    try {
+      client.recv_fail();
+    } catch (Failure& failure) {
+      caught = true;
+      assert(failure.why == "because");
+      assert(failure.trace.size() == 2 && failure.trace[1] == "MoveableHandler");
+      Failure taken(std::move(failure));
+      assert(failure.trace.empty() && taken.trace.size() == 2);
+    }
+    assert(caught);
+  }
+
+  return 0;
+}
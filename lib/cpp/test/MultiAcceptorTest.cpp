@@ -0,0 +1,408 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/server/TThreadPoolServer.h>
+#include <thrift/server/TThreadedServer.h>
+#include <thrift/transport/TServerSocket.h>
+#include <thrift/transport/TServerTransport.h>
+#include <thrift/transport/TSocket.h>
+
+using boost::shared_ptr;
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::server;
+using namespace apache::thrift::transport;
+
+namespace {
+
+/**
+ * Server transport whose accept() blocks until it is interrupted, like a
+ * TServerSocket nobody connects to.
+ */
+class IdleServerTransport : public TServerTransport {
+ public:
+  IdleServerTransport() :
+    accepting_(false),
+    interrupted_(false),
+    closed_(false) {}
+
+  void interrupt() {
+    Synchronized s(monitor_);
+    interrupted_ = true;
+    monitor_.notifyAll();
+  }
+
+  void close() {
+    Synchronized s(monitor_);
+    closed_ = true;
+  }
+
+  /// Waits until an acceptor is blocked in accept()
+  void waitAccepting() {
+    Synchronized s(monitor_);
+    while (!accepting_) {
+      monitor_.wait();
+    }
+  }
+
+  bool interrupted() {
+    Synchronized s(monitor_);
+    return interrupted_;
+  }
+
+  bool closed() {
+    Synchronized s(monitor_);
+    return closed_;
+  }
+
+ protected:
+  shared_ptr<TTransport> acceptImpl() {
+    Synchronized s(monitor_);
+    accepting_ = true;
+    monitor_.notifyAll();
+    while (!interrupted_) {
+      monitor_.wait();
+    }
+    throw TTransportException(TTransportException::INTERRUPTED);
+  }
+
+ private:
+  Monitor monitor_;
+  bool accepting_;
+  bool interrupted_;
+  bool closed_;
+};
+
+/**
+ * Server transport whose accept() fails in the way that makes an acceptor
+ * give up.
+ */
+class BrokenServerTransport : public TServerTransport {
+ public:
+  void close() {}
+
+ protected:
+  shared_ptr<TTransport> acceptImpl() {
+    throw std::string("broken");
+  }
+};
+
+class NullProcessor : public TProcessor {
+ public:
+  bool process(shared_ptr<TProtocol>, shared_ptr<TProtocol>, void*) {
+    return false;
+  }
+};
+
+/**
+ * Runs serve() on a thread of its own.
+ */
+class Serve : public Runnable {
+ public:
+  explicit Serve(shared_ptr<TServer> server) :
+    server_(server),
+    done_(false) {}
+
+  void run() {
+    server_->serve();
+    Synchronized s(monitor_);
+    done_ = true;
+    monitor_.notifyAll();
+  }
+
+  /// Waits up to timeout milliseconds for serve() to return
+  bool waitDone(int64_t timeout) {
+    int64_t deadline = Util::currentTime() + timeout;
+    Synchronized s(monitor_);
+    while (!done_) {
+      int64_t left = deadline - Util::currentTime();
+      if (left <= 0) {
+        break;
+      }
+      try {
+        monitor_.wait(left);
+      } catch (TimedOutException&) {}
+    }
+    return done_;
+  }
+
+ private:
+  shared_ptr<TServer> server_;
+  Monitor monitor_;
+  bool done_;
+};
+
+template <typename Server>
+shared_ptr<Server> newServer(shared_ptr<TServerTransport> serverTransport);
+
+template <>
+shared_ptr<TThreadedServer> newServer<TThreadedServer>(
+    shared_ptr<TServerTransport> serverTransport) {
+  return shared_ptr<TThreadedServer>(new TThreadedServer(
+      shared_ptr<TProcessor>(new NullProcessor),
+      serverTransport,
+      shared_ptr<TTransportFactory>(new TTransportFactory),
+      shared_ptr<TProtocolFactory>(new TBinaryProtocolFactory)));
+}
+
+template <>
+shared_ptr<TThreadPoolServer> newServer<TThreadPoolServer>(
+    shared_ptr<TServerTransport> serverTransport) {
+  shared_ptr<ThreadManager> threadManager =
+    ThreadManager::newSimpleThreadManager(1);
+  threadManager->threadFactory(
+      shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory));
+  threadManager->start();
+  return shared_ptr<TThreadPoolServer>(new TThreadPoolServer(
+      shared_ptr<TProcessor>(new NullProcessor),
+      serverTransport,
+      shared_ptr<TTransportFactory>(new TTransportFactory),
+      shared_ptr<TProtocolFactory>(new TBinaryProtocolFactory),
+      threadManager));
+}
+
+/**
+ * Serves the primary transport and the extra ones, calls stop() if asked
+ * to once every idle transport has an acceptor waiting on it, and checks
+ * that serve() returns having interrupted all the idle ones.
+ */
+template <typename Server>
+void checkServeEnds(shared_ptr<TServerTransport> primary,
+                    const std::vector<shared_ptr<TServerTransport> >& extras,
+                    bool stop) {
+  shared_ptr<Server> server = newServer<Server>(primary);
+  std::vector<shared_ptr<TServerTransport> > all(1, primary);
+  for (size_t i = 0; i < extras.size(); i++) {
+    server->addServerTransport(extras[i]);
+    all.push_back(extras[i]);
+  }
+
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Serve> serve(new Serve(server));
+  shared_ptr<Thread> thread = factory.newThread(serve);
+  thread->start();
+
+  if (stop) {
+    for (size_t i = 0; i < all.size(); i++) {
+      shared_ptr<IdleServerTransport> idle =
+        boost::dynamic_pointer_cast<IdleServerTransport>(all[i]);
+      if (idle) {
+        idle->waitAccepting();
+      }
+    }
+    server->stop();
+  }
+
+  bool done = serve->waitDone(5000);
+  BOOST_CHECK(done);
+  for (size_t i = 0; i < all.size(); i++) {
+    shared_ptr<IdleServerTransport> idle =
+      boost::dynamic_pointer_cast<IdleServerTransport>(all[i]);
+    if (idle) {
+      BOOST_CHECK(idle->interrupted());
+      BOOST_CHECK(idle->closed());
+    }
+  }
+
+  if (!done) {
+    server->stop();
+  }
+  thread->join();
+}
+
+std::vector<shared_ptr<TServerTransport> > transports(
+    shared_ptr<TServerTransport> a,
+    shared_ptr<TServerTransport> b = shared_ptr<TServerTransport>()) {
+  std::vector<shared_ptr<TServerTransport> > result(1, a);
+  if (b) {
+    result.push_back(b);
+  }
+  return result;
+}
+
+shared_ptr<TServerTransport> idle() {
+  return shared_ptr<TServerTransport>(new IdleServerTransport);
+}
+
+shared_ptr<TServerTransport> broken() {
+  return shared_ptr<TServerTransport>(new BrokenServerTransport);
+}
+
+/// Finds a loopback port that nothing listens on at the moment
+int freePort() {
+  int s = ::socket(AF_INET, SOCK_STREAM, 0);
+  BOOST_REQUIRE(s >= 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t size = sizeof(addr);
+  BOOST_REQUIRE(::bind(s, (struct sockaddr*) &addr, size) == 0);
+  BOOST_REQUIRE(::getsockname(s, (struct sockaddr*) &addr, &size) == 0);
+  ::close(s);
+  return ntohs(addr.sin_port);
+}
+
+/// Opens count client connections to port, each of which sends its index
+std::vector<shared_ptr<TSocket> > connectClients(int port, int count) {
+  std::vector<shared_ptr<TSocket> > clients;
+  for (int i = 0; i < count; i++) {
+    shared_ptr<TSocket> client(new TSocket("127.0.0.1", port));
+    client->open();
+    uint8_t index = (uint8_t) i;
+    client->write(&index, 1);
+    clients.push_back(client);
+  }
+  return clients;
+}
+
+/// Reads the index sent by the client at the other end of accepted
+int clientIndex(shared_ptr<TTransport> accepted) {
+  uint8_t index;
+  BOOST_REQUIRE_EQUAL(accepted->read(&index, 1), 1u);
+  return index;
+}
+
+bool isBlocking(shared_ptr<TTransport> accepted) {
+  int flags = fcntl(boost::dynamic_pointer_cast<TSocket>(accepted)->getSocketFD(), F_GETFL, 0);
+  return flags != -1 && (flags & O_NONBLOCK) == 0;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE( MultiAcceptorTest )
+
+BOOST_AUTO_TEST_CASE( test_threaded_stop_interrupts_every_acceptor ) {
+  checkServeEnds<TThreadedServer>(idle(), transports(idle(), idle()), true);
+}
+
+BOOST_AUTO_TEST_CASE( test_threaded_broken_primary_stops_acceptors ) {
+  checkServeEnds<TThreadedServer>(broken(), transports(idle()), false);
+}
+
+BOOST_AUTO_TEST_CASE( test_threaded_broken_acceptor_stops_server ) {
+  checkServeEnds<TThreadedServer>(idle(), transports(idle(), broken()), false);
+}
+
+BOOST_AUTO_TEST_CASE( test_thread_pool_stop_interrupts_every_acceptor ) {
+  checkServeEnds<TThreadPoolServer>(idle(), transports(idle(), idle()), true);
+}
+
+BOOST_AUTO_TEST_CASE( test_thread_pool_broken_primary_stops_acceptors ) {
+  checkServeEnds<TThreadPoolServer>(broken(), transports(idle()), false);
+}
+
+BOOST_AUTO_TEST_CASE( test_thread_pool_broken_acceptor_stops_server ) {
+  checkServeEnds<TThreadPoolServer>(idle(), transports(idle(), broken()), false);
+}
+
+BOOST_AUTO_TEST_CASE( test_reuse_port_shares_port ) {
+  int port = freePort();
+
+  TServerSocket first(port);
+  first.setReusePort(true);
+  first.setAcceptTimeout(10);
+  first.listen();
+
+  // Without SO_REUSEPORT the port is taken
+  TServerSocket refused(port);
+  BOOST_CHECK_THROW(refused.listen(), TTransportException);
+
+  TServerSocket second(port);
+  second.setReusePort(true);
+  second.setAcceptTimeout(10);
+  second.listen();
+
+  // The kernel spreads the connections over both; between them they see
+  // every one of them
+  const int count = 8;
+  std::vector<shared_ptr<TSocket> > clients = connectClients(port, count);
+  std::set<int> seen;
+  TServerSocket* sockets[] = { &first, &second };
+  int64_t deadline = Util::currentTime() + 5000;
+  while ((int) seen.size() < count && Util::currentTime() < deadline) {
+    for (int i = 0; i < 2; i++) {
+      try {
+        shared_ptr<TTransport> accepted = sockets[i]->accept();
+        BOOST_CHECK(isBlocking(accepted));
+        BOOST_CHECK(seen.insert(clientIndex(accepted)).second);
+      } catch (const TTransportException&) {
+        // Nothing waiting on this one within the accept timeout
+      }
+    }
+  }
+  BOOST_CHECK_EQUAL(seen.size(), (size_t) count);
+
+  first.close();
+  second.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_accept_batch_hands_out_queued_connections ) {
+  int port = freePort();
+
+  TServerSocket server(port);
+  server.setAcceptBatchSize(4);
+  server.listen();
+
+  std::vector<shared_ptr<TSocket> > clients = connectClients(port, 3);
+  // Give the last handshake time to land on the listen queue
+  usleep(100000);
+
+  shared_ptr<TTransport> accepted = server.accept();
+  std::set<int> seen;
+  seen.insert(clientIndex(accepted));
+
+  // The other two came in the same batch, so they are handed out without
+  // polling again, and an interrupt only stops the accept() after them
+  server.interrupt();
+  for (int i = 0; i < 2; i++) {
+    accepted = server.accept();
+    BOOST_CHECK(isBlocking(accepted));
+    BOOST_CHECK(seen.insert(clientIndex(accepted)).second);
+  }
+  BOOST_CHECK_EQUAL(seen.size(), 3u);
+
+  try {
+    server.accept();
+    BOOST_ERROR("accept() after the batch should be interrupted");
+  } catch (const TTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::INTERRUPTED);
+  }
+
+  server.close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,99 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include "gen-cpp/NoStaticInitTest_constants.h"
+#include "gen-cpp/NoStaticInitTest_types.h"
+
+using std::cout;
+using std::endl;
+using std::map;
+using std::string;
+using namespace thrift::test::no_static_init;
+
+/**
+ * Reads the generated tables from a static initializer of this file, which
+ * may run before those of the generated files.  With no_static_init that is
+ * safe, since the tables are built on first use.
+ */
+struct EarlyReader {
+  EarlyReader() {
+    name = g_NoStaticInitTest_constants().NAME;
+    words = g_NoStaticInitTest_constants().WORDS.size();
+    colors = _Color_VALUES_TO_NAMES().size();
+  }
+
+  string name;
+  size_t words;
+  size_t colors;
+};
+
+static EarlyReader early;
+
+int main() {
+  cout << "Enum values are named without a map." << endl;
+  {
+    assert(strcmp(_Color_VALUE_TO_NAME(Color::RED), "RED") == 0);
+    assert(strcmp(_Color_VALUE_TO_NAME(Color::GREEN), "GREEN") == 0);
+    assert(strcmp(_Color_VALUE_TO_NAME(Color::BLUE), "BLUE") == 0);
+    // CRIMSON repeats RED's value, and the first name wins
+    assert(strcmp(_Color_VALUE_TO_NAME(Color::CRIMSON), "RED") == 0);
+    assert(_Color_VALUE_TO_NAME(3) == NULL);
+    assert(_Color_VALUE_TO_NAME(-1) == NULL);
+  }
+
+  cout << "The values to names map is built on first use and agrees." << endl;
+  {
+    const map<int, const char*>& names = _Color_VALUES_TO_NAMES();
+    assert(&names == &_Color_VALUES_TO_NAMES());
+    assert(names.size() == 3);
+    for (map<int, const char*>::const_iterator it = names.begin(); it != names.end(); ++it) {
+      assert(strcmp(it->second, _Color_VALUE_TO_NAME(it->first)) == 0);
+    }
+    assert(strcmp(names.find(Color::CRIMSON)->second, "RED") == 0);
+    assert(names.find(3) == names.end());
+  }
+
+  cout << "Constants are built on first use." << endl;
+  {
+    const NoStaticInitTestConstants& constants = g_NoStaticInitTest_constants();
+    assert(&constants == &g_NoStaticInitTest_constants());
+    assert(constants.ANSWER == 42);
+    assert(constants.NAME == "no_static_init");
+    assert(constants.FAVORITE == Color::BLUE);
+    assert(constants.WORDS.size() == 3 && constants.WORDS[2] == "three");
+    assert(constants.LABELS.size() == 2);
+    assert(constants.LABELS.find(Color::GREEN)->second == "green");
+    assert(constants.ORIGIN.x == 0 && constants.ORIGIN.y == 0);
+    assert(constants.CORNER.x == 3 && constants.CORNER.y == 4);
+  }
+
+  cout << "Static initializers can use the constants and enum names." << endl;
+  {
+    assert(early.name == "no_static_init");
+    assert(early.words == 3);
+    assert(early.colors == 3);
+  }
+
+  return 0;
+}
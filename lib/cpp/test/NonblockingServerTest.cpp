@@ -0,0 +1,329 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <set>
+#include <vector>
+#include <unistd.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/PriorityThreadManager.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/server/TAdmissionController.h>
+#include <thrift/server/TNonblockingServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TSocket.h>
+#include "gen-cpp/Pipelined.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using boost::shared_ptr;
+using namespace thrift::test::pipelined;
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::server;
+using namespace apache::thrift::transport;
+
+/**
+ * Handler whose echo() holds each value until the test releases it, so
+ * that the test decides when a worker becomes free again.
+ */
+class GatedHandler : public PipelinedIf {
+ public:
+  int32_t echo(const int32_t value) {
+    Synchronized s(monitor_);
+    started_.insert(value);
+    monitor_.notifyAll();
+    while (released_.count(value) == 0) {
+      monitor_.wait();
+    }
+    return value;
+  }
+
+  void seqid(string& _return, const string& tag) {
+    _return = tag;
+  }
+
+  void refuse(const string& why) {
+    Refused refused;
+    refused.why = why;
+    throw refused;
+  }
+
+  /// Waits until echo(value) is running on a worker thread
+  void waitStarted(int32_t value) {
+    Synchronized s(monitor_);
+    while (started_.count(value) == 0) {
+      monitor_.wait();
+    }
+  }
+
+  void release(int32_t value) {
+    Synchronized s(monitor_);
+    released_.insert(value);
+    monitor_.notifyAll();
+  }
+
+ private:
+  Monitor monitor_;
+  std::set<int32_t> started_;
+  std::set<int32_t> released_;
+};
+
+/**
+ * Runs a TNonblockingServer, set up by the test, on an ephemeral port.
+ */
+class Server : public Runnable, public TServerEventHandler {
+ public:
+  Server(shared_ptr<GatedHandler> handler,
+         shared_ptr<ThreadManager> threadManager) :
+    threadManager_(threadManager),
+    ready_(false) {
+    if (threadManager_) {
+      threadManager_->threadFactory(
+          shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory));
+      threadManager_->start();
+    }
+    server_.reset(new TNonblockingServer(
+        shared_ptr<TProcessor>(new PipelinedProcessor(handler)),
+        shared_ptr<TProtocolFactory>(new TBinaryProtocolFactory),
+        0,
+        threadManager_));
+  }
+
+  TNonblockingServer& server() {
+    return *server_;
+  }
+
+  void run() {
+    server_->serve();
+  }
+
+  void preServe() {
+    Synchronized s(monitor_);
+    ready_ = true;
+    monitor_.notifyAll();
+  }
+
+  void start(shared_ptr<Server> self) {
+    server_->setServerEventHandler(self);
+    PlatformThreadFactory factory;
+    factory.setDetached(false);
+    thread_ = factory.newThread(self);
+    thread_->start();
+    Synchronized s(monitor_);
+    while (!ready_) {
+      monitor_.wait();
+    }
+  }
+
+  void stop() {
+    server_->stop();
+    thread_->join();
+    if (threadManager_) {
+      threadManager_->stop();
+    }
+    server_->setServerEventHandler(shared_ptr<TServerEventHandler>());
+  }
+
+  shared_ptr<PipelinedClient> connect(int recvTimeout = 0) {
+    shared_ptr<TSocket> socket(new TSocket("localhost", server_->getListenPort()));
+    socket->setRecvTimeout(recvTimeout);
+    shared_ptr<TTransport> transport(new TFramedTransport(socket));
+    shared_ptr<TProtocol> protocol(new TBinaryProtocol(transport));
+    transport->open();
+    return shared_ptr<PipelinedClient>(new PipelinedClient(protocol));
+  }
+
+  /// Waits up to timeout milliseconds for the open connections to reach count
+  bool waitActiveConnections(size_t count, int64_t timeout) {
+    int64_t deadline = Util::currentTime() + timeout;
+    while (server_->getNumActiveConnections() != count) {
+      if (Util::currentTime() >= deadline) {
+        return false;
+      }
+      usleep(1000);
+    }
+    return true;
+  }
+
+ private:
+  shared_ptr<ThreadManager> threadManager_;
+  shared_ptr<TNonblockingServer> server_;
+  shared_ptr<Thread> thread_;
+  Monitor monitor_;
+  bool ready_;
+};
+
+void closeClient(shared_ptr<PipelinedClient> client) {
+  client->getInputProtocol()->getTransport()->close();
+}
+
+int main() {
+  cout << "A high priority method skips a busy general pool." << endl;
+  {
+    // One general worker, and one reserved for HIGH once started
+    shared_ptr<PriorityThreadManager> threadManager =
+      PriorityThreadManager::newPriorityThreadManager(1);
+    shared_ptr<GatedHandler> handler(new GatedHandler);
+    shared_ptr<Server> server(new Server(handler, threadManager));
+    threadManager->addWorker(1, PriorityThreadManager::HIGH);
+    server->server().setMethodPriority("seqid", PriorityThreadManager::HIGH);
+    server->start(server);
+
+    shared_ptr<PipelinedClient> slow = server->connect();
+    slow->send_echo(0);
+    handler->waitStarted(0);
+
+    // The general worker is stuck in echo(), so only the reserved one can
+    // answer this
+    shared_ptr<PipelinedClient> fast = server->connect(5000);
+    string tag;
+    fast->seqid(tag, "fast");
+    assert(tag == "fast");
+
+    handler->release(0);
+    assert(slow->recv_echo() == 0);
+
+    closeClient(slow);
+    closeClient(fast);
+    server->stop();
+  }
+
+  cout << "Without a method priority the call waits for a general worker." << endl;
+  {
+    shared_ptr<PriorityThreadManager> threadManager =
+      PriorityThreadManager::newPriorityThreadManager(1);
+    shared_ptr<GatedHandler> handler(new GatedHandler);
+    shared_ptr<Server> server(new Server(handler, threadManager));
+    threadManager->addWorker(1, PriorityThreadManager::HIGH);
+    server->start(server);
+
+    shared_ptr<PipelinedClient> slow = server->connect();
+    slow->send_echo(0);
+    handler->waitStarted(0);
+
+    shared_ptr<PipelinedClient> fast = server->connect(200);
+    fast->send_seqid("fast");
+    bool timedOut = false;
+    try {
+      string tag;
+      fast->recv_seqid(tag);
+    } catch (TTransportException&) {
+      timedOut = true;
+    }
+    assert(timedOut);
+
+    handler->release(0);
+    assert(slow->recv_echo() == 0);
+
+    closeClient(slow);
+    closeClient(fast);
+    server->stop();
+  }
+
+  cout << "Thread-per-core IO threads serve and count their own connections." << endl;
+  {
+    shared_ptr<GatedHandler> handler(new GatedHandler);
+    shared_ptr<Server> server(new Server(handler, shared_ptr<ThreadManager>()));
+    server->server().setNumIOThreads(4);
+    server->server().setThreadPerCore(true);
+    server->start(server);
+
+    const size_t count = 8;
+    std::vector<shared_ptr<PipelinedClient> > clients;
+    for (size_t i = 0; i < count; i++) {
+      shared_ptr<PipelinedClient> client = server->connect(5000);
+      string tag;
+      client->seqid(tag, "client");
+      assert(tag == "client");
+      clients.push_back(client);
+    }
+    // Every client has had its answer, so each is connected and not idle
+    assert(server->server().getNumActiveConnections() == count);
+    assert(server->server().getNumConnections() == count);
+    assert(server->server().getNumIdleConnections() == 0);
+
+    for (size_t i = 0; i < count / 2; i++) {
+      closeClient(clients[i]);
+    }
+    assert(server->waitActiveConnections(count - count / 2, 5000));
+    for (size_t i = count / 2; i < count; i++) {
+      closeClient(clients[i]);
+    }
+    assert(server->waitActiveConnections(0, 5000));
+    assert(server->server().getNumIdleConnections() == count);
+
+    server->stop();
+  }
+
+  cout << "A call that has queued too long is rejected as overloaded." << endl;
+  {
+    shared_ptr<ThreadManager> threadManager =
+      ThreadManager::newSimpleThreadManager(1);
+    shared_ptr<GatedHandler> handler(new GatedHandler);
+    shared_ptr<Server> server(new Server(handler, threadManager));
+    shared_ptr<TAdmissionController> controller(
+        new TAdmissionController(1000, 10000));
+    server->server().setAdmissionController(controller);
+    server->start(server);
+
+    shared_ptr<PipelinedClient> slow = server->connect();
+    slow->send_echo(0);
+    handler->waitStarted(0);
+
+    // Put the controller in the dropping state: a sojourn above target
+    // that lasts a whole interval
+    controller->admit(50000);
+    usleep(11000);
+    assert(!controller->admit(50000));
+    assert(controller->getState().dropping);
+
+    // This call waits behind echo() well past both the target and the next
+    // drop time
+    shared_ptr<PipelinedClient> fast = server->connect(5000);
+    fast->send_seqid("fast");
+    usleep(30000);
+    handler->release(0);
+    assert(slow->recv_echo() == 0);
+
+    bool rejected = false;
+    try {
+      string tag;
+      fast->recv_seqid(tag);
+    } catch (TApplicationException& e) {
+      assert(e.getType() == TApplicationException::INTERNAL_ERROR);
+      assert(string(e.what()).find("overloaded") != string::npos);
+      rejected = true;
+    }
+    assert(rejected);
+    assert(controller->getState().rejected == 2);
+
+    closeClient(slow);
+    closeClient(fast);
+    server->stop();
+  }
+
+  return 0;
+}
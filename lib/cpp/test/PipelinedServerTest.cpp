@@ -0,0 +1,252 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <set>
+#include <unistd.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/server/TNonblockingServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TSocket.h>
+#include "gen-cpp/Pipelined.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using boost::shared_ptr;
+using namespace thrift::test::pipelined;
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::server;
+using namespace apache::thrift::transport;
+
+/**
+ * Handler whose echo() holds each value until the test releases it, so
+ * that the test decides the order in which pipelined requests finish.
+ */
+class GatedHandler : public PipelinedIf {
+ public:
+  int32_t echo(const int32_t value) {
+    Synchronized s(monitor_);
+    started_.insert(value);
+    monitor_.notifyAll();
+    while (released_.count(value) == 0) {
+      monitor_.wait();
+    }
+    return value;
+  }
+
+  void seqid(string& _return, const string& tag) {
+    _return = tag;
+  }
+
+  void refuse(const string& why) {
+    Refused refused;
+    refused.why = why;
+    throw refused;
+  }
+
+  /// Waits until echo(value) is running on a worker thread
+  void waitStarted(int32_t value) {
+    Synchronized s(monitor_);
+    while (started_.count(value) == 0) {
+      monitor_.wait();
+    }
+  }
+
+  void release(int32_t value) {
+    Synchronized s(monitor_);
+    released_.insert(value);
+    monitor_.notifyAll();
+  }
+
+ private:
+  Monitor monitor_;
+  std::set<int32_t> started_;
+  std::set<int32_t> released_;
+};
+
+/**
+ * Runs a pipelining TNonblockingServer on an ephemeral port.
+ */
+class PipelinedServer : public Runnable, public TServerEventHandler {
+ public:
+  PipelinedServer(shared_ptr<GatedHandler> handler, bool outOfOrder) :
+    ready_(false) {
+    threadManager_ = ThreadManager::newSimpleThreadManager(4);
+    threadManager_->threadFactory(
+        shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory));
+    threadManager_->start();
+    server_.reset(new TNonblockingServer(
+        shared_ptr<TProcessor>(new PipelinedProcessor(handler)),
+        shared_ptr<TProtocolFactory>(new TBinaryProtocolFactory),
+        0,
+        threadManager_));
+    server_->setMaxPipelinedRequests(4);
+    server_->setOutOfOrderResponses(outOfOrder);
+  }
+
+  void run() {
+    server_->serve();
+  }
+
+  void preServe() {
+    Synchronized s(monitor_);
+    ready_ = true;
+    monitor_.notifyAll();
+  }
+
+  void start(shared_ptr<PipelinedServer> self) {
+    server_->setServerEventHandler(self);
+    PlatformThreadFactory factory;
+    factory.setDetached(false);
+    thread_ = factory.newThread(self);
+    thread_->start();
+    Synchronized s(monitor_);
+    while (!ready_) {
+      monitor_.wait();
+    }
+  }
+
+  void stop() {
+    server_->stop();
+    thread_->join();
+    threadManager_->stop();
+    server_->setServerEventHandler(shared_ptr<TServerEventHandler>());
+  }
+
+  shared_ptr<PipelinedClient> connect() {
+    shared_ptr<TSocket> socket(new TSocket("localhost", server_->getListenPort()));
+    shared_ptr<TTransport> transport(new TFramedTransport(socket));
+    shared_ptr<TProtocol> protocol(new TBinaryProtocol(transport));
+    transport->open();
+    return shared_ptr<PipelinedClient>(new PipelinedClient(protocol));
+  }
+
+  /// Waits up to timeout milliseconds for the open connections to drop to count
+  bool waitActiveConnections(size_t count, int64_t timeout) {
+    int64_t deadline = Util::currentTime() + timeout;
+    while (server_->getNumActiveConnections() != count) {
+      if (Util::currentTime() >= deadline) {
+        return false;
+      }
+      usleep(1000);
+    }
+    return true;
+  }
+
+ private:
+  shared_ptr<ThreadManager> threadManager_;
+  shared_ptr<TNonblockingServer> server_;
+  shared_ptr<Thread> thread_;
+  Monitor monitor_;
+  bool ready_;
+};
+
+int main() {
+  cout << "Replies come back in request order." << endl;
+  {
+    shared_ptr<GatedHandler> handler(new GatedHandler);
+    shared_ptr<PipelinedServer> server(new PipelinedServer(handler, false));
+    server->start(server);
+    shared_ptr<PipelinedClient> client = server->connect();
+
+    int32_t seqids[4];
+    for (int32_t i = 0; i < 4; i++) {
+      seqids[i] = client->send_echo(i);
+    }
+    // All four are processing at once, and finish last to first
+    for (int32_t i = 0; i < 4; i++) {
+      handler->waitStarted(i);
+    }
+    for (int32_t i = 3; i >= 0; i--) {
+      handler->release(i);
+    }
+
+    string fname;
+    for (int32_t i = 0; i < 4; i++) {
+      assert(client->__recv_seqid(fname) == seqids[i]);
+      assert(client->recv_echo() == i);
+    }
+
+    client->getInputProtocol()->getTransport()->close();
+    assert(server->waitActiveConnections(0, 5000));
+    server->stop();
+  }
+
+  cout << "Out of order, replies come back as they finish." << endl;
+  {
+    shared_ptr<GatedHandler> handler(new GatedHandler);
+    shared_ptr<PipelinedServer> server(new PipelinedServer(handler, true));
+    server->start(server);
+    shared_ptr<PipelinedClient> client = server->connect();
+
+    int32_t seqids[4];
+    for (int32_t i = 0; i < 4; i++) {
+      seqids[i] = client->send_echo(i);
+    }
+    for (int32_t i = 0; i < 4; i++) {
+      handler->waitStarted(i);
+    }
+
+    string fname;
+    const int32_t order[] = {2, 0, 3, 1};
+    for (int i = 0; i < 4; i++) {
+      handler->release(order[i]);
+      assert(client->__recv_seqid(fname) == seqids[order[i]]);
+      assert(client->recv_echo() == order[i]);
+    }
+
+    client->getInputProtocol()->getTransport()->close();
+    assert(server->waitActiveConnections(0, 5000));
+    server->stop();
+  }
+
+  cout << "A client that hangs up waits for its requests to drain." << endl;
+  {
+    shared_ptr<GatedHandler> handler(new GatedHandler);
+    shared_ptr<PipelinedServer> server(new PipelinedServer(handler, false));
+    server->start(server);
+    shared_ptr<PipelinedClient> client = server->connect();
+
+    client->send_echo(0);
+    client->send_echo(1);
+    handler->waitStarted(0);
+    handler->waitStarted(1);
+    client->getInputProtocol()->getTransport()->close();
+
+    // The workers still hold the connection's requests, so it stays open
+    assert(!server->waitActiveConnections(0, 100));
+
+    handler->release(1);
+    assert(!server->waitActiveConnections(0, 100));
+
+    handler->release(0);
+    assert(server->waitActiveConnections(0, 5000));
+    server->stop();
+  }
+
+  return 0;
+}
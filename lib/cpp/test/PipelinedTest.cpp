@@ -0,0 +1,106 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/Pipelined.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using namespace thrift::test::pipelined;
+using namespace apache::thrift;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::protocol;
+
+class PipelinedHandler : public PipelinedIf {
+ public:
+  int32_t echo(const int32_t value) {
+    return value;
+  }
+
+  void seqid(string& _return, const string& tag) {
+    _return = tag + "!";
+  }
+
+  void refuse(const string& why) {
+    Refused refused;
+    refused.why = why;
+    throw refused;
+  }
+};
+
+int main() {
+  boost::shared_ptr<TMemoryBuffer> requests(new TMemoryBuffer);
+  boost::shared_ptr<TMemoryBuffer> replies(new TMemoryBuffer);
+  PipelinedClient client(
+      boost::shared_ptr<TProtocol>(new TBinaryProtocol(replies)),
+      boost::shared_ptr<TProtocol>(new TBinaryProtocol(requests)));
+
+  cout << "Sending three calls before reading any reply." << endl;
+  int32_t echoSeqid = client.send_echo(7);
+  int32_t tagSeqid = client.send_seqid("tag");
+  int32_t refuseSeqid = client.send_refuse("busy");
+  assert(echoSeqid != tagSeqid);
+  assert(tagSeqid != refuseSeqid);
+  assert(echoSeqid != refuseSeqid);
+
+  cout << "Answering them in reverse order." << endl;
+  PipelinedProcessor processor(
+      boost::shared_ptr<PipelinedIf>(new PipelinedHandler));
+  boost::shared_ptr<TProtocol> in(new TBinaryProtocol(requests));
+  std::vector<string> answers;
+  for (int i = 0; i < 3; ++i) {
+    boost::shared_ptr<TMemoryBuffer> answer(new TMemoryBuffer);
+    boost::shared_ptr<TProtocol> out(new TBinaryProtocol(answer));
+    assert(processor.process(in, out, NULL));
+    answers.push_back(answer->getBufferAsString());
+  }
+  for (int i = 2; i >= 0; --i) {
+    replies->write((const uint8_t*)answers[i].data(), answers[i].size());
+  }
+
+  cout << "Collecting replies by seqid." << endl;
+  string fname;
+  assert(client.__recv_seqid(fname) == refuseSeqid);
+  assert(fname == "refuse");
+  try {
+    client.recv_refuse();
+    assert(false);
+  } catch (const Refused& refused) {
+    assert(refused.why == "busy");
+  }
+
+  assert(client.__recv_seqid(fname) == tagSeqid);
+  assert(fname == "seqid");
+  // Peeking twice returns the same pending header.
+  assert(client.__recv_seqid(fname) == tagSeqid);
+  string tag;
+  client.recv_seqid(tag);
+  assert(tag == "tag!");
+
+  // recv_ reads the header itself when nothing is pending.
+  assert(client.recv_echo() == 7);
+  assert(replies->available_read() == 0);
+
+  return 0;
+}
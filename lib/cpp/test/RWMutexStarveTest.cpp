@@ -18,6 +18,7 @@
  */
 
 #include <iostream>
+#include <vector>
 #include <unistd.h>
 
 #include <boost/shared_ptr.hpp>
@@ -80,7 +81,8 @@ public:
   Writer(boost::shared_ptr<ReadWriteMutex> rwlock) : Locker(rwlock, true) { }
 };
 
-void test_starve(PosixThreadFactory::POLICY policy)
+void test_starve(PosixThreadFactory::POLICY policy,
+                 boost::shared_ptr<ReadWriteMutex> rwlock)
 {
   // the man pages for pthread_wrlock_rdlock suggest that any OS guarantee about
   // writer starvation may be influenced by the scheduling policy, so let's try
@@ -88,8 +90,6 @@ void test_starve(PosixThreadFactory::POLICY policy)
   PosixThreadFactory factory(policy);
   factory.setDetached(false);
 
-  boost::shared_ptr<ReadWriteMutex> rwlock(new NoStarveReadWriteMutex());
-
   boost::shared_ptr<Reader> reader1(new Reader(rwlock));
   boost::shared_ptr<Reader> reader2(new Reader(rwlock));
   boost::shared_ptr<Writer> writer(new Writer(rwlock));
@@ -148,6 +148,102 @@ void test_starve(PosixThreadFactory::POLICY policy)
   BOOST_CHECK_MESSAGE(success, "writer is starving");
 }
 
+void test_starve(PosixThreadFactory::POLICY policy)
+{
+  test_starve(policy, boost::shared_ptr<ReadWriteMutex>(new NoStarveReadWriteMutex()));
+}
+
+void test_starve_distributed(PosixThreadFactory::POLICY policy)
+{
+  test_starve(policy, boost::shared_ptr<ReadWriteMutex>(new DistributedReadWriteMutex()));
+}
+
+// Writers keep first == second except while they hold the write lock, so a
+// reader that sees them differ got in alongside a writer.
+class Checker : public Runnable
+{
+public:
+  Checker(boost::shared_ptr<ReadWriteMutex> rwlock, bool writer, int count,
+          volatile int* first, volatile int* second) :
+    rwlock_(rwlock), writer_(writer), count_(count),
+    first_(first), second_(second), failures_(0) { }
+
+  virtual void run()
+  {
+    for (int i = 0; i < count_; ++i) {
+      if (writer_) {
+        rwlock_->acquireWrite();
+        ++*first_;
+        if (i % 16 == 0) {
+          usleep(1);
+        }
+        ++*second_;
+      } else {
+        rwlock_->acquireRead();
+        if (*first_ != *second_) {
+          ++failures_;
+        }
+      }
+      rwlock_->release();
+    }
+  }
+
+  int failures() const { return failures_; }
+
+private:
+  boost::shared_ptr<ReadWriteMutex> rwlock_;
+  bool writer_;
+  int count_;
+  volatile int* first_;
+  volatile int* second_;
+  int failures_;
+};
+
+void test_exclusion(boost::shared_ptr<ReadWriteMutex> rwlock)
+{
+  PosixThreadFactory factory;
+  factory.setDetached(false);
+
+  const int readerCount = 6;
+  const int writerCount = 2;
+  const int count = 20000;
+  volatile int first = 0;
+  volatile int second = 0;
+
+  vector<boost::shared_ptr<Checker> > checkers;
+  vector<boost::shared_ptr<Thread> > threads;
+  for (int i = 0; i < readerCount + writerCount; ++i) {
+    checkers.push_back(boost::shared_ptr<Checker>(
+      new Checker(rwlock, i < writerCount, count, &first, &second)));
+    threads.push_back(factory.newThread(checkers.back()));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->start();
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+
+  int failures = 0;
+  for (size_t i = 0; i < checkers.size(); ++i) {
+    failures += checkers[i]->failures();
+  }
+  BOOST_CHECK_EQUAL(failures, 0);
+  BOOST_CHECK_EQUAL(first, writerCount * count);
+  BOOST_CHECK_EQUAL(second, writerCount * count);
+
+  // A read lock shuts out writers; a write lock shuts out everyone
+  rwlock->acquireRead();
+  BOOST_CHECK(!rwlock->attemptWrite());
+  rwlock->release();
+  BOOST_CHECK(rwlock->attemptWrite());
+  BOOST_CHECK(!rwlock->attemptRead());
+  BOOST_CHECK(!rwlock->attemptWrite());
+  rwlock->release();
+  BOOST_CHECK(rwlock->attemptRead());
+  rwlock->release();
+}
+
 BOOST_AUTO_TEST_SUITE( RWMutexStarveTest )
 
 BOOST_AUTO_TEST_CASE( test_starve_other )
@@ -165,4 +261,24 @@ BOOST_AUTO_TEST_CASE( test_starve_fifo )
   test_starve(PosixThreadFactory::FIFO);
 }
 
+BOOST_AUTO_TEST_CASE( test_starve_distributed_other )
+{
+  test_starve_distributed(PosixThreadFactory::OTHER);
+}
+
+BOOST_AUTO_TEST_CASE( test_starve_distributed_rr )
+{
+  test_starve_distributed(PosixThreadFactory::ROUND_ROBIN);
+}
+
+BOOST_AUTO_TEST_CASE( test_starve_distributed_fifo )
+{
+  test_starve_distributed(PosixThreadFactory::FIFO);
+}
+
+BOOST_AUTO_TEST_CASE( test_exclusion_distributed )
+{
+  test_exclusion(boost::shared_ptr<ReadWriteMutex>(new DistributedReadWriteMutex()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,261 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TDebugProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp-split/gen-cpp/ThriftTest.h"
+
+using std::cout;
+using std::endl;
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+using boost::shared_ptr;
+using namespace thrift::test;
+using namespace apache::thrift;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::protocol;
+
+// ThriftTest_extras.cpp goes with the unsplit code, so this is repeated here
+namespace thrift { namespace test {
+
+bool Insanity::operator<(thrift::test::Insanity const& other) const {
+  return ThriftDebugString(*this) < ThriftDebugString(other);
+}
+
+}}
+
+/**
+ * Handles the calls whose code is spread over the most shards
+ */
+class SplitHandler : public ThriftTestNull {
+ public:
+  SplitHandler() : onewaySeconds_(0) {}
+
+  void testString(string& _return, const string& thing) {
+    _return = thing;
+  }
+
+  void testStruct(Xtruct& _return, const Xtruct& thing) {
+    _return = thing;
+  }
+
+  void testNest(Xtruct2& _return, const Xtruct2& thing) {
+    _return = thing;
+  }
+
+  void testList(vector<int32_t>& _return, const vector<int32_t>& thing) {
+    _return = thing;
+  }
+
+  void testInsanity(map<UserId, map<Numberz::type, Insanity> >& _return,
+                    const Insanity& argument) {
+    _return[1][Numberz::TWO] = argument;
+    _return[2][Numberz::SIX] = Insanity();
+  }
+
+  UserId testTypedef(const UserId thing) {
+    return thing;
+  }
+
+  void testOneway(const int32_t secondsToSleep) {
+    onewaySeconds_ += secondsToSleep;
+  }
+
+  void testException(const string& arg) {
+    if (arg == "Xception") {
+      Xception e;
+      e.errorCode = 1001;
+      e.message = arg;
+      throw e;
+    }
+  }
+
+  void testMultiException(Xtruct& _return, const string& arg0, const string& arg1) {
+    if (arg0 == "Xception2") {
+      Xception2 e;
+      e.errorCode = 2002;
+      e.struct_thing.string_thing = arg1;
+      throw e;
+    }
+    _return.string_thing = arg1;
+  }
+
+  int32_t onewaySeconds_;
+};
+
+static Xtruct makeXtruct(int32_t i) {
+  Xtruct x;
+  x.string_thing = "xtruct";
+  x.byte_thing = 1;
+  x.i32_thing = i;
+  x.i64_thing = -i;
+  return x;
+}
+
+static Insanity makeInsanity() {
+  Insanity insanity;
+  insanity.userMap[Numberz::FIVE] = 5;
+  insanity.userMap[Numberz::EIGHT] = 8;
+  insanity.xtructs.push_back(makeXtruct(1));
+  insanity.xtructs.push_back(makeXtruct(2));
+  return insanity;
+}
+
+template <typename T>
+static void roundTrip(const T& expected) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  TBinaryProtocol protocol(buffer);
+  expected.write(&protocol);
+  T result;
+  result.read(&protocol);
+  assert(result == expected);
+}
+
+int main() {
+  cout << "Structs from every shard round trip." << endl;
+  {
+    roundTrip(makeXtruct(7));
+    Xtruct2 nest;
+    nest.byte_thing = 2;
+    nest.struct_thing = makeXtruct(3);
+    nest.i32_thing = 4;
+    roundTrip(nest);
+    roundTrip(makeInsanity());
+
+    CrazyNesting crazy;
+    crazy.string_field = "crazy";
+    crazy.__set_set_field(set<Insanity>());
+    crazy.set_field.insert(makeInsanity());
+    crazy.list_field.resize(1);
+    set<int32_t> key;
+    key.insert(1);
+    map<Insanity, string> names;
+    names[makeInsanity()] = "insanity";
+    crazy.list_field[0][key][2].insert(vector<map<Insanity, string> >(1, names));
+    crazy.binary_field = string("\0\1\2", 3);
+    roundTrip(crazy);
+
+    Bonk bonk;
+    bonk.message = "bonk";
+    bonk.type = 3;
+    roundTrip(bonk);
+    OneField one;
+    roundTrip(one);
+    Bools bools;
+    bools.im_true = true;
+    roundTrip(bools);
+    ListBonks bonks;
+    bonks.bonk.push_back(bonk);
+    roundTrip(bonks);
+  }
+
+  shared_ptr<TMemoryBuffer> requests(new TMemoryBuffer);
+  shared_ptr<TMemoryBuffer> replies(new TMemoryBuffer);
+  shared_ptr<TProtocol> clientOut(new TBinaryProtocol(requests));
+  shared_ptr<TProtocol> clientIn(new TBinaryProtocol(replies));
+  shared_ptr<TProtocol> serverIn(new TBinaryProtocol(requests));
+  shared_ptr<TProtocol> serverOut(new TBinaryProtocol(replies));
+  ThriftTestClient client(clientIn, clientOut);
+  shared_ptr<SplitHandler> handler(new SplitHandler);
+  ThriftTestProcessor processor(handler);
+
+  cout << "Calls from every shard round trip through the processor." << endl;
+  {
+    string s;
+    client.send_testString("split");
+    assert(processor.process(serverIn, serverOut, NULL));
+    client.recv_testString(s);
+    assert(s == "split");
+
+    Xtruct x;
+    client.send_testStruct(makeXtruct(9));
+    assert(processor.process(serverIn, serverOut, NULL));
+    client.recv_testStruct(x);
+    assert(x == makeXtruct(9));
+
+    Xtruct2 nest;
+    nest.struct_thing = makeXtruct(10);
+    Xtruct2 nested;
+    client.send_testNest(nest);
+    assert(processor.process(serverIn, serverOut, NULL));
+    client.recv_testNest(nested);
+    assert(nested == nest);
+
+    vector<int32_t> list(3, 5);
+    vector<int32_t> listed;
+    client.send_testList(list);
+    assert(processor.process(serverIn, serverOut, NULL));
+    client.recv_testList(listed);
+    assert(listed == list);
+
+    map<UserId, map<Numberz::type, Insanity> > insane;
+    client.send_testInsanity(makeInsanity());
+    assert(processor.process(serverIn, serverOut, NULL));
+    client.recv_testInsanity(insane);
+    assert(insane.size() == 2);
+    assert(insane[1][Numberz::TWO] == makeInsanity());
+
+    client.send_testTypedef(1LL << 40);
+    assert(processor.process(serverIn, serverOut, NULL));
+    assert(client.recv_testTypedef() == 1LL << 40);
+
+    client.send_testOneway(1);
+    assert(processor.process(serverIn, serverOut, NULL));
+    assert(handler->onewaySeconds_ == 1);
+    assert(replies->available_read() == 0);
+
+    // Not overridden, so answered by ThriftTestNull
+    client.send_testI32(3);
+    assert(processor.process(serverIn, serverOut, NULL));
+    assert(client.recv_testI32() == 0);
+  }
+
+  cout << "Declared exceptions reach the client." << endl;
+  {
+    client.send_testException("Xception");
+    assert(processor.process(serverIn, serverOut, NULL));
+    bool caught = false;
+    try {
+      client.recv_testException();
+    } catch (Xception& e) {
+      caught = true;
+      assert(e.errorCode == 1001 && e.message == "Xception");
+    }
+    assert(caught);
+
+    client.send_testMultiException("Xception2", "thing");
+    assert(processor.process(serverIn, serverOut, NULL));
+    caught = false;
+    try {
+      Xtruct x;
+      client.recv_testMultiException(x);
+    } catch (Xception2& e) {
+      caught = true;
+      assert(e.errorCode == 2002 && e.struct_thing.string_thing == "thing");
+    }
+    assert(caught);
+  }
+
+  return 0;
+}
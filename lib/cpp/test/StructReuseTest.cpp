@@ -0,0 +1,190 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/ThriftTest_types.h"
+
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_LIST;
+using apache::thrift::protocol::T_STRUCT;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+using std::string;
+using std::vector;
+using namespace thrift::test;
+
+/*
+ * Generated readers reuse the vectors of a struct that is read again
+ * rather than clearing them first.  Whatever the struct held before, it
+ * must come out of read() exactly as it went onto the wire.
+ */
+
+BOOST_AUTO_TEST_SUITE( StructReuseTest )
+
+template <typename T>
+static string serialize(const T& obj) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+  obj.write(&protocol);
+  return buffer->getBufferAsString();
+}
+
+template <typename T>
+static void deserialize(const string& data, T& obj) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(
+      (uint8_t*) data.data(), data.size()));
+  TBinaryProtocol protocol(buffer);
+  obj.read(&protocol);
+}
+
+BOOST_AUTO_TEST_CASE( test_shorter_scalar_list ) {
+  ListTypeVersioningV1 longer;
+  for (int32_t i = 0; i < 100; i++) {
+    longer.myints.push_back(i);
+  }
+  longer.hello = "longer";
+  ListTypeVersioningV1 shorter;
+  shorter.myints.push_back(-1);
+  shorter.myints.push_back(-2);
+  shorter.hello = "shorter";
+  ListTypeVersioningV1 empty;
+
+  ListTypeVersioningV1 obj;
+  deserialize(serialize(longer), obj);
+  BOOST_CHECK(obj == longer);
+  deserialize(serialize(shorter), obj);
+  BOOST_CHECK(obj == shorter);
+  BOOST_CHECK_EQUAL(obj.myints.size(), 2u);
+  deserialize(serialize(empty), obj);
+  BOOST_CHECK(obj.myints.empty());
+  deserialize(serialize(longer), obj);
+  BOOST_CHECK(obj == longer);
+}
+
+BOOST_AUTO_TEST_CASE( test_shorter_string_list ) {
+  ListTypeVersioningV2 longer;
+  longer.strings.push_back(string(1000, 'a'));
+  longer.strings.push_back("bb");
+  longer.strings.push_back("ccc");
+  ListTypeVersioningV2 shorter;
+  shorter.strings.push_back("d");
+  shorter.strings.push_back("");
+
+  ListTypeVersioningV2 obj;
+  deserialize(serialize(longer), obj);
+  BOOST_CHECK(obj == longer);
+  // Each string is shorter than the one it is read over
+  deserialize(serialize(shorter), obj);
+  BOOST_CHECK(obj == shorter);
+  BOOST_CHECK_EQUAL(obj.strings[0], "d");
+  BOOST_CHECK_EQUAL(obj.strings[1], "");
+}
+
+BOOST_AUTO_TEST_CASE( test_shorter_nested_list ) {
+  NestedListsI32x2 longer;
+  longer.integerlist.resize(3);
+  for (int32_t i = 0; i < 10; i++) {
+    longer.integerlist[0].push_back(i);
+    longer.integerlist[1].push_back(i * 2);
+  }
+  NestedListsI32x2 shorter;
+  shorter.integerlist.resize(2);
+  shorter.integerlist[1].push_back(7);
+
+  NestedListsI32x2 obj;
+  deserialize(serialize(longer), obj);
+  BOOST_CHECK(obj == longer);
+  deserialize(serialize(shorter), obj);
+  BOOST_CHECK(obj == shorter);
+  BOOST_CHECK(obj.integerlist[0].empty());
+  BOOST_CHECK_EQUAL(obj.integerlist[1].size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( test_shorter_struct_list ) {
+  Insanity longer;
+  for (int32_t i = 0; i < 5; i++) {
+    Xtruct x;
+    x.string_thing = "longer";
+    x.byte_thing = 1;
+    x.i32_thing = i;
+    x.i64_thing = i * 10;
+    longer.xtructs.push_back(x);
+  }
+  Insanity shorter;
+  Xtruct x;
+  x.string_thing = "shorter";
+  x.i32_thing = -1;
+  shorter.xtructs.push_back(x);
+
+  Insanity obj;
+  deserialize(serialize(longer), obj);
+  BOOST_CHECK(obj == longer);
+  deserialize(serialize(shorter), obj);
+  BOOST_CHECK(obj == shorter);
+  BOOST_CHECK_EQUAL(obj.xtructs.size(), 1u);
+  BOOST_CHECK_EQUAL(obj.xtructs[0].byte_thing, 0);
+  BOOST_CHECK_EQUAL(obj.xtructs[0].i64_thing, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_struct_list_fields_absent_on_wire ) {
+  Insanity full;
+  Xtruct x;
+  x.string_thing = "stale";
+  x.byte_thing = 1;
+  x.i32_thing = 2;
+  x.i64_thing = 3;
+  full.xtructs.push_back(x);
+
+  // An Insanity whose one Xtruct carries only i32_thing, as a peer with an
+  // older Xtruct would send it
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+  protocol.writeStructBegin("Insanity");
+  protocol.writeFieldBegin("xtructs", T_LIST, 2);
+  protocol.writeListBegin(T_STRUCT, 1);
+  protocol.writeStructBegin("Xtruct");
+  protocol.writeFieldBegin("i32_thing", T_I32, 9);
+  protocol.writeI32(42);
+  protocol.writeFieldEnd();
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+  protocol.writeListEnd();
+  protocol.writeFieldEnd();
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+
+  Insanity obj;
+  deserialize(serialize(full), obj);
+  BOOST_CHECK(obj == full);
+  deserialize(buffer->getBufferAsString(), obj);
+  BOOST_REQUIRE_EQUAL(obj.xtructs.size(), 1u);
+  BOOST_CHECK_EQUAL(obj.xtructs[0].i32_thing, 42);
+  // Nothing of the element read before may survive
+  BOOST_CHECK_EQUAL(obj.xtructs[0].string_thing, "");
+  BOOST_CHECK_EQUAL(obj.xtructs[0].byte_thing, 0);
+  BOOST_CHECK_EQUAL(obj.xtructs[0].i64_thing, 0);
+  BOOST_CHECK(!obj.xtructs[0].__isset.string_thing);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/auto_unit_test.hpp>
+#include <vector>
+#include <thrift/server/TAdmissionController.h>
+
+using apache::thrift::server::TAdmissionController;
+
+// An arbitrary start time for the tests that pass their own clock
+static const int64_t T0 = 1000000000LL;
+
+BOOST_AUTO_TEST_SUITE( TAdmissionControllerTest )
+
+BOOST_AUTO_TEST_CASE( test_admits_below_target ) {
+  TAdmissionController controller(1000, 10000);
+
+  for (int i = 0; i < 100; i++) {
+    BOOST_CHECK(controller.admit(500));
+  }
+
+  TAdmissionController::State state = controller.getState();
+  BOOST_CHECK(!state.dropping);
+  BOOST_CHECK_EQUAL(state.admitted, 100u);
+  BOOST_CHECK_EQUAL(state.rejected, 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_absorbs_burst ) {
+  TAdmissionController controller(1000, 50000);
+
+  // Above target, but for less than an interval
+  for (int i = 0; i < 10; i++) {
+    BOOST_CHECK(controller.admit(5000, T0 + i * 4000));
+  }
+  BOOST_CHECK(controller.admit(100, T0 + 40000));
+  BOOST_CHECK(!controller.getState().dropping);
+}
+
+BOOST_AUTO_TEST_CASE( test_drops_standing_queue ) {
+  TAdmissionController controller(1000, 10000);
+
+  BOOST_CHECK(controller.admit(5000, T0));
+
+  // The delay has persisted for an interval: start dropping
+  BOOST_CHECK(!controller.admit(5000, T0 + 15000));
+  TAdmissionController::State state = controller.getState();
+  BOOST_CHECK(state.dropping);
+  BOOST_CHECK_EQUAL(state.dropCount, 1u);
+  BOOST_CHECK_EQUAL(state.lastSojournUsec, 5000);
+
+  // Between scheduled drops, requests still get through
+  BOOST_CHECK(controller.admit(5000, T0 + 15001));
+
+  // Drops come interval / sqrt(count) apart: the next ones are due at
+  // +25000, +32071, +37844, +42844, +47316, +51398 and +55177
+  std::vector<int64_t> drops;
+  for (int64_t t = 16000; t <= 55000; t += 1000) {
+    if (!controller.admit(5000, T0 + t)) {
+      drops.push_back(t);
+    }
+  }
+  const int64_t expected[] = {25000, 33000, 38000, 43000, 48000, 52000};
+  BOOST_CHECK_EQUAL_COLLECTIONS(drops.begin(), drops.end(),
+                                expected, expected + 6);
+  BOOST_CHECK_EQUAL(controller.getState().dropCount, 7u);
+
+  // Once the delay is back under target, everything is admitted again
+  BOOST_CHECK(controller.admit(500, T0 + 56000));
+  state = controller.getState();
+  BOOST_CHECK(!state.dropping);
+  BOOST_CHECK_EQUAL(state.rejected, 7u);
+
+  // A standing queue soon after resumes near the old drop rate
+  BOOST_CHECK(controller.admit(5000, T0 + 57000));
+  BOOST_CHECK(!controller.admit(5000, T0 + 67000));
+  state = controller.getState();
+  BOOST_CHECK(state.dropping);
+  BOOST_CHECK_EQUAL(state.dropCount, 6u);
+  BOOST_CHECK(controller.admit(5000, T0 + 71081));
+  BOOST_CHECK(!controller.admit(5000, T0 + 71082));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/auto_unit_test.hpp>
+#include <set>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/server/TCompletionQueue.h>
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::server::TCompletionLink;
+using apache::thrift::server::TCompletionQueue;
+
+struct Node {
+  TCompletionLink<Node> completionLink_;
+};
+
+BOOST_AUTO_TEST_SUITE( TCompletionQueueTest )
+
+BOOST_AUTO_TEST_CASE( test_pop_in_push_order ) {
+  TCompletionQueue<Node> queue;
+  Node nodes[3];
+
+  BOOST_CHECK(queue.push(&nodes[0]));
+  BOOST_CHECK(!queue.push(&nodes[1]));
+  BOOST_CHECK(!queue.push(&nodes[2]));
+
+  Node* node = queue.popAll();
+  for (int i = 0; i < 3; i++) {
+    BOOST_REQUIRE(node == &nodes[i]);
+    node = queue.release(node);
+  }
+  BOOST_CHECK(node == NULL);
+  BOOST_CHECK(queue.popAll() == NULL);
+}
+
+BOOST_AUTO_TEST_CASE( test_push_twice ) {
+  TCompletionQueue<Node> queue;
+  Node a;
+  Node b;
+
+  // Pushing a node that is already queued leaves the queue alone
+  BOOST_CHECK(queue.push(&a));
+  BOOST_CHECK(!queue.push(&b));
+  BOOST_CHECK(!queue.push(&a));
+  BOOST_CHECK(!queue.push(&b));
+
+  Node* node = queue.popAll();
+  BOOST_REQUIRE(node == &a);
+  BOOST_REQUIRE(a.completionLink_.next == &b);
+  BOOST_REQUIRE(b.completionLink_.next == NULL);
+
+  // Until released, a popped node still counts as queued
+  BOOST_CHECK(!queue.push(&a));
+  BOOST_CHECK(queue.popAll() == NULL);
+
+  node = queue.release(node);
+  BOOST_CHECK(node == &b);
+  BOOST_CHECK(queue.push(&a));
+  BOOST_CHECK(queue.release(node) == NULL);
+
+  node = queue.popAll();
+  BOOST_REQUIRE(node == &a);
+  BOOST_CHECK(queue.release(node) == NULL);
+}
+
+namespace {
+
+const int NODE_COUNT = 4;
+const int PUSH_COUNT = 100000;
+
+class Pusher : public Runnable {
+ public:
+  Pusher(TCompletionQueue<Node>& queue, Node* nodes) :
+    queue_(queue), nodes_(nodes) {}
+
+  void run() {
+    for (int i = 0; i < PUSH_COUNT; i++) {
+      queue_.push(&nodes_[i % NODE_COUNT]);
+    }
+  }
+
+ private:
+  TCompletionQueue<Node>& queue_;
+  Node* nodes_;
+};
+
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent_pushes ) {
+  TCompletionQueue<Node> queue;
+  Node nodes[NODE_COUNT];
+
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> threads[4];
+  for (int i = 0; i < 4; i++) {
+    threads[i] = factory.newThread(
+        shared_ptr<Runnable>(new Pusher(queue, nodes)));
+    threads[i]->start();
+  }
+
+  // However the pushes interleave, every pass sees each node at most once
+  for (int pass = 0; pass < PUSH_COUNT; pass++) {
+    std::set<Node*> seen;
+    for (Node* node = queue.popAll(); node != NULL; node = queue.release(node)) {
+      BOOST_REQUIRE(seen.insert(node).second);
+    }
+  }
+
+  for (int i = 0; i < 4; i++) {
+    threads[i]->join();
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
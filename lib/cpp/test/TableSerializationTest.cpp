@@ -0,0 +1,237 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/DebugProtoTest_constants.h"
+#include "gen-cpp/DebugProtoTestTable_constants.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using namespace apache::thrift;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::protocol;
+
+// The same IDL, generated with the unrolled readers and writers and with
+// table_serialization
+namespace unrolled = thrift::test::debug;
+namespace table = thrift::test::debug_table;
+
+// As DebugProtoTest_extras.cpp defines for the unrolled version
+namespace thrift { namespace test { namespace debug_table {
+
+bool Empty::operator<(Empty const& other) const {
+  (void) other;
+  // It is empty, so all are equal.
+  return false;
+}
+
+}}}
+
+template <typename Protocol, typename T>
+string serialize(const T& obj) {
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  Protocol protocol(buffer);
+  uint32_t size = obj.write(&protocol);
+  assert(size == buffer->available_read());
+  return buffer->getBufferAsString();
+}
+
+template <typename Protocol, typename T>
+void deserialize(const string& bytes, T& obj) {
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  buffer->write(reinterpret_cast<const uint8_t*>(bytes.data()),
+                static_cast<uint32_t>(bytes.size()));
+  Protocol protocol(buffer);
+  // Not checking read()'s count: container headers go uncounted, in either
+  // version
+  obj.read(&protocol);
+  assert(buffer->available_read() == 0);
+}
+
+/**
+ * Checks that both versions of a struct write the same bytes, and that
+ * each reads what the other wrote back to the same bytes.
+ */
+template <typename Protocol, typename U, typename T>
+void check(const U& u, const T& t) {
+  string bytes = serialize<Protocol>(u);
+  assert(serialize<Protocol>(t) == bytes);
+
+  T tableRead;
+  deserialize<Protocol>(bytes, tableRead);
+  assert(serialize<Protocol>(tableRead) == bytes);
+
+  U unrolledRead;
+  deserialize<Protocol>(serialize<Protocol>(t), unrolledRead);
+  assert(serialize<Protocol>(unrolledRead) == bytes);
+}
+
+template <typename U, typename T>
+void checkAll(const U& u, const T& t) {
+  check<TBinaryProtocol>(u, t);
+  check<TCompactProtocol>(u, t);
+}
+
+template <typename OneOfEach>
+void fillOneOfEach(OneOfEach& ooe) {
+  ooe.im_true = true;
+  ooe.im_false = false;
+  ooe.a_bite = -3;
+  ooe.integer16 = 27000;
+  ooe.integer32 = 1 << 24;
+  ooe.integer64 = -6000LL * 1000 * 1000;
+  ooe.double_precision = M_PI;
+  ooe.some_characters = "Debug THIS!";
+  ooe.zomg_unicode = "\xd7\n\a\t";
+  ooe.base64 = string("\0\1\2\xff", 4);
+  ooe.i64_list.push_back(1LL << 40);
+}
+
+template <typename HolyMoley, typename OneOfEach, typename Bonk>
+void fillHolyMoley(HolyMoley& hm) {
+  OneOfEach ooe;
+  fillOneOfEach(ooe);
+  hm.big.push_back(ooe);
+  hm.big.push_back(OneOfEach());
+  std::vector<string> strings;
+  strings.push_back("and a one");
+  hm.contain.insert(strings);
+  Bonk bonk;
+  bonk.type = 31337;
+  bonk.message = "I am a bonk... xor!";
+  hm.bonks["nothing"];
+  hm.bonks["something"].push_back(bonk);
+}
+
+template <typename Doubles>
+void fillDoubles(Doubles& d) {
+  d.nan = std::numeric_limits<double>::quiet_NaN();
+  d.inf = std::numeric_limits<double>::infinity();
+  d.neginf = -std::numeric_limits<double>::infinity();
+  d.repeating = 1.0 / 3;
+  d.big = 1e300;
+  d.small = 1e-300;
+  d.zero = 0.0;
+  d.negzero = -0.0;
+}
+
+template <typename Tuple>
+void fillTuple(Tuple& tuple) {
+  // Only the set optional fields are written
+  tuple.__set_field1(1);
+  tuple.__set_field3(-3);
+  tuple.field4 = 4;
+  tuple.__set_field12(12);
+}
+
+int main() {
+  cout << "Writing the same bytes as the unrolled code." << endl;
+  {
+    checkAll(unrolled::g_DebugProtoTest_constants.COMPACT_TEST,
+             table::g_DebugProtoTestTable_constants.COMPACT_TEST);
+
+    unrolled::OneOfEach uooe;
+    table::OneOfEach tooe;
+    fillOneOfEach(uooe);
+    fillOneOfEach(tooe);
+    checkAll(uooe, tooe);
+
+    unrolled::HolyMoley uhm;
+    table::HolyMoley thm;
+    fillHolyMoley<unrolled::HolyMoley, unrolled::OneOfEach, unrolled::Bonk>(uhm);
+    fillHolyMoley<table::HolyMoley, table::OneOfEach, table::Bonk>(thm);
+    checkAll(uhm, thm);
+
+    unrolled::Doubles ud;
+    table::Doubles td;
+    fillDoubles(ud);
+    fillDoubles(td);
+    checkAll(ud, td);
+
+    unrolled::TupleProtocolTestStruct utuple;
+    table::TupleProtocolTestStruct ttuple;
+    fillTuple(utuple);
+    fillTuple(ttuple);
+    checkAll(utuple, ttuple);
+
+    unrolled::ReverseOrderStruct ureverse;
+    table::ReverseOrderStruct treverse;
+    ureverse.first = treverse.first = "first";
+    ureverse.fourth = treverse.fourth = 4;
+    checkAll(ureverse, treverse);
+
+    unrolled::BreaksRubyCompactProtocol ubig;
+    table::BreaksRubyCompactProtocol tbig;
+    ubig.field2.field2 = tbig.field2.field2 = "field id 45";
+    checkAll(ubig, tbig);
+
+    unrolled::TestUnion uunion;
+    table::TestUnion tunion;
+    fillOneOfEach(uunion.struct_field);
+    fillOneOfEach(tunion.struct_field);
+    uunion.__isset.struct_field = tunion.__isset.struct_field = true;
+    checkAll(uunion, tunion);
+  }
+
+  cout << "Writing exceptions, which derive from TException." << endl;
+  {
+    unrolled::ExceptionWithAMap ux;
+    table::ExceptionWithAMap tx;
+    ux.blah = tx.blah = "blah";
+    ux.map_field["key"] = tx.map_field["key"] = "value";
+    checkAll(ux, tx);
+  }
+
+  cout << "Reading only the fields the other side knows." << endl;
+  {
+    // Field 1 is an i32 in both, field 2 is a string in Bonk, and Bonk has
+    // no field 3
+    unrolled::PrimitiveThenStruct other;
+    other.blah = 7;
+    other.blah2 = 8;
+    other.bw.first_tag2 = 9;
+    table::Bonk bonk;
+    bonk.message = "replaced?";
+    deserialize<TBinaryProtocol>(serialize<TBinaryProtocol>(other), bonk);
+    assert(bonk.type == 7);
+    assert(bonk.message == "replaced?");
+  }
+
+  cout << "Throwing when a required field is missing." << endl;
+  {
+    string empty = serialize<TBinaryProtocol>(table::Empty());
+    table::StructWithASomemap required;
+    bool thrown = false;
+    try {
+      deserialize<TBinaryProtocol>(empty, required);
+    } catch (TProtocolException& e) {
+      thrown = e.getType() == TProtocolException::INVALID_DATA;
+    }
+    assert(thrown);
+  }
+
+  return 0;
+}
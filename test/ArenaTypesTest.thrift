@@ -0,0 +1,50 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Generated with cpp:arena
+
+namespace cpp thrift.test.arena
+
+const string GREETING = "hello"
+
+struct Item {
+  1: string name;
+  2: binary payload;
+  3: list<i32> counts;
+}
+
+struct Request {
+  1: string name = "unnamed";
+  2: Item item;
+  3: list<string> tags;
+  4: set<string> labels;
+  5: map<string, Item> items;
+  6: list<list<i32>> matrix;
+  7: optional string note;
+}
+
+exception Failure {
+  1: string why;
+  2: list<string> trace;
+}
+
+service ArenaEcho {
+  Request echo(1: Request request);
+  void fail(1: string why) throws (1: Failure failure);
+}
@@ -0,0 +1,43 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Generated with cpp:compact_layout, which orders members by alignment
+
+namespace cpp thrift.test.compact
+
+cpp_include "CppTypeTest_extras.h"
+
+enum Shade {
+  LIGHT = 1,
+  DARK = 2
+}
+
+struct Mixed {
+  1: bool flag;
+  2: i64 big;
+  3: byte tiny;
+  4: string name;
+  5: i16 small;
+  6: i32 medium;
+  7: i32 wide ( cpp.type = "thrift::test::cpptype::Timestamp" );
+  8: optional double ratio;
+  9: Shade shade;
+  10: list<i16> shorts;
+  11: required i32 id;
+}
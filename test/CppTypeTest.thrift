@@ -0,0 +1,41 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Types and templates swapped in with cpp.type and cpp.template.  The
+// classes named here are in lib/cpp/test/CppTypeTest_extras.h.
+
+namespace cpp thrift.test.cpptype
+
+cpp_include "CppTypeTest_extras.h"
+
+typedef list<i32> ( cpp.template = "std::deque" ) int_deque
+
+struct Item {
+  1: string name;
+}
+
+struct Holder {
+  1: int_deque ints;
+  2: list<string> names ( cpp.type = "std::list<std::string>" );
+  3: set<i16> shorts ( cpp.template = "std::set" );
+  4: binary data ( cpp.type = "thrift::test::cpptype::Buffer" );
+  5: i64 when ( cpp.type = "thrift::test::cpptype::Timestamp" );
+  6: list<Item> items ( cpp.template = "std::deque" );
+  7: list<bool> flags ( cpp.type = "thrift::test::cpptype::BitList" );
+}
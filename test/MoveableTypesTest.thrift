@@ -0,0 +1,45 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Generated with cpp:moveable_types, and built as C++11
+
+namespace cpp thrift.test.moveable
+
+struct Inner {
+  1: string text;
+  2: list<i32> numbers;
+}
+
+struct Outer {
+  1: string name;
+  2: Inner inner;
+  3: map<string, Inner> byName;
+  4: optional list<string> tags;
+  5: set<i64> ids;
+}
+
+exception Failure {
+  1: string why;
+  2: list<string> trace;
+}
+
+service Moveable {
+  Outer echo(1: Outer outer);
+  void fail(1: string why) throws (1: Failure failure);
+}
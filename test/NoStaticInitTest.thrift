@@ -0,0 +1,42 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Generated with cpp:no_static_init
+
+namespace cpp thrift.test.no_static_init
+
+enum Color {
+  RED = 1,
+  GREEN = 2,
+  BLUE = 4,
+  CRIMSON = 1
+}
+
+struct Point {
+  1: i32 x;
+  2: i32 y;
+}
+
+const i32 ANSWER = 42
+const string NAME = "no_static_init"
+const Color FAVORITE = Color.BLUE
+const list<string> WORDS = ["one", "two", "three"]
+const map<Color, string> LABELS = {Color.RED: "red", Color.GREEN: "green"}
+const Point ORIGIN = {"x": 0, "y": 0}
+const Point CORNER = {"x": 3, "y": 4}
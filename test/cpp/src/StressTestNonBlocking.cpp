@@ -225,6 +225,7 @@ int main(int argc, char **argv) {
   string serverType = "simple";
   string protocolType = "binary";
   size_t workerCount = 4;
+  size_t ioThreadCount = 1;
   size_t clientCount = 20;
   size_t loopCount = 50000;
   TType loopType  = T_VOID;
@@ -237,18 +238,19 @@ int main(int argc, char **argv) {
   ostringstream usage;
 
   usage <<
-    argv[0] << " [--port=<port number>] [--server] [--server-type=<server-type>] [--protocol-type=<protocol-type>] [--workers=<worker-count>] [--clients=<client-count>] [--loop=<loop-count>]" << endl <<
+    argv[0] << " [--port=<port number>] [--server] [--server-type=<server-type>] [--protocol-type=<protocol-type>] [--workers=<worker-count>] [--io-threads=<io-thread-count>] [--clients=<client-count>] [--loop=<loop-count>]" << endl <<
     "\tclients        Number of client threads to create - 0 implies no clients, i.e. server only.  Default is " << clientCount << endl <<
     "\thelp           Prints this help text." << endl <<
     "\tcall           Service method to call.  Default is " << callName << endl <<
     "\tloop           The number of remote thrift calls each client makes.  Default is " << loopCount << endl <<
     "\tport           The port the server and clients should bind to for thrift network connections.  Default is " << port << endl <<
     "\tserver         Run the Thrift server in this process.  Default is " << runServer << endl <<
-    "\tserver-type    Type of server, \"simple\" or \"thread-pool\".  Default is " << serverType << endl <<
+    "\tserver-type    Type of server, \"simple\", \"thread-pool\" or \"thread-per-core\".  Default is " << serverType << endl <<
     "\tprotocol-type  Type of protocol, \"binary\", \"ascii\", or \"xml\".  Default is " << protocolType << endl <<
     "\tlog-request    Log all request to ./requestlog.tlog. Default is " << logRequests << endl <<
     "\treplay-request Replay requests from log file (./requestlog.tlog) Default is " << replayRequests << endl <<
-    "\tworkers        Number of thread pools workers.  Only valid for thread-pool server type.  Default is " << workerCount << endl;
+    "\tworkers        Number of thread pools workers.  Only valid for thread-pool server type.  Default is " << workerCount << endl <<
+    "\tio-threads     Number of IO threads per server.  For thread-per-core, use one per core.  Default is " << ioThreadCount << endl;
 
 
   map<string, string>  args;
@@ -316,6 +318,10 @@ int main(int argc, char **argv) {
       workerCount = atoi(args["workers"].c_str());
     }
 
+    if (!args["io-threads"].empty()) {
+      ioThreadCount = atoi(args["io-threads"].c_str());
+    }
+
   } catch(std::exception& e) {
     cerr << e.what() << endl;
     cerr << usage;
@@ -368,13 +374,20 @@ int main(int argc, char **argv) {
         boost::shared_ptr<TTransportFactory>(new TPipedTransportFactory(fileTransport));
     }
 
-    boost::shared_ptr<Thread> serverThread;
-    boost::shared_ptr<Thread> serverThread2;
+    boost::shared_ptr<TNonblockingServer> server;
+    boost::shared_ptr<TNonblockingServer> server2;
 
-    if (serverType == "simple") {
+    if (serverType == "simple" || serverType == "thread-per-core") {
 
-      serverThread = threadFactory->newThread(boost::shared_ptr<TServer>(new TNonblockingServer(serviceProcessor, protocolFactory, port)));
-      serverThread2 = threadFactory->newThread(boost::shared_ptr<TServer>(new TNonblockingServer(serviceProcessor, protocolFactory, port+1)));
+      server.reset(new TNonblockingServer(serviceProcessor, protocolFactory, port));
+      server2.reset(new TNonblockingServer(serviceProcessor, protocolFactory, port+1));
+
+      if (serverType == "thread-per-core") {
+        server->setThreadPerCore(true);
+        server->setPinIOThreads(true);
+        server2->setThreadPerCore(true);
+        server2->setPinIOThreads(true);
+      }
 
     } else if (serverType == "thread-pool") {
 
@@ -382,10 +395,18 @@ int main(int argc, char **argv) {
 
       threadManager->threadFactory(threadFactory);
       threadManager->start();
-      serverThread = threadFactory->newThread(boost::shared_ptr<TServer>(new TNonblockingServer(serviceProcessor, protocolFactory, port, threadManager)));
-      serverThread2 = threadFactory->newThread(boost::shared_ptr<TServer>(new TNonblockingServer(serviceProcessor, protocolFactory, port+1, threadManager)));
+      server.reset(new TNonblockingServer(serviceProcessor, protocolFactory, port, threadManager));
+      server2.reset(new TNonblockingServer(serviceProcessor, protocolFactory, port+1, threadManager));
+    } else {
+      throw invalid_argument("Unknown server type "+serverType);
     }
 
+    server->setNumIOThreads(ioThreadCount);
+    server2->setNumIOThreads(ioThreadCount);
+
+    boost::shared_ptr<Thread> serverThread = threadFactory->newThread(server);
+    boost::shared_ptr<Thread> serverThread2 = threadFactory->newThread(server2);
+
     cerr << "Starting the server on port " << port << " and " << (port + 1) << endl;
     serverThread->start();
     serverThread2->start();
@@ -484,7 +505,7 @@ int main(int argc, char **argv) {
     averageTime /= clientCount;
 
 
-    cout <<  "workers :" << workerCount << ", client : " << clientCount << ", loops : " << loopCount << ", rate : " << (clientCount * loopCount * 1000) / ((double)(time01 - time00)) << endl;
+    cout <<  "server : " << serverType << ", io threads : " << ioThreadCount << ", workers :" << workerCount << ", client : " << clientCount << ", loops : " << loopCount << ", rate : " << (clientCount * loopCount * 1000) / ((double)(time01 - time00)) << endl;
 
     count_map count = serviceHandler->getCount();
     count_map::iterator iter;